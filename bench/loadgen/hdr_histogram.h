@@ -0,0 +1,103 @@
+#ifndef BENCH_LOADGEN_HDR_HISTOGRAM_H_
+#define BENCH_LOADGEN_HDR_HISTOGRAM_H_
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief A high dynamic range histogram of nanoseconds, in the layout of
+ * metrics::Histogram with a finer split: every power of two is divided
+ * into 2^sub_bits linear buckets, so a value is off by at most 2^-sub_bits,
+ * about three significant digits. It is not thread safe, every load generator
+ * thread records into its own and they are merged at the end.
+ */
+class HdrHistogram {
+ public:
+  static constexpr size_t sub_bits = 10;
+
+  static constexpr size_t n_sub = size_t(1) << sub_bits;
+
+  /**
+   * @brief Values from 2^max_bits ns (about 18 minutes) are put in the last
+   * bucket.
+   */
+  static constexpr size_t max_bits = 40;
+
+  static constexpr size_t n_buckets = (max_bits - sub_bits + 1) * n_sub;
+
+  HdrHistogram() : buckets_(n_buckets) {}
+
+  static size_t bucket_of(uint64_t value) {
+    size_t bits = std::bit_width(value);
+    if (bits <= sub_bits + 1) return value;
+    if (bits > max_bits) return n_buckets - 1;
+    size_t shift = bits - sub_bits - 1;
+    return (shift + 1) * n_sub + ((value >> shift) - n_sub);
+  }
+
+  /**
+   * @brief Get the largest value that falls in bucket i.
+   */
+  static uint64_t bucket_upper_bound(size_t i) {
+    if (i < 2 * n_sub) return i;
+    size_t shift = i / n_sub - 1;
+    uint64_t sub = i % n_sub + n_sub;
+    return ((sub + 1) << shift) - 1;
+  }
+
+  void record(uint64_t value) {
+    ++buckets_[bucket_of(value)];
+    ++count_;
+    sum_ += value;
+    min_ = std::min(min_, value);
+    max_ = std::max(max_, value);
+  }
+
+  void merge(const HdrHistogram &obj) {
+    for (size_t i = 0; i < n_buckets; ++i) buckets_[i] += obj.buckets_[i];
+    count_ += obj.count_;
+    sum_ += obj.sum_;
+    min_ = std::min(min_, obj.min_);
+    max_ = std::max(max_, obj.max_);
+  }
+
+  uint64_t count() const { return count_; }
+
+  uint64_t min() const { return count_ == 0 ? 0 : min_; }
+
+  uint64_t max() const { return max_; }
+
+  double mean() const { return count_ == 0 ? 0 : double(sum_) / count_; }
+
+  /**
+   * @brief Get the value that p of the recorded values are less than or
+   * equal to.
+   * @param p In the range [0, 1].
+   */
+  uint64_t percentile(double p) const {
+    if (count_ == 0) return 0;
+    auto rank = std::max<uint64_t>(std::ceil(p * count_), 1);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < n_buckets; ++i) {
+      seen += buckets_[i];
+      if (seen >= rank) return std::min(bucket_upper_bound(i), max_);
+    }
+    return max_;
+  }
+
+ protected:
+  std::vector<uint64_t> buckets_;
+
+  uint64_t count_ = 0;
+
+  uint64_t sum_ = 0;
+
+  uint64_t min_ = UINT64_MAX;
+
+  uint64_t max_ = 0;
+};
+
+#endif
@@ -0,0 +1,732 @@
+// An HTTP load generator for tinywebserver, built on Epoller and Buffer.
+//
+// Closed loop: every connection keeps `pipeline` requests in flight and sends
+// the next one as soon as a response arrives, the latency is measured from
+// the send.
+//
+// Open loop (--rate): requests are scheduled at a fixed rate whether or not
+// the server keeps up. A request waits for a free connection when all of them
+// are busy and its latency is measured from the time it was scheduled, not
+// from the time it was sent, so a stalled server is not hidden by the load
+// generator backing off (coordinated omission). The time from the send is
+// reported as the service time.
+//
+// usage: tinywebserver_loadgen [options]
+//   -a, --address ADDR      server IPv4 address, default 127.0.0.1
+//   -p, --port PORT         server port, default 8888
+//   -c, --connections N     connections, default 16
+//   -t, --threads N         threads, the connections are split among them
+//   -d, --duration SEC      measured duration, default 10
+//   -w, --warmup SEC        run before measuring, default 1
+//   -r, --rate RPS          open loop at RPS requests per second in total
+//   -P, --pipeline N        requests in flight per connection, default 1
+//   -k, --no-keepalive      close the connection after every response
+//   -R, --request SPEC      add METHOD:PATH[:BODY_BYTES[:WEIGHT]] to the mix,
+//                           default GET:/
+//   -s, --serve             fork a tinywebserver on the port for the run
+//   -j, --json              print the report as JSON
+#include <arpa/inet.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "hdr_histogram.h"
+#include "tinywebserver/network/epoller.h"
+#include "tinywebserver/network/http/server.h"
+#include "tinywebserver/utils/buffer.h"
+
+static uint64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+struct Options {
+  std::string address = "127.0.0.1";
+  uint16_t port = 8888;
+  unsigned int connections = 16;
+  unsigned int threads = 1;
+  double duration = 10;
+  double warmup = 1;
+  double rate = 0;
+  unsigned int pipeline = 1;
+  bool keep_alive = true;
+  std::vector<std::string> requests;
+  bool serve = false;
+  bool json = false;
+};
+
+/**
+ * @brief The weighted requests to send, encoded once.
+ */
+class RequestMix {
+ public:
+  /**
+   * @param spec METHOD:PATH[:BODY_BYTES[:WEIGHT]]
+   * @return Return false if spec is invalid.
+   */
+  bool add(std::string_view spec, const Options &opt) {
+    std::vector<std::string> fields;
+    for (size_t pos; (pos = spec.find(':')) != std::string_view::npos;
+         spec.remove_prefix(pos + 1))
+      fields.emplace_back(spec.substr(0, pos));
+    fields.emplace_back(spec);
+    if (fields.size() < 2 || fields.size() > 4 || fields[0].empty() ||
+        fields[1].empty() || fields[1][0] != '/')
+      return false;
+    size_t body_size = fields.size() > 2 ? std::stoul(fields[2]) : 0;
+    unsigned int weight = fields.size() > 3 ? std::stoul(fields[3]) : 1;
+    if (weight == 0) return false;
+
+    std::string req = fields[0] + " " + fields[1] + " HTTP/1.1\r\n";
+    req += "Host: " + opt.address + ":" + std::to_string(opt.port) + "\r\n";
+    req += "User-Agent: tinywebserver_loadgen\r\n";
+    if (!opt.keep_alive) req += "Connection: close\r\n";
+    if (body_size > 0) {
+      req += "Content-Type: application/octet-stream\r\n";
+      req += "Content-Length: " + std::to_string(body_size) + "\r\n";
+    }
+    req += "\r\n";
+    req.append(body_size, 'x');
+    total_weight_ += weight;
+    requests_.push_back({std::move(req), total_weight_});
+    return true;
+  }
+
+  bool empty() const { return requests_.empty(); }
+
+  const std::string &next(uint64_t &rng) const {
+    if (requests_.size() == 1) return requests_[0].data;
+    // xorshift64
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    auto r = rng % total_weight_;
+    for (auto &req : requests_)
+      if (r < req.cumulative_weight) return req.data;
+    return requests_.back().data;
+  }
+
+ protected:
+  struct Request {
+    std::string data;
+    unsigned int cumulative_weight;
+  };
+
+  std::vector<Request> requests_;
+
+  unsigned int total_weight_ = 0;
+};
+
+struct Stats {
+  /**
+   * @brief From the scheduled time in the open loop, from the send in the
+   * closed loop.
+   */
+  HdrHistogram latency;
+
+  /**
+   * @brief From the send.
+   */
+  HdrHistogram service;
+
+  uint64_t requests = 0;
+  uint64_t non_2xx = 0;
+  uint64_t connect_errors = 0;
+  uint64_t read_errors = 0;
+  uint64_t reconnects = 0;
+  uint64_t bytes_read = 0;
+  uint64_t bytes_written = 0;
+
+  /**
+   * @brief Requests in flight or waiting for a connection at the end.
+   */
+  uint64_t unfinished = 0;
+
+  void merge(const Stats &obj) {
+    latency.merge(obj.latency);
+    service.merge(obj.service);
+    requests += obj.requests;
+    non_2xx += obj.non_2xx;
+    connect_errors += obj.connect_errors;
+    read_errors += obj.read_errors;
+    reconnects += obj.reconnects;
+    bytes_read += obj.bytes_read;
+    bytes_written += obj.bytes_written;
+    unfinished += obj.unfinished;
+  }
+};
+
+/**
+ * @brief The connections of one thread and their event loop.
+ */
+class Worker {
+ public:
+  Worker(const Options &opt, const RequestMix &mix, sockaddr_in addr,
+         unsigned int connections, double rate, uint64_t seed)
+      : opt_(opt),
+        mix_(mix),
+        addr_(addr),
+        clients_(connections),
+        interval_ns_(rate > 0 ? 1e9 / rate : 0),
+        rng_(seed | 1) {}
+
+  ~Worker() {
+    for (auto &c : clients_)
+      if (c.fd != -1) ::close(c.fd);
+  }
+
+  /**
+   * @brief Send requests until end, recording those sent from measure_start.
+   */
+  void run(uint64_t start, uint64_t measure_start, uint64_t end) {
+    measure_start_ = measure_start;
+    next_arrival_ = start;
+    for (auto &c : clients_) connect(c);
+    while (true) {
+      auto now = now_ns();
+      if (now >= end) break;
+      if (interval_ns_ > 0) {
+        for (; next_arrival_ <= now; next_arrival_ += interval_ns_)
+          backlog_.push_back(next_arrival_);
+        dispatch_backlog(now);
+      }
+      int timeout = 100;
+      if (interval_ns_ > 0)
+        timeout = (std::min(next_arrival_, end) - now + 999999) / 1000000;
+      int n = epoller_.wait(timeout);
+      for (int i = 0; i < n; ++i) {
+        auto &ev = epoller_[i];
+        on_event(clients_[ev.data.u32], ev.events);
+      }
+    }
+    stats_.unfinished += backlog_.size();
+    for (auto &c : clients_) stats_.unfinished += c.in_flight.size();
+  }
+
+  const Stats &stats() const { return stats_; }
+
+ protected:
+  struct InFlight {
+    uint64_t scheduled;
+    uint64_t sent;
+  };
+
+  struct Client {
+    int fd = -1;
+    bool connecting = false;
+    bool want_write = false;
+    Buffer in;
+    Buffer out;
+    std::deque<InFlight> in_flight;
+  };
+
+  unsigned int index_of(const Client &c) const { return &c - &clients_[0]; }
+
+  unsigned int depth() const { return opt_.keep_alive ? opt_.pipeline : 1; }
+
+  void connect(Client &c) {
+    c.fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (c.fd < 0) {
+      ++stats_.connect_errors;
+      return;
+    }
+    int one = 1;
+    setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    c.in.clear();
+    c.out.clear();
+    c.in_flight.clear();
+    c.want_write = false;
+    int ret = ::connect(c.fd, reinterpret_cast<sockaddr *>(&addr_),
+                        sizeof(addr_));
+    if (ret != 0 && errno != EINPROGRESS) {
+      ++stats_.connect_errors;
+      ::close(c.fd);
+      c.fd = -1;
+      return;
+    }
+    // finished when the socket becomes writable, even if it already has
+    c.connecting = true;
+    epoll_event ev = {.events = EPOLLIN | EPOLLRDHUP | EPOLLOUT,
+                      .data{.u32 = index_of(c)}};
+    c.want_write = true;
+    epoller_.add(c.fd, ev);
+  }
+
+  /**
+   * @brief Drop the connection and its requests in flight and connect again.
+   */
+  void reconnect(Client &c, bool error) {
+    if (error) stats_.read_errors += c.in_flight.size();
+    epoller_.del(c.fd);
+    ::close(c.fd);
+    c.fd = -1;
+    ++stats_.reconnects;
+    connect(c);
+  }
+
+  void on_connected(Client &c) {
+    c.connecting = false;
+    if (interval_ns_ == 0)
+      fill(c, now_ns());
+    else
+      dispatch_backlog(now_ns());
+  }
+
+  /**
+   * @brief Keep depth() requests in flight on a closed loop connection.
+   */
+  void fill(Client &c, uint64_t now) {
+    while (c.in_flight.size() < depth()) send(c, now, now);
+    flush(c);
+  }
+
+  /**
+   * @brief Hand the scheduled requests to the connections with a free slot.
+   */
+  void dispatch_backlog(uint64_t now) {
+    for (size_t tried = 0; !backlog_.empty() && tried < clients_.size();
+         ++tried) {
+      auto &c = clients_[next_client_];
+      next_client_ = (next_client_ + 1) % clients_.size();
+      if (c.fd == -1 || c.connecting) continue;
+      if (c.in_flight.size() >= depth()) continue;
+      while (!backlog_.empty() && c.in_flight.size() < depth()) {
+        send(c, backlog_.front(), now);
+        backlog_.pop_front();
+      }
+      flush(c);
+      tried = 0;
+    }
+  }
+
+  void send(Client &c, uint64_t scheduled, uint64_t now) {
+    auto &req = mix_.next(rng_);
+    c.out.write(req.data(), req.size());
+    c.in_flight.push_back({scheduled, now});
+  }
+
+  void flush(Client &c) {
+    while (!c.out.readable_empty()) {
+      auto n = ::write(c.fd, c.out.cur_read_ptr(), c.out.readable_size());
+      if (n < 0) {
+        if (errno == EAGAIN) break;
+        reconnect(c, true);
+        return;
+      }
+      c.out.update_read_ptr(n);
+      stats_.bytes_written += n;
+    }
+    bool want_write = !c.out.readable_empty();
+    if (c.out.readable_empty()) c.out.clear();
+    if (want_write == c.want_write) return;
+    c.want_write = want_write;
+    epoll_event ev = {.events = EPOLLIN | EPOLLRDHUP |
+                                (want_write ? uint32_t(EPOLLOUT) : 0),
+                      .data{.u32 = index_of(c)}};
+    epoller_.mod(c.fd, ev);
+  }
+
+  void on_event(Client &c, uint32_t events) {
+    if (c.fd == -1) return;
+    if (c.connecting) {
+      int err = 0;
+      socklen_t len = sizeof(err);
+      getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+      if (err != 0 || (events & (EPOLLERR | EPOLLHUP))) {
+        ++stats_.connect_errors;
+        reconnect(c, false);
+        return;
+      }
+      on_connected(c);
+    }
+    if (events & EPOLLIN) {
+      if (!on_read(c)) return;
+    } else if (events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) {
+      reconnect(c, true);
+      return;
+    }
+    if (events & EPOLLOUT) flush(c);
+  }
+
+  /**
+   * @return Return false if the connection is closed.
+   */
+  bool on_read(Client &c) {
+    bool eof = false;
+    while (true) {
+      c.in.ensure_writeable(16 * 1024);
+      auto n = ::read(c.fd, c.in.cur_write_ptr(), c.in.writeable_size());
+      if (n > 0) {
+        c.in.update_write_ptr(n);
+        stats_.bytes_read += n;
+        continue;
+      }
+      if (n < 0 && errno == EAGAIN) break;
+      eof = true;
+      break;
+    }
+    auto now = now_ns();
+    bool close = false;
+    while (!close) {
+      int consumed = parse_response(c, now, close);
+      if (consumed < 0) {
+        reconnect(c, true);
+        return false;
+      }
+      if (consumed == 0) break;
+    }
+    if (close || eof) {
+      reconnect(c, !c.in_flight.empty());
+      return false;
+    }
+    if (interval_ns_ == 0)
+      fill(c, now);
+    else
+      dispatch_backlog(now);
+    return true;
+  }
+
+  /**
+   * @brief Consume one complete response from c.in.
+   * @return The bytes consumed, 0 if the response is incomplete, -1 if it is
+   * invalid.
+   */
+  int parse_response(Client &c, uint64_t now, bool &close) {
+    auto data = c.in.view();
+    auto header_end = data.find("\r\n\r\n");
+    if (header_end == std::string_view::npos) return 0;
+    auto head = data.substr(0, header_end + 2);
+    // HTTP/1.1 200 OK
+    if (head.size() < 12 || !head.starts_with("HTTP/")) return -1;
+    int status = std::atoi(std::string(head.substr(9, 3)).c_str());
+
+    size_t content_length = 0;
+    for (size_t pos = head.find("\r\n") + 2; pos < head.size();) {
+      auto eol = head.find("\r\n", pos);
+      auto line = head.substr(pos, eol - pos);
+      pos = eol + 2;
+      auto colon = line.find(':');
+      if (colon == std::string_view::npos) continue;
+      auto name = line.substr(0, colon);
+      auto value = line.substr(colon + 1);
+      while (!value.empty() && value[0] == ' ') value.remove_prefix(1);
+      if (iequals(name, "Content-Length"))
+        content_length = std::strtoul(std::string(value).c_str(), nullptr, 10);
+      else if (iequals(name, "Connection") && iequals(value, "close"))
+        close = true;
+    }
+    size_t total = header_end + 4 + content_length;
+    if (data.size() < total) return 0;
+    c.in.update_read_ptr(total);
+    if (c.in.readable_empty()) c.in.clear();
+
+    if (c.in_flight.empty()) return -1;
+    auto req = c.in_flight.front();
+    c.in_flight.pop_front();
+    if (req.scheduled >= measure_start_) {
+      ++stats_.requests;
+      if (status < 200 || status > 299) ++stats_.non_2xx;
+      stats_.latency.record(now - req.scheduled);
+      stats_.service.record(now - req.sent);
+    }
+    return total;
+  }
+
+  static bool iequals(std::string_view a, std::string_view b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); ++i)
+      if (std::tolower(a[i]) != std::tolower(b[i])) return false;
+    return true;
+  }
+
+  const Options &opt_;
+
+  const RequestMix &mix_;
+
+  sockaddr_in addr_;
+
+  Epoller epoller_;
+
+  std::vector<Client> clients_;
+
+  /**
+   * @brief The time between two scheduled requests, 0 in the closed loop.
+   */
+  uint64_t interval_ns_;
+
+  uint64_t next_arrival_ = 0;
+
+  /**
+   * @brief The scheduled times of the requests waiting for a connection.
+   */
+  std::deque<uint64_t> backlog_;
+
+  size_t next_client_ = 0;
+
+  uint64_t measure_start_ = 0;
+
+  uint64_t rng_;
+
+  Stats stats_;
+};
+
+/**
+ * @brief Run a tinywebserver in a child process, answering every path with a
+ * small body and /echo with the request body.
+ * @return The pid of the child, -1 on failure.
+ */
+static pid_t serve(const Options &opt) {
+  pid_t pid = fork();
+  if (pid != 0) return pid;
+
+  http::Server server;
+  server.handle("/", [](http::ResponseWriter &resp, const http::Request &) {
+    resp.header()["Content-Type"] = "text/plain";
+    resp.write("Hello, World!\n");
+  });
+  server.handle("/echo",
+                [](http::ResponseWriter &resp, const http::Request &req) {
+                  auto &body = req.body();
+                  resp.write(std::string_view(body.data(), body.size()));
+                });
+  if (!server.listen(opt.port, opt.address)) {
+    std::fprintf(stderr, "can't listen on %s:%u\n", opt.address.c_str(),
+                 opt.port);
+    _exit(1);
+  }
+  server.start();
+  _exit(0);
+}
+
+/**
+ * @brief Wait until the server accepts connections.
+ */
+static bool wait_server(sockaddr_in addr, std::chrono::seconds timeout) {
+  auto deadline = std::chrono::steady_clock::now() + timeout;
+  while (std::chrono::steady_clock::now() < deadline) {
+    int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    bool ok = ::connect(fd, reinterpret_cast<sockaddr *>(&addr),
+                        sizeof(addr)) == 0;
+    ::close(fd);
+    if (ok) return true;
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  }
+  return false;
+}
+
+static const double percentiles[] = {0.5,   0.75,   0.9,     0.99,
+                                     0.999, 0.9999, 0.99999, 1.0};
+
+static void report_text(const Options &opt, const Stats &s) {
+  std::printf("%s loop, %u connections, %u threads, pipeline %u, %s\n",
+              opt.rate > 0 ? "open" : "closed", opt.connections, opt.threads,
+              opt.keep_alive ? opt.pipeline : 1,
+              opt.keep_alive ? "keep-alive" : "close");
+  if (opt.rate > 0) std::printf("target     %.1f req/s\n", opt.rate);
+  std::printf("duration   %.2f s (warmup %.2f s)\n", opt.duration, opt.warmup);
+  std::printf("requests   %llu (%.1f req/s)\n", (unsigned long long)s.requests,
+              s.requests / opt.duration);
+  std::printf("transfer   read %.2f MB/s, written %.2f MB/s\n",
+              s.bytes_read / opt.duration / 1e6,
+              s.bytes_written / opt.duration / 1e6);
+  std::printf(
+      "errors     connect %llu, read %llu, non-2xx %llu, reconnects %llu, "
+      "unfinished %llu\n",
+      (unsigned long long)s.connect_errors, (unsigned long long)s.read_errors,
+      (unsigned long long)s.non_2xx, (unsigned long long)s.reconnects,
+      (unsigned long long)s.unfinished);
+  std::printf("latency    mean %.1f us, min %.1f us, max %.1f us\n",
+              s.latency.mean() / 1e3, s.latency.min() / 1e3,
+              s.latency.max() / 1e3);
+  std::printf("%10s %14s %14s\n", "percentile", "latency(us)", "service(us)");
+  for (auto p : percentiles)
+    std::printf("%10.3f %14.1f %14.1f\n", p * 100,
+                s.latency.percentile(p) / 1e3, s.service.percentile(p) / 1e3);
+}
+
+static void report_json(const Options &opt, const Stats &s) {
+  std::printf("{\n  \"mode\": \"%s\",\n", opt.rate > 0 ? "open" : "closed");
+  std::printf("  \"connections\": %u,\n  \"threads\": %u,\n", opt.connections,
+              opt.threads);
+  std::printf("  \"pipeline\": %u,\n  \"keep_alive\": %s,\n",
+              opt.keep_alive ? opt.pipeline : 1,
+              opt.keep_alive ? "true" : "false");
+  std::printf("  \"target_rate\": %.1f,\n  \"duration_s\": %.3f,\n", opt.rate,
+              opt.duration);
+  std::printf("  \"requests\": %llu,\n  \"rate\": %.1f,\n",
+              (unsigned long long)s.requests, s.requests / opt.duration);
+  std::printf("  \"bytes_read\": %llu,\n  \"bytes_written\": %llu,\n",
+              (unsigned long long)s.bytes_read,
+              (unsigned long long)s.bytes_written);
+  std::printf(
+      "  \"errors\": {\"connect\": %llu, \"read\": %llu, \"non_2xx\": %llu, "
+      "\"reconnects\": %llu, \"unfinished\": %llu},\n",
+      (unsigned long long)s.connect_errors, (unsigned long long)s.read_errors,
+      (unsigned long long)s.non_2xx, (unsigned long long)s.reconnects,
+      (unsigned long long)s.unfinished);
+  for (auto [name, h] : {std::pair{"latency_us", &s.latency},
+                         std::pair{"service_us", &s.service}}) {
+    std::printf("  \"%s\": {\"mean\": %.1f, \"min\": %.1f, \"max\": %.1f", name,
+                h->mean() / 1e3, h->min() / 1e3, h->max() / 1e3);
+    for (auto p : percentiles)
+      std::printf(", \"p%g\": %.1f", p * 100, h->percentile(p) / 1e3);
+    std::printf("}%s\n", h == &s.latency ? "," : "");
+  }
+  std::printf("}\n");
+}
+
+static void usage(const char *name) {
+  std::fprintf(
+      stderr,
+      "usage: %s [-a address] [-p port] [-c connections] [-t threads]\n"
+      "          [-d seconds] [-w seconds] [-r rate] [-P pipeline] [-k]\n"
+      "          [-R METHOD:PATH[:BODY_BYTES[:WEIGHT]]]... [-s] [-j]\n",
+      name);
+}
+
+int main(int argc, char **argv) {
+  Options opt;
+  static const option long_options[] = {
+      {"address", required_argument, nullptr, 'a'},
+      {"port", required_argument, nullptr, 'p'},
+      {"connections", required_argument, nullptr, 'c'},
+      {"threads", required_argument, nullptr, 't'},
+      {"duration", required_argument, nullptr, 'd'},
+      {"warmup", required_argument, nullptr, 'w'},
+      {"rate", required_argument, nullptr, 'r'},
+      {"pipeline", required_argument, nullptr, 'P'},
+      {"no-keepalive", no_argument, nullptr, 'k'},
+      {"request", required_argument, nullptr, 'R'},
+      {"serve", no_argument, nullptr, 's'},
+      {"json", no_argument, nullptr, 'j'},
+      {nullptr, 0, nullptr, 0},
+  };
+  for (int c; (c = getopt_long(argc, argv, "a:p:c:t:d:w:r:P:kR:sj",
+                               long_options, nullptr)) != -1;) {
+    switch (c) {
+      case 'a':
+        opt.address = optarg;
+        break;
+      case 'p':
+        opt.port = std::atoi(optarg);
+        break;
+      case 'c':
+        opt.connections = std::atoi(optarg);
+        break;
+      case 't':
+        opt.threads = std::atoi(optarg);
+        break;
+      case 'd':
+        opt.duration = std::atof(optarg);
+        break;
+      case 'w':
+        opt.warmup = std::atof(optarg);
+        break;
+      case 'r':
+        opt.rate = std::atof(optarg);
+        break;
+      case 'P':
+        opt.pipeline = std::atoi(optarg);
+        break;
+      case 'k':
+        opt.keep_alive = false;
+        break;
+      case 'R':
+        opt.requests.push_back(optarg);
+        break;
+      case 's':
+        opt.serve = true;
+        break;
+      case 'j':
+        opt.json = true;
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+  if (opt.threads == 0 || opt.connections < opt.threads ||
+      opt.pipeline == 0 || opt.duration <= 0 || opt.warmup < 0) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  RequestMix mix;
+  if (opt.requests.empty()) opt.requests.push_back("GET:/");
+  for (auto &spec : opt.requests) {
+    if (!mix.add(spec, opt)) {
+      std::fprintf(stderr, "invalid request %s\n", spec.c_str());
+      return 1;
+    }
+  }
+
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(opt.port);
+  if (inet_pton(AF_INET, opt.address.c_str(), &addr.sin_addr) != 1) {
+    std::fprintf(stderr, "invalid address %s\n", opt.address.c_str());
+    return 1;
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+  pid_t server_pid = -1;
+  if (opt.serve) {
+    server_pid = serve(opt);
+    if (server_pid < 0 || !wait_server(addr, std::chrono::seconds(5))) {
+      std::fprintf(stderr, "the server did not start\n");
+      if (server_pid > 0) kill(server_pid, SIGKILL);
+      return 1;
+    }
+  }
+
+  std::vector<std::unique_ptr<Worker>> workers;
+  for (unsigned int i = 0; i < opt.threads; ++i) {
+    auto connections = opt.connections / opt.threads +
+                       (i < opt.connections % opt.threads ? 1 : 0);
+    workers.push_back(std::make_unique<Worker>(
+        opt, mix, addr, connections, opt.rate / opt.threads, i + 1));
+  }
+  auto start = now_ns();
+  auto measure_start = start + uint64_t(opt.warmup * 1e9);
+  auto end = measure_start + uint64_t(opt.duration * 1e9);
+  std::vector<std::thread> threads;
+  for (unsigned int i = 0; i < opt.threads; ++i) {
+    // stagger the schedules of the open loop threads
+    auto offset = opt.rate > 0 ? uint64_t(i * 1e9 / opt.rate) : 0;
+    threads.emplace_back(&Worker::run, workers[i].get(), start + offset,
+                         measure_start, end);
+  }
+  for (auto &t : threads) t.join();
+
+  Stats stats;
+  for (auto &w : workers) stats.merge(w->stats());
+  if (opt.json)
+    report_json(opt, stats);
+  else
+    report_text(opt, stats);
+
+  if (server_pid > 0) {
+    kill(server_pid, SIGKILL);
+    waitpid(server_pid, nullptr, 0);
+  }
+  return stats.requests > 0 ? 0 : 1;
+}
@@ -0,0 +1,81 @@
+// Buffer, BufferVector and IOVector.
+#include <benchmark/benchmark.h>
+#include <sys/uio.h>
+
+#include <string>
+#include <vector>
+
+#include "tinywebserver/utils/buffer.h"
+#include "tinywebserver/utils/buffer_vector.h"
+
+// write a message and read it back, the buffer never grows
+static void BM_BufferWriteRead(benchmark::State &state) {
+  std::string msg(state.range(0), 'x');
+  std::string out(msg.size(), 0);
+  Buffer buf(msg.size());
+  for (auto _ : state) {
+    buf.write(msg.data(), msg.size());
+    buf.read(out.data(), out.size());
+    benchmark::DoNotOptimize(out.data());
+  }
+  state.SetBytesProcessed(state.iterations() * msg.size());
+}
+BENCHMARK(BM_BufferWriteRead)->RangeMultiplier(8)->Range(64, 64 << 10);
+
+// grow a default Buffer to the size of a response in 128 byte writes
+static void BM_BufferGrow(benchmark::State &state) {
+  std::string chunk(128, 'x');
+  size_t n_chunks = state.range(0) / chunk.size();
+  for (auto _ : state) {
+    Buffer buf;
+    for (size_t i = 0; i < n_chunks; ++i) buf.write(chunk.data(), chunk.size());
+    benchmark::DoNotOptimize(buf.cur_read_ptr());
+  }
+  state.SetBytesProcessed(state.iterations() * n_chunks * chunk.size());
+}
+BENCHMARK(BM_BufferGrow)->RangeMultiplier(8)->Range(1 << 10, 256 << 10);
+
+// fill a BufferVector as a response is built and gather it for writev()
+static void BM_BufferVectorWriteGather(benchmark::State &state) {
+  std::string chunk(512, 'x');
+  size_t n_chunks = state.range(0) / chunk.size();
+  BufferVector buf;
+  for (auto _ : state) {
+    for (size_t i = 0; i < n_chunks; ++i) buf.write(chunk);
+    auto iov = buf.get_read_iovec();
+    benchmark::DoNotOptimize(iov.get_iovec_address());
+    buf.clear();
+  }
+  state.SetBytesProcessed(state.iterations() * n_chunks * chunk.size());
+}
+BENCHMARK(BM_BufferVectorWriteGather)
+    ->RangeMultiplier(8)
+    ->Range(1 << 10, 256 << 10);
+
+static void BM_BufferVectorWriteRead(benchmark::State &state) {
+  std::string msg(state.range(0), 'x');
+  std::string out(msg.size(), 0);
+  BufferVector buf;
+  for (auto _ : state) {
+    buf.write(msg);
+    buf.read(out.data(), out.size());
+    benchmark::DoNotOptimize(out.data());
+  }
+  state.SetBytesProcessed(state.iterations() * msg.size());
+}
+BENCHMARK(BM_BufferVectorWriteRead)->RangeMultiplier(8)->Range(64, 64 << 10);
+
+// consume an IOVector of range(0) segments with partial writes of a socket
+// buffer that takes 1000 bytes at a time
+static void BM_IOVectorPartialWrite(benchmark::State &state) {
+  static char data[4096];
+  size_t n = state.range(0);
+  for (auto _ : state) {
+    std::vector<iovec> v(n, iovec{.iov_base = data, .iov_len = sizeof(data)});
+    IOVector iov(std::move(v));
+    while (iov.size() > 0) iov.update(1000);
+    benchmark::DoNotOptimize(iov.get_iovec_address());
+  }
+  state.SetBytesProcessed(state.iterations() * n * sizeof(data));
+}
+BENCHMARK(BM_IOVectorPartialWrite)->Arg(1)->Arg(4)->Arg(16)->Arg(64);
@@ -0,0 +1,156 @@
+#ifndef BENCH_MICRO_CORPUS_H_
+#define BENCH_MICRO_CORPUS_H_
+
+#include <cstdint>
+#include <random>
+#include <string>
+#include <string_view>
+
+/**
+ * @brief Requests and forms shaped like real traffic, shared by the
+ * microbenchmarks.
+ */
+namespace corpus {
+
+// a health check or API probe: request line and a couple of headers
+inline constexpr std::string_view small_get =
+    "GET /healthz HTTP/1.1\r\n"
+    "Host: localhost\r\n"
+    "\r\n";
+
+// what a browser sends for a page, about 700 bytes
+inline constexpr std::string_view browser_get =
+    "GET /static/app/index.html?lang=en&theme=dark HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "Connection: keep-alive\r\n"
+    "Cache-Control: max-age=0\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 "
+    "(KHTML, like Gecko) Chrome/120.0.0.0 Safari/537.36\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,"
+    "image/avif,image/webp,*/*;q=0.8\r\n"
+    "Sec-Fetch-Site: same-origin\r\n"
+    "Sec-Fetch-Mode: navigate\r\n"
+    "Sec-Fetch-Dest: document\r\n"
+    "Referer: https://www.example.com/\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Accept-Language: en-US,en;q=0.9\r\n"
+    "Cookie: session=3f9a2c1e7b4d8f60; csrftoken=a81f0c9e2d; _ga=GA1.1.1234\r\n"
+    "\r\n";
+
+// a login form
+inline constexpr std::string_view post_form =
+    "POST /login HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "Connection: keep-alive\r\n"
+    "Content-Type: application/x-www-form-urlencoded\r\n"
+    "Origin: https://www.example.com\r\n"
+    "Content-Length: 69\r\n"
+    "\r\n"
+    "user=alice%40example.com&password=p%40ss+w0rd%21&remember=on&next=%2F";
+
+// a JSON API call with a 1 KiB body
+inline constexpr std::string_view post_json_head =
+    "POST /api/v1/events HTTP/1.1\r\n"
+    "Host: api.example.com\r\n"
+    "Content-Type: application/json\r\n"
+    "Authorization: Bearer "
+    "eyJhbGciOiJIUzI1NiJ9.eyJzdWIiOiIxMjM0In0.c2lnbmF0\r\n"
+    "Content-Length: 1024\r\n"
+    "\r\n";
+
+inline constexpr std::string_view small_form =
+    "user=alice%40example.com&password=p%40ss+w0rd%21&remember=on&next=%2F";
+
+inline constexpr std::string_view large_form =
+    "q=tiny+web+server&lang=en&page=2&per_page=50&sort=updated&order=desc"
+    "&filter%5Bstatus%5D=open&filter%5Blabel%5D=performance&filter%5Bauthor"
+    "%5D=bob&since=2023-01-01T00%3A00%3A00Z&until=2023-12-31T23%3A59%3A59Z"
+    "&fields=id%2Ctitle%2Cbody%2Cuser%2Clabels%2Ccreated_at&include=comments"
+    "&utm_source=newsletter&utm_medium=email&utm_campaign=winter+sale+2023"
+    "&redirect=https%3A%2F%2Fwww.example.com%2Fsearch%3Fq%3Dserver&x=1";
+
+/**
+ * @brief The knobs of a generated request.
+ */
+struct Shape {
+  size_t uri_size = 32;
+  // headers besides Host, User-Agent, Cookie and Content-Length
+  size_t extra_headers = 8;
+  size_t cookie_size = 0;
+  size_t body_size = 0;
+};
+
+/**
+ * @brief Generate a request of the shape, the filler bytes vary with rng so
+ * repeated requests are not identical.
+ */
+inline std::string make_request(const Shape &shape, std::mt19937 &rng) {
+  static const char alnum[] =
+      "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+  auto fill = [&](std::string &out, size_t n) {
+    for (size_t i = 0; i < n; ++i) out += alnum[rng() % (sizeof(alnum) - 1)];
+  };
+  std::string req = shape.body_size > 0 ? "POST /" : "GET /";
+  fill(req, shape.uri_size > 1 ? shape.uri_size - 1 : 0);
+  req += " HTTP/1.1\r\nHost: www.example.com\r\n";
+  req += "User-Agent: Mozilla/5.0 (X11; Linux x86_64) Gecko/20100101\r\n";
+  for (size_t i = 0; i < shape.extra_headers; ++i) {
+    req += "X-Header-" + std::to_string(i) + ": ";
+    fill(req, 24);
+    req += "\r\n";
+  }
+  if (shape.cookie_size > 0) {
+    req += "Cookie: session=";
+    fill(req, shape.cookie_size);
+    req += "\r\n";
+  }
+  if (shape.body_size > 0)
+    req += "Content-Length: " + std::to_string(shape.body_size) + "\r\n";
+  req += "\r\n";
+  fill(req, shape.body_size);
+  return req;
+}
+
+/**
+ * @brief What curl sends by default.
+ */
+inline std::string make_curl_request(std::mt19937 &rng) {
+  std::string req = "GET /api/v1/items/" + std::to_string(rng() % 100000) +
+                    " HTTP/1.1\r\n"
+                    "Host: localhost:8888\r\n"
+                    "User-Agent: curl/8.4.0\r\n"
+                    "Accept: */*\r\n"
+                    "\r\n";
+  return req;
+}
+
+/**
+ * @brief A browser navigation, browser_get with a varying cookie.
+ */
+inline std::string make_browser_request(std::mt19937 &rng) {
+  std::string req(browser_get.substr(0, browser_get.size() - 2));
+  req += "X-Request-Id: " + std::to_string(rng()) + "\r\n\r\n";
+  return req;
+}
+
+/**
+ * @brief A JSON API call with a body of 64 bytes to 4 KiB.
+ */
+inline std::string make_api_request(std::mt19937 &rng) {
+  size_t body_size = 64 << (rng() % 7);
+  std::string body = "{\"events\":[";
+  while (body.size() + 32 < body_size)
+    body += "{\"id\":" + std::to_string(rng() % 1000000) + ",\"ok\":true},";
+  body.resize(body_size - 2, ' ');
+  body += "]}";
+  auto head = post_json_head.substr(0, post_json_head.find("Content-Length"));
+  std::string req(head);
+  req += "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n";
+  req += body;
+  return req;
+}
+
+}  // namespace corpus
+
+#endif
@@ -0,0 +1,120 @@
+// RequestParser and Parser over the request corpus.
+#include <benchmark/benchmark.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "corpus.h"
+#include "tinywebserver/network/http/parser.h"
+#include "tinywebserver/network/http/request_parser.h"
+
+static std::string json_request() {
+  std::string ret(corpus::post_json_head);
+  ret += '{';
+  ret.append(1022, ' ');
+  ret += '}';
+  return ret;
+}
+
+static const std::vector<std::string> &requests() {
+  static const std::vector<std::string> ret = {
+      std::string(corpus::small_get),
+      std::string(corpus::browser_get),
+      std::string(corpus::post_form),
+      json_request(),
+  };
+  return ret;
+}
+
+/**
+ * @brief A nonblocking socketpair, the server reads what the client writes
+ * like on a real connection.
+ */
+struct SocketPair {
+  SocketPair() {
+    ::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds);
+  }
+
+  ~SocketPair() {
+    ::close(fds[0]);
+    ::close(fds[1]);
+  }
+
+  int client() const { return fds[0]; }
+
+  int server() const { return fds[1]; }
+
+  int fds[2];
+};
+
+// parse range(0) of the corpus read from a socket with a parser per request,
+// as a new connection does
+static void BM_RequestParser(benchmark::State &state) {
+  auto &req = requests()[state.range(0)];
+  SocketPair sock;
+  for (auto _ : state) {
+    if (::write(sock.client(), req.data(), req.size()) !=
+        ssize_t(req.size())) {
+      state.SkipWithError("write");
+      break;
+    }
+    http::RequestParser parser;
+    auto [parse_state, obj] = parser.consume_from_fd(sock.server(), true);
+    if (parse_state != http::RequestParser::State::COMPLETE) {
+      state.SkipWithError("the request is not complete");
+      break;
+    }
+    benchmark::DoNotOptimize(obj.get());
+  }
+  state.SetBytesProcessed(state.iterations() * req.size());
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_RequestParser)->DenseRange(0, 3);
+
+// the same on a keep-alive connection, the parser is reused
+static void BM_RequestParserKeepAlive(benchmark::State &state) {
+  auto &req = requests()[state.range(0)];
+  SocketPair sock;
+  http::RequestParser parser;
+  for (auto _ : state) {
+    if (::write(sock.client(), req.data(), req.size()) !=
+        ssize_t(req.size())) {
+      state.SkipWithError("write");
+      break;
+    }
+    auto [parse_state, obj] = parser.consume_from_fd(sock.server(), true);
+    if (parse_state != http::RequestParser::State::COMPLETE) {
+      state.SkipWithError("the request is not complete");
+      break;
+    }
+    benchmark::DoNotOptimize(obj.get());
+    parser.clear();
+  }
+  state.SetBytesProcessed(state.iterations() * req.size());
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_RequestParserKeepAlive)->DenseRange(0, 3);
+
+static void BM_ParseForm(benchmark::State &state) {
+  auto data = state.range(0) == 0 ? corpus::small_form : corpus::large_form;
+  for (auto _ : state) {
+    auto form = http::Parser::parse_form(data);
+    benchmark::DoNotOptimize(form);
+  }
+  state.SetBytesProcessed(state.iterations() * data.size());
+}
+BENCHMARK(BM_ParseForm)->Arg(0)->Arg(1);
+
+static void BM_ParseHeader(benchmark::State &state) {
+  std::string_view line =
+      "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36";
+  for (auto _ : state) {
+    http::Header header;
+    benchmark::DoNotOptimize(http::Parser::parse_header(line, header));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ParseHeader);
@@ -0,0 +1,130 @@
+// KVHeap and DaryKVHeap used as a timer queue: a min-heap of deadlines keyed
+// by task id.
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+#include <functional>
+#include <random>
+#include <vector>
+
+#include <memory>
+#include <tuple>
+
+#include "tinywebserver/utils/dary_kvheap.hpp"
+#include "tinywebserver/utils/kvheap.hpp"
+
+using TimerHeap = KVHeap<int, uint64_t, std::greater<uint64_t>>;
+
+// the values are tasks behind pointers, as in Timer
+using DaryTimerHeap =
+    DaryKVHeap<int, std::unique_ptr<int>, uint64_t, std::greater<uint64_t>>;
+
+static std::vector<uint64_t> random_deadlines(size_t n) {
+  std::mt19937_64 rng(42);
+  std::vector<uint64_t> ret(n);
+  for (auto &v : ret) v = rng() % 1000000;
+  return ret;
+}
+
+static void fill(TimerHeap &heap, const std::vector<uint64_t> &deadlines) {
+  for (size_t i = 0; i < deadlines.size(); ++i) heap.push(i, deadlines[i]);
+}
+
+static void fill(DaryTimerHeap &heap, const std::vector<uint64_t> &deadlines) {
+  for (size_t i = 0; i < deadlines.size(); ++i)
+    heap.push(i, deadlines[i], std::make_unique<int>(i));
+}
+
+// schedule range(0) timers and fire them all
+template <typename Heap>
+static void BM_KVHeapPushPop(benchmark::State &state) {
+  auto deadlines = random_deadlines(state.range(0));
+  for (auto _ : state) {
+    Heap heap;
+    fill(heap, deadlines);
+    while (!heap.empty()) benchmark::DoNotOptimize(heap.pop());
+  }
+  state.SetItemsProcessed(state.iterations() * deadlines.size());
+}
+BENCHMARK_TEMPLATE(BM_KVHeapPushPop, TimerHeap)
+    ->RangeMultiplier(8)
+    ->Range(64, 256 << 10);
+BENCHMARK_TEMPLATE(BM_KVHeapPushPop, DaryTimerHeap)
+    ->RangeMultiplier(8)
+    ->Range(64, 256 << 10);
+
+// postpone a random timer, like resetting the idle timeout of a connection
+// after a request
+template <typename Heap>
+static void BM_KVHeapUpdate(benchmark::State &state) {
+  auto deadlines = random_deadlines(state.range(0));
+  Heap heap;
+  fill(heap, deadlines);
+  std::mt19937 rng(7);
+  uint64_t now = 1000000;
+  for (auto _ : state) {
+    int key = rng() % deadlines.size();
+    heap.update(key, uint64_t(++now));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK_TEMPLATE(BM_KVHeapUpdate, TimerHeap)
+    ->RangeMultiplier(8)
+    ->Range(64, 256 << 10);
+BENCHMARK_TEMPLATE(BM_KVHeapUpdate, DaryTimerHeap)
+    ->RangeMultiplier(8)
+    ->Range(64, 256 << 10);
+
+// cancel a random timer and schedule it again, like a connection closing and
+// a new one taking its fd
+static void BM_KVHeapErasepush(benchmark::State &state) {
+  auto deadlines = random_deadlines(state.range(0));
+  TimerHeap heap;
+  fill(heap, deadlines);
+  std::mt19937 rng(7);
+  for (auto _ : state) {
+    int key = rng() % deadlines.size();
+    heap.erase(key);
+    heap.push(key, deadlines[key]);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_KVHeapErasepush)->RangeMultiplier(8)->Range(64, 256 << 10);
+
+static void BM_DaryKVHeapErasepush(benchmark::State &state) {
+  auto deadlines = random_deadlines(state.range(0));
+  DaryTimerHeap heap;
+  fill(heap, deadlines);
+  std::mt19937 rng(7);
+  for (auto _ : state) {
+    int key = rng() % deadlines.size();
+    heap.erase(key);
+    heap.push(key, deadlines[key], std::make_unique<int>(key));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_DaryKVHeapErasepush)->RangeMultiplier(8)->Range(64, 256 << 10);
+
+// load range(0) timers at once, like restarting a timer with its tasks, and
+// drain the expired half
+static void BM_DaryKVHeapPushRangePopWhile(benchmark::State &state) {
+  auto deadlines = random_deadlines(state.range(0));
+  for (auto _ : state) {
+    state.PauseTiming();
+    std::vector<std::tuple<int, uint64_t, std::unique_ptr<int>>> tasks;
+    tasks.reserve(deadlines.size());
+    for (size_t i = 0; i < deadlines.size(); ++i)
+      tasks.emplace_back(i, deadlines[i], std::make_unique<int>(i));
+    state.ResumeTiming();
+    DaryTimerHeap heap;
+    heap.push_range(std::move(tasks));
+    heap.pop_while([](uint64_t deadline) { return deadline < 500000; },
+                   [](int, std::unique_ptr<int> task) {
+                     benchmark::DoNotOptimize(task.get());
+                   });
+  }
+  state.SetItemsProcessed(state.iterations() * deadlines.size());
+}
+BENCHMARK(BM_DaryKVHeapPushRangePopWhile)
+    ->RangeMultiplier(8)
+    ->Range(64, 256 << 10);
@@ -0,0 +1,82 @@
+// The cost of a log on the calling thread, LOG_FAST vs the formatted log.
+#include <benchmark/benchmark.h>
+
+#include <memory>
+#include <string>
+
+#include "tinywebserver/log.h"
+#include "tinywebserver/log_format.h"
+
+namespace {
+
+// drop the output, so only the producer and the writer thread are measured
+class NullLogWriter : public LogWriter {
+ public:
+  bool write(const char *, size_t) override { return true; }
+
+  bool flush() override { return true; }
+};
+
+void start_logger(Logger::Encoding encoding, Logger::FullPolicy policy) {
+  auto &logger = Logger::get_instance();
+  logger.stop();
+  logger.set(std::make_unique<NullLogWriter>());
+  logger.set(encoding);
+  logger.set(policy);
+  logger.set(Logger::Level::TRACE);
+  logger.start();
+}
+
+}  // namespace
+
+// range(0) is the Logger::Encoding and range(1) the Logger::FullPolicy
+static void BM_LogFast(benchmark::State &state) {
+  start_logger(Logger::Encoding(state.range(0)),
+               Logger::FullPolicy(state.range(1)));
+  int fd = 42;
+  for (auto _ : state)
+    LOG_FAST(INFO, "close fd {} on a bad request, state {}", fd, 7);
+  Logger::get_instance().stop();
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_LogFast)
+    ->ArgNames({"binary", "policy"})
+    ->Args({int(Logger::Encoding::BINARY), int(Logger::FullPolicy::BLOCK)})
+    ->Args({int(Logger::Encoding::BINARY), int(Logger::FullPolicy::DROP)})
+    ->Args({int(Logger::Encoding::TEXT), int(Logger::FullPolicy::BLOCK)})
+    ->Args({int(Logger::Encoding::TEXT), int(Logger::FullPolicy::DROP)});
+
+// the same log formatted on the calling thread by default_formatter
+static void BM_LogFormatted(benchmark::State &state) {
+  start_logger(Logger::Encoding::TEXT, Logger::FullPolicy(state.range(0)));
+  int fd = 42;
+  for (auto _ : state)
+    Logger::get_instance().info("close fd " + std::to_string(fd) +
+                                " on a bad request, state " +
+                                std::to_string(7));
+  Logger::get_instance().stop();
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_LogFormatted)
+    ->ArgName("policy")
+    ->Arg(int(Logger::FullPolicy::BLOCK))
+    ->Arg(int(Logger::FullPolicy::DROP));
+
+// the work of the writer thread per LOG_FAST in Logger::Encoding::TEXT
+static void BM_FormatLine(benchmark::State &state) {
+  char payload[16];
+  binlog::encode_arg(binlog::encode_arg(payload, 42), 7);
+  std::string message, line;
+  for (auto _ : state) {
+    message.clear();
+    line.clear();
+    binlog::format_message(message, "close fd {} on a bad request, state {}",
+                           "ii", {payload, sizeof(payload)});
+    binlog::format_line(line, 2, binlog::wall_time_ns(), "140234567890",
+                        "src/network/http/server.cpp", 545, 5, "on_read",
+                        message);
+    benchmark::DoNotOptimize(line.data());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_FormatLine);
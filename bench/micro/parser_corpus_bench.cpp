@@ -0,0 +1,172 @@
+// RequestParser::consume() over generated corpora of keep-alive streams,
+// split at random TCP segment boundaries. The rates per core are the rates of
+// one thread, averaged over the threads.
+#include <benchmark/benchmark.h>
+
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "corpus.h"
+#include "tinywebserver/network/http/request_parser.h"
+
+using http::RequestParser;
+
+/**
+ * @brief A stream of requests sent back to back on one connection and the
+ * chunks it arrives in.
+ */
+struct Stream {
+  std::string data;
+  std::vector<std::string_view> chunks;
+  size_t n_requests = 0;
+};
+
+/**
+ * @brief Split the stream into chunks of 1 to max_chunk bytes, or at the
+ * request boundaries if max_chunk is 0.
+ */
+static void split(Stream &stream, const std::vector<size_t> &ends,
+                  size_t max_chunk, std::mt19937 &rng) {
+  std::string_view data = stream.data;
+  if (max_chunk == 0) {
+    for (size_t begin = 0; auto end : ends) {
+      stream.chunks.push_back(data.substr(begin, end - begin));
+      begin = end;
+    }
+    return;
+  }
+  for (size_t pos = 0; pos < data.size();) {
+    size_t n = 1 + rng() % max_chunk;
+    stream.chunks.push_back(data.substr(pos, n));
+    pos += n;
+  }
+}
+
+template <typename Make>
+static Stream make_stream(size_t n_requests, size_t max_chunk, Make &&make) {
+  std::mt19937 rng(42);
+  Stream stream;
+  std::vector<size_t> ends;
+  for (size_t i = 0; i < n_requests; ++i) {
+    stream.data += make(rng);
+    ends.push_back(stream.data.size());
+  }
+  stream.n_requests = n_requests;
+  split(stream, ends, max_chunk, rng);
+  return stream;
+}
+
+/**
+ * @brief Feed the chunks to a parser and count the requests.
+ */
+static size_t parse_stream(const Stream &stream) {
+  RequestParser parser;
+  size_t n = 0;
+  for (auto chunk : stream.chunks) {
+    for (auto ret = parser.consume(chunk);
+         ret.first == RequestParser::State::COMPLETE;
+         ret = parser.consume({})) {
+      benchmark::DoNotOptimize(ret.second.get());
+      ++n;
+    }
+  }
+  return n;
+}
+
+static void run(benchmark::State &state, const Stream &stream) {
+  for (auto _ : state) {
+    if (parse_stream(stream) != stream.n_requests) {
+      state.SkipWithError("the parser lost requests");
+      break;
+    }
+  }
+  auto bytes = state.iterations() * stream.data.size();
+  auto requests = state.iterations() * stream.n_requests;
+  state.SetBytesProcessed(bytes);
+  state.SetItemsProcessed(requests);
+  using benchmark::Counter;
+  state.counters["bytes_per_core"] =
+      Counter(bytes, Counter::kIsRate | Counter::kAvgThreads, Counter::kIs1024);
+  state.counters["requests_per_core"] =
+      Counter(requests, Counter::kIsRate | Counter::kAvgThreads);
+}
+
+// range(0) is the largest TCP chunk, 0 feeds whole requests
+static constexpr size_t n_stream_requests = 256;
+
+static void BM_CorpusCurl(benchmark::State &state) {
+  static auto stream = make_stream(n_stream_requests, state.range(0),
+                                   corpus::make_curl_request);
+  run(state, stream);
+}
+
+static void BM_CorpusBrowser(benchmark::State &state) {
+  static auto stream = make_stream(n_stream_requests, state.range(0),
+                                   corpus::make_browser_request);
+  run(state, stream);
+}
+
+static void BM_CorpusApi(benchmark::State &state) {
+  static auto stream = make_stream(n_stream_requests, state.range(0),
+                                   corpus::make_api_request);
+  run(state, stream);
+}
+
+// 60% curl, 30% browser and 10% API requests
+static void BM_CorpusMixed(benchmark::State &state) {
+  static auto stream =
+      make_stream(n_stream_requests, state.range(0), [](std::mt19937 &rng) {
+        auto r = rng() % 10;
+        if (r < 6) return corpus::make_curl_request(rng);
+        if (r < 9) return corpus::make_browser_request(rng);
+        return corpus::make_api_request(rng);
+      });
+  run(state, stream);
+}
+
+// The streams are built once per benchmark, with the chunk size of the first
+// run, so every benchmark has a single chunk size.
+BENCHMARK(BM_CorpusCurl)->Arg(1448);
+BENCHMARK(BM_CorpusBrowser)->Arg(1448);
+BENCHMARK(BM_CorpusApi)->Arg(1448);
+BENCHMARK(BM_CorpusMixed)->Arg(1448)->ThreadRange(1, 8)->UseRealTime();
+
+static void BM_CorpusMixedSplit(benchmark::State &state) {
+  auto stream = make_stream(n_stream_requests, state.range(0),
+                            [](std::mt19937 &rng) {
+                              return rng() % 2 ? corpus::make_curl_request(rng)
+                                               : corpus::make_api_request(rng);
+                            });
+  run(state, stream);
+}
+// whole requests, MSS sized segments and small segments of a slow client
+BENCHMARK(BM_CorpusMixedSplit)->Arg(0)->Arg(1448)->Arg(64)->Arg(8);
+
+// one knob of the request shape at a time, split at MSS boundaries
+template <size_t corpus::Shape::*knob>
+static void BM_Shape(benchmark::State &state) {
+  corpus::Shape shape;
+  shape.*knob = state.range(0);
+  auto stream = make_stream(n_stream_requests, 1448, [&](std::mt19937 &rng) {
+    return corpus::make_request(shape, rng);
+  });
+  run(state, stream);
+}
+BENCHMARK(BM_Shape<&corpus::Shape::extra_headers>)
+    ->Name("BM_ShapeHeaders")
+    ->RangeMultiplier(4)
+    ->Range(1, 64);
+BENCHMARK(BM_Shape<&corpus::Shape::uri_size>)
+    ->Name("BM_ShapeUri")
+    ->RangeMultiplier(4)
+    ->Range(16, 4096);
+BENCHMARK(BM_Shape<&corpus::Shape::cookie_size>)
+    ->Name("BM_ShapeCookie")
+    ->RangeMultiplier(4)
+    ->Range(16, 4096);
+BENCHMARK(BM_Shape<&corpus::Shape::body_size>)
+    ->Name("BM_ShapeBody")
+    ->RangeMultiplier(8)
+    ->Range(64, 64 << 10);
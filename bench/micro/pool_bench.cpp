@@ -0,0 +1,112 @@
+// MemoryPool, ResourcePool, LockFreeResourcePool and ThreadPool.
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+#include "tinywebserver/pool/lockfree_resource_pool.hpp"
+#include "tinywebserver/pool/memory_pool.hpp"
+#include "tinywebserver/pool/resource_pool.hpp"
+#include "tinywebserver/pool/thread_pool.hpp"
+
+// allocate a batch of range(0) byte objects and free them, MemoryPool is not
+// thread safe so it is only measured on one thread
+static constexpr size_t alloc_batch = 64;
+
+static void BM_MemoryPool(benchmark::State &state) {
+  size_t size = state.range(0);
+  void *ptrs[alloc_batch];
+  for (auto _ : state) {
+    for (auto &p : ptrs) p = MemoryPool::allocate(size);
+    benchmark::DoNotOptimize(ptrs);
+    for (auto p : ptrs) MemoryPool::deallocate(p, size);
+  }
+  state.SetItemsProcessed(state.iterations() * alloc_batch);
+}
+BENCHMARK(BM_MemoryPool)->Arg(16)->Arg(64)->Arg(128)->Arg(512);
+
+static void BM_Malloc(benchmark::State &state) {
+  size_t size = state.range(0);
+  void *ptrs[alloc_batch];
+  for (auto _ : state) {
+    for (auto &p : ptrs) p = std::malloc(size);
+    benchmark::DoNotOptimize(ptrs);
+    for (auto p : ptrs) std::free(p);
+  }
+  state.SetItemsProcessed(state.iterations() * alloc_batch);
+}
+BENCHMARK(BM_Malloc)->Arg(16)->Arg(64)->Arg(128)->Arg(512);
+
+// The pools are singletons per resource type, so each benchmark has its own
+// type, sized like a per connection object.
+struct PooledConnection {
+  char data[256];
+};
+
+struct LockFreePooledConnection {
+  char data[256];
+};
+
+// every thread takes a resource, touches it and gives it back
+static void BM_ResourcePoolGet(benchmark::State &state) {
+  auto &pool = ResourcePool<PooledConnection>::get_instance();
+  for (auto _ : state) {
+    auto res = pool.get();
+    if (res) res->data[0] = 1;
+    benchmark::DoNotOptimize(res.get());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ResourcePoolGet)->ThreadRange(1, 8)->UseRealTime();
+
+static void BM_LockFreeResourcePoolGet(benchmark::State &state) {
+  auto &pool = LockFreeResourcePool<LockFreePooledConnection>::get_instance();
+  for (auto _ : state) {
+    auto res = pool.get();
+    if (res) res->data[0] = 1;
+    benchmark::DoNotOptimize(res.get());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_LockFreeResourcePoolGet)->ThreadRange(1, 8)->UseRealTime();
+
+// range(0) worker threads run batches of 256 tiny tasks
+static void BM_ThreadPoolPushWait(benchmark::State &state) {
+  constexpr size_t batch = 256;
+  ThreadPool pool(state.range(0));
+  std::atomic<size_t> sink = 0;
+  for (auto _ : state) {
+    for (size_t i = 0; i < batch; ++i)
+      pool.push_task([&sink] { sink.fetch_add(1, std::memory_order_relaxed); });
+    pool.wait_for_tasks();
+  }
+  state.SetItemsProcessed(state.iterations() * batch);
+}
+BENCHMARK(BM_ThreadPoolPushWait)
+    ->RangeMultiplier(2)
+    ->Range(1, 8)
+    ->UseRealTime();
+
+// the round trip of one task, what a handler offloaded to the pool pays
+static void BM_ThreadPoolSubmitGet(benchmark::State &state) {
+  ThreadPool pool(state.range(0));
+  for (auto _ : state) {
+    auto future = pool.submit([] { return 1; });
+    benchmark::DoNotOptimize(future.get());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ThreadPoolSubmitGet)->Arg(1)->Arg(4)->UseRealTime();
+
+// several event loops pushing into one shared pool at the same time
+static void BM_ThreadPoolContended(benchmark::State &state) {
+  static ThreadPool pool(4);
+  static std::atomic<size_t> sink = 0;
+  for (auto _ : state)
+    pool.push_task([] { sink.fetch_add(1, std::memory_order_relaxed); });
+  if (state.thread_index() == 0) pool.wait_for_tasks();
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ThreadPoolContended)->ThreadRange(1, 8)->UseRealTime();
@@ -0,0 +1,106 @@
+// Timer and TimingWheel, the idle timeouts of connections.
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "tinywebserver/timer.hpp"
+#include "tinywebserver/timing_wheel.hpp"
+
+using namespace std::chrono_literals;
+
+// schedule the timeout of range(0) connections and cancel them, as they all
+// finish before timing out
+template <typename T>
+static void BM_TimerAddCancel(benchmark::State &state) {
+  int n = state.range(0);
+  T timer;
+  timer.start();
+  for (auto _ : state) {
+    for (int fd = 0; fd < n; ++fd) timer.add(fd, [] {}, 60s);
+    for (int fd = 0; fd < n; ++fd) timer.cancel(fd);
+  }
+  timer.stop();
+  state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK_TEMPLATE(BM_TimerAddCancel, Timer<int>)
+    ->RangeMultiplier(8)
+    ->Range(64, 64 << 10);
+BENCHMARK_TEMPLATE(BM_TimerAddCancel, TimingWheel<int>)
+    ->RangeMultiplier(8)
+    ->Range(64, 64 << 10);
+
+// postpone the timeout of a connection after each request
+template <typename T>
+static void BM_TimerUpdate(benchmark::State &state) {
+  int n = state.range(0);
+  T timer;
+  for (int fd = 0; fd < n; ++fd) timer.add(fd, [] {}, 60s);
+  timer.start();
+  int fd = 0;
+  for (auto _ : state) {
+    timer.update(fd, [](typename T::Task &task) {
+      task.next_run_time = T::clock::now() + 60s;
+    });
+    if (++fd == n) fd = 0;
+  }
+  timer.stop();
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK_TEMPLATE(BM_TimerUpdate, Timer<int>)
+    ->RangeMultiplier(8)
+    ->Range(64, 64 << 10);
+BENCHMARK_TEMPLATE(BM_TimerUpdate, TimingWheel<int>)
+    ->RangeMultiplier(8)
+    ->Range(64, 64 << 10);
+
+// add range(0) timers that are already due and wait until all of them fired
+template <typename T>
+static void BM_TimerFire(benchmark::State &state) {
+  int n = state.range(0);
+  T timer;
+  timer.start();
+  std::atomic<int> fired = 0;
+  // ids are released after the callbacks run, don't reuse them
+  int id = 0;
+  for (auto _ : state) {
+    fired = 0;
+    for (int i = 0; i < n; ++i)
+      timer.add(id++, [&fired] { fired.fetch_add(1); }, 0us);
+    while (fired.load() < n) std::this_thread::yield();
+  }
+  timer.stop();
+  state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK_TEMPLATE(BM_TimerFire, Timer<int>)
+    ->RangeMultiplier(8)
+    ->Range(64, 4096)
+    ->UseRealTime();
+BENCHMARK_TEMPLATE(BM_TimerFire, TimingWheel<int>)
+    ->RangeMultiplier(8)
+    ->Range(64, 4096)
+    ->UseRealTime();
+
+// the same as BM_TimerFire, the callbacks are dispatched to a pool in batches
+static void BM_TimingWheelFirePool(benchmark::State &state) {
+  int n = state.range(0);
+  ThreadPool pool(2);
+  TimingWheel<int> timer;
+  timer.set_thread_pool(&pool);
+  timer.start();
+  std::atomic<int> fired = 0;
+  int id = 0;
+  for (auto _ : state) {
+    fired = 0;
+    for (int i = 0; i < n; ++i)
+      timer.add(id++, [&fired] { fired.fetch_add(1); }, 0us);
+    while (fired.load() < n) std::this_thread::yield();
+  }
+  timer.stop();
+  state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK(BM_TimingWheelFirePool)
+    ->RangeMultiplier(8)
+    ->Range(64, 4096)
+    ->UseRealTime();
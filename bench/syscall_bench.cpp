@@ -0,0 +1,180 @@
+// Count the syscalls per request of the event loop, with the client fds
+// registered once as edge triggered or re-armed with EPOLLONESHOT after
+// every read and write.
+//
+// The epoll and socket calls of the server thread are counted by wrapping
+// them, the server runs in this process and the clients keep their
+// connections alive.
+//
+// usage: tinywebserver_syscall_bench [n_requests] [n_connections] [port]
+#include <arpa/inet.h>
+#include <dlfcn.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "tinywebserver/network/http/server.h"
+
+enum Call { EPOLL_WAIT, EPOLL_CTL, READ, WRITEV, N_CALLS };
+
+static const char *call_names[N_CALLS] = {"epoll_wait", "epoll_ctl", "read",
+                                          "writev"};
+
+static std::atomic<uint64_t> n_calls[N_CALLS];
+
+// only the server thread is counted
+static thread_local bool counting = false;
+
+template <typename F>
+static F real(const char *name) {
+  return reinterpret_cast<F>(dlsym(RTLD_NEXT, name));
+}
+
+static void count(Call call) {
+  if (counting) n_calls[call].fetch_add(1, std::memory_order_relaxed);
+}
+
+extern "C" int epoll_wait(int epfd, epoll_event *events, int maxevents,
+                          int timeout) {
+  static auto fn = real<decltype(&epoll_wait)>("epoll_wait");
+  count(EPOLL_WAIT);
+  return fn(epfd, events, maxevents, timeout);
+}
+
+extern "C" int epoll_ctl(int epfd, int op, int fd, epoll_event *event) {
+  static auto fn = real<decltype(&epoll_ctl)>("epoll_ctl");
+  count(EPOLL_CTL);
+  return fn(epfd, op, fd, event);
+}
+
+extern "C" ssize_t read(int fd, void *buf, size_t n) {
+  static auto fn = real<decltype(&read)>("read");
+  count(READ);
+  return fn(fd, buf, n);
+}
+
+extern "C" ssize_t writev(int fd, const iovec *iov, int iovcnt) {
+  static auto fn = real<decltype(&writev)>("writev");
+  count(WRITEV);
+  return fn(fd, iov, iovcnt);
+}
+
+/**
+ * @brief Send n_requests on the connections in turn, every connection has one
+ * request in flight.
+ */
+static bool drive(uint16_t port, size_t n_requests, size_t n_connections) {
+  static const std::string_view req =
+      "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+  static const std::string_view end = "\r\n\r\nok";
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+  std::vector<int> fds;
+  for (size_t i = 0; i < n_connections; ++i) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0)
+      return false;
+    fds.push_back(fd);
+  }
+  bool ok = true;
+  for (size_t sent = 0; sent < n_requests && ok;) {
+    size_t batch = std::min(n_connections, n_requests - sent);
+    for (size_t i = 0; i < batch; ++i)
+      ok &= ::send(fds[i], req.data(), req.size(), 0) == ssize_t(req.size());
+    // read until the body of the response
+    for (size_t i = 0; i < batch && ok; ++i) {
+      std::string resp;
+      char buf[512];
+      while (resp.size() < end.size() ||
+             std::string_view(resp).substr(resp.size() - end.size()) != end) {
+        auto n = ::recv(fds[i], buf, sizeof(buf), 0);
+        if (n <= 0) {
+          ok = false;
+          break;
+        }
+        resp.append(buf, n);
+      }
+    }
+    sent += batch;
+  }
+  for (int fd : fds) ::close(fd);
+  return ok;
+}
+
+static bool measure(const char *name, bool is_client_et, uint16_t port,
+                    size_t n_requests, size_t n_connections) {
+  http::Server server;
+  server.set_triger_mode(true, is_client_et);
+  server.handle("/", [](http::ResponseWriter &resp, const http::Request &) {
+    resp.set_status(http::Response::OK);
+    resp.write("ok");
+  });
+  if (!server.listen(port, "127.0.0.1")) {
+    std::fprintf(stderr, "can't listen on %u\n", port);
+    return false;
+  }
+  std::thread loop([&server] {
+    counting = true;
+    server.start();
+  });
+
+  // warm up the connections and the buffers
+  bool ok = drive(port, n_connections * 16, n_connections);
+  uint64_t before[N_CALLS];
+  for (int i = 0; i < N_CALLS; ++i) before[i] = n_calls[i].load();
+  auto begin = std::chrono::steady_clock::now();
+  ok = ok && drive(port, n_requests, n_connections);
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - begin;
+  // let the loop handle the closes before reading the counts
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  uint64_t total = 0;
+  double per_request[N_CALLS];
+  for (int i = 0; i < N_CALLS; ++i) {
+    auto calls = n_calls[i].load() - before[i];
+    per_request[i] = double(calls) / n_requests;
+    total += calls;
+  }
+  server.stop();
+  loop.join();
+  if (!ok) {
+    std::fprintf(stderr, "%s: the requests failed\n", name);
+    return false;
+  }
+
+  std::printf("%-22s %10.0f", name, n_requests / elapsed.count());
+  for (int i = 0; i < N_CALLS; ++i) std::printf(" %10.3f", per_request[i]);
+  std::printf(" %10.3f\n", double(total) / n_requests);
+  return true;
+}
+
+int main(int argc, char **argv) {
+  size_t n_requests = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 100000;
+  size_t n_connections = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 16;
+  uint16_t port = argc > 3 ? std::atoi(argv[3]) : 18081;
+  signal(SIGPIPE, SIG_IGN);
+
+  std::printf("%-22s %10s", "client fd", "req/s");
+  for (auto name : call_names) std::printf(" %10s", name);
+  std::printf(" %10s\n", "total");
+  bool ok = measure("EPOLLONESHOT", false, port, n_requests, n_connections);
+  ok &= measure("edge triggered", true, port + 1, n_requests, n_connections);
+  return !ok;
+}
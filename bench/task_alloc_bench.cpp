@@ -0,0 +1,94 @@
+// Count the heap allocations per task when submitting and completing tasks on
+// ThreadPool.
+//
+// usage: tinywebserver_task_alloc_bench [n_tasks] [n_threads]
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <future>
+#include <memory>
+#include <new>
+#include <vector>
+
+#include "tinywebserver/pool/thread_pool.hpp"
+
+static std::atomic<uint64_t> n_allocs = 0;
+
+void *operator new(size_t size) {
+  n_allocs.fetch_add(1, std::memory_order_relaxed);
+  if (auto p = std::malloc(size)) return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+
+using clock_type = std::chrono::steady_clock;
+
+template <typename F>
+static void measure(const char *name, size_t n_tasks, F &&f) {
+  auto allocs = n_allocs.load();
+  auto begin = clock_type::now();
+  f();
+  std::chrono::duration<double> elapsed = clock_type::now() - begin;
+  allocs = n_allocs.load() - allocs;
+  std::printf("%-34s %12.0f %14.3f\n", name, n_tasks / elapsed.count(),
+              double(allocs) / n_tasks);
+}
+
+int main(int argc, char **argv) {
+  size_t n_tasks = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000000;
+  unsigned int n_threads = argc > 2 ? std::atoi(argv[2]) : 4;
+
+  ThreadPool pool(n_threads);
+  std::atomic<uint64_t> sink = 0;
+  auto small_task = [&sink](size_t i) {
+    sink.fetch_add(i, std::memory_order_relaxed);
+  };
+  auto push_all = [&] {
+    for (size_t i = 0; i < n_tasks; ++i) pool.push_task(small_task, i);
+    pool.wait_for_tasks();
+  };
+
+  std::printf("%-34s %12s %14s\n", "case", "tasks/s", "allocs/task");
+  // The first round grows the task queue to its peak size.
+  measure("push_task (cold queue)", n_tasks, push_all);
+  measure("push_task", n_tasks, push_all);
+
+  std::vector<TaskFuture<size_t>> futures;
+  futures.reserve(n_tasks);
+  measure("submit_task + get", n_tasks, [&] {
+    for (size_t i = 0; i < n_tasks; ++i)
+      futures.emplace_back(pool.submit_task([](size_t i) { return i; }, i));
+    for (auto &f : futures) sink += f.get();
+  });
+
+  std::vector<std::future<size_t>> std_futures;
+  std_futures.reserve(n_tasks);
+  measure("submit + get", n_tasks, [&] {
+    for (size_t i = 0; i < n_tasks; ++i)
+      std_futures.emplace_back(pool.submit([](size_t i) { return i; }, i));
+    for (auto &f : std_futures) sink += f.get();
+  });
+
+  // What ThreadPool did before: std::bind + std::function + std::promise.
+  std_futures.clear();
+  measure("std::function + std::promise", n_tasks, [&] {
+    for (size_t i = 0; i < n_tasks; ++i) {
+      std::function<size_t()> task_function =
+          std::bind([](size_t i) { return i; }, i);
+      auto task_promise = std::make_shared<std::promise<size_t>>();
+      std_futures.emplace_back(task_promise->get_future());
+      pool.push_task(std::function<void()>([task_function, task_promise] {
+        task_promise->set_value(task_function());
+      }));
+    }
+    for (auto &f : std_futures) sink += f.get();
+  });
+
+  return sink.load() == 0;
+}
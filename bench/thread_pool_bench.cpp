@@ -0,0 +1,117 @@
+// Compare the task throughput and the tail latency of ThreadPool and
+// WorkStealingThreadPool.
+//
+// usage: tinywebserver_thread_pool_bench [n_tasks] [max_threads]
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "tinywebserver/pool/thread_pool.hpp"
+#include "tinywebserver/pool/work_stealing_thread_pool.hpp"
+
+using clock_type = std::chrono::steady_clock;
+
+struct Result {
+  double tasks_per_sec;
+  double p50_us;
+  double p99_us;
+  double p999_us;
+  double max_us;
+};
+
+static double percentile(std::vector<int64_t> &ns, double p) {
+  auto k = static_cast<size_t>(p * (ns.size() - 1));
+  std::nth_element(ns.begin(), ns.begin() + k, ns.end());
+  return ns[k] / 1e3;
+}
+
+/**
+ * @brief n_producers external threads push n_tasks tiny tasks in total. The
+ * latency is measured from push to the start of the task.
+ */
+template <typename Pool>
+static Result run_external(unsigned int n_threads, unsigned int n_producers,
+                           size_t n_tasks) {
+  std::vector<int64_t> latency(n_tasks);
+  std::atomic<uint64_t> sink = 0;
+  Pool pool(n_threads);
+
+  auto begin = clock_type::now();
+  std::vector<std::thread> producers;
+  for (unsigned int p = 0; p < n_producers; ++p) {
+    producers.emplace_back([&, p] {
+      for (size_t i = p; i < n_tasks; i += n_producers) {
+        auto pushed = clock_type::now();
+        pool.push_task([&latency, &sink, i, pushed] {
+          latency[i] = (clock_type::now() - pushed).count();
+          sink.fetch_add(i, std::memory_order_relaxed);
+        });
+      }
+    });
+  }
+  for (auto &t : producers) t.join();
+  pool.wait_for_tasks();
+  std::chrono::duration<double> elapsed = clock_type::now() - begin;
+
+  Result ret;
+  ret.tasks_per_sec = n_tasks / elapsed.count();
+  ret.p50_us = percentile(latency, 0.5);
+  ret.p99_us = percentile(latency, 0.99);
+  ret.p999_us = percentile(latency, 0.999);
+  ret.max_us = *std::max_element(latency.begin(), latency.end()) / 1e3;
+  return ret;
+}
+
+/**
+ * @brief Every root task pushes its children from inside the pool, which is
+ * the case that work stealing is designed for.
+ * @return Tasks per second.
+ */
+template <typename Pool>
+static double run_nested(unsigned int n_threads, size_t n_tasks) {
+  const size_t fanout = 64;
+  std::atomic<uint64_t> sink = 0;
+  Pool pool(n_threads);
+
+  auto begin = clock_type::now();
+  for (size_t i = 0; i < n_tasks / fanout; ++i) {
+    pool.push_task([&pool, &sink, fanout] {
+      for (size_t j = 0; j < fanout - 1; ++j)
+        pool.push_task(
+            [&sink, j] { sink.fetch_add(j, std::memory_order_relaxed); });
+    });
+  }
+  pool.wait_for_tasks();
+  std::chrono::duration<double> elapsed = clock_type::now() - begin;
+  return n_tasks / elapsed.count();
+}
+
+template <typename Pool>
+static void report(const char *name, unsigned int n_threads, size_t n_tasks) {
+  const unsigned int n_producers = 4;
+  auto r = run_external<Pool>(n_threads, n_producers, n_tasks);
+  auto nested = run_nested<Pool>(n_threads, n_tasks);
+  std::printf("%-14s %7u %14.0f %10.1f %10.1f %10.1f %10.1f %14.0f\n", name,
+              n_threads, r.tasks_per_sec, r.p50_us, r.p99_us, r.p999_us,
+              r.max_us, nested);
+}
+
+int main(int argc, char **argv) {
+  size_t n_tasks = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 200000;
+  unsigned int max_threads = argc > 2 ? std::atoi(argv[2]) : 64;
+
+  std::printf("%-14s %7s %14s %10s %10s %10s %10s %14s\n", "pool", "threads",
+              "tasks/s", "p50(us)", "p99(us)", "p999(us)", "max(us)",
+              "nested tasks/s");
+  for (unsigned int n = 1; n <= max_threads; n *= 2) {
+    report<ThreadPool>("mutex", n, n_tasks);
+    report<WorkStealingThreadPool>("work-stealing", n, n_tasks);
+  }
+  return 0;
+}
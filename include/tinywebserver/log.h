@@ -7,19 +7,20 @@
 #include <condition_variable>
 #include <fstream>
 #include <functional>
-#include <list>
 #include <memory>
 #include <mutex>
 #include <source_location>
 #include <string>
+#include <string_view>
 #include <thread>
 #include <type_traits>
+#include <vector>
 
-class Logger {
- protected:
-  using WriterPtr =
-      std::unique_ptr<std::fstream, std::function<void(std::fstream *)>>;
+#include "tinywebserver/log_format.h"
+#include "tinywebserver/log_writer.h"
+#include "tinywebserver/utils/spsc_ring.hpp"
 
+class Logger {
  private:
   Logger() = default;
   Logger(const Logger &) = delete;
@@ -37,6 +38,30 @@ class Logger {
     FATAL = 5,
   };
 
+  /**
+   * @brief What a thread does when its log buffer is full.
+   */
+  enum class FullPolicy {
+    // wait for the writer thread to make room
+    BLOCK = 0,
+    // drop the log
+    DROP = 1,
+    // keep one of every sample rate logs once the buffer is half full, and
+    // drop the log when it is full
+    SAMPLE = 2,
+  };
+
+  /**
+   * @brief The format of the output.
+   */
+  enum class Encoding {
+    // the writer thread formats the binary logs into text
+    TEXT = 0,
+    // the writer thread writes the records as they are, decode them with
+    // tinywebserver-logdecode
+    BINARY = 1,
+  };
+
   using Formatter = std::function<std::string(
       Logger::Level, const std::string, std::thread::id,
       const std::source_location,
@@ -45,14 +70,24 @@ class Logger {
   static const Formatter default_formatter;
 
   /**
-   * @brief Set the writer for the logger. This method will stop the writer
-   * thread temporarily.
+   * @brief Set the writer for the logger. If the writer thread is running,
+   * the logs before the call go to the original writer, and the writer
+   * thread switches to the new one without stopping the producers.
+   */
+  bool set(std::unique_ptr<LogWriter> writer);
+
+  /**
+   * @brief Set a std::fstream as the writer.
    */
-  bool set(std::unique_ptr<std::fstream> writer);
+  bool set(std::unique_ptr<std::fstream> writer) {
+    if (writer == nullptr) return false;
+    return set(std::make_unique<StreamLogWriter>(std::move(writer)));
+  }
 
   /**
-   * @brief Set the positive number of logs written by the writer thread at one
-   * time. The default value is 8.
+   * @brief Set the positive number of logs a thread buffers before it wakes
+   * up the writer thread. The writer thread also wakes up every
+   * flush_interval to collect the rest. The default value is 8.
    */
   bool set(size_t write_size) {
     if (write_size == 0) return false;
@@ -65,6 +100,52 @@ class Logger {
    */
   void set(Level level) { level_ = level; }
 
+  /**
+   * @brief Set the encoding of the output. The default value is TEXT.
+   * @return Return false if the writer thread is running.
+   */
+  bool set(Encoding encoding) {
+    if (running_) return false;
+    encoding_ = encoding;
+    return true;
+  }
+
+  /**
+   * @brief Set the policy when the buffer of a thread is full. The default
+   * value is BLOCK. A thread never blocks while the writer thread is stopped.
+   */
+  void set(FullPolicy policy) { policy_ = policy; }
+
+  /**
+   * @brief Set the size in bytes of the log buffer of every thread. It
+   * applies to the threads that log for the first time afterwards. The
+   * default value is 64 KiB.
+   */
+  bool set_buffer_size(size_t buffer_size) {
+    if (buffer_size == 0) return false;
+    buffer_size_ = buffer_size;
+    return true;
+  }
+
+  /**
+   * @brief Set the sample rate of FullPolicy::SAMPLE. The default value is 16.
+   */
+  bool set_sample_rate(size_t sample_rate) {
+    if (sample_rate == 0) return false;
+    sample_rate_ = sample_rate;
+    return true;
+  }
+
+  /**
+   * @brief Get the number of logs dropped because the buffers were full.
+   */
+  size_t get_dropped() const { return dropped_; }
+
+  /**
+   * @brief Get the number of bytes waiting in the buffers of the threads.
+   */
+  size_t get_backlog() const;
+
   /**
    * @brief Start the writer thread.
    * @return Return false if one of the conditions is met. 1. The writer thread
@@ -99,7 +180,7 @@ class Logger {
       std::thread::id id = std::this_thread::get_id(),
       const std::source_location location = std::source_location::current(),
       const Formatter &formatter = default_formatter) {
-    return log(Level::INFO, content, id, location, default_formatter);
+    return log(Level::INFO, content, id, location, formatter);
   }
   /**
    * @brief Log in warn level.
@@ -109,7 +190,7 @@ class Logger {
       std::thread::id id = std::this_thread::get_id(),
       const std::source_location location = std::source_location::current(),
       const Formatter &formatter = default_formatter) {
-    return log(Level::WRAN, content, id, location, default_formatter);
+    return log(Level::WRAN, content, id, location, formatter);
   }
 
   /**
@@ -120,7 +201,7 @@ class Logger {
       std::thread::id id = std::this_thread::get_id(),
       const std::source_location location = std::source_location::current(),
       const Formatter &formatter = default_formatter) {
-    return log(Level::ERROR, content, id, location, default_formatter);
+    return log(Level::ERROR, content, id, location, formatter);
   }
 
   /**
@@ -131,7 +212,7 @@ class Logger {
       std::thread::id id = std::this_thread::get_id(),
       const std::source_location location = std::source_location::current(),
       const Formatter &formatter = default_formatter) {
-    return log(Level::DEBUG, content, id, location, default_formatter);
+    return log(Level::DEBUG, content, id, location, formatter);
   }
 
   /**
@@ -142,7 +223,7 @@ class Logger {
       std::thread::id id = std::this_thread::get_id(),
       const std::source_location location = std::source_location::current(),
       const Formatter &formatter = default_formatter) {
-    return log(Level::FATAL, content, id, location, default_formatter);
+    return log(Level::FATAL, content, id, location, formatter);
   }
 
   /**
@@ -153,11 +234,12 @@ class Logger {
       std::thread::id id = std::this_thread::get_id(),
       const std::source_location location = std::source_location::current(),
       const Formatter &formatter = default_formatter) {
-    return log(Level::TRACE, content, id, location, default_formatter);
+    return log(Level::TRACE, content, id, location, formatter);
   }
 
   /**
-   * @brief Add log.
+   * @brief Add log. The log is formatted on the calling thread and appended
+   * to the buffer of the thread without any lock.
    */
   bool log(
       Level level, const std::string &content,
@@ -165,6 +247,51 @@ class Logger {
       const std::source_location location = std::source_location::current(),
       const Formatter &formatter = default_formatter);
 
+  /**
+   * @brief Add a binary log, use LOG_FAST instead of calling it directly.
+   * Only the site ID, the timestamp counter and the raw arguments are copied
+   * into the buffer of the thread, the formatting is deferred to the writer
+   * thread or tinywebserver-logdecode.
+   *
+   * @tparam SiteFn A captureless lambda returning the constexpr site. Its type
+   * is unique to the call site, so the site is registered once.
+   * @param function The __func__ of the call site.
+   */
+  template <typename SiteFn, typename... A>
+  bool log_binary(SiteFn, const char *function, const A &...args) {
+    static constexpr binlog::Site info = SiteFn()();
+    if (Level(info.level) < level_) return false;
+    static const uint32_t site = [this, function] {
+      auto site = info;
+      site.function = function;
+      site.arg_types = binlog::ArgTypes<A...>::value;
+      return register_site(site);
+    }();
+
+    const size_t size =
+        (sizeof(binlog::RecordHeader) + ... + binlog::arg_size(args));
+    char stack[256];
+    std::unique_ptr<char[]> heap;
+    char *record = stack;
+    if (size > sizeof(stack)) {
+      heap = std::make_unique_for_overwrite<char[]>(size);
+      record = heap.get();
+    }
+    binlog::RecordHeader header{
+        site, uint32_t(size - sizeof(header)), binlog::read_timestamp()};
+    std::memcpy(record, &header, sizeof(header));
+    char *p = record + sizeof(header);
+    ((p = binlog::encode_arg(p, args)), ...);
+    (void)p;
+    return append({record, size}, {});
+  }
+
+  /**
+   * @brief Register a call site of binary logs.
+   * @return The ID of the site.
+   */
+  uint32_t register_site(const binlog::Site &site);
+
   /**
    * @brief Flush logs.
    * @return Return false if the writer or formatter hasn't been set.
@@ -172,29 +299,184 @@ class Logger {
   bool flush();
 
  protected:
-  Level level_ = Level::TRACE;
+  /**
+   * @brief The log buffer of a thread.
+   */
+  struct Buffer {
+    Buffer(size_t size, std::string thread)
+        : ring(size), thread(std::move(thread)) {}
+
+    /**
+     * @brief The records of the thread.
+     */
+    SpscByteRing ring;
+
+    /**
+     * @brief The ID of the thread in text.
+     */
+    const std::string thread;
+
+    /**
+     * @brief Set when the thread exits, the writer thread then frees the
+     * buffer after draining it.
+     */
+    std::atomic<bool> closed = false;
+
+    /**
+     * @brief The logs since the writer thread was last woken up, only used by
+     * the owner thread.
+     */
+    size_t unsignaled = 0;
+
+    /**
+     * @brief The logs seen by FullPolicy::SAMPLE, only used by the owner
+     * thread.
+     */
+    size_t sampled = 0;
+  };
+
+  /**
+   * @brief Get the buffer of the calling thread, it is registered on first
+   * use.
+   */
+  Buffer &local_buffer();
+
+  /**
+   * @brief Append a record, given in two pieces, to the buffer of the calling
+   * thread according to policy_.
+   */
+  bool append(std::string_view head, std::string_view body);
+
+  /**
+   * @brief Write the records of a buffer to writer_ in encoding_.
+   */
+  void write_records(const Buffer &buffer, std::string_view records);
+
+  /**
+   * @brief Write everything in the buffers to writer_ once, in a round-robin
+   * sweep, and free the buffers of the exited threads.
+   * @return The number of bytes written.
+   */
+  size_t drain();
 
   void writer_worker();
 
+  Level level_ = Level::TRACE;
+
+  Encoding encoding_ = Encoding::TEXT;
+
+  std::atomic<FullPolicy> policy_ = FullPolicy::BLOCK;
+
+  std::atomic<size_t> buffer_size_ = 64 * 1024;
+
+  std::atomic<size_t> sample_rate_ = 16;
+
+  std::atomic<size_t> dropped_ = 0;
+
+  /**
+   * @brief How long the writer thread sleeps when there is nothing to write.
+   */
+  std::chrono::milliseconds flush_interval_ = std::chrono::milliseconds(10);
+
+  /**
+   * @brief The buffers of all the threads that have logged.
+   */
+  std::vector<std::shared_ptr<Buffer>> buffers_ = {};
+
+  /**
+   * @brief Guard buffers_, it is only taken when a thread logs for the first
+   * time and when the writer thread sees that buffers_ changed.
+   */
+  mutable std::mutex buffers_mutex_ = {};
+
   /**
-   * @brief mutex for producer
+   * @brief Bumped whenever buffers_ changes.
+   */
+  std::atomic<size_t> buffers_version_ = 0;
+
+  /**
+   * @brief The copy of buffers_ used by the writer thread.
+   */
+  std::vector<std::shared_ptr<Buffer>> sweep_ = {};
+
+  size_t sweep_version_ = 0;
+
+  /**
+   * @brief The buffer that the next sweep starts from.
+   */
+  size_t sweep_start_ = 0;
+
+  /**
+   * @brief The registered sites, the ID of sites_[i] is i + 1.
+   */
+  std::vector<binlog::Site> sites_ = {};
+
+  std::mutex sites_mutex_ = {};
+
+  /**
+   * @brief The copy of sites_ used by the writer thread.
+   */
+  std::vector<binlog::Site> site_cache_ = {};
+
+  /**
+   * @brief The number of sites written to writer_ in Encoding::BINARY.
+   */
+  size_t sites_written_ = 0;
+
+  /**
+   * @brief Whether binlog::magic has been written to writer_.
+   */
+  bool magic_written_ = false;
+
+  /**
+   * @brief The timestamp counter and the wall time read by start().
+   */
+  uint64_t start_timestamp_ = 0;
+
+  int64_t start_ns_ = 0;
+
+  /**
+   * @brief The timestamp counter and the wall time read by the current
+   * sweep.
+   */
+  uint64_t sweep_timestamp_ = 0;
+
+  int64_t sweep_ns_ = 0;
+
+  /**
+   * @brief Convert the timestamps in Encoding::TEXT.
+   */
+  binlog::Clock clock_ = {};
+
+  /**
+   * @brief Scratch buffers of the writer thread.
+   */
+  std::string records_ = {}, out_ = {}, message_ = {};
+
+  /**
+   * @brief mutex for the condition variables
    */
   mutable std::mutex logs_mutex_ = {};
 
   /**
-   * @brief
+   * @brief A condition variable used to wake up the writer thread.
    */
   std::condition_variable logs_avail_cv_ = {};
 
   /**
-   * @brief buffer of logs
+   * @brief Whether the writer thread is waiting on logs_avail_cv_.
    */
-  std::list<std::string> logs_ = {};
+  std::atomic<bool> writer_sleeping_ = {false};
 
   /**
    * @brief writer
    */
-  WriterPtr writer_ = nullptr;
+  std::unique_ptr<LogWriter> writer_ = nullptr;
+
+  /**
+   * @brief The writer passed to set() while running, guarded by logs_mutex_.
+   */
+  std::unique_ptr<LogWriter> pending_writer_ = nullptr;
 
   /**
    * @brief writer thread
@@ -213,19 +495,35 @@ class Logger {
   std::atomic<bool> running_ = {false};
 
   /**
-   * @brief An atomic variable indicating that flush().
+   * @brief The number of flush() calls, the writer thread flushes when it is
+   * larger than flushed_.
    */
-  std::atomic<bool> waiting_flush_ = {false};
+  std::atomic<size_t> flush_requested_ = {0};
 
   /**
-   * @brief A condition variable used to notify flush().
+   * @brief The last flush request served by the writer thread.
    */
-  std::condition_variable flush_done_cv = {};
+  std::atomic<size_t> flushed_ = {0};
 
   /**
-   * @brief Temporary suspension flag, it is used to update the writer
+   * @brief A condition variable used to notify flush().
    */
-  std::atomic<bool> temporary_stop_ = false;
+  std::condition_variable flush_done_cv = {};
 };
 
+/**
+ * @brief Log with deferred formatting, for example
+ * LOG_FAST(INFO, "accept fd {} from {}", fd, address). Every {} is replaced by
+ * the next argument, the arguments can be integers, floating points, chars,
+ * strings and pointers.
+ */
+#define LOG_FAST(level, format, ...)                                    \
+  Logger::get_instance().log_binary(                                    \
+      [] {                                                              \
+        return binlog::Site{uint8_t(Logger::Level::level), format,      \
+                            __FILE__, __LINE__,                         \
+                            std::source_location::current().column()};  \
+      },                                                                \
+      __func__ __VA_OPT__(, ) __VA_ARGS__)
+
 #endif
@@ -0,0 +1,247 @@
+#ifndef LOG_FORMAT_H_
+#define LOG_FORMAT_H_
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/**
+ * @brief The record format shared by Logger and tinywebserver-logdecode.
+ *
+ * The per-thread buffers of Logger and the files written in
+ * Logger::Encoding::BINARY are sequences of records, a RecordHeader followed
+ * by size bytes of payload. The payload of a binary log is the raw bytes of
+ * its arguments, the format string and the argument types are written once
+ * per call site in a SITE_DEF record. A binary file starts with magic.
+ */
+namespace binlog {
+
+inline constexpr char magic[8] = "TWSLOG2";
+
+struct RecordHeader {
+  uint32_t site;
+  uint32_t size;
+  uint64_t timestamp;
+};
+
+enum : uint32_t {
+  // a preformatted log, the payload is the text
+  TEXT_SITE = 0,
+  // the payload is the name of the thread of the following records
+  THREAD_SITE = 0xFFFFFFFD,
+  // the timestamp is read with the wall time in the payload, in nanoseconds
+  // since the epoch
+  CLOCK_SITE = 0xFFFFFFFE,
+  // the payload is a Site
+  SITE_DEF = 0xFFFFFFFF,
+};
+
+/**
+ * @brief A call site of a binary log. The strings are static.
+ */
+struct Site {
+  uint8_t level;
+  const char *format;
+  const char *file;
+  uint32_t line;
+  uint32_t column = 0;
+  const char *function = nullptr;
+  /**
+   * @brief One character per argument, see arg_type().
+   */
+  const char *arg_types = nullptr;
+};
+
+/**
+ * @brief Read the timestamp counter, the TSC on x86 and the steady clock
+ * elsewhere.
+ */
+inline uint64_t read_timestamp() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
+
+inline int64_t wall_time_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+template <typename>
+inline constexpr bool always_false = false;
+
+/**
+ * @brief The type character of an argument: b bool, c char, i signed integer,
+ * u unsigned integer, d floating point, s string and p pointer. Integers and
+ * floating points are widened to 8 bytes.
+ */
+template <typename T>
+constexpr char arg_type() {
+  using U = std::remove_cvref_t<T>;
+  if constexpr (std::is_same_v<U, bool>)
+    return 'b';
+  else if constexpr (std::is_same_v<U, char>)
+    return 'c';
+  else if constexpr (std::is_integral_v<U>)
+    return std::is_signed_v<U> ? 'i' : 'u';
+  else if constexpr (std::is_floating_point_v<U>)
+    return 'd';
+  else if constexpr (std::is_convertible_v<const U &, std::string_view>)
+    return 's';
+  else if constexpr (std::is_pointer_v<U>)
+    return 'p';
+  else
+    static_assert(always_false<U>, "unsupported binary log argument");
+}
+
+template <typename... A>
+struct ArgTypes {
+  static constexpr char value[] = {arg_type<A>()..., '\0'};
+};
+
+template <typename T>
+std::string_view as_string(const T &arg) {
+  if constexpr (std::is_pointer_v<std::remove_cvref_t<T>>)
+    if (arg == nullptr) return "(null)";
+  return std::string_view(arg);
+}
+
+/**
+ * @brief Get the encoded size of an argument.
+ */
+template <typename T>
+size_t arg_size(const T &arg) {
+  constexpr char type = arg_type<T>();
+  if constexpr (type == 'b' || type == 'c')
+    return 1;
+  else if constexpr (type == 's')
+    return sizeof(uint32_t) + as_string(arg).size();
+  else
+    return 8;
+}
+
+/**
+ * @brief Write an argument at p.
+ * @return The end of the written bytes.
+ */
+template <typename T>
+char *encode_arg(char *p, const T &arg) {
+  constexpr char type = arg_type<T>();
+  if constexpr (type == 'b' || type == 'c') {
+    *p = char(arg);
+    return p + 1;
+  } else if constexpr (type == 's') {
+    auto str = as_string(arg);
+    uint32_t size = str.size();
+    std::memcpy(p, &size, sizeof(size));
+    std::memcpy(p + sizeof(size), str.data(), size);
+    return p + sizeof(size) + size;
+  } else {
+    std::conditional_t<type == 'i', int64_t,
+                       std::conditional_t<type == 'u', uint64_t,
+                                          std::conditional_t<type == 'd',
+                                                             double,
+                                                             uintptr_t>>>
+        value;
+    if constexpr (type == 'p')
+      value = reinterpret_cast<uintptr_t>(arg);
+    else
+      value = arg;
+    std::memcpy(p, &value, sizeof(value));
+    return p + sizeof(value);
+  }
+}
+
+/**
+ * @brief Convert the timestamps to the wall time by a linear interpolation
+ * between the first and the last calibration points.
+ */
+class Clock {
+ public:
+  void calibrate(uint64_t timestamp, int64_t ns) {
+    if (!calibrated_) {
+      base_timestamp_ = timestamp;
+      base_ns_ = ns;
+      calibrated_ = true;
+    }
+    last_timestamp_ = timestamp;
+    last_ns_ = ns;
+  }
+
+  int64_t to_ns(uint64_t timestamp) const {
+    if (last_timestamp_ == base_timestamp_) return base_ns_;
+    // the difference may be negative for the records read before the base
+    long double elapsed = int64_t(timestamp - base_timestamp_);
+    return base_ns_ + int64_t(elapsed * (last_ns_ - base_ns_) /
+                              (last_timestamp_ - base_timestamp_));
+  }
+
+ protected:
+  bool calibrated_ = false;
+
+  uint64_t base_timestamp_ = 0;
+
+  int64_t base_ns_ = 0;
+
+  uint64_t last_timestamp_ = 0;
+
+  int64_t last_ns_ = 0;
+};
+
+/**
+ * @brief Append a record to out.
+ */
+void append_record(std::string &out, uint32_t site, uint64_t timestamp,
+                   std::string_view payload);
+
+/**
+ * @brief Append the SITE_DEF record of the site to out.
+ */
+void append_site_def(std::string &out, uint32_t id, const Site &site);
+
+/**
+ * @brief A site decoded from a SITE_DEF record.
+ */
+struct SiteDef {
+  uint8_t level = 0;
+  uint32_t line = 0;
+  uint32_t column = 0;
+  std::string format, file, function, arg_types;
+};
+
+/**
+ * @brief Decode the payload of a SITE_DEF record.
+ * @return Return false if the payload is malformed.
+ */
+bool decode_site_def(std::string_view payload, uint32_t &id, SiteDef &site);
+
+/**
+ * @brief Replace every {} in the format with the next argument in the
+ * payload, {{ and }} are escaped braces. A {} without an argument is kept
+ * verbatim.
+ * @return Return false if the payload doesn't match the argument types.
+ */
+bool format_message(std::string &out, std::string_view format,
+                    std::string_view arg_types, std::string_view payload);
+
+/**
+ * @brief Append a log line in the layout of Logger::default_formatter.
+ */
+void format_line(std::string &out, uint8_t level, int64_t ns,
+                 std::string_view thread, std::string_view file, uint32_t line,
+                 uint32_t column, std::string_view function,
+                 std::string_view message);
+
+}  // namespace binlog
+
+#endif
@@ -0,0 +1,141 @@
+#ifndef LOG_WRITER_H_
+#define LOG_WRITER_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief The output of Logger. It is only called by the writer thread.
+ */
+class LogWriter {
+ public:
+  virtual ~LogWriter() = default;
+
+  /**
+   * @brief Make room for a write of n bytes, it may start a new file.
+   * @return Return true if the next write goes to the beginning of a new file.
+   */
+  virtual bool prepare(size_t) { return false; }
+
+  virtual bool write(const char *data, size_t n) = 0;
+
+  virtual bool flush() = 0;
+};
+
+/**
+ * @brief Write to a std::fstream.
+ */
+class StreamLogWriter : public LogWriter {
+ public:
+  explicit StreamLogWriter(std::unique_ptr<std::fstream> stream)
+      : stream_(std::move(stream)) {}
+
+  ~StreamLogWriter() override {
+    stream_->flush();
+    stream_->close();
+  }
+
+  bool write(const char *data, size_t n) override {
+    return bool(stream_->write(data, n));
+  }
+
+  bool flush() override { return bool(stream_->flush()); }
+
+ protected:
+  std::unique_ptr<std::fstream> stream_;
+};
+
+/**
+ * @brief Append to preallocated, memory-mapped segment files, so a write is a
+ * memcpy. A new segment is started when the current one is full or older than
+ * max_age. Full segments are synced, trimmed to their length and closed by a
+ * background thread, so neither the writer thread nor the producers wait for
+ * the disk.
+ *
+ * The segments are named <base_path>.<YYYYmmdd-HHMMSS>-<sequence>.log. A
+ * write is never split across segments.
+ */
+class MappedLogWriter : public LogWriter {
+ public:
+  /**
+   * @param base_path The path of the segments without the suffix.
+   * @param segment_size The size preallocated for every segment.
+   * @param max_age Start a new segment after max_age, zero disables it.
+   */
+  explicit MappedLogWriter(std::string base_path,
+                           size_t segment_size = 64 * 1024 * 1024,
+                           std::chrono::seconds max_age = {});
+
+  ~MappedLogWriter() override;
+
+  bool prepare(size_t n) override;
+
+  bool write(const char *data, size_t n) override;
+
+  /**
+   * @brief Start the write-back of the current segment without waiting.
+   */
+  bool flush() override;
+
+  /**
+   * @brief Get the path of the current segment.
+   */
+  const std::string &path() const { return current_.path; }
+
+ protected:
+  struct Segment {
+    int fd = -1;
+    char *data = nullptr;
+    size_t capacity = 0;
+    size_t used = 0;
+    std::string path;
+  };
+
+  /**
+   * @brief Hand the current segment to the sync thread and map a new one.
+   */
+  bool rotate(size_t min_size);
+
+  bool open_segment(size_t size);
+
+  /**
+   * @brief Sync, unmap, trim and close the segment. An empty segment is
+   * removed.
+   */
+  static void close_segment(Segment &segment);
+
+  void sync_worker();
+
+  std::string base_path_;
+
+  size_t segment_size_;
+
+  std::chrono::seconds max_age_;
+
+  Segment current_ = {};
+
+  std::chrono::steady_clock::time_point opened_ = {};
+
+  uint64_t sequence_ = 0;
+
+  /**
+   * @brief The full segments waiting for the sync thread.
+   */
+  std::vector<Segment> retired_ = {};
+
+  std::mutex retired_mutex_ = {};
+
+  std::condition_variable retired_cv_ = {};
+
+  bool stopping_ = false;
+
+  std::thread sync_thread_;
+};
+
+#endif
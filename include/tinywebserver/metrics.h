@@ -0,0 +1,292 @@
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Metrics recorded on hot paths and aggregated when they are scraped.
+ *
+ * Counters and histograms are split into shards, and every thread updates the
+ * shard picked by shard_index() with relaxed atomics, so the threads of a
+ * server rarely write to the same cache line. A scrape sums the shards.
+ */
+namespace metrics {
+
+inline constexpr size_t n_shards = 16;
+
+/**
+ * @brief Get the shard of the calling thread, the threads are assigned in
+ * turn.
+ */
+inline size_t shard_index() {
+  static std::atomic<size_t> next = 0;
+  thread_local size_t index =
+      next.fetch_add(1, std::memory_order_relaxed) % n_shards;
+  return index;
+}
+
+class Counter {
+ public:
+  void add(uint64_t n = 1) {
+    shards_[shard_index()].value.fetch_add(n, std::memory_order_relaxed);
+  }
+
+  uint64_t value() const {
+    uint64_t ret = 0;
+    for (auto &shard : shards_)
+      ret += shard.value.load(std::memory_order_relaxed);
+    return ret;
+  }
+
+ protected:
+  struct alignas(64) Shard {
+    std::atomic<uint64_t> value = 0;
+  };
+
+  std::array<Shard, n_shards> shards_;
+};
+
+/**
+ * @brief A value that goes up and down. A gauge that is only read at scrape
+ * time should be registered with MetricsRegistry::gauge_fn() instead.
+ */
+class Gauge {
+ public:
+  void set(int64_t value) { value_.store(value, std::memory_order_relaxed); }
+
+  void add(int64_t n = 1) { value_.fetch_add(n, std::memory_order_relaxed); }
+
+  void sub(int64_t n = 1) { value_.fetch_sub(n, std::memory_order_relaxed); }
+
+  int64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+ protected:
+  std::atomic<int64_t> value_ = 0;
+};
+
+/**
+ * @brief An HDR-style histogram of non-negative integers, such as durations in
+ * nanoseconds or queue depths. Every power of two is split into 2^sub_bits
+ * linear buckets, so a recorded value is off by at most 1/2^sub_bits from the
+ * bucket it falls in. It is header only, so the header-only pools can record
+ * into it.
+ */
+class Histogram {
+ public:
+  static constexpr size_t sub_bits = 3;
+
+  static constexpr size_t n_sub = size_t(1) << sub_bits;
+
+  /**
+   * @brief Values from 2^max_bits ns (about 18 minutes) are put in the last
+   * bucket.
+   */
+  static constexpr size_t max_bits = 40;
+
+  static constexpr size_t n_buckets = (max_bits - sub_bits + 1) * n_sub;
+
+  Histogram() = default;
+
+  Histogram(const Histogram &) = delete;
+
+  Histogram &operator=(const Histogram &) = delete;
+
+  using Buckets = std::array<uint64_t, n_buckets>;
+
+  static size_t bucket_of(uint64_t value) {
+    if (value < n_sub) return value;
+    size_t bits = std::bit_width(value);
+    if (bits > max_bits) return n_buckets - 1;
+    // the top sub_bits + 1 bits select the bucket
+    size_t shift = bits - sub_bits - 1;
+    return (shift + 1) * n_sub + ((value >> shift) - n_sub);
+  }
+
+  /**
+   * @brief Get the inclusive upper bound of the values in bucket i.
+   */
+  static uint64_t bucket_upper_bound(size_t i) {
+    if (i < n_sub) return i;
+    if (i == n_buckets - 1) return UINT64_MAX;
+    size_t shift = i / n_sub - 1;
+    return ((n_sub + i % n_sub + 1) << shift) - 1;
+  }
+
+  void record(uint64_t value) {
+    auto &shard = shards_[shard_index()];
+    shard.buckets[bucket_of(value)].fetch_add(1, std::memory_order_relaxed);
+    shard.sum.fetch_add(value, std::memory_order_relaxed);
+  }
+
+  void record(std::chrono::nanoseconds duration) {
+    record(uint64_t(std::max<int64_t>(duration.count(), 0)));
+  }
+
+  /**
+   * @brief Sum the buckets of the shards.
+   */
+  Buckets buckets() const {
+    Buckets ret = {};
+    for (auto &shard : shards_)
+      for (size_t i = 0; i < n_buckets; ++i)
+        ret[i] += shard.buckets[i].load(std::memory_order_relaxed);
+    return ret;
+  }
+
+  uint64_t count() const {
+    uint64_t ret = 0;
+    for (auto n : buckets()) ret += n;
+    return ret;
+  }
+
+  uint64_t sum() const {
+    uint64_t ret = 0;
+    for (auto &shard : shards_)
+      ret += shard.sum.load(std::memory_order_relaxed);
+    return ret;
+  }
+
+  /**
+   * @brief Estimate the percentile by the upper bound of the bucket.
+   * @param p In the range [0, 1].
+   */
+  uint64_t percentile(double p) const {
+    auto b = buckets();
+    uint64_t total = 0;
+    for (auto n : b) total += n;
+    if (total == 0) return 0;
+    uint64_t rank = p * total, seen = 0;
+    for (size_t i = 0; i < n_buckets; ++i) {
+      seen += b[i];
+      if (seen > rank) return bucket_upper_bound(i);
+    }
+    return bucket_upper_bound(n_buckets - 1);
+  }
+
+ protected:
+  struct alignas(64) Shard {
+    std::array<std::atomic<uint64_t>, n_buckets> buckets = {};
+
+    std::atomic<uint64_t> sum = 0;
+  };
+
+  std::array<Shard, n_shards> shards_;
+};
+
+/**
+ * @brief The set of metrics of a server, written in the Prometheus text
+ * exposition format. The metrics live as long as the registry, so the
+ * returned references can be kept by the instrumented code.
+ */
+class MetricsRegistry {
+ public:
+  MetricsRegistry() = default;
+
+  MetricsRegistry(const MetricsRegistry &) = delete;
+
+  MetricsRegistry &operator=(const MetricsRegistry &) = delete;
+
+  /**
+   * @brief Register a counter, the name should end with _total. Registering
+   * a name twice returns the same metric.
+   * @return Return nullptr if the name is registered with another type.
+   */
+  Counter *counter(const std::string &name, const std::string &help);
+
+  /**
+   * @return Return nullptr if the name is registered with another type.
+   */
+  Gauge *gauge(const std::string &name, const std::string &help);
+
+  /**
+   * @brief Register a gauge whose value is read by fn at scrape time. fn is
+   * called by the scraping thread, registering the name again replaces it.
+   * @return Return false if the name is registered with another type.
+   */
+  bool gauge_fn(const std::string &name, const std::string &help,
+                std::function<double()> fn);
+
+  /**
+   * @brief Register a counter whose value is read by fn at scrape time, the
+   * name should end with _total and fn should never return a smaller value.
+   * @return Return false if the name is registered with another type.
+   */
+  bool counter_fn(const std::string &name, const std::string &help,
+                  std::function<double()> fn);
+
+  /**
+   * @brief Register a histogram of durations, it is exported in seconds, so
+   * the name should end with _seconds.
+   * @return Return nullptr if the name is registered with another type.
+   */
+  Histogram *histogram(const std::string &name, const std::string &help);
+
+  /**
+   * @brief Register a histogram owned by someone else, fn returns it at scrape
+   * time and must stay valid as long as the registry.
+   * @param unit The exported value of a recorded 1, e.g. 1e-9 for a histogram
+   * of nanoseconds exported in seconds. The bounds below 1us are skipped if
+   * the unit is smaller than 1.
+   * @return Return false if the name is registered with another type.
+   */
+  bool histogram_fn(const std::string &name, const std::string &help,
+                    std::function<const Histogram &()> fn, double unit = 1);
+
+  /**
+   * @brief Append all the metrics to out in the Prometheus text format.
+   */
+  void write(std::string &out) const;
+
+  std::string scrape() const {
+    std::string out;
+    write(out);
+    return out;
+  }
+
+ protected:
+  enum class Type {
+    COUNTER,
+    COUNTER_FN,
+    GAUGE,
+    GAUGE_FN,
+    HISTOGRAM,
+    HISTOGRAM_FN
+  };
+
+  struct Metric {
+    std::string name;
+    std::string help;
+    Type type;
+    std::unique_ptr<Counter> counter;
+    std::unique_ptr<Gauge> gauge;
+    std::function<double()> fn;
+    std::unique_ptr<Histogram> histogram;
+    std::function<const Histogram &()> histogram_fn;
+    double unit = 1e-9;
+  };
+
+  /**
+   * @brief Find or append the metric of the name.
+   * @return Return nullptr if the name is registered with another type, as
+   * a name has a single type in the exposition format.
+   */
+  Metric *add(const std::string &name, const std::string &help, Type type);
+
+  std::vector<Metric> metrics_;
+
+  mutable std::mutex mutex_;
+};
+
+}  // namespace metrics
+
+#endif
@@ -0,0 +1,257 @@
+#ifndef HTTP_ACCESS_LOG_H_
+#define HTTP_ACCESS_LOG_H_
+
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "tinywebserver/network/http/request.h"
+#include "tinywebserver/utils/spsc_ring.hpp"
+
+namespace http {
+
+/**
+ * @brief A string field of AccessRecord, longer values are truncated.
+ */
+template <size_t N>
+struct FixedString {
+  uint16_t size = 0;
+  char data[N];
+
+  void assign(std::string_view str) {
+    size = std::min(str.size(), N);
+    std::memcpy(data, str.data(), size);
+  }
+
+  std::string_view view() const { return {data, size}; }
+};
+
+/**
+ * @brief The fields of one request, captured by the event loop without any
+ * allocation.
+ */
+struct AccessRecord {
+  /**
+   * @brief The wall time when the request was parsed, in nanoseconds since
+   * the epoch.
+   */
+  int64_t time_ns = 0;
+
+  /**
+   * @brief The time from parsing the request to writing the last byte of the
+   * response.
+   */
+  int64_t duration_ns = 0;
+
+  /**
+   * @brief The size of the response, including the header. It is 0 if the
+   * connection was closed without a response.
+   */
+  uint64_t bytes = 0;
+
+  /**
+   * @brief The IPv4 address and port of the client in network byte order.
+   */
+  uint32_t remote_addr = 0;
+  uint16_t remote_port = 0;
+
+  /**
+   * @brief The status of the response, or the status the request was
+   * rejected with, 400 for a bad request and 404 without a handler.
+   */
+  uint16_t status = 0;
+
+  Request::Method method = Request::Method::UNKNOWN;
+
+  FixedString<8> version;
+
+  /**
+   * @brief It is empty if the request line couldn't be parsed.
+   */
+  FixedString<256> uri;
+
+  FixedString<128> referer;
+
+  FixedString<128> user_agent;
+};
+
+/**
+ * @brief The access log of Server. It doesn't share anything with Logger.
+ *
+ * Every event loop owns a Producer, a ring of AccessRecord, and pushes a
+ * record when a response has been written or a request has been rejected by
+ * closing the connection. The background thread takes the
+ * records in batches, formats every batch into one buffer and writes the
+ * buffers of all the producers with one writev(), so a busy server costs one
+ * system call per batch instead of one per request. A record is dropped and
+ * counted if its ring is full.
+ */
+class AccessLog {
+ public:
+  enum class Format {
+    // host - - [time] "request" status bytes
+    COMMON,
+    // COMMON followed by "referer" "user-agent"
+    COMBINED,
+    // one JSON object per line, with the duration in microseconds
+    JSON,
+  };
+
+  struct Producer {
+    explicit Producer(size_t capacity) : ring(capacity) {}
+
+    SpscRing<AccessRecord> ring;
+
+    /**
+     * @brief The requests seen by sample(), only touched by the event loop.
+     */
+    size_t requests = 0;
+  };
+
+  AccessLog() = default;
+
+  AccessLog(const AccessLog &) = delete;
+
+  AccessLog &operator=(const AccessLog &) = delete;
+
+  ~AccessLog();
+
+  /**
+   * @brief Append the log to path.
+   * @return Return false if the file can't be opened or the writer thread is
+   * running.
+   */
+  bool open(const std::string &path);
+
+  bool is_open() const { return fd_ != -1; }
+
+  /**
+   * @return Return false if the writer thread is running.
+   */
+  bool set(Format format) {
+    if (running_) return false;
+    format_ = format;
+    return true;
+  }
+
+  Format get_format() const { return format_; }
+
+  /**
+   * @brief Log one of every sample_rate requests. The default value is 1.
+   */
+  bool set_sample_rate(size_t sample_rate) {
+    if (sample_rate == 0) return false;
+    sample_rate_ = sample_rate;
+    return true;
+  }
+
+  size_t get_sample_rate() const { return sample_rate_; }
+
+  /**
+   * @brief Add the ring of an event loop.
+   * @return Return nullptr if the writer thread is running.
+   */
+  Producer *add_producer(size_t capacity = 4096);
+
+  /**
+   * @brief Decide whether the next request of the producer is logged.
+   */
+  bool sample(Producer &producer) const {
+    return producer.requests++ % sample_rate_.load(std::memory_order_relaxed) ==
+           0;
+  }
+
+  /**
+   * @brief Queue a record, called by the owner of the producer.
+   * @return Return false if the ring is full, the record is dropped.
+   */
+  bool push(Producer &producer, const AccessRecord &record);
+
+  /**
+   * @brief Start the writer thread.
+   * @return Return false if it is running or the log is not opened.
+   */
+  bool start();
+
+  /**
+   * @brief Write the queued records and stop the writer thread.
+   * @return Return false if the writer thread has not been started.
+   */
+  bool stop();
+
+  /**
+   * @brief Get the number of records dropped because a ring was full.
+   */
+  size_t get_dropped() const { return dropped_; }
+
+  /**
+   * @brief Append the line of the record to out.
+   */
+  static void format(std::string &out, Format format,
+                     const AccessRecord &record);
+
+ protected:
+  /**
+   * @brief The most records taken from a ring at a time.
+   */
+  static constexpr size_t batch_size = 256;
+
+  void writer_worker();
+
+  /**
+   * @brief Format and write the queued records.
+   * @return The number of records written.
+   */
+  size_t drain();
+
+  /**
+   * @brief Write all of the buffers, resuming after partial writes.
+   */
+  bool write_all(iovec *iov, size_t n);
+
+  int fd_ = -1;
+
+  Format format_ = Format::COMBINED;
+
+  std::atomic<size_t> sample_rate_ = 1;
+
+  std::vector<std::unique_ptr<Producer>> producers_;
+
+  /**
+   * @brief The records and the text of the current batch, one buffer per
+   * producer. They are only touched by the writer thread.
+   */
+  std::vector<AccessRecord> records_;
+
+  std::vector<std::string> texts_;
+
+  std::atomic<size_t> dropped_ = 0;
+
+  std::mutex mutex_;
+
+  std::condition_variable cv_;
+
+  /**
+   * @brief Whether the writer thread is waiting, so a producer only notifies
+   * it when it may be asleep.
+   */
+  std::atomic<bool> writer_sleeping_ = false;
+
+  std::atomic<bool> running_ = false;
+
+  std::thread writer_thread_;
+};
+
+}  // namespace http
+
+#endif
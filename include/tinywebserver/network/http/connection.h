@@ -3,11 +3,15 @@
 
 #include <netinet/in.h>
 
+#include <chrono>
 #include <memory>
 #include <shared_mutex>
+#include <string>
 #include <unordered_map>
 
+#include "tinywebserver/network/http/access_log.h"
 #include "tinywebserver/network/http/request_parser.h"
+#include "tinywebserver/network/http/request_trace.h"
 #include "tinywebserver/network/http/response_writer.h"
 
 namespace http {
@@ -29,14 +33,28 @@ class Connection {
   // }
 
   /**
-   * @brief Parsing HTPP Request from file descriptor
+   * @brief Parsing HTPP Request from file descriptor. The bytes a previous read
+   * left in the parser are parsed first, the fd is only read if they don't
+   * make a request and it is readable.
    * @param is_et Whether fd is in the edge triger mode.
+   * @param max_read The most bytes to read, it is reduced by the bytes read.
+   * The fd stays readable if it has more.
    */
   std::pair<RequestParser::State, std::unique_ptr<Request>>
-  parse_request_from_fd(bool is_et) {
+  parse_request_from_fd(bool is_et, size_t &max_read) {
     if (req_parser_ == nullptr) req_parser_ = std::make_unique<RequestParser>();
 
-    auto p = req_parser_->consume_from_fd(fd_, is_et);
+    std::pair<RequestParser::State, std::unique_ptr<Request>> p = {
+        RequestParser::State::INIT, nullptr};
+    read_fd_ = false;
+    if (req_parser_->has_buffered()) p = req_parser_->consume({});
+    if (p.second == nullptr && !RequestParser::is_error_state(p.first) &&
+        readable_) {
+      read_fd_ = true;
+      p = req_parser_->consume_from_fd(fd_, is_et, max_read);
+      max_read -= req_parser_->last_read();
+      readable_ = !req_parser_->drained();
+    }
     if (p.second != nullptr) {
       keep_alive_ = p.second->is_keepalive();
     }
@@ -50,8 +68,37 @@ class Connection {
     return *resp_writer_;
   }
 
+  /**
+   * @brief Whether the parser holds the bytes of a pipelined request that was
+   * read together with the previous one.
+   */
+  bool has_pending_input() const {
+    return req_parser_ != nullptr && req_parser_->has_buffered();
+  }
+
   bool is_keep_alive() const { return keep_alive_; }
 
+  /**
+   * @brief Whether a response made by make_response() is being written.
+   */
+  bool is_writing() const { return full_resp_ != nullptr; }
+
+  /**
+   * @brief Whether EPOLLIN has been reported since the fd was last drained. An
+   * edge triggered fd is read once the response being written is done.
+   */
+  bool is_readable() const { return readable_; }
+
+  void set_readable(bool readable) { readable_ = readable; }
+
+  /**
+   * @brief Whether the connection used up the budget of a readiness event and
+   * waits in the event loop to be served again.
+   */
+  bool is_deferred() const { return deferred_; }
+
+  void set_deferred(bool deferred) { deferred_ = deferred; }
+
   /**
    * @brief Get the address of client
    */
@@ -63,15 +110,65 @@ class Connection {
    */
   IOVector make_response() {
     full_resp_ = std::make_unique<BufferVector>();
-    // todo response line
-    full_resp_->write(std::string(resp_writer_->header()));
+    auto &resp = resp_writer_->resp_;
+    if (resp.status() == Response::INVALID_CODE)
+      resp.set_status(Response::OK);
+    if (resp.version().empty()) resp.set_version("1.1");
+    if (resp.desc().empty())
+      resp.set_desc(Response::status_desc(resp.status()));
+    resp.header()[Header::CONTENT_LENGTH] =
+        std::to_string(resp_writer_->buf_.readable_size());
+    if (!keep_alive_) resp.header()[Header::CONNECTION] = "close";
+    full_resp_->write("HTTP/" + resp.version() + " " +
+                      std::to_string(resp.status()) + " " + resp.desc() +
+                      CRLF + std::string(resp.header()) + CRLF);
     full_resp_->write(resp_writer_->buf_);
     resp_ = full_resp_->get_read_iovec();
+    response_size_ = resp_.bytes();
     return resp_;
   }
 
   IOVector &response() { return resp_; }
 
+  /**
+   * @brief Get the size of the response made by make_response().
+   */
+  size_t response_size() const { return response_size_; }
+
+  /**
+   * @brief The access log record of the response being written.
+   */
+  AccessRecord &access_record() { return access_record_; }
+
+  /**
+   * @brief Whether access_record() should be logged once the response is
+   * written.
+   */
+  bool access_pending() const { return access_pending_; }
+
+  void set_access_pending(bool pending) { access_pending_ = pending; }
+
+  /**
+   * @brief The phase timestamps of the request being served.
+   */
+  RequestTrace &trace() { return trace_; }
+
+  /**
+   * @brief Get RequestParser::read_end_timestamp() of the last read.
+   * @return 0 if the last parse_request_from_fd() parsed buffered bytes
+   * without reading the fd.
+   */
+  uint64_t read_end_timestamp() const {
+    return read_fd_ ? req_parser_->read_end_timestamp() : 0;
+  }
+
+  /**
+   * @brief The time when the response being written was made.
+   */
+  std::chrono::steady_clock::time_point &response_start() {
+    return response_start_;
+  }
+
   /**
    * @brief Close the Connection.
    */
@@ -82,10 +179,15 @@ class Connection {
     return true;
   }
 
+  /**
+   * @brief Clear the state of the last request. The parser is kept with the
+   * pipelined bytes it has read.
+   */
   void clear() {
     resp_writer_ = nullptr;
-    req_parser_ = nullptr;
     full_resp_ = nullptr;
+    access_pending_ = false;
+    trace_.active = false;
   }
 
  protected:
@@ -96,6 +198,15 @@ class Connection {
 
   bool keep_alive_ = true;
 
+  bool readable_ = false;
+
+  /**
+   * @brief Whether the last parse_request_from_fd() read the fd.
+   */
+  bool read_fd_ = false;
+
+  bool deferred_ = false;
+
   /**
    * @brief Address of client
    */
@@ -108,6 +219,16 @@ class Connection {
   std::unique_ptr<BufferVector> full_resp_ = nullptr;
 
   IOVector resp_;
+
+  size_t response_size_ = 0;
+
+  AccessRecord access_record_;
+
+  std::chrono::steady_clock::time_point response_start_;
+
+  bool access_pending_ = false;
+
+  RequestTrace trace_;
 };
 
 class ConnectionManger {
@@ -127,8 +248,7 @@ class ConnectionManger {
 
   Connection *add(int fd, std::unique_ptr<Connection> sptr) {
     std::lock_guard lock(conn_mutex_);
-    auto it = conn_.find(fd);
-    if (it == conn_.end()) return nullptr;
+    if (conn_.count(fd)) return nullptr;
 
     auto ptr = sptr.get();
     conn_.emplace(fd, std::move(sptr));
@@ -29,6 +29,15 @@ class HandlerManager {
    */
   HTTPHandler *match(const std::string &pattern, bool use_default = true) const;
 
+  /**
+   * @brief Get the HTTP handler registered with exactly the pattern.
+   * @return return nullptr when the pattern is not registered.
+   */
+  HTTPHandler *find(const std::string &pattern) const {
+    auto it = pattern2handler_.find(pattern);
+    return it == pattern2handler_.end() ? nullptr : it->second.get();
+  }
+
   bool default_handle(HTTPHandler &&handler) {
     default_handler_ = std::make_unique<HTTPHandler>(std::move(handler));
     return true;
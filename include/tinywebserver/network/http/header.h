@@ -14,6 +14,8 @@ class Header : public std::unordered_map<std::string, std::string> {
   inline static const std::string ACCEPT_ENCODING = "Accept-Encoding";
   inline static const std::string CONNECTION = "Connection";
   inline static const std::string TRANSFER_ENCODING = "Transfer-Encoding";
+  inline static const std::string REFERER = "Referer";
+  inline static const std::string USER_AGENT = "User-Agent";
 
   operator std::string() {
     std::stringstream ss;
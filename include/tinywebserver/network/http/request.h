@@ -2,6 +2,7 @@
 #define HTTP_REQUEST_H_
 
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include "tinywebserver/network/http/form.h"
@@ -29,15 +30,20 @@ class Request {
 
   static Request::Method str2Method(const std::string& str);
 
+  /**
+   * @brief Get the name of the method, UNKNOWN is "-".
+   */
+  static std::string_view method2str(Method method);
+
   Method method() const { return method_; }
   void set_method(Method method) { method_ = method; }
 
   std::string protocol() const { return protocol_; }
 
-  std::string version() const { return version_; }
+  const std::string& version() const { return version_; }
   void set_version(const std::string& version) { version_ = version; }
 
-  std::string uri() const { return uri_; }
+  const std::string& uri() const { return uri_; }
   void set_uri(const std::string& uri) { uri_ = uri; }
 
   Header& header() { return header_; }
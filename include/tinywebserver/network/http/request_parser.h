@@ -3,7 +3,9 @@
 #ifndef HTTP_REQUEST_PARSER_H_
 #define HTTP_REQUEST_PARSER_H_
 
+#include <cstdint>
 #include <memory>
+#include <string_view>
 #include <unordered_set>
 
 #include "tinywebserver/network/http/const.h"
@@ -73,11 +75,45 @@ class RequestParser : public Parser {
    * @brief consume data from Linux file descriptor
    * @param fd socket file descriptor, should be set with O_NONBLOCK
    * @param is_et whether fd is in the edge triger mode.
+   * @param max_read The most bytes to read, an edge triggered fd that has more
+   * is not drained.
    * @return The state of parser and Request object. If parsing is not complete,
    * the Requst object will be nullptr
    */
-  std::pair<State, std::unique_ptr<Request>> consume_from_fd(int fd,
-                                                             bool is_et = true);
+  std::pair<State, std::unique_ptr<Request>> consume_from_fd(
+      int fd, bool is_et = true, size_t max_read = SIZE_MAX);
+
+  /**
+   * @brief Consume data that has already been read, such as a chunk of a TCP
+   * stream or a request in memory. A chunk may end anywhere in a request.
+   * @return The same as consume_from_fd(). If the data holds more than one
+   * request, the next one is returned by calling it again with empty data.
+   */
+  std::pair<State, std::unique_ptr<Request>> consume(std::string_view data);
+
+  /**
+   * @brief Get the binlog::read_timestamp() taken when the last
+   * consume_from_fd() finished reading, before it parsed.
+   */
+  uint64_t read_end_timestamp() const { return read_end_; }
+
+  /**
+   * @brief Get the bytes read by the last consume_from_fd().
+   */
+  size_t last_read() const { return last_read_; }
+
+  /**
+   * @brief Whether the last consume_from_fd() read until the fd had no more
+   * data, rather than stopping at max_read or after one read.
+   */
+  bool drained() const { return drained_; }
+
+  /**
+   * @brief Whether there are bytes read but not parsed yet, e.g. the next
+   * request of a pipeline.
+   */
+  bool has_buffered() const { return !buf_.readable_empty(); }
+
   /**
    * @brief Clear the state of parser.
    */
@@ -89,6 +125,12 @@ class RequestParser : public Parser {
   }
 
  protected:
+  /**
+   * @brief Parse the data in buf_ until a request is complete or more data is
+   * needed.
+   */
+  std::pair<State, std::unique_ptr<Request>> parse();
+
   /**
    * @brief Parse the http request line.
    * @return return false if something errors occur.
@@ -106,6 +148,12 @@ class RequestParser : public Parser {
    * @brief The Content-Length in the header
    */
   size_t req_body_size_ = 0;
+
+  uint64_t read_end_ = 0;
+
+  size_t last_read_ = 0;
+
+  bool drained_ = false;
 };
 
 }  // namespace http
@@ -0,0 +1,185 @@
+#ifndef HTTP_REQUEST_TRACE_H_
+#define HTTP_REQUEST_TRACE_H_
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "tinywebserver/log_format.h"
+#include "tinywebserver/network/http/access_log.h"
+#include "tinywebserver/network/http/request.h"
+
+namespace http {
+
+/**
+ * @brief The timestamps of the phase boundaries of the request being served
+ * on a connection, read with binlog::read_timestamp().
+ */
+struct RequestTrace {
+  enum Mark {
+    // epoll_wait() returned the first readable event of the request
+    FIRST_READY,
+    // epoll_wait() returned the event that completed the request
+    READY,
+    READ_START,
+    READ_END,
+    PARSED,
+    MATCHED,
+    HANDLED,
+    RESPONSE_MADE,
+    WRITE_DONE,
+    N_MARKS,
+  };
+
+  void mark(Mark m) { marks[m] = binlog::read_timestamp(); }
+
+  std::array<uint64_t, N_MARKS> marks = {};
+
+  /**
+   * @brief The calls of on_read and on_write for the request.
+   */
+  uint32_t reads = 0;
+  uint32_t writes = 0;
+
+  Request::Method method = Request::Method::UNKNOWN;
+
+  FixedString<128> uri;
+
+  /**
+   * @brief Whether FIRST_READY has been marked.
+   */
+  bool active = false;
+};
+
+/**
+ * @brief The phase breakdown of a request slower than the threshold.
+ */
+struct SlowRequest {
+  enum Phase {
+    // waiting for the rest of a request that came in several reads
+    WAIT,
+    // behind the other events returned by the same epoll_wait()
+    QUEUE,
+    READ,
+    PARSE,
+    MATCH,
+    HANDLER,
+    // building the response from the ResponseWriter
+    RESPONSE,
+    // writev() calls and the EPOLLOUT waits between them
+    WRITE,
+    N_PHASES,
+  };
+
+  static const char *phase_name(size_t phase);
+
+  /**
+   * @brief The wall time when the response was written, in nanoseconds since
+   * the epoch.
+   */
+  int64_t time_ns = 0;
+
+  int fd = -1;
+
+  uint32_t reads = 0;
+  uint32_t writes = 0;
+
+  Request::Method method = Request::Method::UNKNOWN;
+
+  FixedString<128> uri;
+
+  int64_t total_ns = 0;
+
+  std::array<int64_t, N_PHASES> phase_ns = {};
+};
+
+/**
+ * @brief Keep the phase breakdown of the last requests slower than a
+ * threshold. Checking a request is a subtraction and a compare of timestamp
+ * counts, only the slow ones take the lock.
+ */
+class SlowRequestLog {
+ public:
+  /**
+   * @param capacity The number of slow requests kept, older ones are
+   * overwritten.
+   */
+  explicit SlowRequestLog(size_t capacity = 256)
+      : ring_(capacity == 0 ? 1 : capacity) {}
+
+  SlowRequestLog(const SlowRequestLog &) = delete;
+
+  SlowRequestLog &operator=(const SlowRequestLog &) = delete;
+
+  /**
+   * @brief Set the threshold, zero disables tracing. The first nonzero
+   * threshold calibrates the timestamp counter, which takes a few
+   * milliseconds.
+   */
+  void set_threshold(std::chrono::nanoseconds threshold);
+
+  std::chrono::nanoseconds get_threshold() const;
+
+  bool enabled() const {
+    return threshold_ticks_.load(std::memory_order_relaxed) != 0;
+  }
+
+  /**
+   * @brief Check the trace of a written response and keep it if it is slow.
+   * @return Return true if it is kept.
+   */
+  bool finish(const RequestTrace &trace, int fd);
+
+  /**
+   * @brief Get the kept requests from the oldest to the newest.
+   */
+  std::vector<SlowRequest> snapshot() const;
+
+  /**
+   * @brief Append one line per kept request to out.
+   */
+  void dump(std::string &out) const;
+
+  /**
+   * @brief Get the number of slow requests seen, including the overwritten
+   * ones.
+   */
+  size_t get_count() const;
+
+  void clear();
+
+ protected:
+  /**
+   * @brief Measure the nanoseconds per timestamp count against the steady
+   * clock.
+   */
+  static double calibrate();
+
+  /**
+   * @brief The threshold in timestamp counts, read by the event loop without
+   * the lock.
+   */
+  std::atomic<uint64_t> threshold_ticks_ = 0;
+
+  mutable std::mutex mutex_;
+
+  std::chrono::nanoseconds threshold_ = {};
+
+  double ns_per_tick_ = 0;
+
+  std::vector<SlowRequest> ring_;
+
+  /**
+   * @brief The total number of kept requests, guarded by mutex_. The next one
+   * is written at count_ % ring_.size().
+   */
+  size_t count_ = 0;
+};
+
+}  // namespace http
+
+#endif
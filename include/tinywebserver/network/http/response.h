@@ -90,6 +90,14 @@ class Response {
       {StatusCode::FORBIDDEN, "FORBIDDEN"},
       {StatusCode::NOT_FOUND, "NOT_FOUND"}};
 
+  /**
+   * @brief Get the reason phrase of the status code.
+   */
+  static std::string status_desc(int status) {
+    auto it = CodeToStatus.find(status);
+    return it == CodeToStatus.end() ? "UNKNOWN" : it->second;
+  }
+
   std::string version() { return version_; }
   void set_version(const std::string& version) { version_ = version; }
 
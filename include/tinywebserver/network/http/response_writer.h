@@ -67,6 +67,11 @@ class ResponseWriter {
     buf_.write(buffer, size, std::move(deleter), readonly);
   }
 
+  /**
+   * @brief Get the size of the body written so far.
+   */
+  size_t body_size() const { return buf_.readable_size(); }
+
   void clear() {
     resp_.clear();
     buf_.clear();
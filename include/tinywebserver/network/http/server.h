@@ -3,29 +3,97 @@
 #ifndef HTTP_SERVER_
 #define HTTP_SERVER_
 
+#include <netinet/in.h>
 #include <sys/socket.h>
 
 #include <atomic>
 #include <cstdint>
+#include <memory>
 #include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
 
-#include "tinywebserver/network/epoller.h"
+#include "tinywebserver/metrics.h"
+#include "tinywebserver/network/http/access_log.h"
 #include "tinywebserver/network/http/connection.h"
 #include "tinywebserver/network/http/handler.h"
 #include "tinywebserver/network/http/request_parser.h"
+#include "tinywebserver/network/http/request_trace.h"
 #include "tinywebserver/network/http/response_writer.h"
+#include "tinywebserver/network/local_epoller.h"
 #include "tinywebserver/pool/thread_pool.hpp"
 #include "tinywebserver/timer.hpp"
+#include "tinywebserver/utils/cpu.h"
+#include "tinywebserver/utils/spsc_ring.hpp"
 
 namespace http {
 
 class Server {
  public:
-  Server() = default;
-  ~Server() {
-    if (listen_fd_ != -1) close(listen_fd_);
+  /**
+   * @brief The options of the listening socket and the acceptor.
+   */
+  struct ListenOptions {
+    /**
+     * @brief The backlog of listen(), it is capped by net.core.somaxconn.
+     */
+    int backlog = SOMAXCONN;
+
+    /**
+     * @brief The most connections accepted in a wakeup of the event loop, so
+     * a connection storm can't starve the established connections. The rest
+     * are accepted in the next rounds.
+     */
+    int accept_budget = 64;
+
+    /**
+     * @brief TCP_DEFER_ACCEPT in seconds, a connection is only accepted after
+     * its first data arrives. 0 disables it.
+     */
+    int defer_accept = 0;
+
+    /**
+     * @brief The queue length of TCP_FASTOPEN, the clients that have
+     * connected before may send the request with the SYN. 0 disables it.
+     */
+    int fastopen_queue = 0;
+
+    /**
+     * @brief Give every event loop of set_event_loops() its own SO_REUSEPORT
+     * listener, so the loops accept by themselves. A connection is steered
+     * to the listener of the loop pinned to the CPU that receives it, or by
+     * the kernel's hash if the steering program can't be attached.
+     */
+    bool reuse_port = false;
+  };
+
+  /**
+   * @brief How the acceptor thread picks the event loop of a connection.
+   */
+  enum class Balance {
+    // the fewest open connections
+    LEAST_CONNECTIONS,
+    // the shortest time to handle the ready events of a wakeup, on average
+    LEAST_LATENCY,
+  };
+
+  /**
+   * @brief The most requests served for a connection in a readiness event.
+   */
+  static const int default_event_requests = 64;
+
+  /**
+   * @brief The most bytes read from a connection in a readiness event.
+   */
+  static const size_t default_event_bytes = 256 * 1024;
+
+  Server() {
+    loops_.push_back(std::make_unique<EventLoop>());
+    register_metrics();
   }
 
+
   /**
    * @brief Register the HTTP handler.
    */
@@ -35,73 +103,390 @@ class Server {
 
   bool listen(uint16_t port, const std::string address);
 
+  /**
+   * @brief Set the options of the listening socket. It should be called
+   * before listen().
+   */
+  bool set_listen_options(const ListenOptions &options) {
+    if (running_ || options.backlog <= 0 || options.accept_budget <= 0)
+      return false;
+    listen_options_ = options;
+    return true;
+  }
+
+  /**
+   * @brief Set how much of a connection is served in a readiness event, so a
+   * client that pipelines many requests can't starve the others. The rest is
+   * served after the other ready connections. It should be called before
+   * start().
+   * @param requests The most requests parsed and answered.
+   * @param bytes The most bytes read.
+   */
+  bool set_event_budget(int requests, size_t bytes) {
+    if (running_ || requests <= 0 || bytes == 0) return false;
+    event_requests_ = requests;
+    event_bytes_ = bytes;
+    return true;
+  }
+
   /*
    * @brief main thread loop for waiting for epoller
    */
   void start();
 
-  bool stop() {
-    if (running_ == false) return false;
-    running_ = true;
+  /**
+   * @brief Stop the event loops, it may be called by any thread.
+   */
+  bool stop();
+
+  /**
+   * @brief Serve the connections on n event loop threads, each with its own
+   * epoll, while the thread that calls start() only accepts and hands every
+   * connection to the loop picked by balance. 0 accepts and serves on the
+   * thread of start(), which is the default. It should be called before
+   * listen().
+   * @return Return false and keep the loops as they are if the wakeup eventfd
+   * of a loop can't be created.
+   */
+  bool set_event_loops(size_t n, Balance balance = Balance::LEAST_CONNECTIONS);
+
+  /**
+   * @brief Whether the SO_REUSEPORT listeners pick the event loop by the CPU
+   * that receives the connection, rather than by the kernel's hash.
+   */
+  bool reuse_port_steered() const { return steered_; }
+
+  /**
+   * @brief Pin the event loop and the workers of the thread pool to CPUs.
+   * Pinned threads allocate their buffers on the local NUMA node. It should be
+   * called before listen().
+   * @param reactor_cpus CPUs for the thread of start(). The first one is also
+   * set as SO_INCOMING_CPU of the listening socket. The event loop threads of
+   * set_event_loops() take one CPU each in turn, starting from the second.
+   * @param worker_cpus CPUs for the workers, one CPU per worker in turn.
+   * @return Return false and change nothing if the process may not run on
+   * some of the CPUs.
+   */
+  bool set_cpu_affinity(std::vector<int> reactor_cpus,
+                        std::vector<int> worker_cpus) {
+    if (running_ || (!reactor_cpus.empty() && !cpus_allowed(reactor_cpus)))
+      return false;
+    if (!threadpool_.set_cpu_affinity(std::move(worker_cpus))) return false;
+    reactor_cpus_ = std::move(reactor_cpus);
+    return true;
+  }
+
+  /**
+   * @brief Get the access log. It is written when it is opened before
+   * start().
+   */
+  AccessLog &access_log() { return access_log_; }
+
+  metrics::MetricsRegistry &metrics() { return metrics_; }
+
+  /**
+   * @brief Serve the metrics in the Prometheus text format at the pattern.
+   */
+  bool handle_metrics(const std::string &pattern = "/metrics");
+
+  /**
+   * @brief The requests slower than the threshold set on it, from the first
+   * readable event to the last byte of the response.
+   */
+  SlowRequestLog &slow_requests() { return slow_requests_; }
+
+  /**
+   * @brief Serve the phase breakdown of the kept slow requests at the pattern.
+   */
+  bool handle_slow_requests(const std::string &pattern = "/debug/slow");
+
+  /**
+   * @brief Enable or disable the access log of the handler registered with
+   * the pattern. It is enabled by default.
+   * @return Return false if no handler is registered with the pattern.
+   */
+  bool set_access_log(const std::string &pattern, bool enabled) {
+    auto handler = handler_mgr_.find(pattern);
+    if (handler == nullptr) return false;
+    if (enabled)
+      access_log_disabled_.erase(handler);
+    else
+      access_log_disabled_.insert(handler);
     return true;
   }
 
   /**
    * @brief Set the triger mode of listen fd and client fd.
    * @param is_listen_et Whether listen fd uses edge triger
-   * @param is_client_et Whether client fd uses edge triger
+   * @param is_client_et Whether client fd uses edge triger. An edge triggered
+   * client fd is registered once for EPOLLIN and EPOLLOUT, a level triggered
+   * one uses EPOLLONESHOT and is re-armed after every read and write.
    */
   void set_triger_mode(bool is_listen_et = true, bool is_client_et = true) {
     listen_fd_event_ = EPOLLRDHUP;
-    client_event_ = EPOLLONESHOT | EPOLLRDHUP;
+    client_event_ = EPOLLRDHUP;
     if (is_listen_et) listen_fd_event_ |= EPOLLET;
-    if (is_client_et) client_event_ |= EPOLLET;
+    if (is_client_et)
+      client_event_ |= EPOLLET;
+    else
+      client_event_ |= EPOLLONESHOT;
   }
 
  protected:
-  void acceptor();
+  /**
+   * @brief An accepted connection on its way to an event loop.
+   */
+  struct Handoff {
+    int fd;
+    sockaddr_in addr;
+  };
 
-  void close_client(int client_fd);
+  /**
+   * @brief An epoll and the connections on it, served by one thread.
+   */
+  struct EventLoop {
+    EventLoop();
 
-  /*
-   * @brief handle EPOLLIN event
+    ~EventLoop();
+
+    /**
+     * @brief The operation of Linux epoll api, only used by the loop's thread
+     * once it runs.
+     */
+    LocalEpoller epoller;
+
+    ConnectionManger conn_mgr;
+
+    /**
+     * @brief The listener whose connections the loop accepts, -1 if it has
+     * none.
+     */
+    int listen_fd = -1;
+
+    /**
+     * @brief Whether the acceptor used up its budget with an edge triggered
+     * listen fd, so the rest have to be accepted without a new event.
+     */
+    bool accept_pending = false;
+
+    /**
+     * @brief An eventfd to wake the loop for the connections handed to it and
+     * for stop().
+     */
+    int wake_fd = -1;
+
+    /**
+     * @brief Whether wake_fd has been written since the loop last took the
+     * handoffs, so a burst of connections costs one write().
+     */
+    std::atomic<bool> notified = false;
+
+    /**
+     * @brief The connections that used up their budget in a readiness event,
+     * served again after the next events. An entry is nullptr once its
+     * connection is closed.
+     */
+    std::vector<Connection *> deferred;
+
+    /**
+     * @brief The connections from the acceptor thread.
+     */
+    SpscRing<Handoff> handoffs{4096};
+
+    /**
+     * @brief The open connections, counted from the hand-off.
+     */
+    std::atomic<int> connections = 0;
+
+    /**
+     * @brief The moving average of the time to handle the ready events of a
+     * wakeup.
+     */
+    std::atomic<uint64_t> latency_ns = 0;
+
+    /**
+     * @brief Whether slow_requests_ was enabled when the loop woke up.
+     */
+    bool tracing = false;
+
+    /**
+     * @brief The binlog::read_timestamp() when epoll_wait() returned.
+     */
+    uint64_t loop_timestamp = 0;
+
+    /**
+     * @brief The ring of the loop in access_log_, nullptr if the access log
+     * is not written.
+     */
+    AccessLog::Producer *access_producer = nullptr;
+
+    std::thread thread;
+  };
+
+  /**
+   * @brief Wait for and handle the events of the loop until stop().
    */
-  void on_read(Connection *conn);
+  void run(EventLoop &loop);
 
-  /*
-   * @brief handle EPOLLOUT event
+  /**
+   * @brief Accept the connections of the loop's listener, the loop serves
+   * them or hands them off.
+   */
+  void acceptor(EventLoop &loop);
+
+  /**
+   * @brief Create, bind and listen a socket by listen_options_.
+   * @param cpu Set as SO_INCOMING_CPU if it is not -1.
+   * @return The listen fd, or -1 on failure.
+   */
+  int open_listener(const sockaddr_in &addr, int cpu);
+
+  /**
+   * @brief Attach a classic BPF program to the SO_REUSEPORT group of the
+   * listeners, it picks the listener of the loop pinned to the receiving CPU.
+   */
+  bool attach_steering();
+
+  void close_listeners();
+
+  /**
+   * @brief The CPU that loops_[i] is pinned to, -1 if it is not pinned.
+   */
+  int loop_cpu(size_t i) const;
+
+  /**
+   * @brief Pick a loop by balance_ and pass the connection to it.
+   */
+  void hand_off(int fd, const sockaddr_in &addr);
+
+  /**
+   * @brief Take the connections handed to the loop.
+   */
+  void on_wake(EventLoop &loop);
+
+  /**
+   * @brief Put a new connection on the loop.
+   */
+  void add_client(EventLoop &loop, int fd, const sockaddr_in &addr);
+
+  void register_metrics();
+
+  void close_client(EventLoop &loop, int client_fd);
+
+  /**
+   * @brief What a step of serving a connection leaves it waiting for.
+   */
+  enum class Step {
+    // go on serving it
+    DONE,
+    // an event, a level triggered fd has been re-armed for it
+    WAIT,
+    // the loop, as it used up its budget
+    AGAIN,
+    // nothing, it has been closed
+    CLOSED,
+  };
+
+  /**
+   * @brief Handle the events of a client fd, the state of the connection
+   * decides whether to read or write.
+   */
+  void on_ready(EventLoop &loop, Connection *conn, uint32_t events);
+
+  /**
+   * @brief Answer the requests of the connection in turn, until it has to
+   * wait for an event or has used up the budget of a readiness event.
+   */
+  void serve(EventLoop &loop, Connection *conn);
+
+  /**
+   * @brief Serve the connection again after the other ready connections.
+   */
+  void defer(EventLoop &loop, Connection *conn);
+
+  /**
+   * @brief Parse a request and make its response.
+   * @param read_budget The most bytes to read, reduced by the bytes read.
+   * @return DONE if the response is to be written now.
+   */
+  Step on_read(EventLoop &loop, Connection *conn, size_t &read_budget);
+
+  /**
+   * @brief Write the response.
+   * @return DONE if it is written and the connection is kept alive.
    */
-  void on_write(Connection *conn);
+  Step on_write(EventLoop &loop, Connection *conn);
 
   /**
-   * @brief Listening file descriptor
+   * @brief Capture the fields of the access log record known when the
+   * request is answered, if the request is logged.
+   * @param req nullptr if the request couldn't be parsed.
+   * @param parsed When the request was parsed.
+   * @return The record of the connection, or nullptr if it isn't logged.
    */
-  int listen_fd_ = -1;
+  AccessRecord *begin_access_log(EventLoop &loop, Connection *conn,
+                                 const HTTPHandler *handler,
+                                 const Request *req,
+                                 std::chrono::steady_clock::time_point parsed);
 
   /**
-   * @brief The operation of Linux epoll api
+   * @brief Log a request rejected by closing the connection without a
+   * response.
    */
-  Epoller epoller_;
+  void log_rejected(EventLoop &loop, Connection *conn, const Request *req,
+                    uint16_t status,
+                    std::chrono::steady_clock::time_point parsed);
+
+  /**
+   * @brief loops_[0] runs on the thread of start() and accepts, the others
+   * have their own threads and serve the connections handed to them. A
+   * single loop does both. With ListenOptions::reuse_port, the others accept
+   * from their own listeners and loops_[0] only waits for stop().
+   */
+  std::vector<std::unique_ptr<EventLoop>> loops_;
+
+  Balance balance_ = Balance::LEAST_CONNECTIONS;
 
   /**
-   * @brief The listening event of listen_fd_
+   * @brief Where hand_off() starts looking, so equally loaded loops take
+   * turns.
+   */
+  size_t next_loop_ = 0;
+
+  /**
+   * @brief The listening event of the listen fds
    */
   uint32_t listen_fd_event_ = EPOLLRDHUP;
 
   /**
-   * @brief The listening event of client fd
+   * @brief The listening event of client fd, EPOLLIN and EPOLLOUT are added
+   * as needed.
+   */
+  uint32_t client_event_ = EPOLLET | EPOLLRDHUP;
+
+  ListenOptions listen_options_;
+
+  int event_requests_ = default_event_requests;
+
+  size_t event_bytes_ = default_event_bytes;
+
+  /**
+   * @brief Whether attach_steering() has succeeded for the listeners.
    */
-  uint32_t client_event_ = EPOLLONESHOT | EPOLLRDHUP;
+  bool steered_ = false;
 
   std::atomic<bool> running_ = {false};
 
+  /**
+   * @brief The CPUs that the event loop thread is pinned to.
+   */
+  std::vector<int> reactor_cpus_;
+
   /**
    * @brief HTTP Handler Manager
    */
   HandlerManager handler_mgr_;
 
-  ConnectionManger conn_mgr_;
-
   /**
    * @brief Thread pool
    */
@@ -111,6 +496,34 @@ class Server {
    * @brief Timer
    */
   Timer<int> timer_;
+
+  AccessLog access_log_;
+
+  metrics::MetricsRegistry metrics_;
+
+  SlowRequestLog slow_requests_;
+
+  /**
+   * @brief The metrics recorded by the event loops, owned by metrics_.
+   */
+  struct {
+    metrics::Counter *accepted;
+    metrics::Counter *handoff_dropped;
+    metrics::Counter *accept_budget_exhausted;
+    metrics::Counter *event_budget_exhausted;
+    metrics::Counter *closed;
+    metrics::Counter *requests;
+    metrics::Counter *bad_requests;
+    metrics::Counter *response_bytes;
+    metrics::Histogram *parse;
+    metrics::Histogram *handler;
+    metrics::Histogram *write;
+  } metric_ = {};
+
+  /**
+   * @brief The handlers whose requests are not logged.
+   */
+  std::unordered_set<const HTTPHandler *> access_log_disabled_;
 };
 
 }  // namespace http
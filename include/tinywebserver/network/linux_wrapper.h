@@ -7,7 +7,7 @@
 
 inline int set_fd_nonblock(int fd) {
   assert(fd > 0);
-  return fcntl(fd, F_SETFL, fcntl(fd, F_GETFD, 0) | O_NONBLOCK);
+  return fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
 }
 
 #endif
\ No newline at end of file
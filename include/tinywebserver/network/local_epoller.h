@@ -0,0 +1,228 @@
+#ifndef LOCAL_EPOLLER_H_
+#define LOCAL_EPOLLER_H_
+
+#include <errno.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief A wrapper of Linux epoll owned by one thread, like the epoll of an
+ * event loop. Unlike Epoller it takes no lock, and its ready event buffer
+ * grows when epoll_wait() keeps filling it and shrinks when it stays mostly
+ * empty.
+ * @note Only size() and capacity() may be called by the other threads.
+ */
+class LocalEpoller {
+ public:
+  static const int default_min_capacity = 64;
+
+  static const int default_max_capacity = 1024 * 64;
+
+  /**
+   * @brief The buffer doubles after this many full batches in a row.
+   */
+  static const int grow_after = 2;
+
+  /**
+   * @brief The buffer halves after this many waits that returned at most a
+   * quarter of it.
+   */
+  static const int shrink_after = 1024;
+
+  /**
+   * @param min_capacity The size of the ready event buffer at the beginning
+   * and after shrinking.
+   * @param max_capacity The size the buffer grows up to.
+   */
+  explicit LocalEpoller(int min_capacity = default_min_capacity,
+                        int max_capacity = default_max_capacity)
+      : min_cap_(std::max(1, min_capacity)),
+        max_cap_(std::max(min_cap_, max_capacity)),
+        cap_(min_cap_),
+        events_(min_cap_) {
+    epfd_ = epoll_create1(EPOLL_CLOEXEC);
+  }
+
+  LocalEpoller(const LocalEpoller &) = delete;
+
+  LocalEpoller &operator=(const LocalEpoller &) = delete;
+
+  ~LocalEpoller() { this->close(); }
+
+  void close() {
+    if (epfd_ != -1) ::close(epfd_);
+    epfd_ = -1;
+  }
+
+  /**
+   * @brief Add fd to the epoll tree
+   */
+  bool add(int fd, epoll_event event) {
+    if (fd < 0) return false;
+    if (epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &event) != 0) return false;
+    n_fd_.store(n_fd_.load(std::memory_order_relaxed) + 1,
+                std::memory_order_relaxed);
+    return true;
+  }
+
+  /**
+   * @brief Modify listening event on the epoll tree
+   */
+  bool mod(int fd, epoll_event event) {
+    if (fd < 0) return false;
+    return epoll_ctl(epfd_, EPOLL_CTL_MOD, fd, &event) == 0;
+  }
+
+  /**
+   * @brief Remove the fd from the epoll tree
+   */
+  bool del(int fd) {
+    if (fd < 0) return false;
+    if (epoll_ctl(epfd_, EPOLL_CTL_DEL, fd, nullptr) != 0) return false;
+    n_fd_.store(n_fd_.load(std::memory_order_relaxed) - 1,
+                std::memory_order_relaxed);
+    return true;
+  }
+
+  /**
+   * @brief Epoll wait.
+   * @param timeout In milliseconds, -1 waits until an event.
+   * @return The number of ready events, they are valid until the next wait.
+   */
+  int wait(int timeout = -1) {
+    adapt();
+    int n = epoll_wait(epfd_, events_.data(), events_.size(), timeout);
+    record(n);
+    return n;
+  }
+
+  /**
+   * @brief Epoll wait with a timeout finer than a millisecond, by
+   * epoll_pwait2(). It falls back to epoll_wait() with the timeout rounded
+   * up to milliseconds on the kernels before 5.11.
+   * @param timeout A negative one waits until an event.
+   */
+  int wait(std::chrono::nanoseconds timeout) {
+    if (timeout < std::chrono::nanoseconds(0)) return wait(-1);
+#ifdef SYS_epoll_pwait2
+    if (has_pwait2_) {
+      adapt();
+      auto secs = std::chrono::duration_cast<std::chrono::seconds>(timeout);
+      timespec ts = {.tv_sec = time_t(secs.count()),
+                     .tv_nsec = long((timeout - secs).count())};
+      int n = syscall(SYS_epoll_pwait2, epfd_, events_.data(),
+                      int(events_.size()), &ts, nullptr, _NSIG / 8);
+      if (n != -1 || errno != ENOSYS) {
+        record(n);
+        return n;
+      }
+      has_pwait2_ = false;
+    }
+#endif
+    auto ms = std::chrono::ceil<std::chrono::milliseconds>(timeout);
+    return wait(int(std::min<int64_t>(ms.count(), INT32_MAX)));
+  }
+
+  /**
+   * @brief Get the ready event fd by index. Please check the index by yourself.
+   */
+  const epoll_event &operator[](int i) const { return events_[i]; }
+
+  epoll_event &operator[](int i) { return events_[i]; }
+
+  /**
+   * @brief Get the number of fd on the epoll tree.
+   */
+  int size() const { return n_fd_.load(std::memory_order_relaxed); }
+
+  /**
+   * @brief Get the size of the ready event buffer.
+   */
+  int capacity() const { return cap_.load(std::memory_order_relaxed); }
+
+  void clear() {
+    this->close();
+    epfd_ = epoll_create1(EPOLL_CLOEXEC);
+    n_fd_.store(0, std::memory_order_relaxed);
+  }
+
+ protected:
+  /**
+   * @brief Count the full and the mostly empty batches.
+   */
+  void record(int n) {
+    // a failed wait, such as EINTR, says nothing about the load
+    if (n < 0) return;
+    int cap = events_.size();
+    full_streak_ = n == cap ? full_streak_ + 1 : 0;
+    sparse_streak_ = n <= cap / 4 ? sparse_streak_ + 1 : 0;
+  }
+
+  /**
+   * @brief Resize the buffer before a wait, so the events of the last wait
+   * stay valid until then.
+   */
+  void adapt() {
+    int cap = events_.size();
+    if (full_streak_ >= grow_after && cap < max_cap_) {
+      events_.resize(std::min(cap * 2, max_cap_));
+    } else if (sparse_streak_ >= shrink_after && cap > min_cap_) {
+      events_.resize(std::max(cap / 2, min_cap_));
+      events_.shrink_to_fit();
+    } else {
+      return;
+    }
+    full_streak_ = sparse_streak_ = 0;
+    cap_.store(events_.size(), std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Descriptor for epoll
+   */
+  int epfd_;
+
+  /**
+   * @brief Number of fd on the epoll tree, only the owner writes it.
+   */
+  std::atomic<int> n_fd_ = 0;
+
+  int min_cap_;
+
+  int max_cap_;
+
+  /**
+   * @brief The size of events_, for the other threads.
+   */
+  std::atomic<int> cap_;
+
+  /**
+   * @brief The waits in a row that filled the buffer.
+   */
+  int full_streak_ = 0;
+
+  /**
+   * @brief The waits in a row that returned at most a quarter of the buffer.
+   */
+  int sparse_streak_ = 0;
+
+  /**
+   * @brief Whether the kernel has epoll_pwait2().
+   */
+  bool has_pwait2_ = true;
+
+  /**
+   * @brief buffer for storing ready events
+   */
+  std::vector<epoll_event> events_;
+};
+
+#endif
@@ -0,0 +1,482 @@
+#ifndef LOCKFREE_RESOURCE_POOL_H_
+#define LOCKFREE_RESOURCE_POOL_H_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <utility>
+
+/**
+ * @brief A lock-free variant of ResourcePool. Every thread caches two
+ * magazines (small stacks of resources), so checkout and return only touch
+ * thread-local memory in the common case. Full and empty magazines are
+ * exchanged with a depot which consists of two Treiber stacks.
+ * @ref Bonwick J, Adams J. Magazines and Vmem: Extending the Slab Allocator to
+ * Many CPUs and Arbitrary Resources. USENIX 2001.
+ * @tparam magazine_size The number of resources that one magazine can hold.
+ */
+template <typename Resource, size_t magazine_size = 16>
+class LockFreeResourcePool {
+ public:
+  using clock = std::chrono::steady_clock;
+
+  /**
+   * @brief A move-only RAII handle of a resource. The resource is returned to
+   * the pool when the handle is destroyed.
+   */
+  class Handle {
+    friend LockFreeResourcePool;
+
+   public:
+    Handle() = default;
+
+    Handle(const Handle &) = delete;
+
+    Handle(Handle &&obj) : pool_(obj.pool_), ptr_(obj.ptr_) {
+      obj.pool_ = nullptr;
+      obj.ptr_ = nullptr;
+    }
+
+    Handle &operator=(const Handle &) = delete;
+
+    Handle &operator=(Handle &&obj) {
+      if (this == &obj) return *this;
+      reset();
+      std::swap(pool_, obj.pool_);
+      std::swap(ptr_, obj.ptr_);
+      return *this;
+    }
+
+    ~Handle() { reset(); }
+
+    /**
+     * @brief Return the resource to the pool in advance.
+     */
+    void reset() {
+      if (ptr_ != nullptr) pool_->recycle(ptr_);
+      pool_ = nullptr;
+      ptr_ = nullptr;
+    }
+
+    Resource *get() const { return ptr_; }
+
+    Resource &operator*() const { return *ptr_; }
+
+    Resource *operator->() const { return ptr_; }
+
+    explicit operator bool() const { return ptr_ != nullptr; }
+
+   protected:
+    Handle(LockFreeResourcePool *pool, Resource *ptr)
+        : pool_(ptr == nullptr ? nullptr : pool), ptr_(ptr) {}
+
+    LockFreeResourcePool *pool_ = nullptr;
+
+    Resource *ptr_ = nullptr;
+  };
+
+ protected:
+  struct Magazine {
+    /**
+     * @brief The next magazine in the depot stack.
+     */
+    std::atomic<Magazine *> next = nullptr;
+
+    /**
+     * @brief The next magazine in the list of all the allocated magazines.
+     */
+    Magazine *all_next = nullptr;
+
+    size_t count = 0;
+
+    Resource *res[magazine_size];
+
+    bool empty() const { return count == 0; }
+
+    bool full() const { return count == magazine_size; }
+  };
+
+  /**
+   * @brief A Treiber stack of magazines. Magazines are never freed before the
+   * pool, so a popping thread can always read the next pointer safely. To
+   * avoid the ABA problem, a 16-bit tag is packed into the unused upper bits
+   * of the head pointer (user space addresses on x86-64 and AArch64 fit in 48
+   * bits).
+   */
+  class MagazineStack {
+    static_assert(sizeof(uintptr_t) == 8, "64-bit platform required");
+
+   public:
+    void push(Magazine *mag) {
+      auto head = head_.load(std::memory_order_relaxed);
+      do {
+        mag->next.store(unpack(head), std::memory_order_relaxed);
+      } while (!head_.compare_exchange_weak(head, pack(mag, tag(head) + 1),
+                                            std::memory_order_release,
+                                            std::memory_order_relaxed));
+    }
+
+    Magazine *pop() {
+      auto head = head_.load(std::memory_order_acquire);
+      for (;;) {
+        auto mag = unpack(head);
+        if (mag == nullptr) return nullptr;
+        auto next = mag->next.load(std::memory_order_relaxed);
+        if (head_.compare_exchange_weak(head, pack(next, tag(head) + 1),
+                                        std::memory_order_acquire,
+                                        std::memory_order_acquire))
+          return mag;
+      }
+    }
+
+   protected:
+    static constexpr int tag_shift_ = 48;
+
+    static constexpr uintptr_t ptr_mask_ = (uintptr_t(1) << tag_shift_) - 1;
+
+    static Magazine *unpack(uintptr_t head) {
+      return reinterpret_cast<Magazine *>(head & ptr_mask_);
+    }
+
+    static uintptr_t tag(uintptr_t head) { return head >> tag_shift_; }
+
+    static uintptr_t pack(Magazine *mag, uintptr_t tag) {
+      return reinterpret_cast<uintptr_t>(mag) | (tag << tag_shift_);
+    }
+
+    std::atomic<uintptr_t> head_ = 0;
+  };
+
+  /**
+   * @brief The magazines cached by one thread.
+   */
+  struct LocalCache {
+    Magazine *loaded = nullptr;
+    Magazine *previous = nullptr;
+
+    /**
+     * @brief Give the cached magazines back to the depot when the thread
+     * exits.
+     */
+    ~LocalCache() {
+      if (auto pool = instance_.load(std::memory_order_acquire))
+        pool->flush(*this);
+    }
+  };
+
+ private:
+  /**
+   * @brief Constuct the resource pool.
+   * @param alloc_count The number of resources allocated at one time when the
+   * resource pool is empty. It is capped at magazine_size.
+   * @param max_count The maximum number of resources that can be allocated.
+   * @param alloc Function to allocate the resources.
+   * @param deleter Function to free the resources.
+   */
+  LockFreeResourcePool(size_t alloc_count, size_t max_count,
+                       std::function<Resource *()> &&alloc,
+                       std::function<void(Resource *)> &&deleter)
+      : alloc_count_(std::min(alloc_count, magazine_size)),
+        max_count_(max_count),
+        alloc_(std::move(alloc)),
+        deleter_(std::move(deleter)) {
+    instance_.store(this, std::memory_order_release);
+  }
+  LockFreeResourcePool(const LockFreeResourcePool &) = delete;
+  LockFreeResourcePool(LockFreeResourcePool &&) = delete;
+  LockFreeResourcePool &operator=(const LockFreeResourcePool &) = delete;
+  LockFreeResourcePool &operator=(LockFreeResourcePool &&) = delete;
+
+  /**
+   * @brief The implementation of get_instance()
+   */
+  static LockFreeResourcePool &get_instance_impl(
+      size_t alloc_count, size_t max_count, std::function<Resource *()> &&alloc,
+      std::function<void(Resource *)> &&deleter) {
+    static LockFreeResourcePool instance(alloc_count, max_count,
+                                         std::move(alloc), std::move(deleter));
+    return instance;
+  }
+
+ public:
+  /**
+   * @brief Init the instance
+   * @param alloc_count The number of resources allocated at one time when the
+   * resource pool is empty and the total number after allocation will not
+   * exceed max_count.
+   * @param max_count The maximum number of resources that can be allocated.
+   * @param alloc Function to allocate the resources.
+   * @param deleter Function to free the resources.
+   */
+  static bool init(size_t alloc_count, size_t max_count,
+                   std::function<Resource *()> &&alloc,
+                   std::function<void(Resource *)> &&deleter) {
+    if (alloc_count == 0 || max_count == 0 || alloc == nullptr ||
+        deleter == nullptr)
+      return false;
+    get_instance_impl(alloc_count, max_count, std::move(alloc),
+                      std::move(deleter));
+    return true;
+  }
+
+  /**
+   * @brief A factory method to get the instance of LockFreeResourcePool. The
+   * default values are the same as ResourcePool::get_instance().
+   */
+  static LockFreeResourcePool &get_instance() {
+    return get_instance_impl(
+        8, 64, []() { return new Resource; },
+        [](Resource *ptr) { delete ptr; });
+  }
+
+  /**
+   * @brief Destroy all the resources. Resources that are still checked out
+   * must not be returned afterwards.
+   */
+  ~LockFreeResourcePool() {
+    instance_.store(nullptr, std::memory_order_release);
+    for (auto mag = all_.load(std::memory_order_acquire); mag != nullptr;) {
+      for (size_t i = 0; i < mag->count; ++i) deleter_(mag->res[i]);
+      auto next = mag->all_next;
+      delete mag;
+      mag = next;
+    }
+  }
+
+  /**
+   * @brief Get the number of total resources that haved allocated.
+   */
+  size_t get_total_resource_count() const {
+    return total_count_.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Get the maximum number of resources that can be allocated
+   */
+  size_t get_max_resource_count() const { return max_count_; }
+
+  /**
+   * @brief Get the number of resources allocated at one time.
+   */
+  size_t get_min_resource_count() const { return alloc_count_; }
+
+  /**
+   * @brief Get a resource without blocking.
+   * @return An empty handle if all of the max_count resources are in use.
+   */
+  Handle get() {
+    auto &cache = cache_;
+    if (auto mag = cache.loaded; mag != nullptr && !mag->empty())
+      return Handle(this, mag->res[--mag->count]);
+    return Handle(this, get_slow(cache));
+  }
+
+  /**
+   * @brief Get a resource, waiting at most timeout for another thread to
+   * return one when the pool is exhausted.
+   * @return An empty handle if timeout expires.
+   */
+  template <typename Rep, typename Period>
+  Handle get(std::chrono::duration<Rep, Period> timeout) {
+    if (auto handle = get()) return handle;
+
+    const auto deadline = clock::now() + timeout;
+    waiters_.fetch_add(1);
+    Handle handle;
+    {
+      std::unique_lock lock(wait_mutex_);
+      while (!(handle = get())) {
+        const auto now = clock::now();
+        if (now >= deadline) break;
+        // A returning thread may miss the waiter counter, so the wait is
+        // sliced to poll the depot again.
+        wait_cv_.wait_until(lock, std::min(deadline, now + wait_slice_));
+      }
+    }
+    waiters_.fetch_sub(1);
+    return handle;
+  }
+
+  /**
+   * @brief Give the magazines cached by the calling thread back to the depot.
+   * Threads that go idle should call it on bounded pools, so that other
+   * threads can use the cached resources.
+   */
+  void flush() { flush(cache_); }
+
+ protected:
+  /**
+   * @brief Slow path of get() when the loaded magazine is empty.
+   */
+  Resource *get_slow(LocalCache &cache) {
+    // 1. the previous magazine has resources
+    if (cache.previous != nullptr && !cache.previous->empty()) {
+      std::swap(cache.loaded, cache.previous);
+      return cache.loaded->res[--cache.loaded->count];
+    }
+    // 2. exchange the empty magazine with a full one in the depot
+    if (auto mag = full_.pop(); mag != nullptr) {
+      if (cache.loaded != nullptr) empty_.push(cache.loaded);
+      cache.loaded = mag;
+      return mag->res[--mag->count];
+    }
+    // 3. allocate new resources
+    size_t n = reserve(alloc_count_);
+    if (n == 0) return nullptr;
+    if (cache.loaded == nullptr) cache.loaded = get_empty_magazine();
+    auto mag = cache.loaded;
+    for (size_t i = 0; i < n; ++i) mag->res[mag->count++] = alloc_();
+    return mag->res[--mag->count];
+  }
+
+  /**
+   * @brief Reserve at most n resources from max_count_.
+   * @return The number of resources reserved.
+   */
+  size_t reserve(size_t n) {
+    auto total = total_count_.load(std::memory_order_relaxed);
+    size_t cnt;
+    do {
+      if (total >= max_count_) return 0;
+      cnt = std::min(n, max_count_ - total);
+    } while (!total_count_.compare_exchange_weak(total, total + cnt,
+                                                 std::memory_order_relaxed));
+    return cnt;
+  }
+
+  /**
+   * @brief Recyle the resource into pool.
+   */
+  void recycle(Resource *ptr) {
+    auto &cache = cache_;
+    if (auto mag = cache.loaded; mag != nullptr && !mag->full())
+      mag->res[mag->count++] = ptr;
+    else
+      recycle_slow(cache, ptr);
+
+    if (waiters_.load(std::memory_order_relaxed) > 0) {
+      // hand over the cached resources to the waiting threads
+      flush(cache);
+      std::lock_guard lock(wait_mutex_);
+      wait_cv_.notify_all();
+    }
+  }
+
+  /**
+   * @brief Slow path of recycle() when the loaded magazine is full.
+   */
+  void recycle_slow(LocalCache &cache, Resource *ptr) {
+    if (cache.previous != nullptr && !cache.previous->empty()) {
+      // both are full, move the previous one to the depot
+      full_.push(cache.previous);
+      cache.previous = cache.loaded;
+      cache.loaded = get_empty_magazine();
+    } else {
+      std::swap(cache.loaded, cache.previous);
+      if (cache.loaded == nullptr) cache.loaded = get_empty_magazine();
+    }
+    cache.loaded->res[cache.loaded->count++] = ptr;
+  }
+
+  /**
+   * @brief Move the magazines of cache into the depot.
+   */
+  void flush(LocalCache &cache) {
+    for (auto mag : {cache.loaded, cache.previous}) {
+      if (mag == nullptr) continue;
+      if (mag->empty())
+        empty_.push(mag);
+      else
+        full_.push(mag);
+    }
+    cache.loaded = cache.previous = nullptr;
+  }
+
+  /**
+   * @brief Pop an empty magazine from the depot or allocate a new one.
+   */
+  Magazine *get_empty_magazine() {
+    if (auto mag = empty_.pop(); mag != nullptr) return mag;
+    auto mag = new Magazine;
+    mag->all_next = all_.load(std::memory_order_relaxed);
+    while (!all_.compare_exchange_weak(mag->all_next, mag,
+                                       std::memory_order_release,
+                                       std::memory_order_relaxed))
+      ;
+    return mag;
+  }
+
+  /**
+   * @brief The interval at which a blocked get() polls the depot.
+   */
+  inline static const auto wait_slice_ = std::chrono::milliseconds(1);
+
+  /**
+   * @brief The living instance, it is used by the thread-local caches.
+   */
+  inline static std::atomic<LockFreeResourcePool *> instance_ = nullptr;
+
+  /**
+   * @brief The magazines of the current thread.
+   */
+  inline static thread_local LocalCache cache_;
+
+  /**
+   * @brief The number of resources allocated at one time.
+   */
+  const size_t alloc_count_;
+
+  /**
+   * @brief The maximum number of resources that can be allocated.
+   */
+  const size_t max_count_;
+
+  /**
+   * @brief Function to allocate the resources.
+   */
+  std::function<Resource *()> alloc_;
+
+  /**
+   * @brief Function to free the resources.
+   */
+  std::function<void(Resource *)> deleter_;
+
+  /**
+   * @brief The number of resources that have been allocated.
+   */
+  std::atomic<size_t> total_count_{0};
+
+  /**
+   * @brief Depot of magazines holding at least one resource.
+   */
+  MagazineStack full_;
+
+  /**
+   * @brief Depot of empty magazines.
+   */
+  MagazineStack empty_;
+
+  /**
+   * @brief All the magazines that have been allocated.
+   */
+  std::atomic<Magazine *> all_ = nullptr;
+
+  /**
+   * @brief The number of threads blocked in get(timeout).
+   */
+  std::atomic<size_t> waiters_{0};
+
+  /**
+   * @brief Mutex and condition variable for blocked get(timeout), they are
+   * only used when the pool is exhausted.
+   */
+  std::mutex wait_mutex_;
+
+  std::condition_variable wait_cv_;
+};
+
+#endif
@@ -68,13 +68,6 @@ class MemoryPool {
     return (nbytes + base_ - 1) & ~(base_ - 1);
   }
 
-  /**
-   * @brief Allocates a chunk for n_jobs objects of size nbytes.
-   * n_objs may be reduced if it is unable to allocate the requested
-   * number.
-   */
-  static char *chunk_alloc(std::size_t nbytes, int &n_jobs);
-
   /**
    * @brief Refill the free list that allocates the object with size nbytes.
    * This function will be called when corresponding free list is empty.
@@ -87,13 +80,14 @@ class MemoryPool {
     // time. It may not be possible to apply for so many objects actually.
     int n_objs = 20;
 
-    void *chunk = chunk_alloc(nbytes, n_objs);  // n_objs is pass-by-referene
+    char *chunk = chunk_alloc(nbytes, n_objs);  // n_objs is pass-by-referene
     if (n_objs == 1) return chunk;
     Object *volatile *p_free_list = free_lists_ + get_free_list_index(nbytes);
     auto ret = reinterpret_cast<Object *>(chunk);
 
     // build free list on the chunk and set p_free_list
-    auto p_next_obj = *p_free_list = reinterpret_cast<Object *>(chunk + nbytes);
+    auto p_next_obj = reinterpret_cast<Object *>(chunk + nbytes);
+    *p_free_list = p_next_obj;
     for (int i = 1; true; ++i) {  // i start from 1 to skip the first object
       auto p_current_obj = p_next_obj;
       p_next_obj = reinterpret_cast<Object *>(
@@ -110,6 +104,11 @@ class MemoryPool {
     return ret;
   }
 
+  /**
+   * @brief Allocates a chunk for n_objs objects of size nbytes.
+   * n_objs may be reduced if it is unable to allocate the requested
+   * number.
+   */
   static char *chunk_alloc(size_t nbytes, int &n_objs) {
     char *ret;
     size_t total_bytes = nbytes * n_objs;
@@ -171,6 +170,11 @@ class MemoryPool {
   }
 
  public:
+  /**
+   * @brief Get the number of bytes that the pool has taken from the heap.
+   */
+  static size_t get_heap_size() { return heap_size_; }
+
   /**
    * @brief Allocate the memory.
    * @param nbytes Number of bytes
@@ -190,7 +194,10 @@ class MemoryPool {
   }
   static void deallocate(void *ptr, std::size_t count) {
     // The frist level Allocator
-    if (count > n_free_lists_ * base_) free(ptr);
+    if (count > max_) {
+      free(ptr);
+      return;
+    }
     // The second level Allocator
     auto p_object = reinterpret_cast<Object *>(ptr);
     Object *volatile *p_free_list = free_lists_ + get_free_list_index(count);
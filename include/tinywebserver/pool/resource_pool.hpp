@@ -28,7 +28,7 @@ class ResourcePool {
         alloc_(std::move(alloc)),
         deleter_(std::move(deleter)) {
     std::unique_lock lock(res_mutex_);
-    alloc_res(res_mutex_);
+    alloc_res(lock);
   }
   ResourcePool(const ResourcePool &) = delete;
   ResourcePool(ResourcePool &&) = delete;
@@ -38,7 +38,7 @@ class ResourcePool {
   /**
    * @brief The implementation of get_instance()
    */
-  ResourcePool<Resource> &get_instance_impl(
+  static ResourcePool<Resource> &get_instance_impl(
       size_t alloc_count, size_t max_count, std::function<Resource *()> &&alloc,
       std::function<void(Resource *)> &&deleter) {
     static ResourcePool<Resource> instance(
@@ -147,6 +147,8 @@ class ResourcePool {
    * @brief Get the resource
    * @todo The lifetime of the ResourcePool should be longer than the return
    * value.
+   * @note Every call allocates the control block of std::shared_ptr. See
+   * LockFreeResourcePool for a cheaper move-only handle.
    */
   std::shared_ptr<Resource> get() {
     std::unique_lock lock(res_mutex_);
@@ -155,7 +157,8 @@ class ResourcePool {
     if (res_.empty()) return nullptr;
     auto p = res_.front();
     res_.pop();
-    return std::shared_ptr<Resource>(p, std::bind(ResourcePool::recycle, this));
+    return std::shared_ptr<Resource>(p,
+                                     [this](Resource *ptr) { recycle(ptr); });
   }
 
  protected:
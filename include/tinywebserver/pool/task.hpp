@@ -0,0 +1,408 @@
+#ifndef TASK_H_
+#define TASK_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <future>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+#include "tinywebserver/utils/futex.h"
+#include "tinywebserver/utils/unique_function.hpp"
+
+/**
+ * @brief The task type stored in the queues of the thread pools.
+ */
+using Task = UniqueFunction<void()>;
+
+/**
+ * @brief Bind the arguments to the function like std::bind, but the result is
+ * a plain lambda, so it can be stored inline in Task.
+ */
+template <typename F, typename... A>
+auto bind_task(F &&task, A &&...args) {
+  if constexpr (sizeof...(A) == 0)
+    return std::decay_t<F>(std::forward<F>(task));
+  else
+    return [task = std::forward<F>(task),
+            ... args = std::forward<A>(args)]() mutable {
+      return std::invoke(task, args...);
+    };
+}
+
+/**
+ * @brief The shared state of a submitted task. The callable and its result
+ * live in one allocation that is shared by the queued TaskRunner and the
+ * TaskFuture.
+ */
+template <typename R>
+class TaskState {
+ public:
+  using Value = std::conditional_t<
+      std::is_void_v<R>, std::monostate,
+      std::conditional_t<std::is_reference_v<R>,
+                         std::reference_wrapper<std::remove_reference_t<R>>,
+                         R>>;
+
+  /**
+   * @param refs The initial number of references.
+   */
+  explicit TaskState(uint32_t refs = 2) : refs_(refs) {}
+
+  virtual ~TaskState() = default;
+
+  /**
+   * @brief Publish a std::future_error because the task will never run.
+   */
+  void abandon() {
+    exception_ = std::make_exception_ptr(
+        std::future_error(std::future_errc::broken_promise));
+    publish();
+  }
+
+  /**
+   * @brief Drop one reference, the last one frees the state.
+   */
+  void release() {
+    if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) delete this;
+  }
+
+  bool is_ready() const {
+    return status_.load(std::memory_order_acquire) == READY;
+  }
+
+  /**
+   * @brief Block until the result is published.
+   */
+  void wait() const {
+    for (auto s = status_.load(std::memory_order_acquire); s != READY;
+         s = status_.load(std::memory_order_acquire)) {
+      if (!announce_waiter(s)) continue;
+      futex_wait(&status_, PENDING_WAITED);
+    }
+  }
+
+  /**
+   * @brief Block until the result is published or timeout expires.
+   */
+  template <typename Rep, typename Period>
+  std::future_status wait_for(
+      std::chrono::duration<Rep, Period> timeout) const {
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    for (auto s = status_.load(std::memory_order_acquire); s != READY;
+         s = status_.load(std::memory_order_acquire)) {
+      auto remain = deadline - std::chrono::steady_clock::now();
+      if (remain <= remain.zero()) return std::future_status::timeout;
+      if (!announce_waiter(s)) continue;
+      futex_wait(&status_, PENDING_WAITED, remain);
+    }
+    return std::future_status::ready;
+  }
+
+  /**
+   * @brief Wait and take the result, or rethrow the exception of the task.
+   */
+  R get() {
+    wait();
+    if (exception_) std::rethrow_exception(exception_);
+    if constexpr (std::is_void_v<R>)
+      return;
+    else if constexpr (std::is_reference_v<R>)
+      return value_->get();
+    else
+      return std::move(*value_);
+  }
+
+ protected:
+  enum : uint32_t {
+    PENDING = 0,
+    // pending and some thread is blocked on the futex
+    PENDING_WAITED = 1,
+    READY = 2,
+  };
+
+  /**
+   * @brief Mark the state as waited, so that publish() knows to wake up.
+   * @return Return false if the status changed meanwhile.
+   */
+  bool announce_waiter(uint32_t s) const {
+    return s == PENDING_WAITED ||
+           status_.compare_exchange_weak(s, PENDING_WAITED,
+                                         std::memory_order_acquire);
+  }
+
+  void publish() {
+    if (status_.exchange(READY, std::memory_order_acq_rel) == PENDING_WAITED)
+      futex_wake(&status_);
+  }
+
+  mutable std::atomic<uint32_t> status_ = PENDING;
+
+  /**
+   * @brief References held by the runners and the TaskFuture.
+   */
+  std::atomic<uint32_t> refs_;
+
+  std::optional<Value> value_;
+
+  std::exception_ptr exception_;
+};
+
+template <typename R, typename F>
+class TaskStateImpl final : public TaskState<R> {
+ public:
+  template <typename G>
+  explicit TaskStateImpl(G &&g) : f_(std::forward<G>(g)) {}
+
+  /**
+   * @brief Run the callable and publish its result.
+   */
+  void run() {
+    try {
+      if constexpr (std::is_void_v<R>) {
+        std::invoke(f_);
+        this->value_.emplace();
+      } else {
+        this->value_.emplace(std::invoke(f_));
+      }
+    } catch (...) {
+      this->exception_ = std::current_exception();
+    }
+    this->publish();
+  }
+
+ protected:
+  F f_;
+};
+
+/**
+ * @brief The consumer side of a submitted task, a lightweight replacement of
+ * std::future. Like std::future, get() can only be called once.
+ */
+template <typename R>
+class TaskFuture {
+ public:
+  TaskFuture() = default;
+
+  explicit TaskFuture(TaskState<R> *state) : state_(state) {}
+
+  TaskFuture(const TaskFuture &) = delete;
+
+  TaskFuture(TaskFuture &&obj) : state_(std::exchange(obj.state_, nullptr)) {}
+
+  TaskFuture &operator=(const TaskFuture &) = delete;
+
+  TaskFuture &operator=(TaskFuture &&obj) {
+    if (this == &obj) return *this;
+    if (state_ != nullptr) state_->release();
+    state_ = std::exchange(obj.state_, nullptr);
+    return *this;
+  }
+
+  ~TaskFuture() {
+    if (state_ != nullptr) state_->release();
+  }
+
+  bool valid() const { return state_ != nullptr; }
+
+  bool is_ready() const { return state_->is_ready(); }
+
+  void wait() const { state_->wait(); }
+
+  template <typename Rep, typename Period>
+  std::future_status wait_for(
+      std::chrono::duration<Rep, Period> timeout) const {
+    return state_->wait_for(timeout);
+  }
+
+  /**
+   * @brief Get the result, the future becomes invalid afterwards.
+   */
+  R get() {
+    struct Releaser {
+      TaskState<R> *state;
+      ~Releaser() { state->release(); }
+    } releaser{std::exchange(state_, nullptr)};
+    return releaser.state->get();
+  }
+
+ protected:
+  TaskState<R> *state_ = nullptr;
+};
+
+/**
+ * @brief The producer side of a submitted task, which is pushed into the
+ * queue. It is pointer-sized, so it is stored inline in Task.
+ */
+template <typename R, typename F>
+class TaskRunner {
+ public:
+  explicit TaskRunner(TaskStateImpl<R, F> *state) : state_(state) {}
+
+  TaskRunner(const TaskRunner &) = delete;
+
+  TaskRunner(TaskRunner &&obj) noexcept
+      : state_(std::exchange(obj.state_, nullptr)) {}
+
+  TaskRunner &operator=(const TaskRunner &) = delete;
+
+  TaskRunner &operator=(TaskRunner &&) = delete;
+
+  /**
+   * @brief If the task is dropped without running, the future gets a
+   * broken_promise error instead of blocking forever.
+   */
+  ~TaskRunner() {
+    if (state_ == nullptr) return;
+    state_->abandon();
+    state_->release();
+  }
+
+  void operator()() {
+    auto state = std::exchange(state_, nullptr);
+    state->run();
+    state->release();
+  }
+
+ protected:
+  TaskStateImpl<R, F> *state_;
+};
+
+/**
+ * @brief Create the shared state of f with one allocation.
+ */
+template <typename R, typename F>
+auto make_task(F &&f) {
+  using Impl = TaskStateImpl<R, std::decay_t<F>>;
+  auto state = new Impl(std::forward<F>(f));
+  return std::pair<TaskFuture<R>, TaskRunner<R, std::decay_t<F>>>(
+      TaskFuture<R>(state), TaskRunner<R, std::decay_t<F>>(state));
+}
+
+/**
+ * @brief The shared state of a batch of tasks. The TaskFuture<void> on it
+ * becomes ready when all the tasks finish, and get() rethrows the first
+ * exception thrown by them.
+ */
+class BatchState : public TaskState<void> {
+ public:
+  explicit BatchState(size_t n_tasks)
+      : TaskState<void>(n_tasks + 1), remaining_(n_tasks) {
+    if (n_tasks == 0) finish();
+  }
+
+  /**
+   * @brief Called once by every task of the batch.
+   */
+  void done(std::exception_ptr exception = nullptr) {
+    if (exception != nullptr && !failed_.exchange(true))
+      exception_ = std::move(exception);
+    if (remaining_.fetch_sub(1, std::memory_order_acq_rel) == 1) finish();
+    release();
+  }
+
+ protected:
+  void finish() {
+    value_.emplace();
+    publish();
+  }
+
+  std::atomic<size_t> remaining_;
+
+  std::atomic<bool> failed_ = false;
+};
+
+/**
+ * @brief A BatchState that also owns the loop body of parallel_for().
+ */
+template <typename F>
+class LoopState final : public BatchState {
+ public:
+  template <typename G>
+  LoopState(size_t n_tasks, G &&g)
+      : BatchState(n_tasks), fn(std::forward<G>(g)) {}
+
+  F fn;
+};
+
+/**
+ * @brief One task of a batch.
+ */
+template <typename F>
+class BatchRunner {
+ public:
+  template <typename G>
+  BatchRunner(BatchState *state, G &&g)
+      : state_(state), f_(std::forward<G>(g)) {}
+
+  BatchRunner(const BatchRunner &) = delete;
+
+  BatchRunner(BatchRunner &&obj) noexcept(
+      std::is_nothrow_move_constructible_v<F>)
+      : state_(std::exchange(obj.state_, nullptr)), f_(std::move(obj.f_)) {}
+
+  BatchRunner &operator=(const BatchRunner &) = delete;
+
+  BatchRunner &operator=(BatchRunner &&) = delete;
+
+  ~BatchRunner() {
+    if (state_ == nullptr) return;
+    state_->done(std::make_exception_ptr(
+        std::future_error(std::future_errc::broken_promise)));
+  }
+
+  void operator()() {
+    auto state = std::exchange(state_, nullptr);
+    try {
+      std::invoke(f_);
+    } catch (...) {
+      state->done(std::current_exception());
+      return;
+    }
+    state->done();
+  }
+
+ protected:
+  BatchState *state_;
+
+  F f_;
+};
+
+/**
+ * @brief Split [begin, end) into blocks of grain indices and call
+ * emit(Task &&) for each block. fn is called as fn(block_begin, block_end) if
+ * possible, otherwise as fn(i) for every index.
+ * @return The TaskFuture of the whole loop.
+ */
+template <typename T, typename F, typename Emit>
+TaskFuture<void> split_loop(T begin, T end, T grain, F &&fn, Emit &&emit) {
+  using Loop = LoopState<std::decay_t<F>>;
+  using U = std::make_unsigned_t<T>;
+  if (grain <= T(0)) grain = T(1);
+  // counted in U, as end - begin may not fit in T
+  U span = begin < end ? U(U(end) - U(begin)) : U(0);
+  size_t n_blocks = span / U(grain) + (span % U(grain) != 0);
+  auto state = new Loop(n_blocks, std::forward<F>(fn));
+  TaskFuture<void> future(state);
+  for (T b = begin; n_blocks > 0; --n_blocks) {
+    // b + grain < end before the last block, so it can't overflow
+    T e = n_blocks == 1 ? end : T(b + grain);
+    auto block = [state, b, e] {
+      if constexpr (std::is_invocable_v<std::decay_t<F> &, T, T>) {
+        std::invoke(state->fn, b, e);
+      } else {
+        for (T i = b; i < e; ++i) std::invoke(state->fn, i);
+      }
+    };
+    emit(Task(BatchRunner<decltype(block)>(state, std::move(block))));
+    b = e;
+  }
+  return future;
+}
+
+#endif
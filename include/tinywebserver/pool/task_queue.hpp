@@ -0,0 +1,238 @@
+#ifndef TASK_QUEUE_H_
+#define TASK_QUEUE_H_
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+
+#include "tinywebserver/pool/task.hpp"
+#include "tinywebserver/utils/ring_queue.hpp"
+
+/**
+ * @brief The scheduling class of a task, a smaller value runs first.
+ */
+enum class TaskPriority : uint8_t {
+  HIGH = 0,
+  NORMAL = 1,
+  LOW = 2,
+};
+
+/**
+ * @brief The scheduling options given when a task is pushed.
+ */
+struct TaskOptions {
+  using clock = std::chrono::steady_clock;
+
+  TaskPriority priority = TaskPriority::NORMAL;
+
+  /**
+   * @brief The task is dropped instead of run if a worker takes it after the
+   * deadline.
+   */
+  clock::time_point deadline = clock::time_point::max();
+
+  /**
+   * @brief The options of a task that must start within timeout from now.
+   */
+  static TaskOptions within(clock::duration timeout,
+                            TaskPriority priority = TaskPriority::NORMAL) {
+    return {priority, clock::now() + timeout};
+  }
+};
+
+/**
+ * @brief The task queue of ThreadPool. There is one level per TaskPriority,
+ * and every level has a FIFO ring for the tasks without a deadline and a
+ * min-heap on the deadline for the others, so the common case of a normal
+ * task stays O(1). pop() takes the level with the best priority after aging:
+ * a level gains one class for every aging interval its oldest task has
+ * waited, so low priority tasks are delayed but never starved. Inside a level
+ * the earliest deadline runs first, and a task without a deadline is due one
+ * aging interval after it was pushed, so a stream of tasks with deadlines
+ * can't starve it either. Without aging the tasks without a deadline run once
+ * no task of the level has a deadline.
+ */
+class TaskQueue {
+ public:
+  using clock = std::chrono::steady_clock;
+
+  static constexpr size_t n_levels = 3;
+
+  struct Item {
+    Task task;
+
+    clock::time_point enqueue_time;
+
+    clock::time_point deadline = clock::time_point::max();
+
+    bool expired(clock::time_point now) const { return deadline < now; }
+  };
+
+  size_t size() const { return size_; }
+
+  bool empty() const { return size_ == 0; }
+
+  /**
+   * @param aging The wait time to gain one priority class, zero disables
+   * aging.
+   */
+  void set_aging(clock::duration aging) { aging_ = aging; }
+
+  clock::duration get_aging() const { return aging_; }
+
+  void push(Task &&task, clock::time_point now,
+            const TaskOptions &options = {}) {
+    auto &level = levels_[std::min<size_t>(size_t(options.priority),
+                                           n_levels - 1)];
+    if (options.deadline == clock::time_point::max()) {
+      level.fifo.emplace(std::move(task), now);
+    } else {
+      level.push({std::move(task), now, options.deadline});
+    }
+    ++size_;
+  }
+
+  /**
+   * @brief Get the enqueue time of the oldest task in the queue. The queue
+   * must not be empty.
+   */
+  clock::time_point oldest() const {
+    auto ret = clock::time_point::max();
+    for (auto &level : levels_)
+      if (!level.empty()) ret = std::min(ret, level.oldest());
+    return ret;
+  }
+
+  /**
+   * @brief Take the next task to run. The queue must not be empty. The caller
+   * should drop the task instead of running it if it has expired.
+   */
+  Item pop(clock::time_point now) {
+    size_t pick = n_levels;
+    int64_t best = INT64_MAX;
+    for (size_t i = 0; i < n_levels; ++i) {
+      auto &level = levels_[i];
+      if (level.empty()) continue;
+      int64_t boost =
+          aging_ > aging_.zero() ? (now - level.oldest()) / aging_ : 0;
+      if (int64_t(i) - boost < best) {
+        best = int64_t(i) - boost;
+        pick = i;
+      }
+    }
+    --size_;
+    return levels_[pick].pop(aging_);
+  }
+
+  void clear() {
+    for (auto &level : levels_) level.clear();
+    size_ = 0;
+  }
+
+ protected:
+  struct Level {
+    /**
+     * @brief A task with a deadline and the order it was pushed in the level.
+     */
+    struct Timed {
+      Item item;
+
+      uint64_t seq;
+    };
+
+    static bool later_deadline(const Timed &a, const Timed &b) {
+      return a.item.deadline > b.item.deadline;
+    }
+
+    RingQueue<Item> fifo;
+
+    /**
+     * @brief A min-heap on the deadline.
+     */
+    std::vector<Timed> deadlines;
+
+    /**
+     * @brief The seq and the enqueue time of the tasks pushed to deadlines,
+     * in push order. The front of the heap is the earliest deadline, not the
+     * oldest task, so the oldest is kept here instead: the tasks taken from
+     * the heap are dropped from the front lazily.
+     */
+    RingQueue<std::pair<uint64_t, clock::time_point>> arrivals;
+
+    /**
+     * @brief A min-heap of the seq of the tasks taken from deadlines that are
+     * still in arrivals.
+     */
+    std::vector<uint64_t> taken;
+
+    uint64_t next_seq = 0;
+
+    bool empty() const { return fifo.empty() && deadlines.empty(); }
+
+    /**
+     * @brief Get the enqueue time of the oldest task of the level, taking the
+     * tasks with a deadline as pushed in the order of their enqueue times.
+     */
+    clock::time_point oldest() const {
+      if (deadlines.empty()) return fifo.front().enqueue_time;
+      if (fifo.empty()) return arrivals.front().second;
+      return std::min(fifo.front().enqueue_time, arrivals.front().second);
+    }
+
+    /**
+     * @brief Push a task with a deadline.
+     */
+    void push(Item &&item) {
+      arrivals.emplace(next_seq, item.enqueue_time);
+      deadlines.push_back({std::move(item), next_seq++});
+      std::push_heap(deadlines.begin(), deadlines.end(), later_deadline);
+    }
+
+    /**
+     * @param aging The time after which the oldest task without a deadline
+     * is due, zero means it is never due.
+     */
+    Item pop(clock::duration aging) {
+      if (deadlines.empty() ||
+          (!fifo.empty() && aging > aging.zero() &&
+           fifo.front().enqueue_time + aging <=
+               deadlines.front().item.deadline)) {
+        Item item = std::move(fifo.front());
+        fifo.pop();
+        return item;
+      }
+      std::pop_heap(deadlines.begin(), deadlines.end(), later_deadline);
+      Timed timed = std::move(deadlines.back());
+      deadlines.pop_back();
+      taken.push_back(timed.seq);
+      std::push_heap(taken.begin(), taken.end(), std::greater<>());
+      // every seq in taken is still in arrivals, so the smallest one is the
+      // front of arrivals once the front has been taken
+      while (!taken.empty() && taken.front() == arrivals.front().first) {
+        std::pop_heap(taken.begin(), taken.end(), std::greater<>());
+        taken.pop_back();
+        arrivals.pop();
+      }
+      return std::move(timed.item);
+    }
+
+    void clear() {
+      fifo.clear();
+      deadlines.clear();
+      arrivals.clear();
+      taken.clear();
+    }
+  };
+
+  std::array<Level, n_levels> levels_;
+
+  size_t size_ = 0;
+
+  clock::duration aging_ = std::chrono::milliseconds(100);
+};
+
+#endif
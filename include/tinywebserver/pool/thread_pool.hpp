@@ -1,20 +1,33 @@
 #ifndef THREAD_POOL_H_
 #define THREAD_POOL_H_
 
+#include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
-#include <exception>
 #include <functional>
 #include <future>
+#include <list>
 #include <memory>
 #include <mutex>
-#include <queue>
+#include <ranges>
 #include <thread>
 #include <type_traits>
 #include <utility>
+#include <vector>
+
+#include "tinywebserver/metrics.h"
+#include "tinywebserver/pool/task.hpp"
+#include "tinywebserver/pool/task_queue.hpp"
+#include "tinywebserver/utils/cpu.h"
+#include "tinywebserver/utils/probes.h"
 
 class ThreadPool {
  public:
+  using clock = std::chrono::steady_clock;
+
+  using duration = std::chrono::microseconds;
+
   inline static const unsigned int default_thread_count =
       std::thread::hardware_concurrency();
 
@@ -59,11 +72,71 @@ class ThreadPool {
   }
 
   /**
-   * @brief Get the number of threads in the pool.
+   * @brief Get the number of threads in the pool, including the elastic
+   * threads that are currently alive.
    *
    * @return The number of threads.
    */
-  unsigned int get_thread_count() const { return thread_count_; }
+  unsigned int get_thread_count() const { return thread_count_ + extra_count_; }
+
+  /**
+   * @brief Let the pool grow beyond its thread count under load. When the
+   * oldest queued task has waited longer than spawn_threshold and no worker is
+   * idle, a new thread is spawned, at most one per spawn_threshold. A
+   * supervisor thread checks the queue again when the oldest task is due, so
+   * the pool grows even if every worker is stuck in a long task. An elastic
+   * thread retires after being idle for idle_timeout. Neither of them drains
+   * the queue or pauses the other workers.
+   *
+   * @param max_thread_count The upper bound of get_thread_count(). The
+   * threads created by the constructor or reset() are the lower bound and
+   * never retire. A value no larger than the lower bound disables the elastic
+   * mode, the running elastic threads then retire when they become idle.
+   * @param spawn_threshold The queue wait time that triggers a new thread.
+   * @param idle_timeout How long an elastic thread waits for a task before it
+   * retires.
+   */
+  void set_elastic(unsigned int max_thread_count,
+                   duration spawn_threshold = std::chrono::milliseconds(1),
+                   duration idle_timeout = std::chrono::seconds(10)) {
+    const std::scoped_lock tasks_lock(tasks_mutex_);
+    max_thread_count_ = max_thread_count;
+    spawn_threshold_ = spawn_threshold;
+    idle_timeout_ = idle_timeout;
+    if (running_) create_supervisor();
+  }
+
+  /**
+   * @brief Set how long a queued task waits to gain one priority class, so
+   * that low priority tasks are not starved by a stream of high priority
+   * ones. Zero disables aging. The default value is 100ms.
+   */
+  void set_aging(duration aging) {
+    const std::scoped_lock tasks_lock(tasks_mutex_);
+    tasks_.set_aging(aging);
+  }
+
+  /**
+   * @brief Get the number of tasks dropped because a worker took them after
+   * their deadline.
+   */
+  size_t get_tasks_dropped() const { return tasks_dropped_; }
+
+  /**
+   * @brief Get the histogram of the time the tasks wait in the queue, in
+   * nanoseconds. It is recorded when a worker takes the task.
+   */
+  const metrics::Histogram& get_wait_time_histogram() const {
+    return wait_time_hist_;
+  }
+
+  /**
+   * @brief Get the histogram of the queue depth, recorded every time tasks are
+   * pushed.
+   */
+  const metrics::Histogram& get_queue_depth_histogram() const {
+    return queue_depth_hist_;
+  }
 
   /**
    * @brief Get the number of tasks currently waiting in the queue to be
@@ -113,7 +186,14 @@ class ThreadPool {
    * @brief Unpause the pool. The workers will resume retrieving new tasks out
    * of the queue.
    */
-  void unpause() { paused_ = false; }
+  void unpause() {
+    {
+      const std::scoped_lock tasks_lock(tasks_mutex_);
+      paused_ = false;
+      maybe_spawn(clock::now());
+    }
+    task_avail_cv_.notify_all();
+  }
 
   /**
    * @brief Reset the number of threads in the pool. Waits for all currently
@@ -135,12 +215,46 @@ class ThreadPool {
     wait_for_tasks();
     destroy_threads();
     thread_count_ = determine_thread_count(thread_count);
-    threads_ = std::make_unique<std::thread[]>(thread_count);
+    threads_ = std::make_unique<std::thread[]>(thread_count_);
     // restore the state
     paused_ = was_paused;
     create_threads();
   }
 
+  /**
+   * @brief Pin the workers to the CPUs, the i-th worker runs on cpus[i %
+   * cpus.size()] and allocates memory on the NUMA node of that CPU. Like
+   * reset(), it waits for the running tasks and recreates the threads.
+   *
+   * @param cpus The CPUs to use, an empty vector lets the threads float
+   * freely.
+   * @return Return false and keep the threads as they are if the process may
+   * not run on some of the CPUs.
+   */
+  bool set_cpu_affinity(std::vector<int> cpus) {
+    if (cpus == cpus_) return true;
+    if (!cpus.empty() && !cpus_allowed(cpus)) return false;
+    const bool was_paused = paused_;
+    paused_ = true;
+    wait_for_tasks();
+    destroy_threads();
+    cpus_ = std::move(cpus);
+    paused_ = was_paused;
+    create_threads();
+    return true;
+  }
+
+  /**
+   * @brief Get the CPUs that the workers are pinned to.
+   */
+  const std::vector<int>& get_cpu_affinity() const { return cpus_; }
+
+  /**
+   * @brief Get the number of threads that failed to be pinned to their CPUs,
+   * they run unpinned.
+   */
+  size_t get_pin_failures() const { return pin_failures_; }
+
   /**
    * @brief Push a function with zero or more arguments, but no return value,
    * into the task queue. Does not return a future, so the user must use
@@ -154,15 +268,32 @@ class ThreadPool {
    * if the task is a class member function, the first argument must be a
    * pointer to the object, i.e. &object (or this), followed by the actual
    * arguments.
+   * @note Callables no larger than 64 bytes are stored inline, so pushing them
+   * doesn't allocate once the queue has grown to its peak size.
    */
-
   template <typename F, typename... A>
+    requires(!std::is_same_v<std::decay_t<F>, TaskOptions>)
   void push_task(F&& task, A&&... args) {
-    std::function<void()> task_function =
-        std::bind(std::forward<F>(task), std::forward<A>(args)...);
+    push_task(TaskOptions{}, std::forward<F>(task), std::forward<A>(args)...);
+  }
+
+  /**
+   * @brief Push a task with a priority and an optional deadline. Workers take
+   * the task of the highest priority after aging, and the earliest deadline
+   * in a priority. A task taken after its deadline is dropped without running.
+   *
+   * @param options The priority and the deadline.
+   */
+  template <typename F, typename... A>
+  void push_task(const TaskOptions& options, F&& task, A&&... args) {
+    Task task_function =
+        bind_task(std::forward<F>(task), std::forward<A>(args)...);
+    const auto now = clock::now();
     {
       const std::scoped_lock tasks_lock(tasks_mutex_);
-      tasks_.push(task_function);
+      tasks_.push(std::move(task_function), now, options);
+      queue_depth_hist_.record(tasks_.size());
+      maybe_spawn(now);
     }
     ++tasks_total_;
     task_avail_cv_.notify_one();
@@ -188,26 +319,122 @@ class ThreadPool {
   template <
       typename F, typename... A,
       typename R = std::invoke_result_t<std::decay_t<F>, std::decay_t<A>...>>
+    requires(!std::is_same_v<std::decay_t<F>, TaskOptions>)
   std::future<R> submit(F&& task, A&&... args) {
-    std::function<R()> task_function =
-        std::bind(std::forward<F>(task), std::forward<A>(args)...);
-    auto task_promise = std::make_shared<std::promise<R>>();
-    push_task([task_function, task_promise] {
-      try {
-        if constexpr (std::is_void_v<R>) {
-          std::invoke(task_function);
-          task_promise->set_value();
-        } else {
-          task_promise->set_value(std::invoke(task_function));
-        }
-      } catch (...) {
-        try {
-          task_promise->set_exception(std::current_exception());
-        } catch (...) {
-        }
+    return submit(TaskOptions{}, std::forward<F>(task),
+                  std::forward<A>(args)...);
+  }
+
+  /**
+   * @brief Submit a task with a priority and an optional deadline. If the
+   * task is dropped at its deadline, get() of the future throws a
+   * std::future_error with std::future_errc::broken_promise.
+   *
+   * @param options The priority and the deadline.
+   */
+  template <
+      typename F, typename... A,
+      typename R = std::invoke_result_t<std::decay_t<F>, std::decay_t<A>...>>
+  std::future<R> submit(const TaskOptions& options, F&& task, A&&... args) {
+    std::packaged_task<R()> packaged(
+        bind_task(std::forward<F>(task), std::forward<A>(args)...));
+    auto future = packaged.get_future();
+    push_task(options, std::move(packaged));
+    return future;
+  }
+
+  /**
+   * @brief The same as submit(), but get a TaskFuture. The function and its
+   * result share one allocation and waiting uses a futex, so it is cheaper
+   * than the std::promise behind std::future.
+   */
+  template <
+      typename F, typename... A,
+      typename R = std::invoke_result_t<std::decay_t<F>, std::decay_t<A>...>>
+    requires(!std::is_same_v<std::decay_t<F>, TaskOptions>)
+  TaskFuture<R> submit_task(F&& task, A&&... args) {
+    return submit_task(TaskOptions{}, std::forward<F>(task),
+                       std::forward<A>(args)...);
+  }
+
+  /**
+   * @brief Submit a task with a priority and an optional deadline, and get a
+   * TaskFuture.
+   */
+  template <
+      typename F, typename... A,
+      typename R = std::invoke_result_t<std::decay_t<F>, std::decay_t<A>...>>
+  TaskFuture<R> submit_task(const TaskOptions& options, F&& task,
+                            A&&... args) {
+    auto [future, runner] = make_task<R>(
+        bind_task(std::forward<F>(task), std::forward<A>(args)...));
+    push_task(options, std::move(runner));
+    return std::move(future);
+  }
+
+  /**
+   * @brief Push a batch of tasks into the task queue under one lock
+   * acquisition, and wake up as many workers as needed.
+   *
+   * @tparam Range The type of the range.
+   * @param tasks A range of callables with no arguments. The callables are
+   * moved into the pool if the range is an rvalue, otherwise they are copied.
+   * @param options The priority and the deadline of every task.
+   * @return A future that becomes ready when all the tasks finish. get()
+   * rethrows the first exception thrown by the tasks.
+   */
+  template <typename Range>
+  TaskFuture<void> push_tasks(Range&& tasks, const TaskOptions& options = {}) {
+    size_t n = std::ranges::distance(tasks);
+    auto state = new BatchState(n);
+    TaskFuture<void> future(state);
+    const auto now = clock::now();
+    {
+      const std::scoped_lock tasks_lock(tasks_mutex_);
+      for (auto&& task : tasks) {
+        using F = std::decay_t<decltype(task)>;
+        if constexpr (std::is_lvalue_reference_v<Range>)
+          tasks_.push(BatchRunner<F>(state, task), now, options);
+        else
+          tasks_.push(BatchRunner<F>(state, std::move(task)), now, options);
       }
-    });
-    return task_promise->get_future();
+      queue_depth_hist_.record(tasks_.size());
+      maybe_spawn(now);
+    }
+    tasks_total_ += n;
+    wake_workers(n);
+    return future;
+  }
+
+  /**
+   * @brief Split the loop [begin, end) into blocks of grain indices and push
+   * them into the task queue under one lock acquisition.
+   *
+   * @param fn The loop body. It is called as fn(block_begin, block_end) if
+   * possible, otherwise it is called as fn(i) for every index.
+   * @param options The priority and the deadline of every block.
+   * @return A future that becomes ready when the whole loop finishes.
+   */
+  template <typename T, typename F>
+  TaskFuture<void> parallel_for(T begin, std::type_identity_t<T> end,
+                                std::type_identity_t<T> grain, F&& fn,
+                                const TaskOptions& options = {}) {
+    size_t n = 0;
+    TaskFuture<void> future;
+    const auto now = clock::now();
+    {
+      const std::scoped_lock tasks_lock(tasks_mutex_);
+      future = split_loop(begin, end, grain, std::forward<F>(fn),
+                          [this, &n, now, &options](Task&& task) {
+                            tasks_.push(std::move(task), now, options);
+                            ++n;
+                          });
+      queue_depth_hist_.record(tasks_.size());
+      maybe_spawn(now);
+    }
+    tasks_total_ += n;
+    wake_workers(n);
+    return future;
   }
 
  protected:
@@ -235,13 +462,38 @@ class ThreadPool {
       return 1;
   }
 
+  /**
+   * @brief Wake up the workers for n new tasks.
+   */
+  void wake_workers(size_t n) {
+    if (n >= thread_count_)
+      task_avail_cv_.notify_all();
+    else
+      while (n-- > 0) task_avail_cv_.notify_one();
+  }
+
   /**
    * @brief Create the threads in the pool and assign a worker to each thread.
    */
   void create_threads() {
     running_ = true;
     for (decltype(thread_count_) i = 0; i < thread_count_; ++i)
-      threads_[i] = std::thread(&ThreadPool::worker, this);
+      threads_[i] = std::thread([this, i] {
+        if (!cpus_.empty() && !pin_current_thread({cpus_[i % cpus_.size()]}))
+          ++pin_failures_;
+        worker();
+      });
+    const std::scoped_lock tasks_lock(tasks_mutex_);
+    create_supervisor();
+  }
+
+  /**
+   * @brief Start the supervisor thread if the pool is elastic and it is not
+   * running yet. Must be called with tasks_mutex_ held.
+   */
+  void create_supervisor() {
+    if (thread_count_ < max_thread_count_ && !supervisor_.joinable())
+      supervisor_ = std::thread([this] { supervisor(); });
   }
 
   /**
@@ -249,10 +501,117 @@ class ThreadPool {
    * running, it will wait for these tasks.
    */
   void destroy_threads() {
-    running_ = false;
+    std::list<std::thread> extra_threads;
+    {
+      const std::scoped_lock tasks_lock(tasks_mutex_);
+      running_ = false;
+      // the iterators held by the elastic workers stay valid after the move
+      extra_threads = std::move(extra_threads_);
+    }
     task_avail_cv_.notify_all();
+    supervisor_cv_.notify_one();
+    if (supervisor_.joinable()) supervisor_.join();
     for (decltype(thread_count_) i = 0; i < thread_count_; ++i)
       threads_[i].join();
+    for (auto& thread : extra_threads) thread.join();
+    extra_count_ = 0;
+    const std::scoped_lock tasks_lock(tasks_mutex_);
+    join_retired_threads();
+  }
+
+  /**
+   * @brief Spawn an elastic thread if the oldest task has waited too long, or
+   * arm the supervisor to check again when it is due. Must be called with
+   * tasks_mutex_ held.
+   */
+  void maybe_spawn(clock::time_point now) {
+    if (!running_ || paused_ || idle_count_ > 0 || tasks_.empty() ||
+        thread_count_ + extra_count_ >= max_thread_count_)
+      return;
+    if (now < spawn_due()) {
+      // no worker looks at the queue again until one finishes its task
+      if (!supervisor_armed_) {
+        supervisor_armed_ = true;
+        supervisor_cv_.notify_one();
+      }
+      return;
+    }
+    last_spawn_ = now;
+    join_retired_threads();
+    // the new thread blocks on tasks_mutex_ until its handle is stored
+    auto self = extra_threads_.emplace(extra_threads_.end());
+    *self = std::thread([this, self] {
+      if (!cpus_.empty() && !pin_current_thread(cpus_)) ++pin_failures_;
+      extra_worker(self);
+    });
+    ++extra_count_;
+  }
+
+  /**
+   * @brief The time when maybe_spawn() may spawn a thread for the queued
+   * tasks. Must be called with tasks_mutex_ held and tasks queued.
+   */
+  clock::time_point spawn_due() const {
+    return std::max(tasks_.oldest(), last_spawn_) + spawn_threshold_;
+  }
+
+  /**
+   * @brief The worker of the supervisor thread. Once armed by maybe_spawn(),
+   * it sleeps until the oldest task is due and calls maybe_spawn() again.
+   */
+  void supervisor() {
+    std::unique_lock tasks_lock(tasks_mutex_);
+    while (running_) {
+      supervisor_cv_.wait(tasks_lock,
+                          [this] { return supervisor_armed_ || !running_; });
+      if (!running_) return;
+      supervisor_armed_ = false;
+      if (tasks_.empty()) continue;
+      supervisor_cv_.wait_until(tasks_lock, spawn_due(),
+                                [this] { return !running_; });
+      maybe_spawn(clock::now());
+    }
+  }
+
+  /**
+   * @brief Join the elastic threads that have retired. Must be called with
+   * tasks_mutex_ held, the retired threads no longer need it.
+   */
+  void join_retired_threads() {
+    for (auto& thread : retired_threads_) thread.join();
+    retired_threads_.clear();
+  }
+
+  /**
+   * @brief Whether a worker can take a task now.
+   */
+  bool has_task() const { return !tasks_.empty() && !paused_; }
+
+  /**
+   * @brief Take the next task from the queue and execute it, or drop it if
+   * its deadline has passed. Must be called with tasks_mutex_ held, the lock
+   * is released while the task runs or is destroyed.
+   */
+  void run_front(std::unique_lock<std::mutex>& tasks_lock) {
+    const auto now = clock::now();
+    auto item = tasks_.pop(now);
+    wait_time_hist_.record(now - item.enqueue_time);
+    TWS_PROBE(pool_task_start,
+              std::chrono::duration_cast<duration>(now - item.enqueue_time)
+                  .count(),
+              tasks_.size());
+    maybe_spawn(now);
+    tasks_lock.unlock();
+    bool expired = item.expired(now);
+    if (expired)
+      ++tasks_dropped_;
+    else
+      item.task();
+    item.task = nullptr;
+    TWS_PROBE(pool_task_end, int(expired));
+    tasks_lock.lock();
+    --tasks_total_;
+    if (waiting_) task_done_cv_.notify_one();
   }
 
   /**
@@ -262,22 +621,40 @@ class ThreadPool {
    * the worker notifies wait_for_tasks() in case it is waiting.
    */
   void worker() {
+    std::unique_lock tasks_lock(tasks_mutex_);
     while (running_) {
-      std::unique_lock tasks_lock(tasks_mutex_);
+      ++idle_count_;
       task_avail_cv_.wait(tasks_lock,
-                          [this] { return !tasks_.empty() || !running_; });
-      if (running_ && !paused_) {
-        std::function<void()> task = std::move(tasks_.front());
-        tasks_.pop();
-        tasks_lock.unlock();
-        task();
-        tasks_lock.lock();
-        --tasks_total_;
-        if (waiting_) task_done_cv_.notify_one();
+                          [this] { return has_task() || !running_; });
+      --idle_count_;
+      if (running_) run_front(tasks_lock);
+    }
+  }
+
+  /**
+   * @brief The worker of an elastic thread. It moves its own handle to
+   * retired_threads_ and exits after being idle for idle_timeout_.
+   */
+  void extra_worker(std::list<std::thread>::iterator self) {
+    std::unique_lock tasks_lock(tasks_mutex_);
+    while (running_) {
+      ++idle_count_;
+      bool ready = task_avail_cv_.wait_for(tasks_lock, idle_timeout_, [this] {
+        return has_task() || !running_;
+      });
+      --idle_count_;
+      if (!running_) return;
+      if (!ready) {
+        retired_threads_.push_back(std::move(*self));
+        extra_threads_.erase(self);
+        --extra_count_;
+        return;
       }
+      run_front(tasks_lock);
     }
   }
 
+
   /**
    * @brief An atomic variable indicating whether the workers should pause. When
    * set to true, the workers temporarily stop retrieving new tasks out of the
@@ -313,7 +690,7 @@ class ThreadPool {
   /**
    * @brief A queue of tasks to be executed by the threads.
    */
-  std::queue<std::function<void()>> tasks_ = {};
+  TaskQueue tasks_ = {};
 
   /**
    * @brief A mutex to synchronize access to the task queue by different
@@ -326,6 +703,16 @@ class ThreadPool {
    */
   unsigned int thread_count_ = {0};
 
+  /**
+   * @brief The CPUs that the workers are pinned to.
+   */
+  std::vector<int> cpus_ = {};
+
+  /**
+   * @brief The number of threads that pin_current_thread() failed for.
+   */
+  std::atomic<size_t> pin_failures_ = 0;
+
   /**
    * @brief An atomic variable to keep track of the total number of unfinished
    * tasks - either still in the queue, or running in a thread.
@@ -336,6 +723,63 @@ class ThreadPool {
    * @brief A smart pointer to manage the memory allocated for the threads.
    */
   std::unique_ptr<std::thread[]> threads_ = nullptr;
+
+  /**
+   * @brief The elastic threads spawned by maybe_spawn().
+   */
+  std::list<std::thread> extra_threads_ = {};
+
+  /**
+   * @brief The elastic threads that have exited but are not joined yet.
+   */
+  std::vector<std::thread> retired_threads_ = {};
+
+  /**
+   * @brief The thread that spawns the elastic threads when no push or pop
+   * happens, it exists only in the elastic mode.
+   */
+  std::thread supervisor_ = {};
+
+  /**
+   * @brief A condition variable used by maybe_spawn() to arm the supervisor.
+   */
+  std::condition_variable supervisor_cv_ = {};
+
+  /**
+   * @brief Whether the supervisor should check the queue again, guarded by
+   * tasks_mutex_.
+   */
+  bool supervisor_armed_ = {false};
+
+  /**
+   * @brief The number of the elastic threads alive.
+   */
+  std::atomic<unsigned int> extra_count_ = {0};
+
+  /**
+   * @brief The number of workers waiting for a task, guarded by tasks_mutex_.
+   */
+  unsigned int idle_count_ = {0};
+
+  /**
+   * @brief The upper bound of the thread count in the elastic mode.
+   */
+  unsigned int max_thread_count_ = {0};
+
+  duration spawn_threshold_ = {};
+
+  duration idle_timeout_ = {};
+
+  clock::time_point last_spawn_ = {};
+
+  /**
+   * @brief The number of tasks dropped at their deadlines.
+   */
+  std::atomic<size_t> tasks_dropped_ = {0};
+
+  metrics::Histogram wait_time_hist_;
+
+  metrics::Histogram queue_depth_hist_;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,413 @@
+#ifndef WORK_STEALING_THREAD_POOL_H_
+#define WORK_STEALING_THREAD_POOL_H_
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <ranges>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "tinywebserver/pool/task.hpp"
+#include "tinywebserver/utils/work_stealing_deque.hpp"
+
+/**
+ * @brief A work-stealing variant of ThreadPool. Every worker owns a Chase-Lev
+ * deque. Tasks pushed by a worker go to its own deque, while tasks pushed by
+ * other threads go to a global injection queue. An idle worker first drains
+ * its deque, then the injection queue, and finally steals from randomly
+ * chosen workers.
+ * @note The interface is the same as ThreadPool except reset().
+ */
+class WorkStealingThreadPool {
+ public:
+  inline static const unsigned int default_thread_count =
+      std::thread::hardware_concurrency();
+
+  /**
+   * @brief Construct a new thread pool.
+   *
+   * @param thread_count The number of threads to use. The default value is the
+   * total number of hardware threads available.
+   */
+  WorkStealingThreadPool(unsigned int thread_count = default_thread_count)
+      : thread_count_(determine_thread_count(thread_count)),
+        workers_(std::make_unique<Worker[]>(thread_count_)) {
+    create_threads();
+  }
+
+  /**
+   * @brief Destruct the thread pool. Waits for all tasks to complete, then
+   * destroys all threads.
+   */
+  ~WorkStealingThreadPool() {
+    wait_for_tasks();
+    destroy_threads();
+    drop_tasks();
+  }
+
+  /**
+   * @brief Wait for tasks to be completed, both those that are currently
+   * running in the threads and those that are still waiting in the queues. If
+   * the pool is paused, only wait for the running tasks.
+   */
+  void wait_for_tasks() {
+    waiting_ = true;
+    std::unique_lock done_lock(done_mutex_);
+    task_done_cv_.wait(done_lock, [this] {
+      return tasks_total_ == (paused_ ? tasks_queued_.load() : 0);
+    });
+    waiting_ = false;
+  }
+
+  /**
+   * @brief Get the number of threads in the pool.
+   */
+  unsigned int get_thread_count() const { return thread_count_; }
+
+  /**
+   * @brief Get the number of tasks waiting in the deques and the injection
+   * queue.
+   */
+  size_t get_tasks_queued() const { return tasks_queued_; }
+
+  /**
+   * @brief Get the number of tasks currently being executed by the threads.
+   */
+  size_t get_tasks_running() const { return tasks_total_ - tasks_queued_; }
+
+  /**
+   * @brief Get the total number of unfinished tasks.
+   */
+  size_t get_tasks_total() const { return tasks_total_; }
+
+  bool is_paused() const { return paused_; }
+
+  /**
+   * @brief Pause the pool. The workers will temporarily stop retrieving new
+   * tasks.
+   */
+  void pause() { paused_ = true; }
+
+  /**
+   * @brief Unpause the pool and wake up the sleeping workers.
+   */
+  void unpause() {
+    paused_ = false;
+    std::lock_guard sleep_lock(sleep_mutex_);
+    task_avail_cv_.notify_all();
+  }
+
+  /**
+   * @brief Push a function with zero or more arguments, but no return value.
+   * If the caller is a worker of this pool, the task goes to the worker's own
+   * deque, otherwise it goes to the injection queue.
+   */
+  template <typename F, typename... A>
+  void push_task(F &&task, A &&...args) {
+    schedule(
+        new Task(bind_task(std::forward<F>(task), std::forward<A>(args)...)));
+  }
+
+  /**
+   * @brief Submit a function with zero or more arguments and get a future for
+   * the eventual returned value.
+   */
+  template <
+      typename F, typename... A,
+      typename R = std::invoke_result_t<std::decay_t<F>, std::decay_t<A>...>>
+  std::future<R> submit(F &&task, A &&...args) {
+    std::packaged_task<R()> packaged(
+        bind_task(std::forward<F>(task), std::forward<A>(args)...));
+    auto future = packaged.get_future();
+    push_task(std::move(packaged));
+    return future;
+  }
+
+  /**
+   * @brief The same as submit(), but get a TaskFuture, which shares one
+   * allocation with the function and its result.
+   */
+  template <
+      typename F, typename... A,
+      typename R = std::invoke_result_t<std::decay_t<F>, std::decay_t<A>...>>
+  TaskFuture<R> submit_task(F &&task, A &&...args) {
+    auto [future, runner] = make_task<R>(
+        bind_task(std::forward<F>(task), std::forward<A>(args)...));
+    push_task(std::move(runner));
+    return std::move(future);
+  }
+
+  /**
+   * @brief Push a batch of tasks at once. If the caller is a worker of this
+   * pool, the tasks go to its own deque where idle workers can steal them,
+   * otherwise they are appended to the injection queue under one lock
+   * acquisition.
+   * @return A future that becomes ready when all the tasks finish.
+   */
+  template <typename Range>
+  TaskFuture<void> push_tasks(Range &&tasks) {
+    size_t n = std::ranges::distance(tasks);
+    auto state = new BatchState(n);
+    TaskFuture<void> future(state);
+    std::vector<Task *> batch;
+    batch.reserve(n);
+    for (auto &&task : tasks) {
+      using F = std::decay_t<decltype(task)>;
+      if constexpr (std::is_lvalue_reference_v<Range>)
+        batch.push_back(new Task(BatchRunner<F>(state, task)));
+      else
+        batch.push_back(new Task(BatchRunner<F>(state, std::move(task))));
+    }
+    schedule(batch);
+    return future;
+  }
+
+  /**
+   * @brief Split the loop [begin, end) into blocks of grain indices and push
+   * them at once.
+   * @param fn The loop body. It is called as fn(block_begin, block_end) if
+   * possible, otherwise it is called as fn(i) for every index.
+   * @return A future that becomes ready when the whole loop finishes.
+   */
+  template <typename T, typename F>
+  TaskFuture<void> parallel_for(T begin, std::type_identity_t<T> end,
+                                std::type_identity_t<T> grain, F &&fn) {
+    std::vector<Task *> batch;
+    auto future = split_loop(
+        begin, end, grain, std::forward<F>(fn),
+        [&batch](Task &&task) { batch.push_back(new Task(std::move(task))); });
+    schedule(batch);
+    return future;
+  }
+
+ protected:
+  struct Worker {
+    WorkStealingDeque<Task *> deque;
+    std::thread thread;
+  };
+
+  /**
+   * @brief The maximum number of tasks moved from the injection queue to the
+   * worker deque at one time.
+   */
+  static constexpr size_t inject_batch_size_ = 32;
+
+  static unsigned int determine_thread_count(unsigned int thread_count) {
+    if (thread_count > 0)
+      return thread_count;
+    else if (auto cnt = std::thread::hardware_concurrency(); cnt > 0)
+      return cnt;
+    else
+      return 1;
+  }
+
+  void create_threads() {
+    running_ = true;
+    for (unsigned int i = 0; i < thread_count_; ++i)
+      workers_[i].thread =
+          std::thread(&WorkStealingThreadPool::worker, this, i);
+  }
+
+  void destroy_threads() {
+    running_ = false;
+    {
+      std::lock_guard sleep_lock(sleep_mutex_);
+      task_avail_cv_.notify_all();
+    }
+    for (unsigned int i = 0; i < thread_count_; ++i) workers_[i].thread.join();
+  }
+
+  /**
+   * @brief Free the tasks left by a paused pool.
+   */
+  void drop_tasks() {
+    for (unsigned int i = 0; i < thread_count_; ++i)
+      while (auto task = workers_[i].deque.pop()) delete *task;
+    for (auto task : inject_) delete task;
+    inject_.clear();
+  }
+
+  /**
+   * @brief Put the task into a queue and wake up a sleeping worker.
+   */
+  void schedule(Task *task) {
+    // Count the task before it becomes visible, so that the counters never
+    // fall below zero.
+    ++tasks_total_;
+    tasks_queued_.fetch_add(1);
+    if (cur_pool_ == this) {
+      workers_[cur_index_].deque.push(task);
+    } else {
+      std::lock_guard inject_lock(inject_mutex_);
+      inject_.push_back(task);
+    }
+    if (sleepers_.load() > 0) {
+      std::lock_guard sleep_lock(sleep_mutex_);
+      task_avail_cv_.notify_one();
+    }
+  }
+
+  /**
+   * @brief Put a batch of tasks into a queue and wake up as many sleeping
+   * workers as needed.
+   */
+  void schedule(const std::vector<Task *> &batch) {
+    if (batch.empty()) return;
+    tasks_total_ += batch.size();
+    tasks_queued_.fetch_add(batch.size());
+    if (cur_pool_ == this) {
+      for (auto task : batch) workers_[cur_index_].deque.push(task);
+    } else {
+      std::lock_guard inject_lock(inject_mutex_);
+      inject_.insert(inject_.end(), batch.begin(), batch.end());
+    }
+    if (sleepers_.load() > 0) {
+      std::lock_guard sleep_lock(sleep_mutex_);
+      if (batch.size() >= thread_count_)
+        task_avail_cv_.notify_all();
+      else
+        for (size_t i = 0; i < batch.size(); ++i) task_avail_cv_.notify_one();
+    }
+  }
+
+  /**
+   * @brief Find a task for the worker.
+   * @param seed The state of the random number generator for stealing.
+   */
+  Task *take_task(unsigned int index, uint64_t &seed) {
+    auto &deque = workers_[index].deque;
+    // 1. its own deque
+    if (auto task = deque.pop()) return *task;
+
+    // 2. the injection queue, take a batch to amortize the lock
+    {
+      std::lock_guard inject_lock(inject_mutex_);
+      if (!inject_.empty()) {
+        auto task = inject_.front();
+        inject_.pop_front();
+        auto n = std::min(inject_.size() / thread_count_, inject_batch_size_);
+        for (size_t i = 0; i < n; ++i) {
+          deque.push(inject_.front());
+          inject_.pop_front();
+        }
+        return task;
+      }
+    }
+
+    // 3. steal from a random victim
+    if (thread_count_ == 1) return nullptr;
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    auto start = seed % thread_count_;
+    for (unsigned int i = 0; i < thread_count_; ++i) {
+      auto victim = (start + i) % thread_count_;
+      if (victim == index) continue;
+      if (auto task = workers_[victim].deque.steal()) return *task;
+    }
+    return nullptr;
+  }
+
+  /**
+   * @brief A worker function to be assigned to each thread in the pool.
+   */
+  void worker(unsigned int index) {
+    cur_pool_ = this;
+    cur_index_ = index;
+    uint64_t seed = 0x9E3779B97F4A7C15ull * (index + 1);
+    while (running_) {
+      Task *task = paused_ ? nullptr : take_task(index, seed);
+      if (task == nullptr) {
+        std::unique_lock sleep_lock(sleep_mutex_);
+        sleepers_.fetch_add(1);
+        task_avail_cv_.wait(sleep_lock, [this] {
+          return !running_ || (!paused_ && tasks_queued_.load() > 0);
+        });
+        sleepers_.fetch_sub(1);
+        continue;
+      }
+      tasks_queued_.fetch_sub(1);
+      (*task)();
+      delete task;
+      --tasks_total_;
+      if (waiting_) {
+        std::lock_guard done_lock(done_mutex_);
+        task_done_cv_.notify_one();
+      }
+    }
+    cur_pool_ = nullptr;
+  }
+
+  /**
+   * @brief The pool that the current thread works for.
+   */
+  inline static thread_local WorkStealingThreadPool *cur_pool_ = nullptr;
+
+  /**
+   * @brief The index of the current worker in its pool.
+   */
+  inline static thread_local unsigned int cur_index_ = 0;
+
+  std::atomic<bool> paused_ = {false};
+
+  std::atomic<bool> running_ = {false};
+
+  std::atomic<bool> waiting_ = {false};
+
+  /**
+   * @brief The number of threads in the pool.
+   */
+  unsigned int thread_count_ = {0};
+
+  /**
+   * @brief The workers and their deques.
+   */
+  std::unique_ptr<Worker[]> workers_ = nullptr;
+
+  /**
+   * @brief The injection queue for the tasks pushed by external threads.
+   */
+  std::deque<Task *> inject_ = {};
+
+  std::mutex inject_mutex_ = {};
+
+  /**
+   * @brief The number of tasks that haven't been taken by workers.
+   */
+  std::atomic<size_t> tasks_queued_ = {0};
+
+  /**
+   * @brief The total number of unfinished tasks.
+   */
+  std::atomic<size_t> tasks_total_ = {0};
+
+  /**
+   * @brief The number of workers that are sleeping or going to sleep.
+   */
+  std::atomic<unsigned int> sleepers_ = {0};
+
+  /**
+   * @brief Mutex and condition variable used to park the idle workers.
+   */
+  std::mutex sleep_mutex_ = {};
+
+  std::condition_variable task_avail_cv_ = {};
+
+  /**
+   * @brief Mutex and condition variable used to notify wait_for_tasks().
+   */
+  std::mutex done_mutex_ = {};
+
+  std::condition_variable task_done_cv_ = {};
+};
+
+#endif
@@ -3,17 +3,81 @@
 
 #include <algorithm>
 #include <atomic>
+#include <bit>
 #include <cassert>
 #include <chrono>
 #include <condition_variable>
+#include <cstdint>
 #include <functional>
 #include <memory>
 #include <mutex>
 #include <queue>
 #include <set>
 #include <thread>
+#include <type_traits>
 
-#include "tinywebserver/utils/kvheap.hpp"
+#include "tinywebserver/utils/dary_kvheap.hpp"
+#include "tinywebserver/utils/probes.h"
+
+/**
+ * @brief Count the wakeups of a timer thread, and the wakeups in the last
+ * whole second. It is written by the timer thread and read by any thread.
+ */
+class WakeupCounter {
+ public:
+  using clock = std::chrono::steady_clock;
+
+  /**
+   * @brief Count a wakeup at now, only the timer thread calls it.
+   */
+  void add(clock::time_point now) {
+    auto second = seconds_of(now);
+    auto cur = second_.load(std::memory_order_relaxed);
+    if (second != cur) {
+      last_.store(second == cur + 1 ? cur_.load(std::memory_order_relaxed) : 0,
+                  std::memory_order_relaxed);
+      cur_.store(0, std::memory_order_relaxed);
+      second_.store(second, std::memory_order_relaxed);
+    }
+    cur_.fetch_add(1, std::memory_order_relaxed);
+    total_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  uint64_t total() const { return total_.load(std::memory_order_relaxed); }
+
+  /**
+   * @brief Get the wakeups in the last whole second.
+   */
+  uint64_t last_second() const {
+    auto second = seconds_of(clock::now());
+    auto cur = second_.load(std::memory_order_relaxed);
+    // the thread hasn't woken up since the last second
+    if (second == cur + 1) return cur_.load(std::memory_order_relaxed);
+    if (second != cur) return 0;
+    return last_.load(std::memory_order_relaxed);
+  }
+
+ protected:
+  static int64_t seconds_of(clock::time_point tp) {
+    return std::chrono::duration_cast<std::chrono::seconds>(
+               tp.time_since_epoch())
+        .count();
+  }
+
+  std::atomic<uint64_t> total_ = 0;
+
+  /**
+   * @brief The second that cur_ counts.
+   */
+  std::atomic<int64_t> second_ = 0;
+
+  std::atomic<uint64_t> cur_ = 0;
+
+  /**
+   * @brief The count of the second before second_.
+   */
+  std::atomic<uint64_t> last_ = 0;
+};
 
 /**
  * @brief
@@ -52,27 +116,43 @@ class Timer {
      */
     time_point next_run_time;
 
+    /**
+     * @brief How late the task may run, so that the timer can run it together
+     * with other tasks in one wakeup.
+     */
+    duration slack;
+
+    /**
+     * @brief When the task runs, in [next_run_time, next_run_time + slack].
+     * Call update_fire_time() after changing next_run_time or slack.
+     */
+    time_point fire_time;
+
     Task(std::function<void()> &&call_back, duration start_delay, int times = 1,
-         duration interval = duration::zero())
+         duration interval = duration::zero(),
+         duration slack = duration::zero())
         : call_back(std::move(call_back)),
           start_delay(start_delay),
           times(times),
-          interval(interval) {}
+          interval(interval),
+          slack(slack) {}
 
     /**
      * @brief check validity
      */
     static bool check(Task &task) {
-      return check(task.call_back, task.start_delay, task.start_delay,
-                   task.times, task.interval);
+      return check(task.call_back, task.start_delay, task.times, task.interval,
+                   task.slack);
     }
 
     static bool check(const std::function<void()> &call_back,
-                      duration start_delay, int times, duration interval) {
+                      duration start_delay, int times, duration interval,
+                      duration slack = duration::zero()) {
       if (!call_back) return false;
       if (start_delay < duration::zero()) return false;
       if (times == 0) return false;
       if (interval < duration::zero()) return false;
+      if (slack < duration::zero()) return false;
       return true;
     }
 
@@ -94,6 +174,27 @@ class Timer {
      */
     void reset_next_run_time(time_point now) {
       next_run_time = now + start_delay;
+      update_fire_time();
+    }
+
+    /**
+     * @brief Pick the time in the slack window with the most trailing zero
+     * bits, so the tasks whose windows overlap tend to pick the same time.
+     */
+    void update_fire_time() {
+      if (slack <= duration::zero()) {
+        fire_time = next_run_time;
+        return;
+      }
+      // the whole microseconds in the window
+      auto lo = uint64_t(
+          std::chrono::ceil<duration>(next_run_time.time_since_epoch())
+              .count());
+      auto hi = uint64_t(std::chrono::floor<duration>(
+                             (next_run_time + slack).time_since_epoch())
+                             .count());
+      auto mask = lo == hi ? 0 : std::bit_floor(lo ^ hi) - 1;
+      fire_time = time_point(duration(hi & ~mask));
     }
 
     /**
@@ -104,31 +205,23 @@ class Timer {
     }
   };
 
- protected:
-  /**
-   * @brief To sort the task in tasks_
-   */
-  inline static const std::function<bool(const std::unique_ptr<Task> &,
-                                         const std::unique_ptr<Task> &)>
-      cmp_ = [](const std::unique_ptr<Task> &lhs,
-                const std::unique_ptr<Task> &rhs) {
-        return lhs->next_run_time > rhs->next_run_time;
-      };
-
- public:
   /**
    * @brief Add task. The task won't run until start() is call. Each task
    * will be run after its specified start_delay. Task may also be added
    * after start(), in which case start_delay is still honored.
    × @param task_id Task ID. The task ID can only be reused after
    completing all scheduling times of the task or the task is cancelled..
+   * @param slack How late the task may run. Tasks with slack are run together
+   * when their windows overlap, so the timer wakes up less often.
    * @return Return false if there is some invalid parameters or the task id has
    * been used.
    */
   bool add(ID const &task_id, std::function<void()> &&call_back,
            duration start_delay, int times = 1,
-           duration interval = duration::zero()) {
-    if (Task::check(call_back, start_delay, times, interval)) return false;
+           duration interval = duration::zero(),
+           duration slack = duration::zero()) {
+    if (!Task::check(call_back, start_delay, times, interval, slack))
+      return false;
 
     std::lock_guard lock(tasks_mutex_);
 
@@ -136,15 +229,16 @@ class Timer {
 
     // construct a new task
     auto p_task = std::make_unique<Task>(std::move(call_back), start_delay,
-                                         times, interval);
+                                         times, interval, slack);
     if (running_) {
       p_task->reset_next_run_time(clock::now());
-      tasks_.push(task_id, std::move(p_task));
+      tasks_.push(task_id, p_task->fire_time, std::move(p_task));
       // Signal the running thread to wake up and see if it needs to change its
       // current scheduling decision.
       running_cv_.notify_one();
     } else {
-      tasks_.push(task_id, std::move(p_task));
+      // the priority is set by start()
+      tasks_.push(task_id, time_point(), std::move(p_task));
     }
     return true;
   }
@@ -159,8 +253,11 @@ class Timer {
     bool ret = false;
     {
       std::lock_guard lock(tasks_mutex_);
-      ret = tasks_.update(task_id, call_back);
-      if (ret == false && cur_task_ && cur_task_id_ == task_id) {
+      if (auto task = tasks_.get(task_id)) {
+        call_back(**task);
+        (*task)->update_fire_time();
+        ret = tasks_.update(task_id, (*task)->fire_time);
+      } else if (cur_task_ && cur_task_id_ == task_id) {
         // The task you want to update is running
         update_cur_task_ = std::move(call_back);
         ret = true;
@@ -175,7 +272,7 @@ class Timer {
    * @brief Remove the tasks by id.
    * @return Return false if no such task exist.
    */
-  bool cancel(size_t task_id) {
+  bool cancel(ID const &task_id) {
     std::lock_guard lock(tasks_mutex_);
     auto ret = tasks_.erase(task_id);
     if (ret == false && cur_task_ && cur_task_id_ == task_id) {
@@ -199,8 +296,10 @@ class Timer {
 
     std::lock_guard lock(tasks_mutex_);
     // modify the next_run_time
-    tasks_.update(
-        [now = clock::now()](Task &task) { task.reset_next_run_time(now); });
+    tasks_.update_all([now = clock::now()](std::unique_ptr<Task> &task) {
+      task->reset_next_run_time(now);
+      return task->fire_time;
+    });
     running_ = true;
     thread_ = std::thread(&Timer::worker, this);
     return true;
@@ -212,8 +311,11 @@ class Timer {
    * @return Return false if the timer has been stopped.
    */
   bool stop() {
-    if (running_) return false;
-    running_ = false;
+    if (!running_) return false;
+    {
+      std::lock_guard lock(tasks_mutex_);
+      running_ = false;
+    }
     // wake the worker
     running_cv_.notify_one();
     thread_.join();
@@ -232,6 +334,11 @@ class Timer {
    */
   void set_steady(bool steady) { steady_ = steady; }
 
+  /**
+   * @brief Get the wakeups of the timer thread.
+   */
+  const WakeupCounter &wakeups() const { return wakeups_; }
+
   /**
    * @brief Clear all the tasks
    */
@@ -243,7 +350,7 @@ class Timer {
     }
   }
 
-  Timer() : tasks_(cmp_) {}
+  Timer() = default;
 
   ~Timer() { stop(); }
 
@@ -256,6 +363,7 @@ class Timer {
     while (running_) {
       if (tasks_.empty()) {
         running_cv_.wait(lock);
+        wakeups_.add(clock::now());
         continue;
       }
       // Due to the existence of the Timer::update function, the Task may become
@@ -267,15 +375,26 @@ class Timer {
       }
 
       const auto now = clock::now();
-      const auto sleep_time = tasks_.back()->next_run_time - now;
+      const auto sleep_time = tasks_.top_priority() - now;
       if (sleep_time < duration::zero()) {
         run_one_task(lock, now);
       } else {
         running_cv_.wait_for(lock, sleep_time);
+        wakeups_.add(clock::now());
       }
     }
   }
 
+  /**
+   * @brief The task id passed to the timer_fire probe.
+   */
+  static int64_t probe_id(const ID &id) {
+    if constexpr (std::is_integral_v<ID>)
+      return int64_t(id);
+    else
+      return -1;
+  }
+
   /**
    * @brief Run one task from tasks_. The lock should be locked before calling.
    */
@@ -289,6 +408,10 @@ class Timer {
 
     // run the task
     lock.unlock();
+    TWS_PROBE(timer_fire, probe_id(cur_task_id_),
+              std::chrono::duration_cast<std::chrono::nanoseconds>(
+                  now - cur_task_->next_run_time)
+                  .count());
     try {
       cur_task_->call_back();
     } catch (...) {
@@ -309,15 +432,17 @@ class Timer {
       // time to run.)
       cur_task_->next_run_time = now + cur_task_->interval;
     }
+    cur_task_->update_fire_time();
 
     if (remove_cur_task_ == false) {
       // update the running task
       if (update_cur_task_) {
-        update_cur_task(*cur_task_);
+        update_cur_task_(*cur_task_);
+        cur_task_->update_fire_time();
       }
       // Determine whether the task needs to be rescheduled
       if (cur_task_->need_schedule()) {
-        tasks_.push(cur_task_id_, std::move(cur_task_));
+        tasks_.push(cur_task_id_, cur_task_->fire_time, std::move(cur_task_));
       }
     }
 
@@ -349,11 +474,12 @@ class Timer {
   mutable std::mutex tasks_mutex_;
 
   /**
-   * @brief Tasks container. It uses a minimal heap to manage elements. And The
-   * currently scheduling task will be popped up from it temporarily, because
-   * the next_run_time_ of task needs to be recalculated.
+   * @brief Tasks container. It uses a minimal heap of the fire_time to manage
+   * elements. And The currently scheduling task will be popped up from it
+   * temporarily, because the next_run_time_ of task needs to be recalculated.
    */
-  KVHeap<ID, std::unique_ptr<Task>, decltype(cmp_)> tasks_;
+  DaryKVHeap<ID, std::unique_ptr<Task>, time_point, std::greater<time_point>>
+      tasks_;
 
   /**
    * @brief The task id of current running task.
@@ -377,6 +503,8 @@ class Timer {
    */
   std::function<void(Task &)> update_cur_task_ = nullptr;
 
+  WakeupCounter wakeups_;
+
   std::atomic<bool> steady_ = false;
 };
 
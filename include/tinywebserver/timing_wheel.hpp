@@ -0,0 +1,542 @@
+#ifndef TIMING_WHEEL_H_
+#define TIMING_WHEEL_H_
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "tinywebserver/pool/thread_pool.hpp"
+#include "tinywebserver/timer.hpp"
+#include "tinywebserver/utils/probes.h"
+
+/**
+ * @brief A drop-in alternative to Timer<ID> backed by a hierarchical timing
+ * wheel. add(), update() and cancel() are O(1) and only wake the worker when
+ * the task is due before its planned wakeup. The worker collects every task
+ * due in a tick and fires them as a batch, inline or on a ThreadPool.
+ *
+ * Time is cut into ticks, a task fires in the first tick that is not before
+ * its fire_time, so it is late by less than a tick and its slack plus the
+ * wakeup latency. There are n_levels wheels of wheel_size slots, a level covers
+ * wheel_size times the span of the level below, and the tasks of a slot are
+ * moved down a level when the wheel below wraps. Tasks farther than the span
+ * of all the levels (2^32 ticks) wait in the last slot and are moved again.
+ *
+ * @tparam ID The unique id of the task.
+ */
+template <typename ID>
+class TimingWheel {
+ public:
+  using duration = typename Timer<ID>::duration;
+  using clock = typename Timer<ID>::clock;
+  using time_point = typename Timer<ID>::time_point;
+
+  /**
+   * @brief The same as Timer<ID>::Task, including times, interval and the
+   * steady mode.
+   */
+  using Task = typename Timer<ID>::Task;
+
+  static constexpr size_t wheel_bits = 8;
+
+  static constexpr size_t wheel_size = size_t(1) << wheel_bits;
+
+  static constexpr size_t n_levels = 4;
+
+  /**
+   * @param tick The resolution of the wheel.
+   */
+  explicit TimingWheel(duration tick = std::chrono::milliseconds(1))
+      : tick_(tick > duration::zero() ? tick : duration(1)) {}
+
+  ~TimingWheel() { stop(); }
+
+  TimingWheel(const TimingWheel &) = delete;
+
+  TimingWheel &operator=(const TimingWheel &) = delete;
+
+  /**
+   * @brief Add task, see Timer::add().
+   * @return Return false if there is some invalid parameters or the task id has
+   * been used.
+   */
+  bool add(ID const &task_id, std::function<void()> &&call_back,
+           duration start_delay, int times = 1,
+           duration interval = duration::zero(),
+           duration slack = duration::zero()) {
+    if (!Task::check(call_back, start_delay, times, interval, slack))
+      return false;
+
+    std::lock_guard lock(tasks_mutex_);
+    auto [it, inserted] = tasks_.try_emplace(task_id);
+    if (!inserted) return false;
+    it->second = std::make_unique<Node>(task_id, std::move(call_back),
+                                        start_delay, times, interval, slack);
+    if (running_) {
+      auto node = it->second.get();
+      node->task.reset_next_run_time(clock::now());
+      link(node);
+      wake_if_earlier(node->expire);
+    }
+    return true;
+  }
+
+  /**
+   * @brief Update Task, see Timer::update(). The task is moved to the slot of
+   * its new next_run_time.
+   */
+  bool update(ID const &task_id, std::function<void(Task &task)> &&call_back) {
+    std::lock_guard lock(tasks_mutex_);
+    auto it = tasks_.find(task_id);
+    if (it == tasks_.end()) return false;
+    auto node = it->second.get();
+    if (node->running) {
+      // applied after the batch is fired
+      node->update = std::move(call_back);
+      return true;
+    }
+    call_back(node->task);
+    node->task.update_fire_time();
+    if (!node->task.need_schedule()) {
+      unlink(node);
+      tasks_.erase(it);
+      return true;
+    }
+    if (running_) {
+      unlink(node);
+      link(node);
+      wake_if_earlier(node->expire);
+    }
+    return true;
+  }
+
+  /**
+   * @brief Remove the tasks by id.
+   * @return Return false if no such task exist.
+   */
+  bool cancel(ID const &task_id) {
+    std::lock_guard lock(tasks_mutex_);
+    auto it = tasks_.find(task_id);
+    if (it == tasks_.end()) return false;
+    auto node = it->second.get();
+    if (node->running) {
+      node->cancelled = true;
+      return true;
+    }
+    unlink(node);
+    tasks_.erase(it);
+    return true;
+  }
+
+  /**
+   * @brief Start a backstage thread to schedule the tasks.
+   * @return Return false if the timer is running.
+   */
+  bool start() {
+    std::lock_guard lock(tasks_mutex_);
+    if (running_) return false;
+    origin_ = clock::now();
+    base_ = 0;
+    for (auto &[id, node] : tasks_) {
+      node->task.reset_next_run_time(origin_);
+      link(node.get());
+    }
+    running_ = true;
+    thread_ = std::thread(&TimingWheel::worker, this);
+    return true;
+  }
+
+  /**
+   * @brief Stop the timer temporarily, see Timer::stop().
+   * @return Return false if the timer has been stopped.
+   */
+  bool stop() {
+    {
+      std::lock_guard lock(tasks_mutex_);
+      if (!running_) return false;
+      running_ = false;
+    }
+    running_cv_.notify_one();
+    thread_.join();
+    std::lock_guard lock(tasks_mutex_);
+    for (auto &[id, node] : tasks_) unlink(node.get());
+    return true;
+  }
+
+  /**
+   * @brief See Timer::set_steady().
+   */
+  void set_steady(bool steady) { steady_ = steady; }
+
+  /**
+   * @brief Get the wakeups of the timer thread.
+   */
+  const WakeupCounter &wakeups() const { return wakeups_; }
+
+  /**
+   * @brief Run the callbacks on the pool instead of the timer thread, so a
+   * slow callback doesn't delay the others. nullptr runs them inline. A
+   * repeating task is rescheduled when its callback is dispatched, so its
+   * runs may overlap if a run takes longer than the interval.
+   * @note The pool must outlive the timer or be reset before it is destroyed.
+   */
+  void set_thread_pool(ThreadPool *pool) {
+    std::lock_guard lock(tasks_mutex_);
+    pool_ = pool;
+  }
+
+  /**
+   * @brief Clear all the tasks
+   */
+  void clear() {
+    std::lock_guard lock(tasks_mutex_);
+    for (auto it = tasks_.begin(); it != tasks_.end();) {
+      auto node = it->second.get();
+      if (node->running) {
+        node->cancelled = true;
+        ++it;
+      } else {
+        unlink(node);
+        it = tasks_.erase(it);
+      }
+    }
+  }
+
+  /**
+   * @brief Get the number of tasks, including the ones being fired.
+   */
+  size_t size() const {
+    std::lock_guard lock(tasks_mutex_);
+    return tasks_.size();
+  }
+
+ protected:
+  struct Node {
+    template <typename... Args>
+    Node(ID const &id, Args &&...args)
+        : id(id), task(std::forward<Args>(args)...) {}
+
+    ID id;
+
+    Task task;
+
+    /**
+     * @brief The tick that the task fires in.
+     */
+    uint64_t expire = 0;
+
+    /**
+     * @brief The links of the slot list, prev is nullptr for the head.
+     */
+    Node *prev = nullptr;
+    Node *next = nullptr;
+
+    /**
+     * @brief The level and the slot, level is n_levels if it is not linked.
+     */
+    uint8_t level = n_levels;
+    uint8_t slot = 0;
+
+    /**
+     * @brief Whether it is in the batch being fired.
+     */
+    bool running = false;
+
+    bool cancelled = false;
+
+    /**
+     * @brief The update() received while it was being fired.
+     */
+    std::function<void(Task &)> update;
+  };
+
+  /**
+   * @brief The first tick that does not start before the time point.
+   */
+  uint64_t tick_of(time_point tp) const {
+    if (tp <= origin_) return 0;
+    return (tp - origin_ + tick_ - std::chrono::nanoseconds(1)) / tick_;
+  }
+
+  /**
+   * @brief Put the node in the slot of its fire_time.
+   */
+  void link(Node *node) {
+    node->expire = std::max(tick_of(node->task.fire_time), base_);
+    place(node);
+  }
+
+  void place(Node *node) {
+    uint64_t delta = node->expire - base_;
+    size_t level = 0;
+    while (level + 1 < n_levels && delta >> (wheel_bits * (level + 1)))
+      ++level;
+    uint64_t expire = node->expire;
+    // farther than the last level, wait at its farthest slot
+    if (level == n_levels - 1 && delta >> (wheel_bits * n_levels))
+      expire = base_ + (uint64_t(1) << (wheel_bits * n_levels)) - 1;
+    size_t slot = (expire >> (wheel_bits * level)) & (wheel_size - 1);
+
+    auto &head = slots_[level][slot];
+    node->prev = nullptr;
+    node->next = head;
+    if (head) head->prev = node;
+    head = node;
+    node->level = level;
+    node->slot = slot;
+    occupied_[level][slot / 64] |= uint64_t(1) << (slot % 64);
+  }
+
+  void unlink(Node *node) {
+    if (node->level == n_levels) return;
+    auto &head = slots_[node->level][node->slot];
+    if (node->prev)
+      node->prev->next = node->next;
+    else
+      head = node->next;
+    if (node->next) node->next->prev = node->prev;
+    if (head == nullptr)
+      occupied_[node->level][node->slot / 64] &=
+          ~(uint64_t(1) << (node->slot % 64));
+    node->prev = node->next = nullptr;
+    node->level = n_levels;
+  }
+
+  /**
+   * @brief Take the whole list of a slot.
+   */
+  Node *take(size_t level, size_t slot) {
+    auto head = std::exchange(slots_[level][slot], nullptr);
+    occupied_[level][slot / 64] &= ~(uint64_t(1) << (slot % 64));
+    return head;
+  }
+
+  /**
+   * @brief Move the tasks of the slot at base_ of the level down.
+   * @return The index of the slot.
+   */
+  size_t cascade(size_t level) {
+    size_t slot = (base_ >> (wheel_bits * level)) & (wheel_size - 1);
+    for (auto node = take(level, slot); node;) {
+      auto next = node->next;
+      place(node);
+      node = next;
+    }
+    return slot;
+  }
+
+  /**
+   * @brief Get the first slot from index that is occupied in the level.
+   * @return wheel_size if there is none.
+   */
+  size_t next_occupied(size_t level, size_t index) const {
+    for (size_t w = index / 64; w < wheel_size / 64; ++w) {
+      auto bits = occupied_[level][w];
+      if (w == index / 64) bits &= ~uint64_t(0) << (index % 64);
+      if (bits) return w * 64 + std::countr_zero(bits);
+    }
+    return wheel_size;
+  }
+
+  bool empty_wheel() const {
+    for (auto &level : occupied_)
+      for (auto w : level)
+        if (w) return false;
+    return true;
+  }
+
+  /**
+   * @brief The next tick that has tasks in the first level or moves tasks
+   * down, UINT64_MAX if the wheel is empty. The empty slots are skipped, so
+   * a far task costs a few steps instead of one per wheel_size ticks.
+   */
+  uint64_t next_tick() const {
+    if (empty_wheel()) return UINT64_MAX;
+    // the higher levels are not moved down yet
+    if ((base_ & (wheel_size - 1)) == 0) return base_;
+    uint64_t ret = UINT64_MAX;
+    for (size_t level = 0; level < n_levels; ++level) {
+      const size_t shift = wheel_bits * level;
+      const uint64_t pos = base_ >> shift;
+      // the current slot of a higher level has been moved down, a task in it
+      // is a whole turn away
+      size_t slot = next_occupied(level, (pos + (level > 0)) % wheel_size);
+      if (slot == wheel_size) slot = next_occupied(level, 0);
+      if (slot == wheel_size) continue;
+      uint64_t distance = (slot - pos) % wheel_size;
+      if (level > 0 && distance == 0) distance = wheel_size;
+      ret = std::min(ret, (pos + distance) << shift);
+    }
+    return ret;
+  }
+
+  /**
+   * @brief Collect the tasks of the ticks up to now_tick.
+   */
+  void collect(uint64_t now_tick, std::vector<Node *> &batch) {
+    for (uint64_t t; (t = next_tick()) <= now_tick;) {
+      base_ = t;
+      size_t index = base_ & (wheel_size - 1);
+      for (size_t level = 1; index == 0 && level < n_levels; ++level)
+        index = cascade(level);
+      for (auto node = take(0, base_ & (wheel_size - 1)); node;) {
+        auto next = node->next;
+        node->prev = node->next = nullptr;
+        node->level = n_levels;
+        node->running = true;
+        batch.push_back(node);
+        node = next;
+      }
+      ++base_;
+    }
+    if (base_ <= now_tick) base_ = now_tick + 1;
+  }
+
+  void wake_if_earlier(uint64_t expire) {
+    if (expire < wake_tick_) running_cv_.notify_one();
+  }
+
+  /**
+   * @brief The task id passed to the timer_fire probe.
+   */
+  static int64_t probe_id(const ID &id) {
+    if constexpr (std::is_integral_v<ID>)
+      return int64_t(id);
+    else
+      return -1;
+  }
+
+  void worker() {
+    std::vector<Node *> batch;
+    std::vector<std::function<void()>> dispatched;
+    std::unique_lock lock(tasks_mutex_);
+    while (running_) {
+      auto now = clock::now();
+      collect((now - origin_) / tick_, batch);
+      if (batch.empty()) {
+        auto next = next_tick();
+        wake_tick_ = next;
+        if (next == UINT64_MAX)
+          running_cv_.wait(lock);
+        else
+          running_cv_.wait_until(lock, origin_ + next * tick_);
+        wake_tick_ = 0;
+        wakeups_.add(clock::now());
+        continue;
+      }
+
+      if (pool_ == nullptr) {
+        lock.unlock();
+        for (auto node : batch) {
+          TWS_PROBE(timer_fire, probe_id(node->id),
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        now - node->task.next_run_time)
+                        .count());
+          try {
+            node->task.call_back();
+          } catch (...) {
+          }
+        }
+        lock.lock();
+      } else {
+        for (auto node : batch) dispatched.push_back(node->task.call_back);
+      }
+      finish(batch, now);
+      batch.clear();
+
+      if (!dispatched.empty()) {
+        auto pool = pool_;
+        lock.unlock();
+        // the whole batch under one lock of the pool
+        pool->push_tasks(std::move(dispatched));
+        dispatched.clear();
+        lock.lock();
+      }
+    }
+  }
+
+  /**
+   * @brief Reschedule the fired tasks. The lock should be locked.
+   */
+  void finish(const std::vector<Node *> &batch, time_point now) {
+    for (auto node : batch) {
+      node->running = false;
+      auto &task = node->task;
+      if (!node->cancelled) {
+        task.reduce_times();
+        if (steady_)
+          task.next_run_time += task.interval;
+        else
+          task.next_run_time = now + task.interval;
+        if (node->update) {
+          node->update(task);
+          node->update = nullptr;
+        }
+        task.update_fire_time();
+      }
+      if (node->cancelled || !task.need_schedule())
+        tasks_.erase(node->id);
+      else
+        link(node);
+    }
+  }
+
+  duration tick_;
+
+  /**
+   * @brief The time of tick 0, set by start().
+   */
+  time_point origin_;
+
+  /**
+   * @brief The next tick to collect.
+   */
+  uint64_t base_ = 0;
+
+  /**
+   * @brief The tick that the sleeping worker wakes up at, 0 if it is not
+   * sleeping. add() and update() only wake it for earlier tasks.
+   */
+  uint64_t wake_tick_ = 0;
+
+  std::array<std::array<Node *, wheel_size>, n_levels> slots_ = {};
+
+  /**
+   * @brief A bit per slot that has tasks.
+   */
+  std::array<std::array<uint64_t, wheel_size / 64>, n_levels> occupied_ = {};
+
+  /**
+   * @brief All the tasks, linked or being fired.
+   */
+  std::unordered_map<ID, std::unique_ptr<Node>> tasks_;
+
+  ThreadPool *pool_ = nullptr;
+
+  WakeupCounter wakeups_;
+
+  std::thread thread_;
+
+  std::atomic<bool> running_{false};
+
+  std::condition_variable running_cv_;
+
+  mutable std::mutex tasks_mutex_;
+
+  std::atomic<bool> steady_ = false;
+};
+
+#endif
@@ -126,13 +126,13 @@ class Buffer {
       write_ptr_ = read_ptr_ + move_size;
     } else {
       // reallocate space
-      auto new_size = size * 2;
+      auto new_size = std::max(cap_ * 2, move_size + size);
       auto new_buf = std::make_unique<char[]>(new_size);
       std::copy(read_ptr_, write_ptr_, new_buf.get());
       // reset the pointer
       data_ = std::move(new_buf);
       cap_ = new_size;
-      begin_ptr_ = new_buf.get();
+      begin_ptr_ = data_.get();
       read_ptr_ = begin_ptr_;
       write_ptr_ = read_ptr_ + move_size;
     }
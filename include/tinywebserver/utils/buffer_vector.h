@@ -38,8 +38,9 @@ class IOVector {
         step -= iov.iov_len;
         ++begin_;
       } else {
-        step = 0;
         iov.iov_base = reinterpret_cast<char*>(iov.iov_base) + step;
+        iov.iov_len -= step;
+        step = 0;
       }
     }
   }
@@ -358,11 +359,11 @@ class BufferVector {
       ++it_end;
     }
 
+    // insert the full segments in order before the segment being written
     while (buffer.data_.begin() != it_end) {
-      it_write_ = data_.emplace(it_write_, std::move(buffer.data_.front()));
+      data_.emplace(it_write_, std::move(buffer.data_.front()));
       buffer.data_.pop_front();
     }
-    forward_writer();
 
     // set the buffer
     buffer.n_read_ = buffer.n_write_ = 0;
@@ -0,0 +1,99 @@
+#ifndef UTILS_CPU_H_
+#define UTILS_CPU_H_
+
+#include <errno.h>
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <charconv>
+#include <string_view>
+#include <vector>
+
+#include "tinywebserver/utils/sv.h"
+
+/**
+ * @brief Parse a CPU list in the format of /sys/devices/system/cpu/online,
+ * for example "0-3,8,10-11".
+ * @return Return an empty vector if the list is empty or invalid.
+ */
+inline std::vector<int> parse_cpu_list(std::string_view list) {
+  auto to_int = [](std::string_view str, int &value) {
+    str = trim(str);
+    auto end = str.data() + str.size();
+    auto [ptr, ec] = std::from_chars(str.data(), end, value);
+    return ec == std::errc() && ptr == end && value >= 0;
+  };
+
+  std::vector<int> ret;
+  for (size_t pos = 0; pos < list.size();) {
+    auto next = list.find(',', pos);
+    if (next == std::string_view::npos) next = list.size();
+    auto item = trim(list.substr(pos, next - pos));
+    pos = next + 1;
+    if (item.empty()) continue;
+
+    int first, last;
+    if (auto dash = item.find('-'); dash == std::string_view::npos) {
+      if (!to_int(item, first)) return {};
+      last = first;
+    } else if (!to_int(item.substr(0, dash), first) ||
+               !to_int(item.substr(dash + 1), last) || first > last) {
+      return {};
+    }
+    for (int cpu = first; cpu <= last; ++cpu) ret.push_back(cpu);
+  }
+  return ret;
+}
+
+/**
+ * @brief Restrict the thread to run on the CPUs.
+ */
+inline bool set_thread_affinity(pthread_t thread,
+                                const std::vector<int> &cpus) {
+  if (cpus.empty()) return false;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (auto cpu : cpus) {
+    if (cpu < 0 || cpu >= CPU_SETSIZE) return false;
+    CPU_SET(cpu, &set);
+  }
+  return pthread_setaffinity_np(thread, sizeof(set), &set) == 0;
+}
+
+/**
+ * @brief Whether the process may run on every one of the CPUs, so pinning a
+ * thread to them can succeed.
+ */
+inline bool cpus_allowed(const std::vector<int> &cpus) {
+  if (cpus.empty()) return false;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) != 0) return false;
+  for (auto cpu : cpus)
+    if (cpu < 0 || cpu >= CPU_SETSIZE || !CPU_ISSET(cpu, &set)) return false;
+  return true;
+}
+
+/**
+ * @brief Let the calling thread allocate memory on the NUMA node of the CPU it
+ * is running on, even if the process was started with another policy such as
+ * numactl --interleave.
+ */
+inline bool bind_local_memory() {
+  return syscall(SYS_set_mempolicy, MPOL_LOCAL, nullptr, 0) == 0;
+}
+
+/**
+ * @brief Pin the calling thread to the CPUs and bind its memory to the local
+ * NUMA node. It should be called before the thread allocates its buffers. A
+ * kernel without NUMA support has one node, so the binding is not needed.
+ */
+inline bool pin_current_thread(const std::vector<int> &cpus) {
+  return set_thread_affinity(pthread_self(), cpus) &&
+         (bind_local_memory() || errno == ENOSYS);
+}
+
+#endif
@@ -0,0 +1,358 @@
+#ifndef DARY_KVHEAP_H_
+#define DARY_KVHEAP_H_
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief A d-ary heap of values ordered by a separate priority, whose
+ * elements can be accessed, updated or erased by key like KVHeap.
+ *
+ * The heap array only holds (priority, slot) pairs, so sifting moves small
+ * entries and compares the priorities without touching the values. The values
+ * live in slots that don't move, every slot knows the position of its entry,
+ * and a key is mapped to its slot by a vector when it is a small non-negative
+ * integer such as a fd, or by a hash map otherwise. So a sift writes no hash
+ * map.
+ *
+ * Like std::priority_queue, top() is an element that no other element is
+ * ordered after by Compare, use std::greater for a min-heap.
+ *
+ * @tparam Arity The number of children of a node, 4 children of an entry of
+ * 16 bytes fit in a cache line.
+ */
+template <typename Key, typename Value, typename Priority,
+          typename Compare = std::less<Priority>, size_t Arity = 4>
+class DaryKVHeap {
+  static_assert(Arity >= 2);
+
+ public:
+  /**
+   * @brief Integer keys from it are indexed by the hash map, so a big key
+   * doesn't grow the vector.
+   */
+  static constexpr size_t max_dense_key = size_t(1) << 20;
+
+  explicit DaryKVHeap(const Compare &compare = Compare()) : cmp_(compare) {}
+
+  /**
+   * @note Return const reference to avoid being modified by callers.
+   */
+  const Value &top() const { return *slots_[heap_[0].slot].value; }
+
+  const Key &top_key() const { return slots_[heap_[0].slot].key; }
+
+  const Priority &top_priority() const { return heap_[0].priority; }
+
+  /**
+   * @return The key and the value.
+   */
+  std::pair<Key, Value> pop() {
+    auto &slot = slots_[heap_[0].slot];
+    std::pair<Key, Value> ret = {slot.key, std::move(*slot.value)};
+    erase_by_pos(0);
+    return ret;
+  }
+
+  size_t size() const { return heap_.size(); }
+
+  bool empty() const { return heap_.empty(); }
+
+  size_t count(Key const &key) const { return find_slot(key) != npos; }
+
+  void clear() {
+    heap_.clear();
+    slots_.clear();
+    free_.clear();
+    dense_.clear();
+    sparse_.clear();
+  }
+
+  /**
+   * @brief Access the value by key. The value may be modified, it doesn't
+   * affect the order.
+   * @return nullptr if there is no such key.
+   */
+  Value *get(Key const &key) {
+    auto slot = find_slot(key);
+    return slot == npos ? nullptr : &*slots_[slot].value;
+  }
+
+  const Value *get(Key const &key) const {
+    auto slot = find_slot(key);
+    return slot == npos ? nullptr : &*slots_[slot].value;
+  }
+
+  template <typename... Args>
+  bool emplace(Key const &key, Priority priority, Args &&...args) {
+    if (find_slot(key) != npos) return false;
+    auto slot = alloc_slot(key, std::forward<Args>(args)...);
+    append(std::move(priority), slot);
+    sift_up(heap_.size() - 1);
+    return true;
+  }
+
+  bool push(Key const &key, Priority priority, const Value &value) {
+    return emplace(key, std::move(priority), value);
+  }
+
+  bool push(Key const &key, Priority priority, Value &&value) {
+    return emplace(key, std::move(priority), std::move(value));
+  }
+
+  /**
+   * @brief Push a range of (key, priority, value), the keys that exist are
+   * skipped. The heap is rebuilt in O(n) if the range is not smaller than the
+   * heap, otherwise the elements are sifted up one by one.
+   * @param range The values are moved if the range is an rvalue, otherwise
+   * they are copied.
+   * @return The number of pushed elements.
+   */
+  template <typename Range>
+  size_t push_range(Range &&range) {
+    size_t n = heap_.size();
+    for (auto &&[key, priority, value] : range) {
+      if (find_slot(key) != npos) continue;
+      uint32_t slot;
+      if constexpr (std::is_lvalue_reference_v<Range>)
+        slot = alloc_slot(key, value);
+      else
+        slot = alloc_slot(key, std::move(value));
+      append(priority, slot);
+    }
+    size_t added = heap_.size() - n;
+    if (added >= n) {
+      heapify();
+    } else {
+      for (size_t i = n; i < heap_.size(); ++i) sift_up(i);
+    }
+    return added;
+  }
+
+  bool erase(Key const &key) {
+    auto slot = find_slot(key);
+    if (slot == npos) return false;
+    erase_by_pos(slots_[slot].pos);
+    return true;
+  }
+
+  /**
+   * @brief Change the priority of the key.
+   */
+  bool update(Key const &key, Priority priority) {
+    auto slot = find_slot(key);
+    if (slot == npos) return false;
+    auto pos = slots_[slot].pos;
+    heap_[pos].priority = std::move(priority);
+    if (!sift_up(pos)) sift_down(pos);
+    return true;
+  }
+
+  /**
+   * @brief Update all the elements and rebuild the heap in O(n).
+   * @param fn It is called as fn(value) and returns the new priority.
+   */
+  template <typename F>
+  void update_all(F &&fn) {
+    for (auto &entry : heap_) entry.priority = fn(*slots_[entry.slot].value);
+    heapify();
+  }
+
+  /**
+   * @brief Pop the top while pred(top_priority()) holds, like draining the
+   * expired timers.
+   * @param fn It is called as fn(key, value) after the element is popped, so
+   * it may push the element again.
+   * @return The number of popped elements.
+   */
+  template <typename Pred, typename F>
+  size_t pop_while(Pred &&pred, F &&fn) {
+    size_t n = 0;
+    while (!heap_.empty() && pred(heap_[0].priority)) {
+      auto [key, value] = pop();
+      fn(key, std::move(value));
+      ++n;
+    }
+    return n;
+  }
+
+ protected:
+  static constexpr uint32_t npos = UINT32_MAX;
+
+  /**
+   * @brief The entry of the heap array.
+   */
+  struct Entry {
+    Priority priority;
+    uint32_t slot;
+  };
+
+  struct Slot {
+    Key key;
+
+    /**
+     * @brief The position of the entry in heap_.
+     */
+    uint32_t pos;
+
+    std::optional<Value> value;
+  };
+
+  /**
+   * @brief Whether the integer key is indexed by dense_.
+   */
+  static bool is_dense(Key const &key) {
+    if constexpr (std::is_signed_v<Key>)
+      if (key < 0) return false;
+    return size_t(key) < max_dense_key;
+  }
+
+  uint32_t find_slot(Key const &key) const {
+    if constexpr (std::is_integral_v<Key>) {
+      if (is_dense(key))
+        return size_t(key) < dense_.size() ? dense_[size_t(key)] : npos;
+    }
+    auto it = sparse_.find(key);
+    return it == sparse_.end() ? npos : it->second;
+  }
+
+  /**
+   * @brief Map the key to the slot, npos removes the key.
+   */
+  void set_slot(Key const &key, uint32_t slot) {
+    if constexpr (std::is_integral_v<Key>) {
+      if (is_dense(key)) {
+        auto i = size_t(key);
+        if (i >= dense_.size())
+          dense_.resize(std::min(std::max(i + 1, dense_.size() * 2),
+                                 max_dense_key),
+                        npos);
+        dense_[i] = slot;
+        return;
+      }
+    }
+    if (slot == npos)
+      sparse_.erase(key);
+    else
+      sparse_[key] = slot;
+  }
+
+  template <typename... Args>
+  uint32_t alloc_slot(Key const &key, Args &&...args) {
+    uint32_t slot;
+    if (free_.empty()) {
+      slot = slots_.size();
+      slots_.emplace_back();
+    } else {
+      slot = free_.back();
+      free_.pop_back();
+    }
+    slots_[slot].key = key;
+    slots_[slot].value.emplace(std::forward<Args>(args)...);
+    set_slot(key, slot);
+    return slot;
+  }
+
+  void append(Priority priority, uint32_t slot) {
+    slots_[slot].pos = heap_.size();
+    heap_.push_back({std::move(priority), slot});
+  }
+
+  void erase_by_pos(size_t pos) {
+    assert(pos < heap_.size());
+    auto slot = heap_[pos].slot;
+    set_slot(slots_[slot].key, npos);
+    slots_[slot].value.reset();
+    free_.push_back(slot);
+
+    size_t last = heap_.size() - 1;
+    if (pos != last) {
+      place(pos, std::move(heap_[last]));
+      heap_.pop_back();
+      if (!sift_up(pos)) sift_down(pos);
+    } else {
+      heap_.pop_back();
+    }
+  }
+
+  /**
+   * @brief Put the entry at pos and tell its slot.
+   */
+  void place(size_t pos, Entry &&entry) {
+    slots_[entry.slot].pos = pos;
+    heap_[pos] = std::move(entry);
+  }
+
+  /**
+   * @brief Move the entry at pos up, the entries on the way are moved down
+   * instead of swapped.
+   */
+  bool sift_up(size_t pos) {
+    assert(pos < heap_.size());
+    auto start = pos;
+    Entry entry = std::move(heap_[pos]);
+    while (pos > 0) {
+      auto parent = (pos - 1) / Arity;
+      if (!cmp_(heap_[parent].priority, entry.priority)) break;
+      place(pos, std::move(heap_[parent]));
+      pos = parent;
+    }
+    place(pos, std::move(entry));
+    return pos != start;
+  }
+
+  bool sift_down(size_t pos) {
+    assert(pos < heap_.size());
+    auto start = pos;
+    size_t n = heap_.size();
+    Entry entry = std::move(heap_[pos]);
+    for (size_t first = pos * Arity + 1; first < n; first = pos * Arity + 1) {
+      auto best = first;
+      for (auto c = first + 1; c < std::min(first + Arity, n); ++c)
+        if (cmp_(heap_[best].priority, heap_[c].priority)) best = c;
+      if (!cmp_(entry.priority, heap_[best].priority)) break;
+      place(pos, std::move(heap_[best]));
+      pos = best;
+    }
+    place(pos, std::move(entry));
+    return pos != start;
+  }
+
+  /**
+   * @brief Floyd's O(n) heap construction.
+   */
+  void heapify() {
+    if (heap_.size() < 2) return;
+    for (size_t i = (heap_.size() - 2) / Arity + 1; i-- > 0;) sift_down(i);
+  }
+
+  Compare cmp_;
+
+  std::vector<Entry> heap_;
+
+  std::vector<Slot> slots_;
+
+  /**
+   * @brief The slots to reuse.
+   */
+  std::vector<uint32_t> free_;
+
+  /**
+   * @brief The slots of the small integer keys, npos if there is none.
+   */
+  std::vector<uint32_t> dense_;
+
+  /**
+   * @brief The slots of the other keys.
+   */
+  std::unordered_map<Key, uint32_t> sparse_;
+};
+
+#endif
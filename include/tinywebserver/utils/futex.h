@@ -0,0 +1,44 @@
+#ifndef UTILS_FUTEX_H_
+#define UTILS_FUTEX_H_
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t),
+              "futex requires a plain 32-bit word");
+
+/**
+ * @brief Block while *addr == expected, or until timeout expires.
+ * @param timeout Relative timeout, nullptr means waiting forever.
+ */
+inline int futex_wait(std::atomic<uint32_t> *addr, uint32_t expected,
+                      const timespec *timeout = nullptr) {
+  return syscall(SYS_futex, reinterpret_cast<uint32_t *>(addr),
+                 FUTEX_WAIT_PRIVATE, expected, timeout, nullptr, 0);
+}
+
+template <typename Rep, typename Period>
+int futex_wait(std::atomic<uint32_t> *addr, uint32_t expected,
+               std::chrono::duration<Rep, Period> timeout) {
+  auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(timeout);
+  if (ns.count() < 0) ns = ns.zero();
+  timespec ts = {.tv_sec = static_cast<time_t>(ns.count() / 1000000000),
+                 .tv_nsec = static_cast<long>(ns.count() % 1000000000)};
+  return futex_wait(addr, expected, &ts);
+}
+
+/**
+ * @brief Wake up at most n threads blocked on addr.
+ */
+inline int futex_wake(std::atomic<uint32_t> *addr, int n = INT32_MAX) {
+  return syscall(SYS_futex, reinterpret_cast<uint32_t *>(addr),
+                 FUTEX_WAKE_PRIVATE, n, nullptr, nullptr, 0);
+}
+
+#endif
@@ -71,12 +71,10 @@ class KVHeap {
 
   /**
    * @brief Access the value by key
+   * @throw std::out_of_range if no such key exists.
    */
   const Value &get(Key const &key) const {
-    if (auto it = key2index_.find(key); it == key2index_.end())
-      return {};
-    else
-      return heap_[it->second].value;
+    return heap_[key2index_.at(key)].value;
   }
 
   /**
@@ -89,7 +87,7 @@ class KVHeap {
     auto index = heap_.size();
     key2index_[key] = index;
     heap_.emplace_back(key, elem);
-    sift_up(index, heap_.size());
+    sift_up(index);
     return true;
   }
 
@@ -98,7 +96,7 @@ class KVHeap {
     auto index = heap_.size();
     key2index_[key] = index;
     heap_.emplace_back(key, std::move(elem));
-    sift_up(index, heap_.size());
+    sift_up(index);
     return true;
   }
 
@@ -108,7 +106,7 @@ class KVHeap {
     auto index = heap_.size();
     key2index_[key] = index;
     heap_.emplace_back(key, std::forward<Args>(args)...);
-    sift_up(index, heap_.size());
+    sift_up(index);
     return true;
   }
 
@@ -153,7 +151,7 @@ class KVHeap {
   void update(const std::function<void(Value &obj)> &call_back) {
     for (auto it = heap_.begin(); it != heap_.end(); ++it) call_back(it->value);
     for (size_t i = 1; i < heap_.size(); ++i) {
-      sift_up(i, i + 1);
+      sift_up(i);
     }
   }
 
@@ -170,7 +168,7 @@ class KVHeap {
     assert(index < n);
     assert(n <= heap_.size());
     if (n == 1) return;
-    if (!sift_down(index, n)) sift_up(index, n);
+    if (!sift_down(index, n)) sift_up(index);
   }
 
   void earse_by_index(size_t index) {
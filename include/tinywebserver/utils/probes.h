@@ -0,0 +1,52 @@
+#ifndef PROBES_H_
+#define PROBES_H_
+
+/**
+ * @brief Static tracepoints (USDT) of the tinywebserver provider.
+ *
+ * They are compiled in when TINYWEBSERVER_USDT is defined and <sys/sdt.h> is
+ * available, see the TINYWEBSERVER_USDT option of CMake. A probe is a single
+ * nop until a tracer attaches to it, e.g.
+ *
+ *   bpftrace -e 'usdt:./tinywebserver:tinywebserver:write_done
+ *                { @[arg1] = count(); }'
+ *
+ * Otherwise TWS_PROBE expands to nothing and the arguments are not evaluated.
+ *
+ * The probes and their arguments:
+ *   accept(fd, ipv4 address, port)            a connection is accepted
+ *   request_parsed(fd, method, uri, body size) a request is complete
+ *   handler_start(fd, uri)
+ *   handler_end(fd, status, body size)
+ *   response_queued(fd, status, response size) the response is made and
+ *                                             about to be written
+ *   write_done(fd, status, response size)
+ *   close(fd)
+ *   timer_fire(task id, lateness in ns)       task id is -1 if ID is not an
+ *                                             integer
+ *   pool_task_start(wait in us, queued tasks)
+ *   pool_task_end(1 if the task expired and was dropped, otherwise 0)
+ * Addresses and ports are in network byte order, uri is a C string. The
+ * probes don't read the clock, a tracer times the start and end pairs with
+ * its own timestamps.
+ */
+
+#if defined(TINYWEBSERVER_USDT) && __has_include(<sys/sdt.h>)
+
+#include <sys/sdt.h>
+
+#define TWS_PROBES_ENABLED 1
+
+#define TWS_PROBE(name, ...) STAP_PROBEV(tinywebserver, name, ##__VA_ARGS__)
+
+#else
+
+#define TWS_PROBES_ENABLED 0
+
+#define TWS_PROBE(name, ...) \
+  do {                       \
+  } while (0)
+
+#endif
+
+#endif
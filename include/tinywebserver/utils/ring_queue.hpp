@@ -0,0 +1,127 @@
+#ifndef RING_QUEUE_H_
+#define RING_QUEUE_H_
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+
+/**
+ * @brief A FIFO queue on a growable circular array. Different to std::queue
+ * on std::deque, it doesn't allocate or free memory on push and pop once the
+ * capacity has grown to the peak size.
+ */
+template <typename T>
+class RingQueue {
+ public:
+  static const size_t default_capacity = 64;
+
+  /**
+   * @param capacity The initial capacity, it will be rounded up to a power of
+   * two.
+   */
+  explicit RingQueue(size_t capacity) { reserve(capacity); }
+
+  RingQueue() : RingQueue(default_capacity) {}
+
+  RingQueue(const RingQueue &) = delete;
+
+  RingQueue(RingQueue &&obj)
+      : data_(obj.data_), cap_(obj.cap_), head_(obj.head_), size_(obj.size_) {
+    obj.data_ = nullptr;
+    obj.cap_ = obj.head_ = obj.size_ = 0;
+  }
+
+  RingQueue &operator=(const RingQueue &) = delete;
+
+  RingQueue &operator=(RingQueue &&obj) {
+    if (this == &obj) return *this;
+    destroy();
+    std::swap(data_, obj.data_);
+    std::swap(cap_, obj.cap_);
+    std::swap(head_, obj.head_);
+    std::swap(size_, obj.size_);
+    return *this;
+  }
+
+  ~RingQueue() { destroy(); }
+
+  size_t size() const { return size_; }
+
+  bool empty() const { return size_ == 0; }
+
+  size_t capacity() const { return cap_; }
+
+  T &front() { return data_[head_]; }
+
+  const T &front() const { return data_[head_]; }
+
+  void push(T &&value) { emplace(std::move(value)); }
+
+  void push(const T &value) { emplace(value); }
+
+  template <typename... Args>
+  T &emplace(Args &&...args) {
+    if (size_ == cap_) reserve(cap_ == 0 ? 1 : cap_ * 2);
+    auto p = ::new (data_ + ((head_ + size_) & (cap_ - 1)))
+        T(std::forward<Args>(args)...);
+    ++size_;
+    return *p;
+  }
+
+  void pop() {
+    data_[head_].~T();
+    head_ = (head_ + 1) & (cap_ - 1);
+    --size_;
+  }
+
+  void clear() {
+    while (!empty()) pop();
+    head_ = 0;
+  }
+
+  /**
+   * @brief Make sure the queue can hold capacity elements without
+   * reallocation.
+   */
+  void reserve(size_t capacity) {
+    if (capacity <= cap_) return;
+    size_t new_cap = 1;
+    while (new_cap < capacity) new_cap <<= 1;
+    auto new_data = std::allocator<T>().allocate(new_cap);
+    for (size_t i = 0; i < size_; ++i) {
+      auto &elem = data_[(head_ + i) & (cap_ - 1)];
+      ::new (new_data + i) T(std::move(elem));
+      elem.~T();
+    }
+    if (data_ != nullptr) std::allocator<T>().deallocate(data_, cap_);
+    data_ = new_data;
+    cap_ = new_cap;
+    head_ = 0;
+  }
+
+ protected:
+  void destroy() {
+    if (data_ == nullptr) return;
+    clear();
+    std::allocator<T>().deallocate(data_, cap_);
+    data_ = nullptr;
+    cap_ = 0;
+  }
+
+  T *data_ = nullptr;
+
+  /**
+   * @brief Capacity, always a power of two.
+   */
+  size_t cap_ = 0;
+
+  /**
+   * @brief Index of the first element.
+   */
+  size_t head_ = 0;
+
+  size_t size_ = 0;
+};
+
+#endif
@@ -0,0 +1,206 @@
+#ifndef SPSC_RING_H_
+#define SPSC_RING_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+/**
+ * @brief A lock-free byte ring for one producer thread and one consumer
+ * thread. A write is all or nothing, so the consumer never sees a partial
+ * record. The positions only grow and are masked on access, and each side
+ * caches the position of the other side to avoid touching its cache line on
+ * every call.
+ */
+class SpscByteRing {
+ public:
+  /**
+   * @param capacity It will be rounded up to a power of two.
+   */
+  explicit SpscByteRing(size_t capacity) {
+    size_t cap = 1;
+    while (cap < capacity) cap <<= 1;
+    data_ = std::make_unique<char[]>(cap);
+    mask_ = cap - 1;
+  }
+
+  SpscByteRing(const SpscByteRing &) = delete;
+
+  SpscByteRing &operator=(const SpscByteRing &) = delete;
+
+  size_t capacity() const { return mask_ + 1; }
+
+  /**
+   * @brief Get the number of readable bytes. It is exact on the consumer side
+   * and an upper bound on the producer side.
+   */
+  size_t size() const {
+    return tail_.load(std::memory_order_acquire) -
+           head_.load(std::memory_order_acquire);
+  }
+
+  bool empty() const { return size() == 0; }
+
+  /**
+   * @brief Get the free space, called by the producer.
+   */
+  size_t available() {
+    cached_head_ = head_.load(std::memory_order_acquire);
+    return capacity() - (tail_.load(std::memory_order_relaxed) - cached_head_);
+  }
+
+  /**
+   * @brief Append the bytes, called by the producer.
+   * @return Return false if there is not enough space, nothing is written.
+   */
+  bool try_write(const void *src, size_t n) {
+    return try_write({static_cast<const char *>(src), n}, {});
+  }
+
+  /**
+   * @brief Append the two pieces as one write, called by the producer.
+   * @return Return false if there is not enough space, nothing is written.
+   */
+  bool try_write(std::string_view first, std::string_view second) {
+    auto n = first.size() + second.size();
+    auto tail = tail_.load(std::memory_order_relaxed);
+    if (capacity() - (tail - cached_head_) < n) {
+      cached_head_ = head_.load(std::memory_order_acquire);
+      if (capacity() - (tail - cached_head_) < n) return false;
+    }
+    copy_in(tail, first);
+    copy_in(tail + first.size(), second);
+    tail_.store(tail + n, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * @brief Get the readable bytes as up to two contiguous pieces, called by
+   * the consumer. They stay valid until consume().
+   */
+  std::pair<std::string_view, std::string_view> peek() {
+    auto head = head_.load(std::memory_order_relaxed);
+    auto n = tail_.load(std::memory_order_acquire) - head;
+    auto pos = head & mask_;
+    auto first = std::min(n, capacity() - pos);
+    return {{data_.get() + pos, first}, {data_.get(), n - first}};
+  }
+
+  /**
+   * @brief Release n bytes returned by peek(), called by the consumer.
+   */
+  void consume(size_t n) {
+    head_.store(head_.load(std::memory_order_relaxed) + n,
+                std::memory_order_release);
+  }
+
+ protected:
+  void copy_in(size_t at, std::string_view src) {
+    if (src.empty()) return;
+    auto pos = at & mask_;
+    auto first = std::min(src.size(), capacity() - pos);
+    std::memcpy(data_.get() + pos, src.data(), first);
+    std::memcpy(data_.get(), src.data() + first, src.size() - first);
+  }
+
+  std::unique_ptr<char[]> data_;
+
+  size_t mask_;
+
+  /**
+   * @brief The read position, written by the consumer.
+   */
+  alignas(64) std::atomic<size_t> head_ = 0;
+
+  /**
+   * @brief The write position, written by the producer.
+   */
+  alignas(64) std::atomic<size_t> tail_ = 0;
+
+  /**
+   * @brief The last head_ seen by the producer.
+   */
+  size_t cached_head_ = 0;
+};
+
+/**
+ * @brief A lock-free ring of trivially copyable elements for one producer
+ * thread and one consumer thread, with the same layout as SpscByteRing.
+ */
+template <typename T>
+class SpscRing {
+  static_assert(std::is_trivially_copyable_v<T>);
+
+ public:
+  /**
+   * @param capacity It will be rounded up to a power of two.
+   */
+  explicit SpscRing(size_t capacity) {
+    size_t cap = 1;
+    while (cap < capacity) cap <<= 1;
+    data_ = std::make_unique<T[]>(cap);
+    mask_ = cap - 1;
+  }
+
+  SpscRing(const SpscRing &) = delete;
+
+  SpscRing &operator=(const SpscRing &) = delete;
+
+  size_t capacity() const { return mask_ + 1; }
+
+  /**
+   * @brief Get the number of elements. It is exact on the consumer side and
+   * an upper bound on the producer side.
+   */
+  size_t size() const {
+    return tail_.load(std::memory_order_acquire) -
+           head_.load(std::memory_order_acquire);
+  }
+
+  bool empty() const { return size() == 0; }
+
+  /**
+   * @brief Append an element, called by the producer.
+   * @return Return false if the ring is full.
+   */
+  bool try_push(const T &value) {
+    auto tail = tail_.load(std::memory_order_relaxed);
+    if (tail - cached_head_ == capacity()) {
+      cached_head_ = head_.load(std::memory_order_acquire);
+      if (tail - cached_head_ == capacity()) return false;
+    }
+    data_[tail & mask_] = value;
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * @brief Move up to max elements to out, called by the consumer.
+   * @return The number of elements moved.
+   */
+  size_t pop(T *out, size_t max) {
+    auto head = head_.load(std::memory_order_relaxed);
+    auto n = std::min(max, tail_.load(std::memory_order_acquire) - head);
+    for (size_t i = 0; i < n; ++i) out[i] = data_[(head + i) & mask_];
+    head_.store(head + n, std::memory_order_release);
+    return n;
+  }
+
+ protected:
+  std::unique_ptr<T[]> data_;
+
+  size_t mask_;
+
+  alignas(64) std::atomic<size_t> head_ = 0;
+
+  alignas(64) std::atomic<size_t> tail_ = 0;
+
+  size_t cached_head_ = 0;
+};
+
+#endif
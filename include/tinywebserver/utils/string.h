@@ -13,7 +13,7 @@ inline std::string& toupper(std::string& str) {
 
 inline std::string toupper(const std::string& str) {
   auto ret = str;
-  return toupper(str);
+  return toupper(ret);
 }
 
 inline std::string toupper(std::string&& str) {
@@ -29,7 +29,7 @@ inline std::string& tolower(std::string& str) {
 
 inline std::string tolower(const std::string& str) {
   auto ret = str;
-  return tolower(str);
+  return tolower(ret);
 }
 
 inline std::string tolower(std::string&& str) {
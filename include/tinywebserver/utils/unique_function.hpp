@@ -0,0 +1,150 @@
+#ifndef UNIQUE_FUNCTION_H_
+#define UNIQUE_FUNCTION_H_
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+template <typename Signature, size_t capacity = 64>
+class UniqueFunction;
+
+/**
+ * @brief A move-only alternative of std::function. Callables that fit in
+ * capacity bytes are stored inline, so constructing and moving them never
+ * touches the heap. Larger callables fall back to a heap allocation.
+ * @tparam capacity The size of the inline storage.
+ */
+template <typename R, typename... Args, size_t capacity>
+class UniqueFunction<R(Args...), capacity> {
+ protected:
+  struct VTable {
+    R (*invoke)(void *storage, Args &&...args);
+
+    /**
+     * @brief Move construct dest from src, then destroy src.
+     */
+    void (*relocate)(void *dest, void *src);
+
+    void (*destroy)(void *storage);
+  };
+
+  /**
+   * @brief Whether the callable can be stored inline.
+   */
+  template <typename F>
+  static constexpr bool is_inline_v =
+      sizeof(F) <= capacity && alignof(F) <= alignof(std::max_align_t) &&
+      std::is_nothrow_move_constructible_v<F>;
+
+  template <typename F>
+  struct InlineOps {
+    static F *get(void *storage) {
+      return std::launder(reinterpret_cast<F *>(storage));
+    }
+
+    static R invoke(void *storage, Args &&...args) {
+      return std::invoke(*get(storage), std::forward<Args>(args)...);
+    }
+
+    static void relocate(void *dest, void *src) {
+      ::new (dest) F(std::move(*get(src)));
+      get(src)->~F();
+    }
+
+    static void destroy(void *storage) { get(storage)->~F(); }
+
+    static constexpr VTable vtable = {invoke, relocate, destroy};
+  };
+
+  template <typename F>
+  struct HeapOps {
+    static F *&get(void *storage) {
+      return *std::launder(reinterpret_cast<F **>(storage));
+    }
+
+    static R invoke(void *storage, Args &&...args) {
+      return std::invoke(*get(storage), std::forward<Args>(args)...);
+    }
+
+    static void relocate(void *dest, void *src) {
+      ::new (dest) F *(get(src));
+      get(src) = nullptr;
+    }
+
+    static void destroy(void *storage) { delete get(storage); }
+
+    static constexpr VTable vtable = {invoke, relocate, destroy};
+  };
+
+ public:
+  UniqueFunction() = default;
+
+  UniqueFunction(std::nullptr_t) {}
+
+  template <typename F, typename D = std::decay_t<F>,
+            typename = std::enable_if_t<
+                !std::is_same_v<D, UniqueFunction> &&
+                std::is_invocable_r_v<R, D &, Args...>>>
+  UniqueFunction(F &&f) {
+    if constexpr (std::is_pointer_v<D> || std::is_member_pointer_v<D> ||
+                  std::is_same_v<D, std::function<R(Args...)>>) {
+      if (f == nullptr) return;
+    }
+    if constexpr (is_inline_v<D>) {
+      ::new (static_cast<void *>(storage_)) D(std::forward<F>(f));
+      vtable_ = &InlineOps<D>::vtable;
+    } else {
+      ::new (static_cast<void *>(storage_)) D *(new D(std::forward<F>(f)));
+      vtable_ = &HeapOps<D>::vtable;
+    }
+  }
+
+  UniqueFunction(const UniqueFunction &) = delete;
+
+  UniqueFunction(UniqueFunction &&obj) noexcept : vtable_(obj.vtable_) {
+    if (vtable_ != nullptr) vtable_->relocate(storage_, obj.storage_);
+    obj.vtable_ = nullptr;
+  }
+
+  UniqueFunction &operator=(const UniqueFunction &) = delete;
+
+  UniqueFunction &operator=(UniqueFunction &&obj) noexcept {
+    if (this == &obj) return *this;
+    reset();
+    vtable_ = obj.vtable_;
+    if (vtable_ != nullptr) vtable_->relocate(storage_, obj.storage_);
+    obj.vtable_ = nullptr;
+    return *this;
+  }
+
+  UniqueFunction &operator=(std::nullptr_t) {
+    reset();
+    return *this;
+  }
+
+  ~UniqueFunction() { reset(); }
+
+  explicit operator bool() const { return vtable_ != nullptr; }
+
+  R operator()(Args... args) {
+    return vtable_->invoke(storage_, std::forward<Args>(args)...);
+  }
+
+  /**
+   * @brief Destroy the stored callable.
+   */
+  void reset() {
+    if (vtable_ == nullptr) return;
+    vtable_->destroy(storage_);
+    vtable_ = nullptr;
+  }
+
+ protected:
+  alignas(std::max_align_t) unsigned char storage_[capacity];
+
+  const VTable *vtable_ = nullptr;
+};
+
+#endif
@@ -0,0 +1,167 @@
+#ifndef WORK_STEALING_DEQUE_H_
+#define WORK_STEALING_DEQUE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <type_traits>
+#include <vector>
+
+/**
+ * @brief A lock-free Chase-Lev work-stealing deque. The owner thread pushes
+ * and pops at the bottom, while other threads steal from the top.
+ * @ref Lê N M, Pop A, Cohen A, et al. Correct and efficient work-stealing for
+ * weak memory models. PPoPP 2013.
+ * @tparam T The element type. It is read racily by thieves, so it should be
+ * small and trivially copyable, such as a pointer.
+ */
+template <typename T>
+class WorkStealingDeque {
+  static_assert(std::is_trivially_copyable_v<T>,
+                "T should be trivially copyable");
+
+ protected:
+  /**
+   * @brief A circular array whose capacity is a power of two.
+   */
+  class Array {
+   public:
+    explicit Array(int64_t capacity)
+        : cap_(capacity),
+          mask_(capacity - 1),
+          data_(std::make_unique<std::atomic<T>[]>(capacity)) {}
+
+    int64_t capacity() const { return cap_; }
+
+    void put(int64_t i, T x) {
+      data_[i & mask_].store(x, std::memory_order_relaxed);
+    }
+
+    T get(int64_t i) const {
+      return data_[i & mask_].load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Copy [top, bottom) into a new array with double capacity.
+     */
+    Array *grow(int64_t bottom, int64_t top) const {
+      auto ret = new Array(cap_ * 2);
+      for (auto i = top; i != bottom; ++i) ret->put(i, get(i));
+      return ret;
+    }
+
+   protected:
+    int64_t cap_;
+
+    int64_t mask_;
+
+    std::unique_ptr<std::atomic<T>[]> data_;
+  };
+
+ public:
+  static const int64_t default_capacity = 256;
+
+  /**
+   * @param capacity The initial capacity, it will be rounded up to a power of
+   * two.
+   */
+  explicit WorkStealingDeque(int64_t capacity = default_capacity) {
+    int64_t cap = 1;
+    while (cap < capacity) cap <<= 1;
+    array_.store(new Array(cap), std::memory_order_relaxed);
+  }
+
+  WorkStealingDeque(const WorkStealingDeque &) = delete;
+  WorkStealingDeque &operator=(const WorkStealingDeque &) = delete;
+
+  ~WorkStealingDeque() { delete array_.load(std::memory_order_relaxed); }
+
+  /**
+   * @brief Get the approximate number of elements.
+   */
+  size_t size() const {
+    auto b = bottom_.load(std::memory_order_relaxed);
+    auto t = top_.load(std::memory_order_relaxed);
+    return b > t ? b - t : 0;
+  }
+
+  bool empty() const { return size() == 0; }
+
+  /**
+   * @brief Push an element at the bottom. Only the owner can call it.
+   */
+  void push(T x) {
+    auto b = bottom_.load(std::memory_order_relaxed);
+    auto t = top_.load(std::memory_order_acquire);
+    auto a = array_.load(std::memory_order_relaxed);
+    if (b - t > a->capacity() - 1) {
+      // Thieves may still read the old array, so it is retired until the
+      // deque is destroyed.
+      garbage_.emplace_back(a);
+      a = a->grow(b, t);
+      array_.store(a, std::memory_order_release);
+    }
+    a->put(b, x);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom_.store(b + 1, std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Pop an element from the bottom. Only the owner can call it.
+   */
+  std::optional<T> pop() {
+    auto b = bottom_.load(std::memory_order_relaxed) - 1;
+    auto a = array_.load(std::memory_order_relaxed);
+    bottom_.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    auto t = top_.load(std::memory_order_relaxed);
+
+    if (t > b) {
+      // empty
+      bottom_.store(b + 1, std::memory_order_relaxed);
+      return std::nullopt;
+    }
+    std::optional<T> ret = a->get(b);
+    if (t == b) {
+      // the last element, race with the thieves
+      if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                        std::memory_order_relaxed))
+        ret = std::nullopt;
+      bottom_.store(b + 1, std::memory_order_relaxed);
+    }
+    return ret;
+  }
+
+  /**
+   * @brief Steal an element from the top. Any thread can call it.
+   * @return std::nullopt if the deque is empty or the race is lost.
+   */
+  std::optional<T> steal() {
+    auto t = top_.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    auto b = bottom_.load(std::memory_order_acquire);
+    if (t >= b) return std::nullopt;
+
+    auto a = array_.load(std::memory_order_acquire);
+    T x = a->get(t);
+    if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                      std::memory_order_relaxed))
+      return std::nullopt;
+    return x;
+  }
+
+ protected:
+  alignas(64) std::atomic<int64_t> top_ = 0;
+
+  alignas(64) std::atomic<int64_t> bottom_ = 0;
+
+  std::atomic<Array *> array_;
+
+  /**
+   * @brief Arrays replaced by grow(), only accessed by the owner.
+   */
+  std::vector<std::unique_ptr<Array>> garbage_;
+};
+
+#endif
@@ -1,15 +1,17 @@
+#include <algorithm>
 #include <ctime>
 #include <sstream>
+#include <unordered_map>
 // #include <format> // format haven't been support
 
 #include "tinywebserver/log.h"
 
-Logger::Formatter default_formatter =
+const Logger::Formatter Logger::default_formatter =
     [](Logger::Level level, const std::string content,
        std::thread::id thread_id, const std::source_location location,
        std::chrono::time_point<std::chrono::system_clock> time) -> std::string {
   // format Logger::Level
-  static std::unordered_map<Logger::Level, std::string> level2str = {
+  static const std::unordered_map<Logger::Level, std::string> level2str = {
       {Logger::Level::INFO, "INFO"},   {Logger::Level::WRAN, "WRAN"},
       {Logger::Level::ERROR, "ERROR"}, {Logger::Level::DEBUG, "DEBUG"},
       {Logger::Level::FATAL, "FATAL"}, {Logger::Level::TRACE, "TRACE"},
@@ -18,12 +20,14 @@ Logger::Formatter default_formatter =
   // year-month-day hour:min:second, for example 2023-01-05 09:05:01
   // TODO: Using C++ 20 std::format like https://stackoverflow.com/a/68754043
   auto in_time_t = std::chrono::system_clock::to_time_t(time);
+  std::tm tm;
+  localtime_r(&in_time_t, &tm);
   std::string strtime(30, '\0');
-  std::strftime(&strtime[0], strtime.size(), "%Y-%m-%d %H:%M:%S",
-                std::localtime(&in_time_t));
+  strtime.resize(std::strftime(&strtime[0], strtime.size(),
+                               "%Y-%m-%d %H:%M:%S", &tm));
 
   std::stringstream ss;
-  ss << "[" << level2str[level] << "]"  // Level
+  ss << "[" << level2str.at(level) << "]"  // Level
      << "[" + strtime << "]"            // Time
      << "[thread " << thread_id << "]"  // Thread
      << "[" << location.file_name() << "(" << location.line() << ":"
@@ -32,34 +36,33 @@ Logger::Formatter default_formatter =
   return ss.str();
 };
 
-bool Logger::set(std::unique_ptr<std::fstream> writer) {
+bool Logger::set(std::unique_ptr<LogWriter> writer) {
   // check the parameter
   if (writer == nullptr) return false;
 
   if (!running_) {
     writer_ = std::move(writer);
+    magic_written_ = false;
+    sites_written_ = 0;
     return true;
   }
 
-  // save logs in the original writer and formatter
-  flush();
-  temporary_stop_ = true;
-  // The reason why stop the writer thread is to avoid writer_ conflict
-  stop();
-  // set the writer
-  writer_ = WriterPtr(writer.release(), [](std::fstream *ptr) {
-    if (ptr == nullptr) return;
-    ptr->flush();
-    ptr->close();
-    delete ptr;
-  });
-  start();
-  temporary_stop_ = false;
+  // the writer thread switches after writing the logs in the buffers
+  std::unique_lock lock(logs_mutex_);
+  pending_writer_ = std::move(writer);
+  const auto ticket = ++flush_requested_;
+  writer_sleeping_ = false;
+  logs_avail_cv_.notify_one();
+  flush_done_cv.wait(lock, [&] { return flushed_ >= ticket || !running_; });
   return true;
 }
 
 bool Logger::start() {
   if (running_ || writer_ == nullptr) return false;
+  start_timestamp_ = binlog::read_timestamp();
+  start_ns_ = binlog::wall_time_ns();
+  clock_ = {};
+  clock_.calibrate(start_timestamp_, start_ns_);
   running_ = true;
   writer_thread_ = std::thread(&Logger::writer_worker, this);
   return true;
@@ -68,56 +71,247 @@ bool Logger::start() {
 bool Logger::log(Logger::Level level, const std::string &content,
                  std::thread::id id, const std::source_location location,
                  const Logger::Formatter &formatter) {
-  // usd temporary_stop_ == true  to allow logging during temporary suspension
-  if (running_ == false && temporary_stop_ == true) return false;
   if (level < level_) return false;
-  auto time = std::chrono::system_clock::now();
-  const auto msg = formatter == nullptr
-                       ? content
-                       : formatter(level, content, id, location, time);
-  // insert the log
-  {
-    std::lock_guard lock(logs_mutex_);
-    logs_.emplace_back(std::move(msg));
+  std::string formatted;
+  std::string_view msg = content;
+  if (formatter != nullptr) {
+    auto time = std::chrono::system_clock::now();
+    formatted = formatter(level, content, id, location, time);
+    msg = formatted;
+  }
+  binlog::RecordHeader header{binlog::TEXT_SITE, uint32_t(msg.size()), 0};
+  return append({reinterpret_cast<const char *>(&header), sizeof(header)},
+                msg);
+}
+
+uint32_t Logger::register_site(const binlog::Site &site) {
+  std::lock_guard lock(sites_mutex_);
+  sites_.push_back(site);
+  return sites_.size();
+}
+
+Logger::Buffer &Logger::local_buffer() {
+  struct Holder {
+    std::shared_ptr<Buffer> buffer;
+    ~Holder() {
+      if (buffer != nullptr)
+        buffer->closed.store(true, std::memory_order_release);
+    }
+  };
+  thread_local Holder holder;
+  if (holder.buffer == nullptr) {
+    std::ostringstream thread;
+    thread << std::this_thread::get_id();
+    holder.buffer = std::make_shared<Buffer>(buffer_size_, thread.str());
+    std::lock_guard lock(buffers_mutex_);
+    buffers_.push_back(holder.buffer);
+    ++buffers_version_;
+  }
+  return *holder.buffer;
+}
+
+bool Logger::append(std::string_view head, std::string_view body) {
+  auto &buffer = local_buffer();
+  auto &ring = buffer.ring;
+  const auto size = head.size() + body.size();
+  bool ok = false;
+  switch (policy_.load(std::memory_order_relaxed)) {
+    case FullPolicy::BLOCK:
+      // the writer thread can't make room if it is stopped
+      while (!(ok = ring.try_write(head, body)) && size <= ring.capacity() &&
+             running_) {
+        if (writer_sleeping_.exchange(false)) logs_avail_cv_.notify_one();
+        std::this_thread::yield();
+      }
+      break;
+    case FullPolicy::DROP:
+      ok = ring.try_write(head, body);
+      break;
+    case FullPolicy::SAMPLE:
+      if (ring.capacity() - ring.available() < ring.capacity() / 2 ||
+          buffer.sampled++ % sample_rate_ == 0)
+        ok = ring.try_write(head, body);
+      break;
+  }
+  if (!ok) {
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    return false;
   }
   // wake the writer thread
-  if (waiting_flush_ || logs_.size() >= write_size_)
-    logs_avail_cv_.notify_one();
+  if (++buffer.unsignaled >= write_size_) {
+    buffer.unsignaled = 0;
+    if (writer_sleeping_.load(std::memory_order_relaxed) &&
+        writer_sleeping_.exchange(false)) {
+      // pair with the predicate check of the writer thread
+      { std::lock_guard lock(logs_mutex_); }
+      logs_avail_cv_.notify_one();
+    }
+  }
   return true;
 }
 
+size_t Logger::get_backlog() const {
+  std::lock_guard lock(buffers_mutex_);
+  size_t ret = 0;
+  for (auto &buffer : buffers_) ret += buffer->ring.size();
+  return ret;
+}
+
+size_t Logger::drain() {
+  if (buffers_version_.load(std::memory_order_acquire) != sweep_version_) {
+    std::lock_guard lock(buffers_mutex_);
+    sweep_ = buffers_;
+    sweep_version_ = buffers_version_;
+  }
+  sweep_timestamp_ = binlog::read_timestamp();
+  sweep_ns_ = binlog::wall_time_ns();
+  clock_.calibrate(sweep_timestamp_, sweep_ns_);
+  size_t written = 0;
+  bool has_closed = false;
+  // start from a different buffer every sweep
+  for (size_t i = 0; i < sweep_.size(); ++i) {
+    auto &buffer = *sweep_[(sweep_start_ + i) % sweep_.size()];
+    // a closed buffer is complete once the logs seen here are written
+    has_closed |= buffer.closed.load(std::memory_order_acquire);
+    auto [first, second] = buffer.ring.peek();
+    const auto n = first.size() + second.size();
+    if (n == 0) continue;
+    // a record may wrap around the end of the ring
+    auto records = first;
+    if (!second.empty()) {
+      records_.assign(first).append(second);
+      records = records_;
+    }
+    write_records(buffer, records);
+    buffer.ring.consume(n);
+    written += n;
+  }
+  ++sweep_start_;
+  if (has_closed) {
+    std::lock_guard lock(buffers_mutex_);
+    std::erase_if(buffers_, [](const std::shared_ptr<Buffer> &buffer) {
+      return buffer->closed && buffer->ring.empty();
+    });
+    sweep_ = buffers_;
+    sweep_version_ = ++buffers_version_;
+  }
+  return written;
+}
+
+void Logger::write_records(const Buffer &buffer, std::string_view records) {
+  if (encoding_ == Encoding::BINARY) {
+    auto build = [&] {
+      out_.clear();
+      if (!magic_written_) {
+        // a new file repeats the preamble, so that it decodes on its own
+        out_.append(binlog::magic, sizeof(binlog::magic));
+        binlog::append_record(out_, binlog::CLOCK_SITE, start_timestamp_,
+                              {reinterpret_cast<const char *>(&start_ns_),
+                               sizeof(start_ns_)});
+        sites_written_ = 0;
+      }
+      {
+        std::lock_guard lock(sites_mutex_);
+        for (; sites_written_ < sites_.size(); ++sites_written_)
+          binlog::append_site_def(out_, sites_written_ + 1,
+                                  sites_[sites_written_]);
+      }
+      binlog::append_record(
+          out_, binlog::CLOCK_SITE, sweep_timestamp_,
+          {reinterpret_cast<const char *>(&sweep_ns_), sizeof(sweep_ns_)});
+      binlog::append_record(out_, binlog::THREAD_SITE, 0, buffer.thread);
+      out_.append(records);
+    };
+    build();
+    if (writer_->prepare(out_.size()) && magic_written_) {
+      magic_written_ = false;
+      build();
+    }
+    magic_written_ = true;
+    writer_->write(out_.data(), out_.size());
+    return;
+  }
+
+  out_.clear();
+  binlog::RecordHeader header;
+  while (records.size() >= sizeof(header)) {
+    std::memcpy(&header, records.data(), sizeof(header));
+    auto payload = records.substr(sizeof(header), header.size);
+    records.remove_prefix(sizeof(header) + payload.size());
+    if (header.site == binlog::TEXT_SITE) {
+      out_.append(payload);
+      continue;
+    }
+    if (header.site > site_cache_.size()) {
+      std::lock_guard lock(sites_mutex_);
+      site_cache_ = sites_;
+    }
+    const auto &site = site_cache_[header.site - 1];
+    message_.clear();
+    binlog::format_message(message_, site.format, site.arg_types, payload);
+    binlog::format_line(out_, site.level, clock_.to_ns(header.timestamp),
+                        buffer.thread, site.file, site.line, site.column,
+                        site.function, message_);
+  }
+  writer_->prepare(out_.size());
+  writer_->write(out_.data(), out_.size());
+}
+
 bool Logger::flush() {
   if (!running_) return false;
-  waiting_flush_ = true;
   std::unique_lock lock(logs_mutex_);
-  flush_done_cv.wait(lock, [this] { return logs_.empty(); });
-  waiting_flush_ = false;
+  const auto ticket = ++flush_requested_;
+  writer_sleeping_ = false;
+  logs_avail_cv_.notify_one();
+  flush_done_cv.wait(lock, [&] { return flushed_ >= ticket || !running_; });
   return true;
 }
 
 bool Logger::stop() {
   if (!running_) return false;
-  running_ = false;
+  {
+    std::lock_guard lock(logs_mutex_);
+    running_ = false;
+  }
   logs_avail_cv_.notify_one();
   writer_thread_.join();
   return true;
 }
 
 void Logger::writer_worker() {
-  while (running_) {
-    std::unique_lock lock(logs_mutex_);
-    logs_avail_cv_.wait(
-        lock, [this] { return waiting_flush_ || logs_.size() >= write_size_; });
-    if (!running_ || logs_.empty()) continue;
-    decltype(logs_) logs = std::move(logs_);
-    lock.unlock();
-    // write logs
-    for (auto &log : logs) (*writer_) << log;
-    // lock.lock();
-    if (waiting_flush_) {
+  for (;;) {
+    // the last sweep after stop() writes the remaining logs
+    const bool stopping = !running_;
+    const auto requested = flush_requested_.load(std::memory_order_acquire);
+    const auto written = drain();
+    std::unique_ptr<LogWriter> next;
+    {
+      std::lock_guard lock(logs_mutex_);
+      next = std::move(pending_writer_);
+    }
+    if (next != nullptr) {
+      writer_->flush();
+      writer_ = std::move(next);
+      magic_written_ = false;
+      sites_written_ = 0;
+    }
+    if (requested != flushed_) {
       writer_->flush();
-      flush_done_cv.notify_one();
+      {
+        std::lock_guard lock(logs_mutex_);
+        flushed_ = requested;
+      }
+      flush_done_cv.notify_all();
     }
+    if (stopping) break;
+    // keep sweeping without sleep while the buffers fill up quickly
+    if (written >= buffer_size_ / 2) continue;
+    std::unique_lock lock(logs_mutex_);
+    writer_sleeping_ = true;
+    logs_avail_cv_.wait_for(lock, flush_interval_, [this] {
+      return !writer_sleeping_ || !running_ || flush_requested_ != flushed_;
+    });
+    writer_sleeping_ = false;
   }
 }
 
@@ -127,10 +321,7 @@ Logger::~Logger() {
     // ensure the writer thread ends before Logger
     stop();
   } else if (writer_ != nullptr) {
-    std::unique_lock lock(logs_mutex_);
-    decltype(logs_) logs = std::move(logs_);
-    lock.unlock();
-    for (auto &log : logs) (*writer_) << log;
+    drain();
     writer_->flush();
   }
 };
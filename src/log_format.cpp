@@ -0,0 +1,184 @@
+#include "tinywebserver/log_format.h"
+
+#include <charconv>
+#include <ctime>
+#include <iterator>
+
+namespace binlog {
+
+namespace {
+
+void append_string(std::string &out, std::string_view str) {
+  uint32_t size = str.size();
+  out.append(reinterpret_cast<const char *>(&size), sizeof(size));
+  out.append(str);
+}
+
+template <typename T>
+bool read(std::string_view &in, T &value) {
+  if (in.size() < sizeof(T)) return false;
+  std::memcpy(&value, in.data(), sizeof(T));
+  in.remove_prefix(sizeof(T));
+  return true;
+}
+
+bool read_string(std::string_view &in, std::string_view &str) {
+  uint32_t size;
+  if (!read(in, size) || in.size() < size) return false;
+  str = in.substr(0, size);
+  in.remove_prefix(size);
+  return true;
+}
+
+template <typename T>
+void append_number(std::string &out, T value) {
+  char buf[32];
+  auto [end, ec] = std::to_chars(buf, buf + sizeof(buf), value);
+  out.append(buf, end);
+}
+
+/**
+ * @brief Format the next argument of the payload.
+ */
+bool format_arg(std::string &out, char type, std::string_view &payload) {
+  switch (type) {
+    case 'b':
+    case 'c': {
+      char c;
+      if (!read(payload, c)) return false;
+      if (type == 'c')
+        out.push_back(c);
+      else
+        out.append(c ? "true" : "false");
+      return true;
+    }
+    case 'i': {
+      int64_t value;
+      if (!read(payload, value)) return false;
+      append_number(out, value);
+      return true;
+    }
+    case 'u': {
+      uint64_t value;
+      if (!read(payload, value)) return false;
+      append_number(out, value);
+      return true;
+    }
+    case 'd': {
+      double value;
+      if (!read(payload, value)) return false;
+      append_number(out, value);
+      return true;
+    }
+    case 'p': {
+      uint64_t value;
+      if (!read(payload, value)) return false;
+      char buf[32];
+      auto [end, ec] = std::to_chars(buf, buf + sizeof(buf), value, 16);
+      out.append("0x").append(buf, end);
+      return true;
+    }
+    case 's': {
+      std::string_view str;
+      if (!read_string(payload, str)) return false;
+      out.append(str);
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace
+
+void append_record(std::string &out, uint32_t site, uint64_t timestamp,
+                   std::string_view payload) {
+  RecordHeader header{site, uint32_t(payload.size()), timestamp};
+  out.append(reinterpret_cast<const char *>(&header), sizeof(header));
+  out.append(payload);
+}
+
+void append_site_def(std::string &out, uint32_t id, const Site &site) {
+  std::string payload;
+  payload.append(reinterpret_cast<const char *>(&id), sizeof(id));
+  payload.push_back(char(site.level));
+  payload.append(reinterpret_cast<const char *>(&site.line),
+                 sizeof(site.line));
+  payload.append(reinterpret_cast<const char *>(&site.column),
+                 sizeof(site.column));
+  append_string(payload, site.format);
+  append_string(payload, site.file);
+  append_string(payload, site.function == nullptr ? "" : site.function);
+  append_string(payload, site.arg_types == nullptr ? "" : site.arg_types);
+  append_record(out, SITE_DEF, 0, payload);
+}
+
+bool decode_site_def(std::string_view payload, uint32_t &id, SiteDef &site) {
+  std::string_view format, file, function, arg_types;
+  if (!read(payload, id) || !read(payload, site.level) ||
+      !read(payload, site.line) || !read(payload, site.column) ||
+      !read_string(payload, format) ||
+      !read_string(payload, file) || !read_string(payload, function) ||
+      !read_string(payload, arg_types))
+    return false;
+  site.format = format;
+  site.file = file;
+  site.function = function;
+  site.arg_types = arg_types;
+  return true;
+}
+
+bool format_message(std::string &out, std::string_view format,
+                    std::string_view arg_types, std::string_view payload) {
+  size_t arg = 0;
+  for (size_t i = 0; i < format.size(); ++i) {
+    char c = format[i];
+    if ((c == '{' || c == '}') && i + 1 < format.size() &&
+        format[i + 1] == c) {
+      out.push_back(c);
+      ++i;
+    } else if (c == '{' && i + 1 < format.size() && format[i + 1] == '}') {
+      if (arg >= arg_types.size())
+        out.append("{}");
+      else if (!format_arg(out, arg_types[arg++], payload))
+        return false;
+      ++i;
+    } else {
+      out.push_back(c);
+    }
+  }
+  return true;
+}
+
+void format_line(std::string &out, uint8_t level, int64_t ns,
+                 std::string_view thread, std::string_view file, uint32_t line,
+                 uint32_t column, std::string_view function,
+                 std::string_view message) {
+  static const char *level2str[] = {"TRACE", "DEBUG", "INFO",
+                                    "WRAN",  "ERROR", "FATAL"};
+  // the conversion of the same second is cached
+  thread_local time_t cached_second = -1;
+  thread_local char cached_time[32];
+  time_t second = ns / 1000000000;
+  if (second != cached_second) {
+    std::tm tm;
+    localtime_r(&second, &tm);
+    std::strftime(cached_time, sizeof(cached_time), "%Y-%m-%d %H:%M:%S", &tm);
+    cached_second = second;
+  }
+  out.append("[")
+      .append(level < std::size(level2str) ? level2str[level] : "?")
+      .append("][")
+      .append(cached_time)
+      .append("][thread ")
+      .append(thread)
+      .append("][")
+      .append(file)
+      .append("(");
+  append_number(out, line);
+  out.push_back(':');
+  append_number(out, column);
+  out.append(") `").append(function).append("`]: ").append(message);
+  out.push_back('\n');
+}
+
+}  // namespace binlog
@@ -0,0 +1,123 @@
+#include "tinywebserver/log_writer.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+
+MappedLogWriter::MappedLogWriter(std::string base_path, size_t segment_size,
+                                 std::chrono::seconds max_age)
+    : base_path_(std::move(base_path)),
+      segment_size_(segment_size == 0 ? 1 : segment_size),
+      max_age_(max_age),
+      sync_thread_(&MappedLogWriter::sync_worker, this) {}
+
+MappedLogWriter::~MappedLogWriter() {
+  {
+    std::lock_guard lock(retired_mutex_);
+    if (current_.data != nullptr) retired_.push_back(std::move(current_));
+    stopping_ = true;
+  }
+  retired_cv_.notify_one();
+  sync_thread_.join();
+}
+
+bool MappedLogWriter::prepare(size_t n) {
+  if (current_.data == nullptr) return rotate(n);
+  bool expired = max_age_ > max_age_.zero() &&
+                 std::chrono::steady_clock::now() - opened_ >= max_age_;
+  if (current_.used + n > current_.capacity || (expired && current_.used > 0))
+    return rotate(n);
+  return false;
+}
+
+bool MappedLogWriter::write(const char *data, size_t n) {
+  if ((current_.data == nullptr || current_.used + n > current_.capacity) &&
+      !rotate(n))
+    return false;
+  std::memcpy(current_.data + current_.used, data, n);
+  current_.used += n;
+  return true;
+}
+
+bool MappedLogWriter::flush() {
+  if (current_.data == nullptr || current_.used == 0) return true;
+  return msync(current_.data, current_.used, MS_ASYNC) == 0;
+}
+
+bool MappedLogWriter::rotate(size_t min_size) {
+  if (current_.data != nullptr) {
+    {
+      std::lock_guard lock(retired_mutex_);
+      retired_.push_back(std::move(current_));
+    }
+    retired_cv_.notify_one();
+    current_ = {};
+  }
+  return open_segment(std::max(segment_size_, min_size));
+}
+
+bool MappedLogWriter::open_segment(size_t size) {
+  char time[32];
+  std::time_t now = std::time(nullptr);
+  std::tm tm;
+  localtime_r(&now, &tm);
+  std::strftime(time, sizeof(time), "%Y%m%d-%H%M%S", &tm);
+
+  Segment segment;
+  segment.path = base_path_ + "." + time + "-" + std::to_string(sequence_++) +
+                 ".log";
+  segment.fd = ::open(segment.path.c_str(),
+                      O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (segment.fd < 0) return false;
+  // reserve the blocks up front, so the page faults don't allocate them
+  if (fallocate(segment.fd, 0, 0, size) != 0 &&
+      (errno != EOPNOTSUPP || ftruncate(segment.fd, size) != 0)) {
+    ::close(segment.fd);
+    ::unlink(segment.path.c_str());
+    return false;
+  }
+  void *data =
+      mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, segment.fd, 0);
+  if (data == MAP_FAILED) {
+    ::close(segment.fd);
+    ::unlink(segment.path.c_str());
+    return false;
+  }
+  madvise(data, size, MADV_SEQUENTIAL);
+  segment.data = static_cast<char *>(data);
+  segment.capacity = size;
+  current_ = std::move(segment);
+  opened_ = std::chrono::steady_clock::now();
+  return true;
+}
+
+void MappedLogWriter::close_segment(Segment &segment) {
+  msync(segment.data, segment.capacity, MS_SYNC);
+  munmap(segment.data, segment.capacity);
+  if (segment.used == 0) {
+    ::unlink(segment.path.c_str());
+  } else {
+    // drop the preallocated tail
+    ftruncate(segment.fd, segment.used);
+    fdatasync(segment.fd);
+  }
+  ::close(segment.fd);
+}
+
+void MappedLogWriter::sync_worker() {
+  std::unique_lock lock(retired_mutex_);
+  while (true) {
+    retired_cv_.wait(lock, [this] { return stopping_ || !retired_.empty(); });
+    if (retired_.empty()) return;
+    auto segments = std::move(retired_);
+    retired_.clear();
+    lock.unlock();
+    for (auto &segment : segments) close_segment(segment);
+    lock.lock();
+  }
+}
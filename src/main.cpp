@@ -1,12 +1,15 @@
 // todo
+#include <chrono>
 #include <fstream>
 #include <iostream>
 #include <streambuf>
 #include <string>
 #include <string_view>
+#include <utility>
 
 #include "tinywebserver/ini.h"
 #include "tinywebserver/network/http/server.h"
+#include "tinywebserver/utils/cpu.h"
 
 INI read_config(const std::string &filename) {
   std::fstream fs(filename);
@@ -32,6 +35,59 @@ int main() {
     // todo
   });
 
+  // an invalid list parses to an empty one, which would leave them unpinned
+  auto reactor_cpus = ini.get("server", "reactor_cpus");
+  auto worker_cpus = ini.get("server", "worker_cpus");
+  auto reactor_list = parse_cpu_list(reactor_cpus);
+  auto worker_list = parse_cpu_list(worker_cpus);
+  if ((reactor_list.empty() && !trim(reactor_cpus).empty()) ||
+      (worker_list.empty() && !trim(worker_cpus).empty()) ||
+      !server.set_cpu_affinity(std::move(reactor_list),
+                               std::move(worker_list)))
+    std::cerr << "Invalid reactor_cpus or worker_cpus" << std::endl;
+
+  if (auto path = ini.get("server", "metrics_path", "/metrics"); !path.empty())
+    server.handle_metrics(path);
+
+  if (auto us = std::stol(ini.get("server", "slow_request_us", "0")); us > 0) {
+    server.slow_requests().set_threshold(std::chrono::microseconds(us));
+    server.handle_slow_requests();
+  }
+
+  if (auto path = ini.get("server", "access_log"); !path.empty()) {
+    auto &access_log = server.access_log();
+    auto format = ini.get("server", "access_log_format", "combined");
+    if (format == "common")
+      access_log.set(http::AccessLog::Format::COMMON);
+    else if (format == "json")
+      access_log.set(http::AccessLog::Format::JSON);
+    access_log.set_sample_rate(
+        std::stoul(ini.get("server", "access_log_sample", "1")));
+    if (!access_log.open(path))
+      std::cerr << "Can't open access log " << path << std::endl;
+  }
+
+  http::Server::ListenOptions listen_options;
+  listen_options.backlog = std::stoi(
+      ini.get("server", "backlog", std::to_string(listen_options.backlog)));
+  listen_options.accept_budget =
+      std::stoi(ini.get("server", "accept_budget",
+                        std::to_string(listen_options.accept_budget)));
+  listen_options.defer_accept =
+      std::stoi(ini.get("server", "defer_accept", "0"));
+  listen_options.fastopen_queue =
+      std::stoi(ini.get("server", "fastopen_queue", "0"));
+  listen_options.reuse_port = ini.get("server", "reuse_port", "0") == "1";
+  if (!server.set_listen_options(listen_options))
+    std::cerr << "Invalid backlog or accept_budget" << std::endl;
+
+  auto balance = ini.get("server", "event_loop_balance", "connections") ==
+                         "latency"
+                     ? http::Server::Balance::LEAST_LATENCY
+                     : http::Server::Balance::LEAST_CONNECTIONS;
+  server.set_event_loops(std::stoul(ini.get("server", "event_loops", "0")),
+                         balance);
+
   uint16_t port = std::stoi(ini.get("server", "port", "8888"));
   server.listen(port, ini.get("server", "adress"));
 
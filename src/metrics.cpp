@@ -0,0 +1,146 @@
+#include "tinywebserver/metrics.h"
+
+#include <cinttypes>
+#include <cstdio>
+
+namespace metrics {
+
+MetricsRegistry::Metric *MetricsRegistry::add(const std::string &name,
+                                              const std::string &help,
+                                              Type type) {
+  // registering a name twice returns the same metric
+  for (auto &metric : metrics_)
+    if (metric.name == name) return metric.type == type ? &metric : nullptr;
+  auto &metric = metrics_.emplace_back();
+  metric.name = name;
+  metric.help = help;
+  metric.type = type;
+  return &metric;
+}
+
+Counter *MetricsRegistry::counter(const std::string &name,
+                                  const std::string &help) {
+  std::lock_guard lock(mutex_);
+  auto metric = add(name, help, Type::COUNTER);
+  if (metric == nullptr) return nullptr;
+  if (metric->counter == nullptr) metric->counter = std::make_unique<Counter>();
+  return metric->counter.get();
+}
+
+Gauge *MetricsRegistry::gauge(const std::string &name,
+                              const std::string &help) {
+  std::lock_guard lock(mutex_);
+  auto metric = add(name, help, Type::GAUGE);
+  if (metric == nullptr) return nullptr;
+  if (metric->gauge == nullptr) metric->gauge = std::make_unique<Gauge>();
+  return metric->gauge.get();
+}
+
+bool MetricsRegistry::gauge_fn(const std::string &name,
+                               const std::string &help,
+                               std::function<double()> fn) {
+  std::lock_guard lock(mutex_);
+  auto metric = add(name, help, Type::GAUGE_FN);
+  if (metric == nullptr) return false;
+  metric->fn = std::move(fn);
+  return true;
+}
+
+bool MetricsRegistry::counter_fn(const std::string &name,
+                                 const std::string &help,
+                                 std::function<double()> fn) {
+  std::lock_guard lock(mutex_);
+  auto metric = add(name, help, Type::COUNTER_FN);
+  if (metric == nullptr) return false;
+  metric->fn = std::move(fn);
+  return true;
+}
+
+Histogram *MetricsRegistry::histogram(const std::string &name,
+                                      const std::string &help) {
+  std::lock_guard lock(mutex_);
+  auto metric = add(name, help, Type::HISTOGRAM);
+  if (metric == nullptr) return nullptr;
+  if (metric->histogram == nullptr)
+    metric->histogram = std::make_unique<Histogram>();
+  return metric->histogram.get();
+}
+
+bool MetricsRegistry::histogram_fn(const std::string &name,
+                                   const std::string &help,
+                                   std::function<const Histogram &()> fn,
+                                   double unit) {
+  std::lock_guard lock(mutex_);
+  auto metric = add(name, help, Type::HISTOGRAM_FN);
+  if (metric == nullptr) return false;
+  metric->histogram_fn = std::move(fn);
+  metric->unit = unit;
+  return true;
+}
+
+void MetricsRegistry::write(std::string &out) const {
+  // the histograms are exported at every power of two, the durations from
+  // about 1us
+  constexpr size_t min_bits = 10;
+  char line[128];
+  std::lock_guard lock(mutex_);
+  for (auto &metric : metrics_) {
+    const char *type =
+        metric.type == Type::COUNTER || metric.type == Type::COUNTER_FN
+            ? "counter"
+        : metric.type == Type::HISTOGRAM || metric.type == Type::HISTOGRAM_FN
+            ? "histogram"
+            : "gauge";
+    out += "# HELP " + metric.name + " " + metric.help + "\n";
+    out += "# TYPE " + metric.name + " " + type + "\n";
+    switch (metric.type) {
+      case Type::COUNTER:
+        std::snprintf(line, sizeof(line), " %" PRIu64 "\n",
+                      metric.counter->value());
+        out += metric.name + line;
+        break;
+      case Type::GAUGE:
+        std::snprintf(line, sizeof(line), " %" PRId64 "\n",
+                      metric.gauge->value());
+        out += metric.name + line;
+        break;
+      case Type::COUNTER_FN:
+      case Type::GAUGE_FN:
+        std::snprintf(line, sizeof(line), " %.17g\n", metric.fn());
+        out += metric.name + line;
+        break;
+      case Type::HISTOGRAM:
+      case Type::HISTOGRAM_FN: {
+        auto &hist = metric.type == Type::HISTOGRAM ? *metric.histogram
+                                                    : metric.histogram_fn();
+        auto buckets = hist.buckets();
+        uint64_t cumulative = 0;
+        for (size_t i = 0; i < Histogram::n_buckets - 1; ++i) {
+          cumulative += buckets[i];
+          if (i % Histogram::n_sub != Histogram::n_sub - 1) continue;
+          // le is inclusive, so it is the largest value of the bucket
+          auto bound = Histogram::bucket_upper_bound(i);
+          if (metric.unit < 1 && bound + 1 < (uint64_t(1) << min_bits))
+            continue;
+          std::snprintf(line, sizeof(line),
+                        "_bucket{le=\"%.9g\"} %" PRIu64 "\n",
+                        bound * metric.unit, cumulative);
+          out += metric.name + line;
+        }
+        cumulative += buckets[Histogram::n_buckets - 1];
+        std::snprintf(line, sizeof(line), "_bucket{le=\"+Inf\"} %" PRIu64 "\n",
+                      cumulative);
+        out += metric.name + line;
+        std::snprintf(line, sizeof(line), metric.unit < 1 ? "_sum %.9f\n"
+                                                          : "_sum %.17g\n",
+                      hist.sum() * metric.unit);
+        out += metric.name + line;
+        std::snprintf(line, sizeof(line), "_count %" PRIu64 "\n", cumulative);
+        out += metric.name + line;
+        break;
+      }
+    }
+  }
+}
+
+}  // namespace metrics
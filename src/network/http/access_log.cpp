@@ -0,0 +1,264 @@
+#include "tinywebserver/network/http/access_log.h"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <iterator>
+
+namespace http {
+
+namespace {
+
+/**
+ * @brief Get the local time of the second in the layout of strftime, the
+ * result is cached since the records of a batch mostly share the second.
+ */
+std::string_view local_time(int64_t second, bool iso8601) {
+  struct Cache {
+    int64_t second = -1;
+    size_t size = 0;
+    char text[64];
+  };
+  thread_local Cache caches[2];
+  auto &cache = caches[iso8601];
+  if (cache.second != second) {
+    std::time_t t = second;
+    std::tm tm;
+    localtime_r(&t, &tm);
+    cache.size =
+        std::strftime(cache.text, sizeof(cache.text),
+                      iso8601 ? "%Y-%m-%dT%H:%M:%S%z" : "%d/%b/%Y:%H:%M:%S %z",
+                      &tm);
+    cache.second = second;
+  }
+  return {cache.text, cache.size};
+}
+
+/**
+ * @brief Append a quoted field, " and \ are escaped with a backslash and the
+ * control characters are written as \xHH.
+ */
+void append_escaped(std::string &out, std::string_view str) {
+  for (char c : str) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if (static_cast<unsigned char>(c) < 0x20 || c == 0x7f) {
+      char hex[8];
+      std::snprintf(hex, sizeof(hex), "\\x%02X", static_cast<unsigned char>(c));
+      out += hex;
+    } else {
+      out += c;
+    }
+  }
+}
+
+/**
+ * @brief Append a JSON string without the quotes.
+ */
+void append_json(std::string &out, std::string_view str) {
+  for (char c : str) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char hex[8];
+      std::snprintf(hex, sizeof(hex), "\\u%04X", static_cast<unsigned char>(c));
+      out += hex;
+    } else {
+      out += c;
+    }
+  }
+}
+
+template <typename T>
+void append_number(std::string &out, T value) {
+  char number[24];
+  out.append(number, std::to_chars(number, std::end(number), value).ptr);
+}
+
+std::string_view or_dash(std::string_view str) {
+  return str.empty() ? "-" : str;
+}
+
+}  // namespace
+
+AccessLog::~AccessLog() {
+  stop();
+  if (fd_ != -1) ::close(fd_);
+}
+
+bool AccessLog::open(const std::string &path) {
+  if (running_) return false;
+  int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+                  0644);
+  if (fd < 0) return false;
+  if (fd_ != -1) ::close(fd_);
+  fd_ = fd;
+  return true;
+}
+
+AccessLog::Producer *AccessLog::add_producer(size_t capacity) {
+  if (running_) return nullptr;
+  producers_.push_back(std::make_unique<Producer>(capacity));
+  return producers_.back().get();
+}
+
+bool AccessLog::push(Producer &producer, const AccessRecord &record) {
+  if (!producer.ring.try_push(record)) {
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  // wake the writer early when the ring is half full
+  if (writer_sleeping_.load(std::memory_order_relaxed) &&
+      producer.ring.size() >= producer.ring.capacity() / 2)
+    cv_.notify_one();
+  return true;
+}
+
+bool AccessLog::start() {
+  if (running_ || fd_ == -1) return false;
+  running_ = true;
+  writer_thread_ = std::thread(&AccessLog::writer_worker, this);
+  return true;
+}
+
+bool AccessLog::stop() {
+  if (!running_) return false;
+  {
+    std::lock_guard lock(mutex_);
+    running_ = false;
+  }
+  cv_.notify_one();
+  writer_thread_.join();
+  return true;
+}
+
+void AccessLog::format(std::string &out, Format format,
+                       const AccessRecord &record) {
+  char addr[INET_ADDRSTRLEN] = "-";
+  in_addr in = {.s_addr = record.remote_addr};
+  inet_ntop(AF_INET, &in, addr, sizeof(addr));
+  auto second = record.time_ns / 1000000000;
+  auto method = Request::method2str(record.method);
+
+  if (format == Format::JSON) {
+    out += "{\"time\":\"";
+    out += local_time(second, true);
+    out += "\",\"remote_addr\":\"";
+    out += addr;
+    out += "\",\"remote_port\":";
+    append_number(out, ntohs(record.remote_port));
+    out += ",\"method\":\"";
+    out += method;
+    out += "\",\"uri\":\"";
+    append_json(out, record.uri.view());
+    out += "\",\"version\":\"";
+    append_json(out, record.version.view());
+    out += "\",\"status\":";
+    append_number(out, record.status);
+    out += ",\"bytes\":";
+    append_number(out, record.bytes);
+    out += ",\"duration_us\":";
+    append_number(out, record.duration_ns / 1000);
+    out += ",\"referer\":\"";
+    append_json(out, record.referer.view());
+    out += "\",\"user_agent\":\"";
+    append_json(out, record.user_agent.view());
+    out += "\"}\n";
+    return;
+  }
+
+  out += addr;
+  out += " - - [";
+  out += local_time(second, false);
+  out += "] \"";
+  if (record.uri.size == 0) {
+    // the request line couldn't be parsed
+    out += '-';
+  } else {
+    out += method;
+    out += ' ';
+    append_escaped(out, record.uri.view());
+    out += " HTTP/";
+    append_escaped(out, record.version.view());
+  }
+  out += "\" ";
+  append_number(out, record.status);
+  out += ' ';
+  append_number(out, record.bytes);
+  if (format == Format::COMBINED) {
+    out += " \"";
+    append_escaped(out, or_dash(record.referer.view()));
+    out += "\" \"";
+    append_escaped(out, or_dash(record.user_agent.view()));
+    out += '"';
+  }
+  out += '\n';
+}
+
+size_t AccessLog::drain() {
+  records_.resize(batch_size);
+  texts_.resize(producers_.size());
+  std::vector<iovec> iov;
+  size_t total = 0;
+  while (true) {
+    iov.clear();
+    size_t written = 0;
+    for (size_t i = 0; i < producers_.size(); ++i) {
+      auto n = producers_[i]->ring.pop(records_.data(), batch_size);
+      if (n == 0) continue;
+      auto &text = texts_[i];
+      text.clear();
+      for (size_t j = 0; j < n; ++j) format(text, format_, records_[j]);
+      iov.push_back({.iov_base = text.data(), .iov_len = text.size()});
+      written += n;
+    }
+    if (written == 0) break;
+    write_all(iov.data(), iov.size());
+    total += written;
+  }
+  return total;
+}
+
+bool AccessLog::write_all(iovec *iov, size_t n) {
+  while (n > 0) {
+    auto size = ::writev(fd_, iov, std::min<size_t>(n, IOV_MAX));
+    if (size < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    // skip the written buffers and advance into a partially written one
+    while (n > 0 && size_t(size) >= iov->iov_len) {
+      size -= iov->iov_len;
+      ++iov;
+      --n;
+    }
+    if (n > 0) {
+      iov->iov_base = static_cast<char *>(iov->iov_base) + size;
+      iov->iov_len -= size;
+    }
+  }
+  return true;
+}
+
+void AccessLog::writer_worker() {
+  while (true) {
+    drain();
+    std::unique_lock lock(mutex_);
+    if (!running_) break;
+    writer_sleeping_ = true;
+    cv_.wait_for(lock, std::chrono::milliseconds(10));
+    writer_sleeping_ = false;
+  }
+  drain();
+}
+
+}  // namespace http
@@ -19,8 +19,8 @@ int Parser::hex2dec(char ch) {
 
 std::string Parser::parse_form_elem(std::string_view data) {
   std::string ret;
-  for (int i = 0; i < data.size();) {
-    if (data[i] == '%') {
+  for (size_t i = 0; i < data.size();) {
+    if (data[i] == '%' && i + 2 < data.size()) {
       ret.push_back(hex2dec(data[i + 1]) * 16 + hex2dec(data[i + 2]));
       // skip the hexadecimal char
       i += 3;
@@ -45,7 +45,11 @@ Form Parser::parse_form(std::string_view data) {
    *    - %3D = 0f3D = 61 = '='
    */
   Form ret;
-  for (std::string_view line; getline(data, line, '&'), !data.empty();) {
+  while (!data.empty()) {
+    auto end = data.find('&');
+    auto line = data.substr(0, end);
+    data = end == std::string_view::npos ? std::string_view()
+                                         : data.substr(end + 1);
     auto pos = line.find('=');
     if (pos == std::string_view::npos) return {};
     ret.emplace(parse_form_elem(line.substr(0, pos)),
@@ -19,6 +19,27 @@ Request::Method Request::str2Method(const std::string &str) {
     return Method::UNKNOWN;
 }
 
+std::string_view Request::method2str(Method method) {
+  switch (method) {
+    case Method::GET:
+      return "GET";
+    case Method::POST:
+      return "POST";
+    case Method::HEAD:
+      return "HEAD";
+    case Method::PUT:
+      return "PUT";
+    case Method::DELETE:
+      return "DELETE";
+    case Method::TRACE:
+      return "TRACE";
+    case Method::CONNECT:
+      return "CONNECT";
+    default:
+      return "-";
+  }
+}
+
 Form Request::parse_form() const {
   if (auto it = header_.find("Content-Type");
       it == header_.end() || it->second != "application/x-www-form-urlencoded")
@@ -36,11 +57,12 @@ Form Request::parse_form() const {
 }
 
 bool Request::is_keepalive() const {
-  if (auto it = header_.find("Connnection"); it == header_.end())
-    return false;
-  else if (it->second == "keep-alive" && version_ == "1.1")
-    return true;
-  return false;
+  // HTTP/1.1 keeps the connection alive unless the client asks to close it,
+  // HTTP/1.0 closes it unless the client asks to keep it
+  auto it = header_.find(Header::CONNECTION);
+  if (version_ == "1.1")
+    return it == header_.end() || tolower(it->second) != "close";
+  return it != header_.end() && tolower(it->second) == "keep-alive";
 }
 
 }  // namespace http
\ No newline at end of file
@@ -3,6 +3,10 @@
 
 #include <unistd.h>
 
+#include <algorithm>
+#include <cstdlib>
+
+#include "tinywebserver/log_format.h"
 #include "tinywebserver/network/http/const.h"
 #include "tinywebserver/utils/sv.h"
 
@@ -24,26 +28,48 @@ bool RequestParser::parse_request_line(std::string_view line, Request &obj) {
 };
 
 std::pair<RequestParser::State, std::unique_ptr<Request>>
-RequestParser::consume_from_fd(int fd, bool is_et) {
+RequestParser::consume_from_fd(int fd, bool is_et, size_t max_read) {
   // read data from file descriptor
   ssize_t total_read = 0;
+  drained_ = false;
   do {
-    ssize_t n = 1024 * 5;
+    ssize_t n = std::min<size_t>(1024 * 5, max_read - total_read);
+    if (n == 0) break;
     buf_.ensure_writeable(n);
     int readn = ::read(fd, buf_.cur_write_ptr(), n);
     if (readn <= 0) {
+      drained_ = true;
       break;
     } else {
       buf_.update_write_ptr(readn);
       total_read += readn;
+      // A short read has drained the socket, and new data raises a new edge,
+      // so there is no need to read until EAGAIN.
+      if (readn < n) {
+        drained_ = true;
+        break;
+      }
     }
   } while (is_et);
+  last_read_ = total_read;
+  read_end_ = binlog::read_timestamp();
 
   if (total_read <= 0 && errno != EAGAIN) {
     return {State::ERROR_READ_FD, nullptr};
   }
+  return parse();
+}
 
-  // parse http request from buf_
+std::pair<RequestParser::State, std::unique_ptr<Request>>
+RequestParser::consume(std::string_view data) {
+  buf_.write(data.data(), data.size());
+  return parse();
+}
+
+std::pair<RequestParser::State, std::unique_ptr<Request>>
+RequestParser::parse() {
+  // start from the beginning of buf_ again once everything is parsed
+  if (buf_.readable_empty()) buf_.clear();
   for (bool stop = false; !stop;) {
     auto content = buf_.view();
     switch (state_) {
@@ -97,11 +123,16 @@ RequestParser::consume_from_fd(int fd, bool is_et) {
       case State::BEFORE_PARSING_REQUST_BODY: {
         auto &header = obj_->header();
         auto it = header.find(Header::CONTENT_LENGTH);
-        if (it == header.end()) {
-          state_ = State::ERROR_BODY_LENGTH;
-          return {state_, nullptr};
+        // a request without Content-Length has no body
+        req_body_size_ = 0;
+        if (it != header.end()) {
+          char *end = nullptr;
+          req_body_size_ = std::strtoul(it->second.c_str(), &end, 10);
+          if (it->second.empty() || *end != '\0') {
+            state_ = State::ERROR_BODY_LENGTH;
+            return {state_, nullptr};
+          }
         }
-        req_body_size_ = std::stoul(it->second);
         state_ = State::PARSING_REQUEST_BODY;
         break;
       }
@@ -117,15 +148,10 @@ RequestParser::consume_from_fd(int fd, bool is_et) {
                     buf_.cur_read_ptr() + readn);
         buf_.update_read_ptr(readn);
 
-        if (body.size() < req_body_size_) break;
-        if (body.size() == req_body_size_) {
-          if (buf_.readable_size()) {
-            state_ = State::ERROR_BODY_LENGTH;
-            return {state_, nullptr};
-          }
-          state_ = State::COMPLETE;
-          break;
-        }
+        // the rest of buf_ is the next request of a pipeline
+        if (body.size() < req_body_size_) return {state_, nullptr};
+        state_ = State::COMPLETE;
+        [[fallthrough]];
       }
       case State::COMPLETE: {
         state_ = State::INIT;
@@ -0,0 +1,124 @@
+#include "tinywebserver/network/http/request_trace.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+#include <thread>
+
+namespace http {
+
+const char *SlowRequest::phase_name(size_t phase) {
+  static const char *names[N_PHASES] = {
+      "wait", "queue", "read", "parse", "match", "handler", "response", "write",
+  };
+  return phase < N_PHASES ? names[phase] : "unknown";
+}
+
+double SlowRequestLog::calibrate() {
+  using clock = std::chrono::steady_clock;
+  auto start = clock::now();
+  auto start_ticks = binlog::read_timestamp();
+  std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  auto ticks = binlog::read_timestamp() - start_ticks;
+  auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() -
+                                                                 start)
+                .count();
+  return ticks == 0 ? 1 : double(ns) / ticks;
+}
+
+void SlowRequestLog::set_threshold(std::chrono::nanoseconds threshold) {
+  std::lock_guard lock(mutex_);
+  if (threshold <= threshold.zero()) {
+    threshold_ = threshold.zero();
+    threshold_ticks_.store(0, std::memory_order_relaxed);
+    return;
+  }
+  if (ns_per_tick_ == 0) ns_per_tick_ = calibrate();
+  threshold_ = threshold;
+  threshold_ticks_.store(
+      std::max<uint64_t>(threshold.count() / ns_per_tick_, 1),
+      std::memory_order_relaxed);
+}
+
+std::chrono::nanoseconds SlowRequestLog::get_threshold() const {
+  std::lock_guard lock(mutex_);
+  return threshold_;
+}
+
+bool SlowRequestLog::finish(const RequestTrace &trace, int fd) {
+  auto threshold = threshold_ticks_.load(std::memory_order_relaxed);
+  if (threshold == 0 || !trace.active) return false;
+  auto &marks = trace.marks;
+  auto total =
+      marks[RequestTrace::WRITE_DONE] - marks[RequestTrace::FIRST_READY];
+  if (total < threshold) return false;
+
+  // the phases in the order of the marks that end them
+  static const RequestTrace::Mark ends[SlowRequest::N_PHASES] = {
+      RequestTrace::READY,   RequestTrace::READ_START, RequestTrace::READ_END,
+      RequestTrace::PARSED,  RequestTrace::MATCHED,    RequestTrace::HANDLED,
+      RequestTrace::RESPONSE_MADE, RequestTrace::WRITE_DONE,
+  };
+  std::lock_guard lock(mutex_);
+  auto &slow = ring_[count_++ % ring_.size()];
+  slow.time_ns = binlog::wall_time_ns();
+  slow.fd = fd;
+  slow.reads = trace.reads;
+  slow.writes = trace.writes;
+  slow.method = trace.method;
+  slow.uri = trace.uri;
+  slow.total_ns = total * ns_per_tick_;
+  for (size_t i = 0; i < SlowRequest::N_PHASES; ++i)
+    slow.phase_ns[i] = int64_t(marks[ends[i]] - marks[ends[i] - 1]) *
+                       ns_per_tick_;
+  return true;
+}
+
+std::vector<SlowRequest> SlowRequestLog::snapshot() const {
+  std::lock_guard lock(mutex_);
+  std::vector<SlowRequest> ret;
+  auto n = std::min(count_, ring_.size());
+  ret.reserve(n);
+  for (auto i = count_ - n; i < count_; ++i)
+    ret.push_back(ring_[i % ring_.size()]);
+  return ret;
+}
+
+void SlowRequestLog::dump(std::string &out) const {
+  char line[128];
+  for (auto &slow : snapshot()) {
+    std::time_t second = slow.time_ns / 1000000000;
+    std::tm tm;
+    localtime_r(&second, &tm);
+    auto n = std::strftime(line, sizeof(line), "%Y-%m-%d %H:%M:%S", &tm);
+    std::snprintf(line + n, sizeof(line) - n, ".%06lld fd=%d ",
+                  static_cast<long long>(slow.time_ns % 1000000000 / 1000),
+                  slow.fd);
+    out += line;
+    out += Request::method2str(slow.method);
+    out += ' ';
+    out += slow.uri.view();
+    std::snprintf(line, sizeof(line), " total=%.1fus", slow.total_ns / 1e3);
+    out += line;
+    for (size_t i = 0; i < SlowRequest::N_PHASES; ++i) {
+      std::snprintf(line, sizeof(line), " %s=%.1fus",
+                    SlowRequest::phase_name(i), slow.phase_ns[i] / 1e3);
+      out += line;
+    }
+    std::snprintf(line, sizeof(line), " reads=%u writes=%u\n", slow.reads,
+                  slow.writes);
+    out += line;
+  }
+}
+
+size_t SlowRequestLog::get_count() const {
+  std::lock_guard lock(mutex_);
+  return count_;
+}
+
+void SlowRequestLog::clear() {
+  std::lock_guard lock(mutex_);
+  count_ = 0;
+}
+
+}  // namespace http
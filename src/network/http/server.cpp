@@ -4,218 +4,772 @@
 
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <linux/filter.h>
+#include <netinet/tcp.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
 
+#include <algorithm>
+#include <chrono>
 #include <cstring>
 #include <memory>
+#include <unordered_set>
+#include <utility>
 
-#include "tinywebserver/network/linux_wrapper.h"
+#include "tinywebserver/log.h"
+#include "tinywebserver/pool/memory_pool.hpp"
+#include "tinywebserver/utils/cpu.h"
+#include "tinywebserver/utils/probes.h"
 
 namespace http {
 
+Server::EventLoop::EventLoop() {
+  wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (wake_fd == -1) {
+    LOG_FAST(ERROR, "failed to create the wakeup eventfd, errno {}", errno);
+    return;
+  }
+  epoll_event ev = {.events = EPOLLIN, .data{.ptr = &wake_fd}};
+  if (!epoller.add(wake_fd, ev)) {
+    LOG_FAST(ERROR, "failed to add the wakeup eventfd to epoll, errno {}",
+             errno);
+    ::close(wake_fd);
+    wake_fd = -1;
+  }
+}
+
+Server::EventLoop::~EventLoop() {
+  // the connections handed off after the loop stopped
+  Handoff handoff;
+  while (handoffs.pop(&handoff, 1)) ::close(handoff.fd);
+  if (listen_fd != -1) ::close(listen_fd);
+  if (wake_fd != -1) ::close(wake_fd);
+}
+
+bool Server::set_event_loops(size_t n, Balance balance) {
+  if (running_) return false;
+  std::vector<std::unique_ptr<EventLoop>> loops;
+  for (size_t i = 0; i < n; ++i) {
+    loops.push_back(std::make_unique<EventLoop>());
+    // stop() and hand_off() could never wake the loop
+    if (loops.back()->wake_fd == -1) {
+      LOG_FAST(ERROR, "event loop {} has no wakeup fd", i + 1);
+      return false;
+    }
+  }
+  loops_.resize(1);
+  for (auto &loop : loops) loops_.push_back(std::move(loop));
+  balance_ = balance;
+  next_loop_ = 0;
+  return true;
+}
+
 bool Server::listen(uint16_t port, const std::string address) {
   if (running_ || port < 1024) return false;
 
-  if (listen_fd_ != -1) {
-    ::close(listen_fd_);
-    // todo: clear all the data, such as epoller, connections
+  // todo: clear all the data, such as epoller, connections
+  close_listeners();
+
+  sockaddr_in serv_addr;
+  memset(&serv_addr, 0, sizeof(serv_addr));
+  serv_addr.sin_family = AF_INET;
+  serv_addr.sin_port = htons(port);
+  if (address.empty())
+    serv_addr.sin_addr.s_addr = INADDR_ANY;
+  else if (inet_pton(AF_INET, address.c_str(), &serv_addr.sin_addr.s_addr) <=
+           0)
+    return false;
+
+  // one listener per event loop thread, or a listener for loops_[0]
+  bool per_loop = listen_options_.reuse_port && loops_.size() > 1;
+  size_t first = per_loop ? 1 : 0, last = per_loop ? loops_.size() : 1;
+  for (size_t i = first; i < last; ++i) {
+    // Prefer the reactor CPU when the kernel picks a listener for packets.
+    int fd = open_listener(serv_addr, loop_cpu(i));
+    if (fd == -1) {
+      close_listeners();
+      return false;
+    }
+    loops_[i]->listen_fd = fd;
+
+    // 用 nullptr 去区分客户端链接还是服务器 fd
+    epoll_event ev = {.events = listen_fd_event_ | EPOLLIN,
+                      .data{.ptr = nullptr}};
+
+    // add to epoll tree
+    if (loops_[i]->epoller.add(fd, ev) == false) {
+      close_listeners();
+      return false;
+    }
   }
+  // the kernel's hash is used if it fails
+  steered_ = per_loop && attach_steering();
+
+  return true;
+}
 
+int Server::open_listener(const sockaddr_in &addr, int cpu) {
   // create the socket
-  listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
-  if (listen_fd_ < 0) return false;
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) return -1;
 
   // todo struct linger
 
   /* 端口复用 */
   /* 只有最后一个套接字会正常接收数据。 */
-  if (int optval = 1; setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR,
+  if (int optval = 1; setsockopt(fd, SOL_SOCKET, SO_REUSEADDR,
                                  (const void *)&optval, sizeof(int)) == -1) {
     // std::cout<<"set socket setsockopt error !"<<std::endl;
-    close(listen_fd_);
-    listen_fd_ = -1;
-    return false;
+    ::close(fd);
+    return -1;
+  }
+  if (int optval = 1;
+      listen_options_.reuse_port &&
+      setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval)) == -1) {
+    ::close(fd);
+    return -1;
   }
 
+  if (cpu != -1) setsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(cpu));
+
   // bind
-  sockaddr_in serv_addr;
-  serv_addr.sin_port = htons(port);
-  memset(&serv_addr, 0, sizeof(serv_addr));
-  if (address.empty())
-    serv_addr.sin_addr.s_addr = INADDR_ANY;
-  else if (inet_pton(AF_INET, address.c_str(), &serv_addr.sin_addr.s_addr) <=
-           0) {
-    ::close(listen_fd_);
-    listen_fd_ = -1;
-    return false;
-  }
-  if (bind(listen_fd_, reinterpret_cast<sockaddr *>(&serv_addr),
-           sizeof(serv_addr)) < 0) {
-    ::close(listen_fd_);
-    listen_fd_ = -1;
-    return false;
+  if (bind(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) < 0) {
+    ::close(fd);
+    return -1;
   }
 
+  // optional, the kernel may not support them
+  if (int secs = listen_options_.defer_accept; secs > 0)
+    setsockopt(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &secs, sizeof(secs));
+  if (int qlen = listen_options_.fastopen_queue; qlen > 0)
+    setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN, &qlen, sizeof(qlen));
+
   // listen
-  // todo backlog
-  if (::listen(listen_fd_, 6) < 0) {
-    ::close(listen_fd_);
-    listen_fd_ = -1;
-    return false;
+  if (::listen(fd, listen_options_.backlog) < 0) {
+    ::close(fd);
+    return -1;
   }
+  return fd;
+}
 
-  // 用 nullptr 去区分客户端链接还是服务器 fd
-  epoll_event ev = {.events = listen_fd_event_ | EPOLLIN,
-                    .data{.ptr = nullptr}};
-
-  // add to epoll tree
-  if (epoller_.add(listen_fd_, ev) == false) {
-    ::close(listen_fd_);
-    listen_fd_ = -1;
-    return false;
+bool Server::attach_steering() {
+  // The program returns the index of a listener in the SO_REUSEPORT group,
+  // which is the order of listen(), so loops_[i] has the index i - 1. An
+  // index out of the group falls back to the hash.
+  size_t n = loops_.size() - 1;
+  std::vector<sock_filter> code;
+  // A = the CPU that handles the packet
+  code.push_back(
+      BPF_STMT(BPF_LD | BPF_W | BPF_ABS, uint32_t(SKF_AD_OFF + SKF_AD_CPU)));
+  // loops sharing a CPU would leave all but one idle, so they are only
+  // matched by CPU when each has its own
+  std::unordered_set<int> cpus;
+  for (size_t i = 1; i <= n; ++i) cpus.insert(loop_cpu(i));
+  for (size_t i = 1; i <= n && cpus.size() == n && !cpus.count(-1); ++i) {
+    // if A == cpu return i - 1, else skip the return
+    code.push_back(
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, uint32_t(loop_cpu(i)), 0, 1));
+    code.push_back(BPF_STMT(BPF_RET | BPF_K, uint32_t(i - 1)));
   }
+  // the CPUs without a loop are spread over the loops
+  code.push_back(BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, uint32_t(n)));
+  code.push_back(BPF_STMT(BPF_RET | BPF_A, 0));
+
+  sock_fprog prog = {.len = static_cast<unsigned short>(code.size()),
+                     .filter = code.data()};
+  return setsockopt(loops_[1]->listen_fd, SOL_SOCKET,
+                    SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) == 0;
+}
 
-  set_fd_nonblock(listen_fd_);
+void Server::close_listeners() {
+  for (auto &loop : loops_) {
+    if (loop->listen_fd == -1) continue;
+    loop->epoller.del(loop->listen_fd);
+    ::close(loop->listen_fd);
+    loop->listen_fd = -1;
+    loop->accept_pending = false;
+  }
+  steered_ = false;
+}
 
-  return true;
+int Server::loop_cpu(size_t i) const {
+  if (reactor_cpus_.empty()) return -1;
+  return reactor_cpus_[i % reactor_cpus_.size()];
 }
 
 void Server::start() {
-  if (listen_fd_ == -1 || running_) return;
+  if (running_) return;
+  bool listening = false;
+  for (auto &loop : loops_) listening |= loop->listen_fd != -1;
+  if (!listening) return;
+  for (size_t i = 0; i < loops_.size(); ++i) {
+    if (loops_[i]->wake_fd == -1) {
+      LOG_FAST(ERROR, "event loop {} has no wakeup fd", i);
+      return;
+    }
+  }
 
   running_ = true;
+  if (!reactor_cpus_.empty() && !pin_current_thread(reactor_cpus_))
+    LOG_FAST(ERROR, "failed to pin the acceptor to its CPUs, errno {}", errno);
+  // the loops that serve connections write the access log
+  for (size_t i = loops_.size() > 1 ? 1 : 0; i < loops_.size(); ++i) {
+    auto &loop = *loops_[i];
+    if (access_log_.is_open() && loop.access_producer == nullptr)
+      loop.access_producer = access_log_.add_producer();
+  }
+  if (access_log_.is_open()) access_log_.start();
+  for (size_t i = 1; i < loops_.size(); ++i) {
+    loops_[i]->thread = std::thread([this, i] {
+      // a steered listener assumes its loop runs on the CPU
+      if (int cpu = loop_cpu(i); cpu != -1 && !pin_current_thread({cpu}))
+        LOG_FAST(ERROR, "failed to pin event loop {} to CPU {}, errno {}", i,
+                 cpu, errno);
+      run(*loops_[i]);
+    });
+  }
+  run(*loops_[0]);
+  for (size_t i = 1; i < loops_.size(); ++i) loops_[i]->thread.join();
+  access_log_.stop();
+}
+
+bool Server::stop() {
+  if (running_.exchange(false) == false) return false;
+  for (auto &loop : loops_) {
+    uint64_t one = 1;
+    [[maybe_unused]] auto ret = ::write(loop->wake_fd, &one, sizeof(one));
+  }
+  return true;
+}
+
+void Server::run(EventLoop &loop) {
+  const bool measuring = balance_ == Balance::LEAST_LATENCY;
   while (running_) {
-    int n = epoller_.wait(-1);
+    // poll when there are connections left in the backlog or to be served
+    bool pending = loop.accept_pending || !loop.deferred.empty();
+    int n = loop.epoller.wait(pending ? 0 : -1);
     if (n == -1 && (errno == ECONNABORTED || errno == EINTR)) continue;
+    std::chrono::steady_clock::time_point begin;
+    if (measuring) begin = std::chrono::steady_clock::now();
+    loop.tracing = slow_requests_.enabled();
+    if (loop.tracing) loop.loop_timestamp = binlog::read_timestamp();
+    bool accepted = false;
     for (int i = 0; i < n; ++i) {
-      auto event = epoller_[i];
-      auto conn = static_cast<Connection *>(event.data.ptr);
-      if (conn == nullptr) {
-        acceptor();
+      auto event = loop.epoller[i];
+      if (event.data.ptr == nullptr) {
+        acceptor(loop);
+        accepted = true;
+      } else if (event.data.ptr == &loop.wake_fd) {
+        on_wake(loop);
       } else {
+        auto conn = static_cast<Connection *>(event.data.ptr);
         if (event.events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
           // close fd
-          this->close_client(conn->fd());
-        } else if (event.events & EPOLLIN) {
-          // readable
-          on_read(conn);
-        } else if (event.events & EPOLLOUT) {
-          // writeable
-          on_write(conn);
+          this->close_client(loop, conn->fd());
         } else {
-          // log unknown event
+          on_ready(loop, conn, event.events);
         }
       }
     }
+    if (loop.accept_pending && !accepted) acceptor(loop);
+    // the ones deferred now wait for the next round
+    size_t n_deferred = loop.deferred.size();
+    for (size_t i = 0; i < n_deferred; ++i) {
+      auto conn = loop.deferred[i];
+      if (conn == nullptr) continue;
+      conn->set_deferred(false);
+      serve(loop, conn);
+    }
+    loop.deferred.erase(loop.deferred.begin(),
+                        loop.deferred.begin() + n_deferred);
+    if (measuring && n > 0) {
+      uint64_t took = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                          std::chrono::steady_clock::now() - begin)
+                          .count();
+      // an exponential moving average with a weight of 1/8
+      auto avg = loop.latency_ns.load(std::memory_order_relaxed);
+      loop.latency_ns.store(avg - avg / 8 + took / 8,
+                            std::memory_order_relaxed);
+    }
   }
 }
 
+void Server::register_metrics() {
+  metric_.accepted = metrics_.counter(
+      "tinywebserver_connections_accepted_total", "Accepted connections.");
+  metric_.handoff_dropped = metrics_.counter(
+      "tinywebserver_handoff_dropped_total",
+      "Connections closed because the queues of all event loops were full.");
+  metric_.accept_budget_exhausted = metrics_.counter(
+      "tinywebserver_accept_budget_exhausted_total",
+      "Wakeups that accepted as many connections as the budget allows.");
+  metric_.event_budget_exhausted = metrics_.counter(
+      "tinywebserver_event_budget_exhausted_total",
+      "Connections deferred as they used up the budget of a readiness event.");
+  metric_.closed = metrics_.counter("tinywebserver_connections_closed_total",
+                                    "Closed connections.");
+  metric_.requests = metrics_.counter("tinywebserver_requests_total",
+                                      "Requests passed to a handler.");
+  metric_.bad_requests = metrics_.counter(
+      "tinywebserver_bad_requests_total", "Requests that failed to parse.");
+  metric_.response_bytes = metrics_.counter(
+      "tinywebserver_response_bytes_total", "Bytes of responses written.");
+  metric_.parse = metrics_.histogram(
+      "tinywebserver_request_read_seconds",
+      "Time to read and parse the readable data of a connection.");
+  metric_.handler = metrics_.histogram("tinywebserver_handler_seconds",
+                                       "Time spent in the handler.");
+  metric_.write = metrics_.histogram(
+      "tinywebserver_response_write_seconds",
+      "Time from making a response to writing its last byte.");
+
+  // read at scrape time, so they cost nothing on the event loop
+  metrics_.gauge_fn("tinywebserver_epoll_fds",
+                    "File descriptors on the epoll tree.",
+                    [this] {
+                      int n = 0;
+                      for (auto &loop : loops_) n += loop->epoller.size();
+                      return n;
+                    });
+  metrics_.gauge_fn("tinywebserver_epoll_event_capacity",
+                    "Ready events an epoll_wait() of the event loops can "
+                    "return.",
+                    [this] {
+                      int n = 0;
+                      for (auto &loop : loops_) n += loop->epoller.capacity();
+                      return n;
+                    });
+  metrics_.gauge_fn("tinywebserver_connections_open", "Open connections.",
+                    [this] {
+                      int n = 0;
+                      for (auto &loop : loops_) n += loop->connections;
+                      return n;
+                    });
+  metrics_.gauge_fn("tinywebserver_threadpool_tasks_queued",
+                    "Tasks waiting in the thread pool.",
+                    [this] { return threadpool_.get_tasks_queued(); });
+  metrics_.gauge_fn("tinywebserver_threadpool_threads",
+                    "Threads of the thread pool.",
+                    [this] { return threadpool_.get_thread_count(); });
+  metrics_.histogram_fn(
+      "tinywebserver_threadpool_wait_seconds",
+      "Time the tasks wait in the thread pool queue.",
+      [this]() -> auto & { return threadpool_.get_wait_time_histogram(); },
+      1e-9);
+  metrics_.histogram_fn(
+      "tinywebserver_threadpool_queue_depth",
+      "Tasks in the thread pool queue after a push.",
+      [this]() -> auto & { return threadpool_.get_queue_depth_histogram(); });
+  metrics_.gauge_fn("tinywebserver_memory_pool_heap_bytes",
+                    "Bytes that MemoryPool has taken from the heap.",
+                    [] { return MemoryPool::get_heap_size(); });
+  metrics_.gauge_fn("tinywebserver_log_backlog_bytes",
+                    "Bytes waiting in the log buffers.",
+                    [] { return Logger::get_instance().get_backlog(); });
+  metrics_.counter_fn("tinywebserver_access_log_dropped_total",
+                      "Access log records dropped since the start.",
+                      [this] { return access_log_.get_dropped(); });
+  metrics_.counter_fn("tinywebserver_timer_wakeups_total",
+                      "Wakeups of the timer thread since the start.",
+                      [this] { return timer_.wakeups().total(); });
+  metrics_.gauge_fn("tinywebserver_timer_wakeups_per_second",
+                    "Wakeups of the timer thread in the last whole second.",
+                    [this] { return timer_.wakeups().last_second(); });
+}
+
+bool Server::handle_slow_requests(const std::string &pattern) {
+  return handle(pattern, [this](ResponseWriter &resp, const Request &) {
+    resp.set_status(Response::OK);
+    resp.header()["Content-Type"] = "text/plain";
+    std::string out;
+    slow_requests_.dump(out);
+    resp.write(out);
+  });
+}
+
+bool Server::handle_metrics(const std::string &pattern) {
+  return handle(pattern, [this](ResponseWriter &resp, const Request &) {
+    resp.set_status(Response::OK);
+    resp.header()["Content-Type"] = "text/plain; version=0.0.4";
+    resp.write(metrics_.scrape());
+  });
+}
+
 /**
  * finish
  */
-void Server::acceptor() {
-  struct sockaddr_in addr;
-  socklen_t len = sizeof(addr);
-  do {
-    int fd = accept(listen_fd_, (struct sockaddr *)&addr, &len);
-    if (fd <= 0) break;
-    auto con = conn_mgr_.add(fd, std::make_unique<Connection>(fd, addr));
-    epoll_event ev = {.events = client_event_, .data{.ptr = con}};
-    epoller_.add(fd, ev);
-  } while (listen_fd_event_ & EPOLLET);
+void Server::acceptor(EventLoop &loop) {
+  // loops_[0] hands off unless it is the only loop
+  bool hand_over = &loop == loops_[0].get() && loops_.size() > 1;
+  loop.accept_pending = false;
+  for (int i = 0; i < listen_options_.accept_budget; ++i) {
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    int fd = accept4(loop.listen_fd, (struct sockaddr *)&addr, &len,
+                     SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      // the client has gone, try the next one
+      if (errno == ECONNABORTED || errno == EINTR) continue;
+      // EAGAIN or out of fds
+      return;
+    }
+    metric_.accepted->add();
+    TWS_PROBE(accept, fd, addr.sin_addr.s_addr, addr.sin_port);
+    if (hand_over) {
+      hand_off(fd, addr);
+    } else {
+      ++loop.connections;
+      add_client(loop, fd, addr);
+    }
+  }
+  metric_.accept_budget_exhausted->add();
+  // a level triggered listen fd is reported again
+  loop.accept_pending = listen_fd_event_ & EPOLLET;
+}
+
+void Server::hand_off(int fd, const sockaddr_in &addr) {
+  size_t n = loops_.size() - 1;
+  // an idle loop wins, so a stale latency doesn't keep it idle
+  auto load = [this](const EventLoop &loop) -> std::pair<uint64_t, uint64_t> {
+    uint64_t conns = loop.connections.load(std::memory_order_relaxed);
+    if (balance_ == Balance::LEAST_CONNECTIONS) return {conns, 0};
+    return {conns != 0, loop.latency_ns.load(std::memory_order_relaxed)};
+  };
+  size_t best = next_loop_;
+  auto best_load = load(*loops_[best + 1]);
+  for (size_t k = 1; k < n; ++k) {
+    size_t i = (next_loop_ + k) % n;
+    if (auto l = load(*loops_[i + 1]); l < best_load) {
+      best = i;
+      best_load = l;
+    }
+  }
+  next_loop_ = (best + 1) % n;
+
+  Handoff handoff = {.fd = fd, .addr = addr};
+  for (size_t k = 0; k < n; ++k) {
+    auto &loop = *loops_[(best + k) % n + 1];
+    ++loop.connections;
+    if (!loop.handoffs.try_push(handoff)) {
+      --loop.connections;
+      continue;
+    }
+    if (!loop.notified.exchange(true)) {
+      uint64_t one = 1;
+      [[maybe_unused]] auto ret = ::write(loop.wake_fd, &one, sizeof(one));
+    }
+    return;
+  }
+  metric_.handoff_dropped->add();
+  ::close(fd);
+}
+
+void Server::on_wake(EventLoop &loop) {
+  uint64_t count;
+  [[maybe_unused]] auto ret = ::read(loop.wake_fd, &count, sizeof(count));
+  // cleared before taking the handoffs, so a later one writes wake_fd again
+  loop.notified.exchange(false);
+  Handoff handoffs[64];
+  while (size_t n = loop.handoffs.pop(handoffs, std::size(handoffs)))
+    for (size_t i = 0; i < n; ++i)
+      add_client(loop, handoffs[i].fd, handoffs[i].addr);
+}
+
+void Server::add_client(EventLoop &loop, int fd, const sockaddr_in &addr) {
+  // the Connection closes fd if it is not added
+  auto con = loop.conn_mgr.add(fd, std::make_unique<Connection>(fd, addr));
+  if (con == nullptr) {
+    --loop.connections;
+    return;
+  }
+  // an edge triggered fd stays registered for both until it is closed
+  uint32_t events = client_event_ & EPOLLET ? EPOLLIN | EPOLLOUT : EPOLLIN;
+  epoll_event ev = {.events = client_event_ | events, .data{.ptr = con}};
+  if (!loop.epoller.add(fd, ev)) {
+    loop.conn_mgr.close(fd);
+    --loop.connections;
+  }
 }
 
-void Server::close_client(int client_fd) {
-  conn_mgr_.close(client_event_);
-  epoller_.del(client_fd);
+void Server::close_client(EventLoop &loop, int client_fd) {
+  metric_.closed->add();
+  TWS_PROBE(close, client_fd);
+  if (auto conn = loop.conn_mgr.get(client_fd); conn && conn->is_deferred())
+    std::replace(loop.deferred.begin(), loop.deferred.end(), conn,
+                 static_cast<Connection *>(nullptr));
+  loop.epoller.del(client_fd);
+  loop.conn_mgr.close(client_fd);
+  --loop.connections;
+}
+
+void Server::on_ready(EventLoop &loop, Connection *conn, uint32_t events) {
+  if (events & EPOLLIN) conn->set_readable(true);
+  // a deferred connection is served after the events, and the next request is
+  // read once the response is written
+  if (conn->is_deferred()) return;
+  if (conn->is_writing() && !(events & EPOLLOUT)) return;
+  serve(loop, conn);
+}
+
+void Server::serve(EventLoop &loop, Connection *conn) {
+  const bool persistent = client_event_ & EPOLLET;
+  int requests = 0;
+  size_t read_budget = event_bytes_;
+  for (;;) {
+    if (conn->is_writing() && on_write(loop, conn) != Step::DONE) return;
+    // A pipelined request read with the previous one gets no new EPOLLIN.
+    if (!conn->has_pending_input() && !conn->is_readable()) {
+      if (persistent) return;
+      epoll_event ev = {.events = this->client_event_ | EPOLLIN,
+                        .data = {.ptr = conn}};
+      if (!loop.epoller.mod(conn->fd(), ev)) close_client(loop, conn->fd());
+      return;
+    }
+    if (requests == event_requests_ || read_budget == 0) {
+      defer(loop, conn);
+      return;
+    }
+    ++requests;
+    auto step = on_read(loop, conn, read_budget);
+    if (step == Step::AGAIN) defer(loop, conn);
+    if (step != Step::DONE) return;
+  }
+}
+
+void Server::defer(EventLoop &loop, Connection *conn) {
+  if (conn->is_deferred()) return;
+  metric_.event_budget_exhausted->add();
+  conn->set_deferred(true);
+  loop.deferred.push_back(conn);
 }
 
 /**
  * @todo
  */
-void Server::on_read(Connection *conn) {
+Server::Step Server::on_read(EventLoop &loop, Connection *conn,
+                             size_t &read_budget) {
   int client_fd = conn->fd();
+  const bool persistent = client_event_ & EPOLLET;
   // todo: update expire time
 
+  auto &trace = conn->trace();
+  if (loop.tracing) {
+    if (!trace.active) {
+      trace.marks[RequestTrace::FIRST_READY] = loop.loop_timestamp;
+      trace.reads = trace.writes = 0;
+      trace.active = true;
+    }
+    trace.marks[RequestTrace::READY] = loop.loop_timestamp;
+    trace.mark(RequestTrace::READ_START);
+    ++trace.reads;
+  }
+
   // read data from fd
-  auto [state, req] =
-      conn->parse_request_from_fd(this->client_event_ & EPOLLET);
+  auto parse_start = std::chrono::steady_clock::now();
+  // an edge triggered fd is read until it is drained or the budget is used up
+  auto [state, req] = conn->parse_request_from_fd(persistent, read_budget);
+  auto handler_start = std::chrono::steady_clock::now();
+  if (loop.tracing) {
+    // a pipelined request parsed from buffered bytes has no read
+    auto read_end = conn->read_end_timestamp();
+    trace.marks[RequestTrace::READ_END] =
+        read_end != 0 ? read_end : trace.marks[RequestTrace::READ_START];
+    trace.mark(RequestTrace::PARSED);
+  }
+  metric_.parse->record(handler_start - parse_start);
   if (RequestParser::is_error_state(state)) {
+    metric_.bad_requests->add();
+    LOG_FAST(WRAN, "close fd {} on a bad request, parser state {}", client_fd,
+             int(state));
+    log_rejected(loop, conn, nullptr, 400, handler_start);
     // todo 发送错误原因
-    this->close_client(client_fd);
-    return;
+    this->close_client(loop, client_fd);
+    return Step::CLOSED;
   }
   if (req == nullptr) {
+    // the rest of the request is still to be read
+    if (conn->is_readable()) return Step::AGAIN;
+    // wait for the rest of the request
+    if (persistent) return Step::WAIT;
     epoll_event ev = {.events = this->client_event_ | EPOLLIN,
                       .data = {.ptr = conn}};
-    bool ret = this->epoller_.mod(client_fd, ev);
+    bool ret = loop.epoller.mod(client_fd, ev);
     if (!ret) {
       // todo 服务器内部错误
-      close_client(client_fd);
+      close_client(loop, client_fd);
+      return Step::CLOSED;
     }
-    return;
+    return Step::WAIT;
   }
 
+  TWS_PROBE(request_parsed, client_fd, int(req->method()), req->uri().c_str(),
+            req->body().size());
+
   // todo 这里从 request 中获取是否要设置 keep-alive
 
   // find the http handler
   auto handler = this->handler_mgr_.match(req->uri());
+  if (loop.tracing) {
+    trace.mark(RequestTrace::MATCHED);
+    trace.method = req->method();
+    trace.uri.assign(req->uri());
+  }
   if (handler == nullptr) {
+    LOG_FAST(INFO, "close fd {}, no handler for {}", client_fd, req->uri());
+    log_rejected(loop, conn, req.get(), 404, handler_start);
     // todo 发送找不到 handler 的错误信息
     // 或者尝试使用 default handler
-    this->close_client(client_fd);
-    return;
+    this->close_client(loop, client_fd);
+    return Step::CLOSED;
   }
 
+  metric_.requests->add();
   ResponseWriter &resp_writer = conn->response_writer();
+  TWS_PROBE(handler_start, client_fd, req->uri().c_str());
   handler->operator()(resp_writer, *req);
+  // make_response() sends 200 if the handler doesn't set a status
+  TWS_PROBE(handler_end, client_fd,
+            resp_writer.status() == Response::INVALID_CODE
+                ? int(Response::OK)
+                : resp_writer.status(),
+            resp_writer.body_size());
+  if (loop.tracing) trace.mark(RequestTrace::HANDLED);
 
   conn->make_response();
+  if (loop.tracing) trace.mark(RequestTrace::RESPONSE_MADE);
+  conn->response_start() = std::chrono::steady_clock::now();
+  metric_.handler->record(conn->response_start() - handler_start);
+  if (auto record =
+          begin_access_log(loop, conn, handler, req.get(), handler_start)) {
+    record->status = resp_writer.status();
+    record->bytes = conn->response().bytes();
+    conn->set_access_pending(true);
+  }
+  TWS_PROBE(response_queued, client_fd, resp_writer.status(),
+            conn->response_size());
+  // the send buffer is likely to have room, so write without waiting for
+  // EPOLLOUT
+  if (persistent) return Step::DONE;
   epoll_event ev = {.events = this->client_event_ | EPOLLOUT,
                     .data = {.ptr = conn}};
-  bool ret = this->epoller_.mod(client_fd, ev);
+  bool ret = loop.epoller.mod(client_fd, ev);
   if (!ret) {
     // 服务器内部错误
-    close_client(client_fd);
+    close_client(loop, client_fd);
+    return Step::CLOSED;
   }
+  return Step::WAIT;
 }
 
-void Server::on_write(Connection *conn) {
+AccessRecord *Server::begin_access_log(
+    EventLoop &loop, Connection *conn, const HTTPHandler *handler,
+    const Request *req, std::chrono::steady_clock::time_point parsed) {
+  if (loop.access_producer == nullptr || access_log_disabled_.count(handler) ||
+      !access_log_.sample(*loop.access_producer))
+    return nullptr;
+  auto &record = conn->access_record();
+  // the wall time of parsed, from the steady time elapsed since then
+  auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                     std::chrono::steady_clock::now() - parsed)
+                     .count();
+  record.time_ns = binlog::wall_time_ns() - elapsed;
+  record.duration_ns = elapsed;
+  record.bytes = 0;
+  record.remote_addr = conn->address().sin_addr.s_addr;
+  record.remote_port = conn->address().sin_port;
+  record.status = 0;
+  if (req == nullptr) {
+    record.method = Request::Method::UNKNOWN;
+    record.version.assign("");
+    record.uri.assign("");
+    record.referer.assign("");
+    record.user_agent.assign("");
+    return &record;
+  }
+  record.method = req->method();
+  record.version.assign(req->version());
+  record.uri.assign(req->uri());
+  auto &header = req->header();
+  auto it = header.find(Header::REFERER);
+  record.referer.assign(it == header.end() ? "" : it->second);
+  it = header.find(Header::USER_AGENT);
+  record.user_agent.assign(it == header.end() ? "" : it->second);
+  return &record;
+}
+
+void Server::log_rejected(EventLoop &loop, Connection *conn,
+                          const Request *req, uint16_t status,
+                          std::chrono::steady_clock::time_point parsed) {
+  auto record = begin_access_log(loop, conn, nullptr, req, parsed);
+  if (record == nullptr) return;
+  record->status = status;
+  access_log_.push(*loop.access_producer, *record);
+}
+
+Server::Step Server::on_write(EventLoop &loop, Connection *conn) {
   int client_fd = conn->fd();
   // todo: update expire time
 
   auto &bv = conn->response();
+  auto &trace = conn->trace();
+  const bool persistent = client_event_ & EPOLLET;
 
-  auto size = writev(client_fd, bv.get_iovec_address(), bv.size());
-  bv.update(size);
+  ssize_t size;
+  // an edge triggered fd is written until it would block, as there is no
+  // EPOLLOUT before that
+  do {
+    size = writev(client_fd, bv.get_iovec_address(), bv.size());
+    if (size > 0) {
+      bv.update(size);
+      metric_.response_bytes->add(size);
+    }
+    if (loop.tracing && trace.active) ++trace.writes;
+  } while (persistent && size > 0 && bv.bytes() > 0);
   if (bv.bytes() == 0) {
+    TWS_PROBE(write_done, client_fd, conn->response_writer().status(),
+              conn->response_size());
+    if (loop.tracing && trace.active) {
+      trace.mark(RequestTrace::WRITE_DONE);
+      slow_requests_.finish(trace, client_fd);
+      trace.active = false;
+    }
+    auto duration = std::chrono::steady_clock::now() - conn->response_start();
+    metric_.write->record(duration);
+    if (conn->access_pending()) {
+      auto &record = conn->access_record();
+      // the time from parsing to making the response is already in it
+      record.duration_ns +=
+          std::chrono::duration_cast<std::chrono::nanoseconds>(duration)
+              .count();
+      access_log_.push(*loop.access_producer, record);
+      conn->set_access_pending(false);
+    }
     if (conn->is_keep_alive()) {
       // 清空上个链接的缓冲
       conn->clear();
-      epoll_event ev = {.events = this->client_event_ | EPOLLIN,
-                        .data = {.ptr = conn}};
-      this->epoller_.mod(client_fd, ev);
-      return;
+      return Step::DONE;
     }
-    this->close_client(client_fd);
-    return;
+    this->close_client(loop, client_fd);
+    return Step::CLOSED;
   }
 
   if (size < 0) {
     if (errno == EAGAIN) {
+      if (persistent) return Step::WAIT;
       epoll_event ev = {.events = this->client_event_ | EPOLLOUT,
                         .data = {.ptr = conn}};
-      this->epoller_.mod(client_fd, ev);
-      return;
+      loop.epoller.mod(client_fd, ev);
+      return Step::WAIT;
     }
     // todo 产生未知错误
-    this->close_client(client_fd);
-    return;
+    this->close_client(loop, client_fd);
+    return Step::CLOSED;
   }
 
   epoll_event ev = {.events = this->client_event_ | EPOLLOUT,
                     .data = {.ptr = conn}};
-  this->epoller_.mod(client_fd, ev);
+  loop.epoller.mod(client_fd, ev);
+  return Step::WAIT;
 }
 
 }  // namespace http
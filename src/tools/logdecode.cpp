@@ -0,0 +1,100 @@
+// Decode the log files written by Logger in Logger::Encoding::BINARY into
+// text.
+//
+// usage: tinywebserver-logdecode <file>...
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "tinywebserver/log_format.h"
+
+static bool decode(const char *filename) {
+  std::ifstream fs(filename, std::ios::binary);
+  if (!fs) {
+    std::fprintf(stderr, "%s: can't open the file\n", filename);
+    return false;
+  }
+  std::string data((std::istreambuf_iterator<char>(fs)),
+                   std::istreambuf_iterator<char>());
+  std::string_view in = data;
+  if (!in.starts_with({binlog::magic, sizeof(binlog::magic)})) {
+    std::fprintf(stderr, "%s: not a binary log file\n", filename);
+    return false;
+  }
+  in.remove_prefix(sizeof(binlog::magic));
+
+  std::unordered_map<uint32_t, binlog::SiteDef> sites;
+  binlog::Clock clock;
+  std::string thread = "?", out, message;
+  binlog::RecordHeader header;
+  while (in.size() >= sizeof(header)) {
+    std::memcpy(&header, in.data(), sizeof(header));
+    if (in.size() - sizeof(header) < header.size) break;
+    auto payload = in.substr(sizeof(header), header.size);
+    in.remove_prefix(sizeof(header) + header.size);
+
+    switch (header.site) {
+      case binlog::TEXT_SITE:
+        out.append(payload);
+        break;
+      case binlog::THREAD_SITE:
+        thread = payload;
+        break;
+      case binlog::CLOCK_SITE: {
+        int64_t ns;
+        if (payload.size() != sizeof(ns)) goto malformed;
+        std::memcpy(&ns, payload.data(), sizeof(ns));
+        clock.calibrate(header.timestamp, ns);
+        break;
+      }
+      case binlog::SITE_DEF: {
+        uint32_t id;
+        binlog::SiteDef site;
+        if (!binlog::decode_site_def(payload, id, site)) goto malformed;
+        sites[id] = std::move(site);
+        break;
+      }
+      default: {
+        auto it = sites.find(header.site);
+        if (it == sites.end()) goto malformed;
+        auto &site = it->second;
+        message.clear();
+        if (!binlog::format_message(message, site.format, site.arg_types,
+                                    payload))
+          goto malformed;
+        binlog::format_line(out, site.level, clock.to_ns(header.timestamp),
+                            thread, site.file, site.line, site.column,
+                            site.function, message);
+      }
+    }
+    if (out.size() >= 64 * 1024) {
+      std::fwrite(out.data(), 1, out.size(), stdout);
+      out.clear();
+    }
+  }
+  std::fwrite(out.data(), 1, out.size(), stdout);
+  if (!in.empty())
+    std::fprintf(stderr, "%s: %zu trailing bytes of a truncated record\n",
+                 filename, in.size());
+  return true;
+
+malformed:
+  std::fwrite(out.data(), 1, out.size(), stdout);
+  std::fprintf(stderr, "%s: malformed record at offset %zu\n", filename,
+               data.size() - in.size() - sizeof(header) - header.size);
+  return false;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    std::fprintf(stderr, "usage: %s <file>...\n", argv[0]);
+    return 2;
+  }
+  bool ok = true;
+  for (int i = 1; i < argc; ++i) ok = decode(argv[i]) && ok;
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,60 @@
+#include "tinywebserver/network/http/access_log.h"
+
+#include <arpa/inet.h>
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <limits>
+#include <string>
+
+namespace {
+
+http::AccessRecord make_record() {
+  http::AccessRecord record;
+  record.remote_addr = htonl(INADDR_LOOPBACK);
+  record.remote_port = htons(54321);
+  record.status = 200;
+  record.bytes = 1234;
+  record.duration_ns = 5678000;
+  record.method = http::Request::Method::GET;
+  record.version.assign("1.1");
+  record.uri.assign("/a \"b\"");
+  record.user_agent.assign("curl");
+  return record;
+}
+
+}  // namespace
+
+TEST(AccessLogTest, FormatsTheCombinedLayout) {
+  std::string out;
+  http::AccessLog::format(out, http::AccessLog::Format::COMBINED,
+                          make_record());
+  EXPECT_TRUE(out.starts_with("127.0.0.1 - - [")) << out;
+  EXPECT_TRUE(out.ends_with(
+      "] \"GET /a \\\"b\\\" HTTP/1.1\" 200 1234 \"-\" \"curl\"\n"))
+      << out;
+}
+
+TEST(AccessLogTest, FormatsTheLargestNumbers) {
+  auto record = make_record();
+  record.status = std::numeric_limits<uint16_t>::max();
+  record.bytes = std::numeric_limits<uint64_t>::max();
+  record.duration_ns = std::numeric_limits<int64_t>::min();
+  std::string out;
+  http::AccessLog::format(out, http::AccessLog::Format::JSON, record);
+  EXPECT_NE(out.find("\"remote_port\":54321,"), std::string::npos) << out;
+  EXPECT_NE(out.find("\"status\":65535,\"bytes\":18446744073709551615,"
+                     "\"duration_us\":-9223372036854775,"),
+            std::string::npos)
+      << out;
+}
+
+TEST(AccessLogTest, FormatsARejectedRequest) {
+  http::AccessRecord record;
+  record.remote_addr = htonl(INADDR_LOOPBACK);
+  record.status = 400;
+  std::string out;
+  http::AccessLog::format(out, http::AccessLog::Format::COMMON, record);
+  EXPECT_TRUE(out.ends_with("] \"-\" 400 0\n")) << out;
+}
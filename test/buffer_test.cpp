@@ -0,0 +1,32 @@
+#include "tinywebserver/utils/buffer.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+TEST(BufferTest, GrowsWhenFull) {
+  Buffer buf(4);
+  buf.write("abcd", 4);
+  buf.write("efghijkl", 8);
+  EXPECT_EQ(buf.view(), "abcdefghijkl");
+  EXPECT_GE(buf.readable_size() + buf.writeable_size(), 12u);
+}
+
+TEST(BufferTest, GrowsToHoldTheUnreadData) {
+  // the unread data is larger than twice the new write
+  Buffer buf(4);
+  std::string data(1000, 'x');
+  buf.write(data.data(), data.size());
+  buf.write("y", 1);
+  buf.write("z", 1);
+  EXPECT_EQ(buf.view(), data + "yz");
+}
+
+TEST(BufferTest, ReusesTheReadSpace) {
+  Buffer buf(8);
+  buf.write("abcdef", 6);
+  char out[4];
+  EXPECT_EQ(buf.read(out, 4), 4);
+  buf.write("ghij", 4);
+  EXPECT_EQ(buf.view(), "efghij");
+}
@@ -0,0 +1,63 @@
+#include "tinywebserver/utils/buffer_vector.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+TEST(IOVectorTest, UpdateSkipsTheWrittenIovecs) {
+  char a[4], b[8];
+  IOVector iov{{a, sizeof(a)}, {b, sizeof(b)}};
+  iov.update(4);
+  EXPECT_EQ(iov.size(), 1u);
+  EXPECT_EQ(iov[0].iov_base, b);
+  EXPECT_EQ(iov.bytes(), 8u);
+}
+
+TEST(IOVectorTest, UpdateAdvancesAPartiallyWrittenIovec) {
+  char a[4], b[8];
+  IOVector iov{{a, sizeof(a)}, {b, sizeof(b)}};
+  iov.update(6);
+  ASSERT_EQ(iov.size(), 1u);
+  EXPECT_EQ(iov[0].iov_base, b + 2);
+  EXPECT_EQ(iov[0].iov_len, 6u);
+  EXPECT_EQ(iov.bytes(), 6u);
+  iov.update(6);
+  EXPECT_EQ(iov.bytes(), 0u);
+}
+
+namespace {
+
+std::string read_all(BufferVector &buf) {
+  std::string ret(buf.readable_size(), '\0');
+  ret.resize(buf.read(ret.data(), ret.size()));
+  return ret;
+}
+
+}  // namespace
+
+TEST(BufferVectorTest, WritesAndReads) {
+  BufferVector buf(4);
+  buf.write("0123456789");
+  EXPECT_EQ(buf.readable_size(), 10u);
+  EXPECT_EQ(buf.get_read_iovec().bytes(), 10u);
+  EXPECT_EQ(read_all(buf), "0123456789");
+  EXPECT_TRUE(buf.readable_empty());
+}
+
+TEST(BufferVectorTest, MovesTheSegmentsOfAnotherBuffer) {
+  BufferVector head;
+  head.write("HTTP/1.1 200 OK\r\n\r\n");
+  // the body spans several segments
+  BufferVector body(4);
+  body.write("0123456789");
+  head.write(body);
+  EXPECT_TRUE(body.readable_empty());
+  head.write("!");
+  EXPECT_EQ(head.readable_size(), 30u);
+  EXPECT_EQ(head.get_read_iovec().bytes(), 30u);
+  EXPECT_EQ(read_all(head), "HTTP/1.1 200 OK\r\n\r\n0123456789!");
+
+  // the moved-from buffer is still usable
+  body.write("abc");
+  EXPECT_EQ(read_all(body), "abc");
+}
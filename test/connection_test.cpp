@@ -0,0 +1,76 @@
+#include "tinywebserver/network/http/connection.h"
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <string>
+
+using http::Connection;
+using http::ConnectionManger;
+using http::Response;
+
+namespace {
+
+std::string to_string(IOVector iov) {
+  std::string ret;
+  for (size_t i = 0; i < iov.size(); ++i)
+    ret.append(static_cast<const char *>(iov[i].iov_base), iov[i].iov_len);
+  return ret;
+}
+
+}  // namespace
+
+TEST(ConnectionTest, MakesTheResponse) {
+  Connection conn;
+  auto &resp = conn.response_writer();
+  resp.header()["Content-Type"] = "text/plain";
+  resp.write("hello");
+  auto text = to_string(conn.make_response());
+  EXPECT_TRUE(text.starts_with("HTTP/1.1 200 OK\r\n")) << text;
+  EXPECT_NE(text.find("\r\nContent-Length: 5\r\n"), std::string::npos);
+  EXPECT_NE(text.find("\r\nContent-Type: text/plain\r\n"), std::string::npos);
+  EXPECT_TRUE(text.ends_with("\r\n\r\nhello")) << text;
+  EXPECT_EQ(conn.response_size(), text.size());
+}
+
+TEST(ConnectionTest, MakesTheResponseOfTheStatus) {
+  Connection conn;
+  conn.response_writer().set_status(Response::NOT_FOUND);
+  auto text = to_string(conn.make_response());
+  EXPECT_TRUE(text.starts_with("HTTP/1.1 404 NOT_FOUND\r\n")) << text;
+  EXPECT_NE(text.find("\r\nContent-Length: 0\r\n"), std::string::npos);
+  EXPECT_TRUE(text.ends_with("\r\n\r\n")) << text;
+}
+
+TEST(ConnectionMangerTest, AddsAndClosesAConnection) {
+  int fds[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  ConnectionManger mgr;
+  auto conn = mgr.add(fds[0], std::make_unique<Connection>(fds[0]));
+  ASSERT_NE(conn, nullptr);
+  EXPECT_EQ(conn->fd(), fds[0]);
+  EXPECT_EQ(mgr.get(fds[0]), conn);
+
+  EXPECT_TRUE(mgr.close(fds[0]));
+  EXPECT_EQ(mgr.get(fds[0]), nullptr);
+  EXPECT_FALSE(mgr.close(fds[0]));
+  // the peer sees the close
+  char c;
+  EXPECT_EQ(read(fds[1], &c, 1), 0);
+  close(fds[1]);
+}
+
+TEST(ConnectionMangerTest, RejectsAnFdInUse) {
+  int fds[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  ConnectionManger mgr;
+  auto conn = mgr.add(fds[0], std::make_unique<Connection>(fds[0]));
+  ASSERT_NE(conn, nullptr);
+  EXPECT_EQ(mgr.add(fds[0], std::make_unique<Connection>()), nullptr);
+  EXPECT_EQ(mgr.get(fds[0]), conn);
+  mgr.clear();
+  close(fds[1]);
+}
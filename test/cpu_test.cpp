@@ -0,0 +1,57 @@
+#include "tinywebserver/utils/cpu.h"
+
+#include <sched.h>
+
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <vector>
+
+namespace {
+
+/**
+ * @brief The first CPU the process may run on.
+ */
+int allowed_cpu() {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  sched_getaffinity(0, sizeof(set), &set);
+  for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+    if (CPU_ISSET(cpu, &set)) return cpu;
+  return -1;
+}
+
+}  // namespace
+
+TEST(CpuTest, ParsesACpuList) {
+  EXPECT_EQ(parse_cpu_list("0-3,8, 10-11"),
+            (std::vector<int>{0, 1, 2, 3, 8, 10, 11}));
+  EXPECT_EQ(parse_cpu_list("5"), std::vector<int>{5});
+  EXPECT_TRUE(parse_cpu_list("").empty());
+}
+
+TEST(CpuTest, RejectsABadCpuList) {
+  EXPECT_TRUE(parse_cpu_list("3-1").empty());
+  EXPECT_TRUE(parse_cpu_list("a").empty());
+  EXPECT_TRUE(parse_cpu_list("1,-2").empty());
+}
+
+TEST(CpuTest, TellsTheAllowedCpus) {
+  int cpu = allowed_cpu();
+  ASSERT_NE(cpu, -1);
+  EXPECT_TRUE(cpus_allowed({cpu}));
+  EXPECT_FALSE(cpus_allowed({}));
+  EXPECT_FALSE(cpus_allowed({-1}));
+  EXPECT_FALSE(cpus_allowed({cpu, CPU_SETSIZE}));
+}
+
+TEST(CpuTest, PinsTheCurrentThread) {
+  int cpu = allowed_cpu();
+  bool pinned = false, rejected = true;
+  std::thread([&] {
+    pinned = pin_current_thread({cpu});
+    rejected = !pin_current_thread({CPU_SETSIZE});
+  }).join();
+  EXPECT_TRUE(pinned);
+  EXPECT_TRUE(rejected);
+}
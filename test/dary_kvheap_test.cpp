@@ -0,0 +1,143 @@
+#include "tinywebserver/utils/dary_kvheap.hpp"
+
+#include <gtest/gtest.h>
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace {
+
+using MinHeap = DaryKVHeap<int, std::string, int, std::greater<int>>;
+
+std::vector<int> pop_keys(MinHeap &heap) {
+  std::vector<int> keys;
+  while (!heap.empty()) keys.push_back(heap.pop().first);
+  return keys;
+}
+
+}  // namespace
+
+TEST(DaryKVHeapTest, PushesARangeIntoAnEmptyHeap) {
+  MinHeap heap;
+  std::vector<std::tuple<int, int, std::string>> range;
+  for (int key : {5, 3, 9, 1, 7, 2, 8, 3})
+    range.emplace_back(key, key * 10, std::to_string(key));
+  // the repeated key is skipped
+  EXPECT_EQ(heap.push_range(range), 7u);
+  EXPECT_EQ(heap.size(), 7u);
+  // an lvalue range is copied
+  EXPECT_EQ(std::get<2>(range[0]), "5");
+  EXPECT_EQ(*heap.get(9), "9");
+  EXPECT_EQ(pop_keys(heap), (std::vector<int>{1, 2, 3, 5, 7, 8, 9}));
+}
+
+TEST(DaryKVHeapTest, PushesASmallRangeIntoABigHeap) {
+  MinHeap heap;
+  for (int key = 0; key < 100; ++key)
+    heap.push(key, key * 2, std::to_string(key));
+  std::vector<std::tuple<int, int, std::string>> range = {
+      {1000, -1, "first"}, {1001, 51, "middle"}, {10, 0, "exists"}};
+  // fewer than the heap, so they are sifted up one by one
+  EXPECT_EQ(heap.push_range(range), 2u);
+  EXPECT_EQ(*heap.get(10), "10");
+  EXPECT_EQ(heap.top_key(), 1000);
+  EXPECT_EQ(heap.top(), "first");
+
+  auto keys = pop_keys(heap);
+  ASSERT_EQ(keys.size(), 102u);
+  EXPECT_EQ(keys[0], 1000);
+  // 51 goes after the priority 50 of key 25
+  EXPECT_EQ(keys[27], 1001);
+}
+
+TEST(DaryKVHeapTest, MovesTheValuesOfAnRvalueRange) {
+  DaryKVHeap<int, std::unique_ptr<int>, int, std::greater<int>> heap;
+  std::vector<std::tuple<int, int, std::unique_ptr<int>>> range;
+  for (int key = 0; key < 8; ++key)
+    range.emplace_back(key, -key, std::make_unique<int>(key));
+  EXPECT_EQ(heap.push_range(std::move(range)), 8u);
+  EXPECT_EQ(heap.top_key(), 7);
+  EXPECT_EQ(**heap.get(3), 3);
+}
+
+TEST(DaryKVHeapTest, PopsWhileThePredicateHolds) {
+  MinHeap heap;
+  for (int key = 0; key < 20; ++key)
+    heap.push(key, key, std::to_string(key));
+  std::vector<int> popped;
+  auto n = heap.pop_while([](int priority) { return priority < 5; },
+                          [&](int key, std::string &&value) {
+                            EXPECT_EQ(value, std::to_string(key));
+                            EXPECT_EQ(heap.count(key), 0u);
+                            popped.push_back(key);
+                          });
+  EXPECT_EQ(n, 5u);
+  EXPECT_EQ(popped, (std::vector<int>{0, 1, 2, 3, 4}));
+  EXPECT_EQ(heap.top_priority(), 5);
+  EXPECT_EQ(heap.pop_while([](int) { return false; }, [](int, auto &&) {}),
+            0u);
+}
+
+TEST(DaryKVHeapTest, PushesAgainFromPopWhile) {
+  MinHeap heap;
+  for (int key = 0; key < 4; ++key) heap.push(key, key, "timer");
+  // reschedule every popped element like a repeating timer, each is popped
+  // again until its priority passes the limit
+  std::map<int, int> runs;
+  auto n = heap.pop_while([](int priority) { return priority < 10; },
+                          [&](int key, std::string &&value) {
+                            int priority = key + 4 * ++runs[key];
+                            EXPECT_TRUE(heap.push(key, priority,
+                                                  std::move(value)));
+                          });
+  EXPECT_EQ(n, 10u);
+  EXPECT_EQ(runs, (std::map<int, int>{{0, 3}, {1, 3}, {2, 2}, {3, 2}}));
+  EXPECT_EQ(heap.size(), 4u);
+  EXPECT_EQ(heap.top_priority(), 10);
+}
+
+TEST(DaryKVHeapTest, MatchesAReferenceWithSparseKeys) {
+  // negative and big keys are indexed by the hash map, the others by vector
+  DaryKVHeap<int64_t, int64_t, int64_t, std::greater<int64_t>> heap;
+  std::map<int64_t, int64_t> priorities;
+  std::mt19937_64 rng(7);
+  auto random_key = [&] {
+    switch (rng() % 3) {
+      case 0:
+        return int64_t(rng() % 64);
+      case 1:
+        return -int64_t(rng() % 64) - 1;
+      default:
+        return int64_t(1) << 40 | int64_t(rng() % 64);
+    }
+  };
+  for (int round = 0; round < 200; ++round) {
+    std::vector<std::tuple<int64_t, int64_t, int64_t>> range;
+    size_t n = rng() % (round % 2 ? 4 : 64);
+    for (size_t i = 0; i < n; ++i) {
+      auto key = random_key();
+      range.emplace_back(key, int64_t(rng() % 1000), key);
+    }
+    size_t added = 0;
+    for (auto &[key, priority, value] : range)
+      added += priorities.try_emplace(key, priority).second;
+    EXPECT_EQ(heap.push_range(range), added);
+
+    int64_t limit = rng() % 1000;
+    heap.pop_while([&](int64_t priority) { return priority < limit; },
+                   [&](int64_t key, int64_t value) {
+                     EXPECT_EQ(key, value);
+                     ASSERT_TRUE(priorities.count(key));
+                     EXPECT_LT(priorities[key], limit);
+                     priorities.erase(key);
+                   });
+    for (auto &[key, priority] : priorities) ASSERT_GE(priority, limit);
+    ASSERT_EQ(heap.size(), priorities.size());
+  }
+}
@@ -0,0 +1,46 @@
+#include "tinywebserver/utils/kvheap.hpp"
+
+#include <gtest/gtest.h>
+
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+TEST(KVHeapTest, PopsInOrder) {
+  KVHeap<std::string, int, std::greater<int>> heap;
+  std::vector<int> values = {5, 3, 9, 1, 7, 2, 8};
+  for (auto v : values) EXPECT_TRUE(heap.push(std::to_string(v), v));
+  EXPECT_FALSE(heap.push("5", 0));
+  EXPECT_EQ(heap.size(), values.size());
+
+  std::vector<int> popped;
+  while (!heap.empty()) {
+    auto [key, value] = heap.pop();
+    EXPECT_EQ(key, std::to_string(value));
+    EXPECT_EQ(heap.count(key), 0u);
+    popped.push_back(value);
+  }
+  EXPECT_EQ(popped, (std::vector<int>{1, 2, 3, 5, 7, 8, 9}));
+}
+
+TEST(KVHeapTest, UpdatesAndErasesByKey) {
+  KVHeap<int, int, std::greater<int>> heap;
+  for (int i = 0; i < 16; ++i) heap.emplace(i, i * 10);
+  EXPECT_TRUE(heap.update(15, -1));
+  EXPECT_EQ(heap.top(), -1);
+  EXPECT_TRUE(heap.update(15, [](int &v) { v = 1000; }));
+  EXPECT_EQ(heap.top(), 0);
+  EXPECT_EQ(heap.get(15), 1000);
+  EXPECT_THROW(heap.get(16), std::out_of_range);
+  EXPECT_TRUE(heap.erase(0));
+  EXPECT_FALSE(heap.erase(0));
+  EXPECT_FALSE(heap.update(0, 1));
+  EXPECT_EQ(heap.top(), 10);
+
+  // move every element, the order is restored
+  heap.update([](int &v) { v = -v; });
+  EXPECT_EQ(heap.top(), -1000);
+  EXPECT_EQ(heap.pop().first, 15);
+  EXPECT_EQ(heap.pop().first, 14);
+}
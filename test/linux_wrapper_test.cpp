@@ -0,0 +1,18 @@
+#include "tinywebserver/network/linux_wrapper.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+TEST(LinuxWrapperTest, SetsNonblockAndKeepsTheFlags) {
+  int fd = memfd_create("linux_wrapper_test", MFD_CLOEXEC);
+  ASSERT_NE(fd, -1);
+  ASSERT_EQ(fcntl(fd, F_SETFL, O_APPEND), 0);
+  EXPECT_NE(set_fd_nonblock(fd), -1);
+  int flags = fcntl(fd, F_GETFL);
+  EXPECT_TRUE(flags & O_NONBLOCK);
+  EXPECT_TRUE(flags & O_APPEND);
+  close(fd);
+}
@@ -0,0 +1,143 @@
+#include "tinywebserver/network/local_epoller.h"
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+namespace {
+
+/**
+ * @brief Expose the bookkeeping of the buffer.
+ */
+class TestEpoller : public LocalEpoller {
+ public:
+  using LocalEpoller::LocalEpoller;
+  using LocalEpoller::record;
+
+  /**
+   * @brief Use epoll_wait() as on a kernel without epoll_pwait2().
+   */
+  void disable_pwait2() { has_pwait2_ = false; }
+};
+
+/**
+ * @brief n eventfds that stay readable, added to the epoller.
+ */
+class ReadyFds {
+ public:
+  ReadyFds(LocalEpoller &epoller, int n) {
+    for (int i = 0; i < n; ++i) {
+      int fd = eventfd(1, EFD_CLOEXEC);
+      epoller.add(fd, {.events = EPOLLIN, .data{.fd = fd}});
+      fds_.push_back(fd);
+    }
+  }
+
+  ~ReadyFds() {
+    for (int fd : fds_) close(fd);
+  }
+
+ private:
+  std::vector<int> fds_;
+};
+
+/**
+ * @brief Wait n times without an event.
+ */
+void wait_idle(LocalEpoller &epoller, int n) {
+  for (int i = 0; i < n; ++i) ASSERT_EQ(epoller.wait(0), 0);
+}
+
+}  // namespace
+
+TEST(LocalEpollerTest, GrowsAfterFullBatches) {
+  LocalEpoller epoller(4, 16);
+  ReadyFds fds(epoller, 32);
+  EXPECT_EQ(epoller.capacity(), 4);
+  for (int i = 0; i < LocalEpoller::grow_after; ++i) {
+    EXPECT_EQ(epoller.wait(0), 4);
+    EXPECT_EQ(epoller.capacity(), 4);
+  }
+  // the buffer grows before the next wait
+  EXPECT_EQ(epoller.wait(0), 8);
+  EXPECT_EQ(epoller.capacity(), 8);
+  EXPECT_EQ(epoller.wait(0), 8);
+  EXPECT_EQ(epoller.wait(0), 16);
+  // up to the max
+  for (int i = 0; i < 2 * LocalEpoller::grow_after; ++i)
+    EXPECT_EQ(epoller.wait(0), 16);
+  EXPECT_EQ(epoller.capacity(), 16);
+}
+
+TEST(LocalEpollerTest, ShrinksAfterSparseBatches) {
+  LocalEpoller epoller(4, 16);
+  {
+    ReadyFds fds(epoller, 16);
+    for (int i = 0; i < 2 * LocalEpoller::grow_after + 1; ++i) epoller.wait(0);
+    ASSERT_EQ(epoller.capacity(), 16);
+  }
+  // the closed eventfds leave the epoll tree
+  wait_idle(epoller, LocalEpoller::shrink_after);
+  EXPECT_EQ(epoller.capacity(), 16);
+  wait_idle(epoller, 1);
+  EXPECT_EQ(epoller.capacity(), 8);
+  // a batch of more than a quarter breaks the streak
+  wait_idle(epoller, LocalEpoller::shrink_after - 2);
+  {
+    ReadyFds fds(epoller, 3);
+    EXPECT_EQ(epoller.wait(0), 3);
+  }
+  wait_idle(epoller, LocalEpoller::shrink_after);
+  EXPECT_EQ(epoller.capacity(), 8);
+  wait_idle(epoller, 1);
+  EXPECT_EQ(epoller.capacity(), 4);
+  // down to the min
+  wait_idle(epoller, LocalEpoller::shrink_after + 1);
+  EXPECT_EQ(epoller.capacity(), 4);
+}
+
+TEST(LocalEpollerTest, IgnoresFailedWaits) {
+  TestEpoller epoller(4, 16);
+  {
+    ReadyFds fds(epoller, 8);
+    for (int i = 0; i < LocalEpoller::grow_after + 1; ++i) epoller.wait(0);
+    ASSERT_EQ(epoller.capacity(), 8);
+  }
+  wait_idle(epoller, LocalEpoller::shrink_after - 1);
+  // as epoll_wait() interrupted by a signal
+  epoller.record(-1);
+  wait_idle(epoller, 1);
+  EXPECT_EQ(epoller.capacity(), 8);
+  wait_idle(epoller, 1);
+  EXPECT_EQ(epoller.capacity(), 4);
+}
+
+TEST(LocalEpollerTest, WaitsForNanoseconds) {
+  LocalEpoller epoller;
+  auto begin = std::chrono::steady_clock::now();
+  EXPECT_EQ(epoller.wait(300us), 0);
+  EXPECT_GE(std::chrono::steady_clock::now() - begin, 300us);
+  ReadyFds fds(epoller, 1);
+  EXPECT_EQ(epoller.wait(1h), 1);
+  // a negative timeout waits for the event
+  EXPECT_EQ(epoller.wait(-1ns), 1);
+  EXPECT_EQ(epoller.wait(0ns), 1);
+}
+
+TEST(LocalEpollerTest, FallsBackToMilliseconds) {
+  TestEpoller epoller;
+  epoller.disable_pwait2();
+  // rounded up to a millisecond
+  auto begin = std::chrono::steady_clock::now();
+  EXPECT_EQ(epoller.wait(300us), 0);
+  EXPECT_GE(std::chrono::steady_clock::now() - begin, 1ms);
+  ReadyFds fds(epoller, 1);
+  EXPECT_EQ(epoller.wait(1h), 1);
+}
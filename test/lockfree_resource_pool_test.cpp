@@ -0,0 +1,138 @@
+#include "tinywebserver/pool/lockfree_resource_pool.hpp"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <set>
+#include <thread>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+namespace {
+
+/**
+ * @brief A resource that counts the threads using it. The pool is a singleton
+ * per type, so every test has its own type.
+ */
+template <int N>
+struct Resource {
+  std::atomic<int> users = 0;
+};
+
+template <int N>
+LockFreeResourcePool<Resource<N>> &init_pool(size_t alloc_count,
+                                             size_t max_count) {
+  using Pool = LockFreeResourcePool<Resource<N>>;
+  EXPECT_TRUE(Pool::init(
+      alloc_count, max_count, [] { return new Resource<N>; },
+      [](Resource<N> *ptr) { delete ptr; }));
+  return Pool::get_instance();
+}
+
+}  // namespace
+
+TEST(LockFreeResourcePoolTest, RejectsBadArguments) {
+  using Pool = LockFreeResourcePool<Resource<0>>;
+  EXPECT_FALSE(Pool::init(
+      0, 1, [] { return new Resource<0>; }, [](Resource<0> *p) { delete p; }));
+  EXPECT_FALSE(Pool::init(
+      1, 0, [] { return new Resource<0>; }, [](Resource<0> *p) { delete p; }));
+  EXPECT_FALSE(Pool::init(1, 1, nullptr, [](Resource<0> *p) { delete p; }));
+}
+
+TEST(LockFreeResourcePoolTest, ReusesAReturnedResource) {
+  auto &pool = init_pool<1>(4, 8);
+  auto handle = pool.get();
+  ASSERT_TRUE(handle);
+  auto ptr = handle.get();
+  handle.reset();
+  EXPECT_FALSE(handle);
+  EXPECT_EQ(pool.get().get(), ptr);
+  EXPECT_EQ(pool.get_total_resource_count(), 4);
+}
+
+TEST(LockFreeResourcePoolTest, MovesTheHandle) {
+  auto &pool = init_pool<2>(1, 1);
+  auto handle = pool.get();
+  auto ptr = handle.get();
+  auto moved = std::move(handle);
+  EXPECT_FALSE(handle);
+  EXPECT_EQ(moved.get(), ptr);
+  EXPECT_FALSE(pool.get());
+  handle = std::move(moved);
+  EXPECT_EQ(handle.get(), ptr);
+  handle = {};
+  EXPECT_EQ(pool.get().get(), ptr);
+}
+
+TEST(LockFreeResourcePoolTest, AllocatesAtMostMaxCount) {
+  auto &pool = init_pool<3>(3, 8);
+  std::vector<LockFreeResourcePool<Resource<3>>::Handle> handles;
+  std::set<Resource<3> *> ptrs;
+  for (int i = 0; i < 8; ++i) {
+    handles.push_back(pool.get());
+    ASSERT_TRUE(handles.back());
+    ptrs.insert(handles.back().get());
+  }
+  EXPECT_EQ(ptrs.size(), 8);
+  EXPECT_FALSE(pool.get());
+  auto start = std::chrono::steady_clock::now();
+  EXPECT_FALSE(pool.get(20ms));
+  EXPECT_GE(std::chrono::steady_clock::now() - start, 20ms);
+  EXPECT_EQ(pool.get_total_resource_count(), 8);
+}
+
+TEST(LockFreeResourcePoolTest, WaitsForAResourceOfAnotherThread) {
+  auto &pool = init_pool<4>(1, 1);
+  auto held = pool.get();
+  ASSERT_TRUE(held);
+  auto ptr = held.get();
+  std::thread other([&pool, held = std::move(held)]() mutable {
+    std::this_thread::sleep_for(20ms);
+    // returned to the cache of this thread, the waiter takes it from there
+    held.reset();
+    pool.flush();
+  });
+  auto handle = pool.get(5s);
+  other.join();
+  EXPECT_EQ(handle.get(), ptr);
+}
+
+TEST(LockFreeResourcePoolTest, HandsOutAResourceToOneThreadAtATime) {
+  constexpr int max_count = 32;
+  auto &pool = init_pool<5>(4, max_count);
+  std::atomic<bool> shared = false;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&] {
+      std::vector<LockFreeResourcePool<Resource<5>>::Handle> handles;
+      for (int i = 0; i < 20000; ++i) {
+        // hold up to 12 at a time, so the magazines move between threads
+        if (auto handle = pool.get()) {
+          if (handle->users.fetch_add(1) != 0) shared = true;
+          handles.push_back(std::move(handle));
+        }
+        if (handles.size() == 12 || (i % 7 == 0 && !handles.empty())) {
+          for (auto &h : handles) h->users.fetch_sub(1);
+          handles.clear();
+        }
+      }
+      for (auto &h : handles) h->users.fetch_sub(1);
+    });
+  }
+  for (auto &t : threads) t.join();
+  EXPECT_FALSE(shared);
+  EXPECT_LE(pool.get_total_resource_count(), max_count);
+
+  // the caches of the exited threads are back in the depot
+  std::vector<LockFreeResourcePool<Resource<5>>::Handle> handles;
+  std::set<Resource<5> *> ptrs;
+  while (auto handle = pool.get()) {
+    ptrs.insert(handle.get());
+    handles.push_back(std::move(handle));
+  }
+  EXPECT_EQ(handles.size(), max_count);
+  EXPECT_EQ(ptrs.size(), max_count);
+}
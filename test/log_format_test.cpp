@@ -0,0 +1,88 @@
+#include "tinywebserver/log_format.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstring>
+#include <source_location>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include "tinywebserver/log.h"
+
+namespace {
+
+std::string encode(int64_t a, std::string_view b) {
+  std::string payload(binlog::arg_size(a) + binlog::arg_size(b), '\0');
+  binlog::encode_arg(binlog::encode_arg(payload.data(), a), b);
+  return payload;
+}
+
+}  // namespace
+
+TEST(LogFormatTest, FormatsTheArguments) {
+  std::string out;
+  EXPECT_TRUE(binlog::format_message(out, "fd {} uri {}, {{}}", "is",
+                                     encode(-7, "/index.html")));
+  EXPECT_EQ(out, "fd -7 uri /index.html, {}");
+}
+
+TEST(LogFormatTest, KeepsThePlaceholdersWithoutArguments) {
+  std::string out;
+  EXPECT_TRUE(binlog::format_message(out, "fd {} uri {} state {} {}", "is",
+                                     encode(3, "/")));
+  EXPECT_EQ(out, "fd 3 uri / state {} {}");
+}
+
+TEST(LogFormatTest, RejectsAShortPayload) {
+  std::string out;
+  auto payload = encode(3, "/");
+  payload.resize(10);
+  EXPECT_FALSE(binlog::format_message(out, "{} {}", "is", payload));
+}
+
+TEST(LogFormatTest, MatchesTheDefaultFormatter) {
+  const auto location = std::source_location::current();
+  const auto thread = std::this_thread::get_id();
+  const auto time = std::chrono::system_clock::now();
+  const auto expected =
+      Logger::default_formatter(Logger::Level::WRAN, "bad request", thread,
+                                location, time);
+
+  std::ostringstream thread_name;
+  thread_name << thread;
+  std::string out;
+  binlog::format_line(
+      out, uint8_t(Logger::Level::WRAN),
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          time.time_since_epoch())
+          .count(),
+      thread_name.str(), location.file_name(), location.line(),
+      location.column(), location.function_name(), "bad request");
+  EXPECT_EQ(out, expected);
+}
+
+TEST(LogFormatTest, DecodesASiteDef) {
+  binlog::Site site{uint8_t(Logger::Level::INFO), "fd {}", "server.cpp", 42,
+                    5, "on_read", "i"};
+  std::string out;
+  binlog::append_site_def(out, 3, site);
+
+  binlog::RecordHeader header;
+  ASSERT_GE(out.size(), sizeof(header));
+  std::memcpy(&header, out.data(), sizeof(header));
+  EXPECT_EQ(header.site, binlog::SITE_DEF);
+  uint32_t id = 0;
+  binlog::SiteDef def;
+  ASSERT_TRUE(binlog::decode_site_def(
+      std::string_view(out).substr(sizeof(header), header.size), id, def));
+  EXPECT_EQ(id, 3u);
+  EXPECT_EQ(def.level, site.level);
+  EXPECT_EQ(def.line, 42u);
+  EXPECT_EQ(def.column, 5u);
+  EXPECT_EQ(def.format, "fd {}");
+  EXPECT_EQ(def.file, "server.cpp");
+  EXPECT_EQ(def.function, "on_read");
+  EXPECT_EQ(def.arg_types, "i");
+}
@@ -0,0 +1,208 @@
+#include "tinywebserver/log.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+namespace {
+
+/**
+ * @brief Keep the output in memory. The writes block while the gate is
+ * closed.
+ */
+class StubLogWriter : public LogWriter {
+ public:
+  struct Output {
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool open = true;
+    std::string data;
+  };
+
+  explicit StubLogWriter(std::shared_ptr<Output> output)
+      : output_(std::move(output)) {}
+
+  bool write(const char *data, size_t n) override {
+    std::unique_lock lock(output_->mutex);
+    output_->cv.wait(lock, [this] { return output_->open; });
+    output_->data.append(data, n);
+    return true;
+  }
+
+  bool flush() override { return true; }
+
+ private:
+  std::shared_ptr<Output> output_;
+};
+
+template <typename Pred>
+bool wait_for(Pred pred, std::chrono::milliseconds timeout = 5s) {
+  auto deadline = std::chrono::steady_clock::now() + timeout;
+  while (!pred()) {
+    if (std::chrono::steady_clock::now() > deadline) return false;
+    std::this_thread::sleep_for(1ms);
+  }
+  return true;
+}
+
+std::vector<size_t> sequence(size_t n) {
+  std::vector<size_t> seqs(n);
+  std::iota(seqs.begin(), seqs.end(), 0);
+  return seqs;
+}
+
+/**
+ * @brief Run the Logger with a StubLogWriter and small buffers. The logs are
+ * written by new threads, as a buffer is sized when its thread first logs.
+ */
+class LoggerTest : public ::testing::Test {
+ protected:
+  static const size_t buffer_size = 256;
+
+  void SetUp() override {
+    logger_.stop();
+    output_ = std::make_shared<StubLogWriter::Output>();
+    ASSERT_TRUE(logger_.set(std::make_unique<StubLogWriter>(output_)));
+    logger_.set(Logger::Level::TRACE);
+    ASSERT_TRUE(logger_.set(Logger::Encoding::TEXT));
+    ASSERT_TRUE(logger_.set_buffer_size(buffer_size));
+    dropped_ = logger_.get_dropped();
+  }
+
+  void TearDown() override {
+    set_open(true);
+    // the logs left in the buffers go to the writer of this test
+    logger_.start();
+    logger_.stop();
+    logger_.set(Logger::FullPolicy::BLOCK);
+    logger_.set_buffer_size(64 * 1024);
+    logger_.set_sample_rate(16);
+  }
+
+  /**
+   * @brief Log the sequence numbers from 0 to n - 1 on a new thread.
+   * @return The number of logs accepted.
+   */
+  static size_t log_on_thread(size_t n) {
+    size_t accepted = 0;
+    std::thread([&] {
+      for (size_t i = 0; i < n; ++i) accepted += LOG_FAST(INFO, "seq {}", i);
+    }).join();
+    return accepted;
+  }
+
+  /**
+   * @brief The sequence numbers written so far.
+   */
+  std::vector<size_t> written() {
+    std::lock_guard lock(output_->mutex);
+    std::vector<size_t> seqs;
+    const std::string key = "]: seq ";
+    for (auto pos = output_->data.find(key); pos != std::string::npos;
+         pos = output_->data.find(key, pos + 1))
+      seqs.push_back(std::stoul(output_->data.substr(pos + key.size())));
+    return seqs;
+  }
+
+  void set_open(bool open) {
+    {
+      std::lock_guard lock(output_->mutex);
+      output_->open = open;
+    }
+    output_->cv.notify_all();
+  }
+
+  Logger &logger_ = Logger::get_instance();
+
+  std::shared_ptr<StubLogWriter::Output> output_;
+
+  size_t dropped_ = 0;
+};
+
+}  // namespace
+
+TEST_F(LoggerTest, DropsWhenTheBufferIsFull) {
+  logger_.set(Logger::FullPolicy::DROP);
+  // nothing drains the buffer before start()
+  auto accepted = log_on_thread(100);
+  EXPECT_GT(accepted, 0u);
+  EXPECT_LT(accepted, 100u);
+  EXPECT_EQ(logger_.get_dropped() - dropped_, 100 - accepted);
+  ASSERT_TRUE(logger_.start());
+  ASSERT_TRUE(logger_.flush());
+  // the logs after the buffer filled up are lost
+  EXPECT_EQ(written(), sequence(accepted));
+}
+
+TEST_F(LoggerTest, DoesNotBlockWhileStopped) {
+  logger_.set(Logger::FullPolicy::BLOCK);
+  auto accepted = log_on_thread(100);
+  EXPECT_LT(accepted, 100u);
+  EXPECT_EQ(logger_.get_dropped() - dropped_, 100 - accepted);
+}
+
+TEST_F(LoggerTest, BlocksUntilTheWriterMakesRoom) {
+  logger_.set(Logger::FullPolicy::BLOCK);
+  set_open(false);
+  ASSERT_TRUE(logger_.start());
+  std::atomic<size_t> accepted = 0;
+  std::thread producer([&] {
+    for (size_t i = 0; i < 100; ++i) accepted += LOG_FAST(INFO, "seq {}", i);
+  });
+  // the writer thread is stuck in a write, so the buffer stays full
+  std::this_thread::sleep_for(50ms);
+  EXPECT_LT(accepted, 100u);
+  set_open(true);
+  producer.join();
+  EXPECT_EQ(accepted, 100u);
+  ASSERT_TRUE(logger_.flush());
+  EXPECT_EQ(written(), sequence(100));
+  EXPECT_EQ(logger_.get_dropped(), dropped_);
+}
+
+TEST_F(LoggerTest, SamplesOnceTheBufferIsHalfFull) {
+  logger_.set(Logger::FullPolicy::SAMPLE);
+  ASSERT_TRUE(logger_.set_sample_rate(4));
+  auto accepted = log_on_thread(200);
+  EXPECT_EQ(logger_.get_dropped() - dropped_, 200 - accepted);
+  ASSERT_TRUE(logger_.start());
+  ASSERT_TRUE(logger_.flush());
+  auto seqs = written();
+  ASSERT_EQ(seqs.size(), accepted);
+
+  // every log until the buffer is half full, then one of every 4 until it
+  // is full
+  size_t half = 0;
+  while (half < seqs.size() && seqs[half] == half) ++half;
+  ASSERT_GT(half, 1u);
+  ASSERT_LT(half, seqs.size());
+  for (size_t i = half - 1; i < seqs.size(); ++i)
+    EXPECT_EQ(seqs[i], half - 1 + (i - half + 1) * 4) << i;
+  EXPECT_LT(seqs.back(), 100u);
+}
+
+TEST_F(LoggerTest, WritesTheBufferOfAnExitedThread) {
+  ASSERT_TRUE(logger_.set_buffer_size(64 * 1024));
+  ASSERT_TRUE(logger_.start());
+  // fewer than wake the writer thread, it finds them in a periodic sweep
+  EXPECT_EQ(log_on_thread(5), 5u);
+  EXPECT_TRUE(wait_for([&] { return written().size() == 5; }));
+  EXPECT_EQ(written(), sequence(5));
+  // the ring is consumed after the records are written
+  EXPECT_TRUE(wait_for([&] { return logger_.get_backlog() == 0; }));
+  // and the logs left at stop()
+  EXPECT_EQ(log_on_thread(3), 3u);
+  ASSERT_TRUE(logger_.stop());
+  EXPECT_EQ(written().size(), 8u);
+}
@@ -0,0 +1,134 @@
+#include "tinywebserver/log_writer.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+namespace {
+
+/**
+ * @brief Write the segments in a temporary directory.
+ */
+class MappedLogWriterTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    char dir[] = "/tmp/tinywebserver_log_XXXXXX";
+    ASSERT_NE(mkdtemp(dir), nullptr);
+    dir_ = dir;
+    base_ = dir_ + "/server";
+  }
+
+  void TearDown() override { std::filesystem::remove_all(dir_); }
+
+  /**
+   * @brief The contents of the segments in the order of their sequence
+   * numbers, checking their names.
+   */
+  std::vector<std::string> segments() {
+    std::vector<std::pair<uint64_t, std::string>> found;
+    for (auto &entry : std::filesystem::directory_iterator(dir_)) {
+      // server.<YYYYmmdd-HHMMSS>-<sequence>.log
+      auto name = entry.path().filename().string();
+      EXPECT_TRUE(name.starts_with("server.")) << name;
+      EXPECT_TRUE(name.ends_with(".log")) << name;
+      EXPECT_EQ(name[15], '-') << name;
+      EXPECT_EQ(name[22], '-') << name;
+      auto sequence = std::stoull(name.substr(23));
+      std::ifstream file(entry.path(), std::ios::binary);
+      found.emplace_back(sequence,
+                         std::string(std::istreambuf_iterator<char>(file), {}));
+    }
+    std::sort(found.begin(), found.end());
+    std::vector<std::string> contents;
+    for (auto &[sequence, content] : found) contents.push_back(content);
+    return contents;
+  }
+
+  std::string dir_, base_;
+};
+
+off_t file_size(const std::string &path) {
+  struct stat st;
+  return stat(path.c_str(), &st) == 0 ? st.st_size : -1;
+}
+
+}  // namespace
+
+TEST_F(MappedLogWriterTest, RotatesWhenTheSegmentIsFull) {
+  {
+    MappedLogWriter writer(base_, 100);
+    // the first segment is opened by the first write
+    EXPECT_TRUE(writer.prepare(60));
+    EXPECT_TRUE(writer.write(std::string(60, 'a').data(), 60));
+    EXPECT_FALSE(writer.prepare(40));
+    EXPECT_TRUE(writer.write(std::string(40, 'b').data(), 40));
+    // a write is never split
+    EXPECT_TRUE(writer.prepare(1));
+    EXPECT_TRUE(writer.write("c", 1));
+    // write() rotates by itself without prepare()
+    EXPECT_TRUE(writer.write(std::string(100, 'd').data(), 100));
+    EXPECT_TRUE(writer.flush());
+  }
+  EXPECT_EQ(segments(),
+            (std::vector<std::string>{std::string(60, 'a') +
+                                          std::string(40, 'b'),
+                                      "c", std::string(100, 'd')}));
+}
+
+TEST_F(MappedLogWriterTest, FitsAWriteLargerThanASegment) {
+  {
+    MappedLogWriter writer(base_, 100);
+    EXPECT_TRUE(writer.write("a", 1));
+    EXPECT_TRUE(writer.prepare(250));
+    EXPECT_TRUE(writer.write(std::string(250, 'b').data(), 250));
+    EXPECT_EQ(file_size(writer.path()), 250);
+  }
+  EXPECT_EQ(segments(), (std::vector<std::string>{"a", std::string(250, 'b')}));
+}
+
+TEST_F(MappedLogWriterTest, PreallocatesAndTrimsTheTail) {
+  std::string path;
+  {
+    MappedLogWriter writer(base_, 4096);
+    EXPECT_TRUE(writer.write("hello\n", 6));
+    path = writer.path();
+    // the whole segment is reserved while it is written
+    EXPECT_EQ(file_size(path), 4096);
+    struct stat st;
+    ASSERT_EQ(stat(path.c_str(), &st), 0);
+    EXPECT_GE(st.st_blocks * 512, 4096);
+  }
+  EXPECT_EQ(file_size(path), 6);
+  EXPECT_EQ(segments(), std::vector<std::string>{"hello\n"});
+}
+
+TEST_F(MappedLogWriterTest, RotatesByAge) {
+  {
+    MappedLogWriter writer(base_, 4096, 1s);
+    EXPECT_TRUE(writer.write("old\n", 4));
+    EXPECT_FALSE(writer.prepare(4));
+    std::this_thread::sleep_for(1100ms);
+    EXPECT_TRUE(writer.prepare(4));
+    EXPECT_TRUE(writer.write("new\n", 4));
+    // an empty segment is kept however old it is
+    EXPECT_TRUE(writer.prepare(4096));
+    std::this_thread::sleep_for(1100ms);
+    EXPECT_FALSE(writer.prepare(4));
+  }
+  // the empty one is removed
+  EXPECT_EQ(segments(), (std::vector<std::string>{"old\n", "new\n"}));
+}
@@ -0,0 +1,26 @@
+#include "tinywebserver/pool/memory_pool.hpp"
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+
+TEST(MemoryPoolTest, RecyclesSmallBlocks) {
+  auto p = MemoryPool::allocate(16);
+  std::memset(p, 0xab, 16);
+  MemoryPool::deallocate(p, 16);
+  EXPECT_EQ(MemoryPool::allocate(16), p);
+  MemoryPool::deallocate(p, 16);
+}
+
+TEST(MemoryPoolTest, FreesLargeBlocksToTheHeap) {
+  // a large block is not kept on a free list once it is freed
+  auto heap_size = MemoryPool::get_heap_size();
+  auto p = MemoryPool::allocate(4096);
+  std::memset(p, 0xab, 4096);
+  MemoryPool::deallocate(p, 4096);
+  EXPECT_EQ(MemoryPool::get_heap_size(), heap_size);
+
+  auto small = MemoryPool::allocate(128);
+  std::memset(small, 0xcd, 128);
+  MemoryPool::deallocate(small, 128);
+}
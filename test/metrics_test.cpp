@@ -0,0 +1,86 @@
+#include "tinywebserver/metrics.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+TEST(MetricsRegistryTest, ReturnsTheSameMetricForAName) {
+  metrics::MetricsRegistry registry;
+  auto counter = registry.counter("requests_total", "Requests.");
+  ASSERT_NE(counter, nullptr);
+  EXPECT_EQ(registry.counter("requests_total", "Requests."), counter);
+  auto hist = registry.histogram("handler_seconds", "Handler time.");
+  ASSERT_NE(hist, nullptr);
+  EXPECT_EQ(registry.histogram("handler_seconds", "Handler time."), hist);
+}
+
+TEST(MetricsRegistryTest, RejectsANameOfAnotherType) {
+  metrics::MetricsRegistry registry;
+  ASSERT_NE(registry.counter("requests_total", "Requests."), nullptr);
+  EXPECT_EQ(registry.gauge("requests_total", "Requests."), nullptr);
+  EXPECT_EQ(registry.histogram("requests_total", "Requests."), nullptr);
+  EXPECT_FALSE(registry.gauge_fn("requests_total", "Requests.", [] {
+    return 1.0;
+  }));
+
+  auto out = registry.scrape();
+  EXPECT_EQ(out.find("# TYPE requests_total"),
+            out.rfind("# TYPE requests_total"))
+      << out;
+}
+
+TEST(MetricsRegistryTest, WritesTheValues) {
+  metrics::MetricsRegistry registry;
+  registry.counter("requests_total", "Requests.")->add(3);
+  registry.gauge("connections", "Connections.")->add(2);
+  EXPECT_TRUE(registry.gauge_fn("queued", "Queued.", [] { return 1.5; }));
+  EXPECT_TRUE(
+      registry.counter_fn("dropped_total", "Dropped.", [] { return 7.0; }));
+  auto out = registry.scrape();
+  EXPECT_NE(out.find("# TYPE requests_total counter\nrequests_total 3\n"),
+            std::string::npos)
+      << out;
+  EXPECT_NE(out.find("# TYPE connections gauge\nconnections 2\n"),
+            std::string::npos)
+      << out;
+  EXPECT_NE(out.find("# TYPE queued gauge\nqueued 1.5\n"), std::string::npos)
+      << out;
+  EXPECT_NE(out.find("# TYPE dropped_total counter\ndropped_total 7\n"),
+            std::string::npos)
+      << out;
+}
+
+TEST(MetricsRegistryTest, WritesAHistogramOwnedBySomeoneElse) {
+  metrics::MetricsRegistry registry;
+  metrics::Histogram depth;
+  for (uint64_t n : {1, 2, 7, 8, 20}) depth.record(n);
+  EXPECT_TRUE(registry.histogram_fn(
+      "depth", "Depth.", [&depth]() -> auto & { return depth; }));
+  EXPECT_FALSE(registry.gauge_fn("depth", "Depth.", [] { return 1.0; }));
+  auto out = registry.scrape();
+  EXPECT_NE(out.find("# TYPE depth histogram\n"), std::string::npos) << out;
+  // not in seconds, so the bounds start from the first power of two, and a
+  // value on a bound is counted in it
+  EXPECT_NE(out.find("depth_bucket{le=\"7\"} 3\n"), std::string::npos) << out;
+  EXPECT_NE(out.find("depth_bucket{le=\"15\"} 4\n"), std::string::npos) << out;
+  EXPECT_NE(out.find("depth_bucket{le=\"31\"} 5\n"), std::string::npos) << out;
+  EXPECT_NE(out.find("depth_sum 38\ndepth_count 5\n"), std::string::npos)
+      << out;
+}
+
+TEST(MetricsRegistryTest, CountsADurationOnABoundInTheBucket) {
+  metrics::MetricsRegistry registry;
+  auto hist = registry.histogram("handler_seconds", "Handler time.");
+  hist->record(std::chrono::nanoseconds(1023));
+  hist->record(std::chrono::nanoseconds(1024));
+  auto out = registry.scrape();
+  // the first exported bound is about 1us
+  EXPECT_NE(out.find("handler_seconds_bucket{le=\"1.023e-06\"} 1\n"),
+            std::string::npos)
+      << out;
+  EXPECT_NE(out.find("handler_seconds_bucket{le=\"2.047e-06\"} 2\n"),
+            std::string::npos)
+      << out;
+}
@@ -0,0 +1,49 @@
+#include "tinywebserver/network/http/parser.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <memory>
+#include <string_view>
+
+using http::Form;
+using http::Parser;
+
+TEST(ParserTest, ParsesEveryFormPair) {
+  auto form = Parser::parse_form("user=admin&password=123456");
+  EXPECT_EQ(form.size(), 2u);
+  EXPECT_EQ(form["user"], "admin");
+  EXPECT_EQ(form["password"], "123456");
+}
+
+TEST(ParserTest, ParsesASingleFormPair) {
+  auto form = Parser::parse_form("key=value");
+  EXPECT_EQ(form.size(), 1u);
+  EXPECT_EQ(form["key"], "value");
+}
+
+TEST(ParserTest, DecodesTheFormElements) {
+  auto form = Parser::parse_form("key1=a+b%5C%3D&key2=cc");
+  EXPECT_EQ(form["key1"], "a b\\=");
+  EXPECT_EQ(form["key2"], "cc");
+}
+
+TEST(ParserTest, KeepsATruncatedEscape) {
+  // the escape is at the end of the heap block, so reading past it is caught
+  std::string_view data = "k=%4";
+  auto copy = std::make_unique<char[]>(data.size());
+  std::copy(data.begin(), data.end(), copy.get());
+  auto form = Parser::parse_form({copy.get(), data.size()});
+  EXPECT_EQ(form["k"], "%4");
+}
+
+TEST(ParserTest, RejectsAPairWithoutValue) {
+  EXPECT_TRUE(Parser::parse_form("a=1&b").empty());
+}
+
+TEST(ParserTest, ParsesAHeaderLine) {
+  http::Header header;
+  EXPECT_TRUE(Parser::parse_header("Host: localhost", header));
+  EXPECT_EQ(header["Host"], "localhost");
+  EXPECT_FALSE(Parser::parse_header("no colon", header));
+}
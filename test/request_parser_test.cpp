@@ -0,0 +1,142 @@
+#include "tinywebserver/network/http/request_parser.h"
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <string_view>
+
+using http::RequestParser;
+using State = RequestParser::State;
+
+namespace {
+
+/**
+ * @brief Feed the parser through a non-blocking socketpair.
+ */
+class RequestParserTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    ASSERT_EQ(
+        socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds_), 0);
+  }
+
+  void TearDown() override {
+    close(fds_[0]);
+    close(fds_[1]);
+  }
+
+  void send(std::string_view data) {
+    ASSERT_EQ(write(fds_[1], data.data(), data.size()), ssize_t(data.size()));
+  }
+
+  auto consume() { return parser_.consume_from_fd(fds_[0], true); }
+
+  int fds_[2];
+
+  RequestParser parser_;
+};
+
+}  // namespace
+
+TEST_F(RequestParserTest, ParsesARequestWithoutBody) {
+  send("GET /index.html HTTP/1.1\r\nHost: localhost\r\n\r\n");
+  auto [state, req] = consume();
+  EXPECT_EQ(state, State::COMPLETE);
+  ASSERT_NE(req, nullptr);
+  EXPECT_EQ(req->uri(), "/index.html");
+  EXPECT_EQ(req->version(), "1.1");
+  EXPECT_EQ(req->header().at("Host"), "localhost");
+  EXPECT_TRUE(req->body().empty());
+}
+
+TEST_F(RequestParserTest, WaitsForTheRestOfTheBody) {
+  send("POST /login HTTP/1.1\r\nContent-Length: 10\r\n\r\n01234");
+  auto [state, req] = consume();
+  EXPECT_FALSE(RequestParser::is_error_state(state));
+  EXPECT_EQ(req, nullptr);
+
+  send("56789");
+  std::tie(state, req) = consume();
+  EXPECT_EQ(state, State::COMPLETE);
+  ASSERT_NE(req, nullptr);
+  EXPECT_EQ(std::string(req->body().begin(), req->body().end()),
+            "0123456789");
+}
+
+TEST_F(RequestParserTest, RejectsABadContentLength) {
+  send("POST / HTTP/1.1\r\nContent-Length: ten\r\n\r\n");
+  auto [state, req] = consume();
+  EXPECT_EQ(state, State::ERROR_BODY_LENGTH);
+  EXPECT_EQ(req, nullptr);
+}
+
+TEST_F(RequestParserTest, KeepsTheNextRequest) {
+  send(
+      "POST /a HTTP/1.1\r\nContent-Length: 2\r\n\r\nok"
+      "GET /b HTTP/1.1\r\n\r\n");
+  auto [state, req] = consume();
+  EXPECT_EQ(state, State::COMPLETE);
+  ASSERT_NE(req, nullptr);
+  EXPECT_EQ(req->uri(), "/a");
+
+  // nothing more to read, the request is in the buffer
+  std::tie(state, req) = consume();
+  EXPECT_EQ(state, State::COMPLETE);
+  ASSERT_NE(req, nullptr);
+  EXPECT_EQ(req->uri(), "/b");
+}
+
+TEST(RequestParserConsumeTest, ParsesARequestFedOneByteAtATime) {
+  RequestParser parser;
+  std::string_view data =
+      "POST /login HTTP/1.1\r\nHost: localhost\r\n"
+      "Content-Length: 4\r\n\r\nuser";
+  for (size_t i = 0; i + 1 < data.size(); ++i) {
+    auto [state, req] = parser.consume(data.substr(i, 1));
+    ASSERT_FALSE(RequestParser::is_error_state(state)) << i;
+    ASSERT_EQ(req, nullptr) << i;
+  }
+  auto [state, req] = parser.consume(data.substr(data.size() - 1));
+  EXPECT_EQ(state, State::COMPLETE);
+  ASSERT_NE(req, nullptr);
+  EXPECT_EQ(req->uri(), "/login");
+  EXPECT_EQ(req->header().at("Host"), "localhost");
+  EXPECT_EQ(std::string(req->body().begin(), req->body().end()), "user");
+  EXPECT_FALSE(parser.has_buffered());
+}
+
+TEST(RequestParserConsumeTest, ReturnsTheNextRequestForEmptyData) {
+  RequestParser parser;
+  auto [state, req] = parser.consume(
+      "GET /a HTTP/1.1\r\n\r\n"
+      "GET /b HTTP/1.1\r\n\r\n");
+  EXPECT_EQ(state, State::COMPLETE);
+  ASSERT_NE(req, nullptr);
+  EXPECT_EQ(req->uri(), "/a");
+  EXPECT_TRUE(parser.has_buffered());
+
+  std::tie(state, req) = parser.consume({});
+  EXPECT_EQ(state, State::COMPLETE);
+  ASSERT_NE(req, nullptr);
+  EXPECT_EQ(req->uri(), "/b");
+  EXPECT_FALSE(parser.has_buffered());
+}
+
+TEST(RequestParserConsumeTest, ParsesABodySplitAcrossChunks) {
+  RequestParser parser;
+  auto [state, req] =
+      parser.consume("POST /upload HTTP/1.1\r\nContent-Length: 10\r\n\r\n012");
+  EXPECT_FALSE(RequestParser::is_error_state(state));
+  EXPECT_EQ(req, nullptr);
+  std::tie(state, req) = parser.consume("3456");
+  EXPECT_FALSE(RequestParser::is_error_state(state));
+  EXPECT_EQ(req, nullptr);
+  std::tie(state, req) = parser.consume("789");
+  EXPECT_EQ(state, State::COMPLETE);
+  ASSERT_NE(req, nullptr);
+  EXPECT_EQ(std::string(req->body().begin(), req->body().end()),
+            "0123456789");
+}
@@ -0,0 +1,31 @@
+#include "tinywebserver/network/http/request.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+using http::Request;
+
+namespace {
+
+Request make_request(const std::string &version, const char *connection) {
+  Request req;
+  req.set_version(version);
+  if (connection != nullptr) req.header()["Connection"] = connection;
+  return req;
+}
+
+}  // namespace
+
+TEST(RequestTest, KeepsHttp11AliveByDefault) {
+  EXPECT_TRUE(make_request("1.1", nullptr).is_keepalive());
+  EXPECT_TRUE(make_request("1.1", "keep-alive").is_keepalive());
+  EXPECT_FALSE(make_request("1.1", "close").is_keepalive());
+  EXPECT_FALSE(make_request("1.1", "Close").is_keepalive());
+}
+
+TEST(RequestTest, ClosesHttp10ByDefault) {
+  EXPECT_FALSE(make_request("1.0", nullptr).is_keepalive());
+  EXPECT_TRUE(make_request("1.0", "Keep-Alive").is_keepalive());
+  EXPECT_FALSE(make_request("1.0", "close").is_keepalive());
+}
@@ -0,0 +1,138 @@
+#include "tinywebserver/network/http/request_trace.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdint>
+#include <regex>
+#include <string>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+namespace {
+
+/**
+ * @brief A SlowRequestLog that counts the timestamps in nanoseconds, so the
+ * hand-built marks need no calibration.
+ */
+class TestSlowRequestLog : public http::SlowRequestLog {
+ public:
+  explicit TestSlowRequestLog(size_t capacity = 256)
+      : SlowRequestLog(capacity) {
+    ns_per_tick_ = 1;
+  }
+};
+
+/**
+ * @brief A trace whose every phase takes phase_ns.
+ */
+http::RequestTrace make_trace(const std::string &uri, uint64_t phase_ns) {
+  http::RequestTrace trace;
+  for (size_t i = 0; i < http::RequestTrace::N_MARKS; ++i)
+    trace.marks[i] = 1000000 + i * phase_ns;
+  trace.reads = 2;
+  trace.writes = 1;
+  trace.method = http::Request::Method::GET;
+  trace.uri.assign(uri);
+  trace.active = true;
+  return trace;
+}
+
+std::vector<std::string> uris(const http::SlowRequestLog &log) {
+  std::vector<std::string> ret;
+  for (auto &slow : log.snapshot()) ret.emplace_back(slow.uri.view());
+  return ret;
+}
+
+}  // namespace
+
+TEST(SlowRequestLogTest, KeepsTheRequestsOverTheThreshold) {
+  TestSlowRequestLog log;
+  // disabled
+  EXPECT_FALSE(log.finish(make_trace("/a", 1000), 3));
+  log.set_threshold(8000ns);
+  EXPECT_TRUE(log.enabled());
+  EXPECT_EQ(log.get_threshold(), 8000ns);
+  // 8 phases of 1000ns
+  EXPECT_TRUE(log.finish(make_trace("/a", 1000), 3));
+  EXPECT_FALSE(log.finish(make_trace("/b", 999), 3));
+  auto inactive = make_trace("/c", 2000);
+  inactive.active = false;
+  EXPECT_FALSE(log.finish(inactive, 3));
+  EXPECT_EQ(uris(log), std::vector<std::string>{"/a"});
+
+  log.set_threshold(0ns);
+  EXPECT_FALSE(log.enabled());
+  EXPECT_FALSE(log.finish(make_trace("/d", 2000), 3));
+  EXPECT_EQ(log.get_count(), 1u);
+}
+
+TEST(SlowRequestLogTest, BreaksTheRequestIntoPhases) {
+  TestSlowRequestLog log;
+  log.set_threshold(1ns);
+  auto trace = make_trace("/a", 1000);
+  // waited for the rest of the request
+  trace.marks[http::RequestTrace::FIRST_READY] -= 5000;
+  ASSERT_TRUE(log.finish(trace, 7));
+  auto slow = log.snapshot();
+  ASSERT_EQ(slow.size(), 1u);
+  EXPECT_EQ(slow[0].fd, 7);
+  EXPECT_EQ(slow[0].reads, 2u);
+  EXPECT_EQ(slow[0].writes, 1u);
+  EXPECT_EQ(slow[0].method, http::Request::Method::GET);
+  EXPECT_EQ(slow[0].total_ns, 13000);
+  EXPECT_EQ(slow[0].phase_ns[http::SlowRequest::WAIT], 6000);
+  for (size_t i = http::SlowRequest::QUEUE; i < http::SlowRequest::N_PHASES;
+       ++i)
+    EXPECT_EQ(slow[0].phase_ns[i], 1000) << http::SlowRequest::phase_name(i);
+}
+
+TEST(SlowRequestLogTest, OverwritesTheOldestRequests) {
+  TestSlowRequestLog log(3);
+  log.set_threshold(1ns);
+  for (auto uri : {"/0", "/1"}) log.finish(make_trace(uri, 10), 1);
+  EXPECT_EQ(uris(log), (std::vector<std::string>{"/0", "/1"}));
+  for (auto uri : {"/2", "/3", "/4"}) log.finish(make_trace(uri, 10), 1);
+  // from the oldest to the newest
+  EXPECT_EQ(uris(log), (std::vector<std::string>{"/2", "/3", "/4"}));
+  EXPECT_EQ(log.get_count(), 5u);
+}
+
+TEST(SlowRequestLogTest, DumpsALinePerRequest) {
+  TestSlowRequestLog log;
+  log.set_threshold(1ns);
+  log.finish(make_trace("/a", 1500), 7);
+  log.finish(make_trace("/b", 20), 8);
+  std::string out;
+  log.dump(out);
+  auto newline = out.find('\n');
+  ASSERT_NE(newline, std::string::npos);
+  auto first = out.substr(0, newline + 1), second = out.substr(newline + 1);
+  const std::regex time(R"(\d{4}-\d\d-\d\d \d\d:\d\d:\d\d\.\d{6})");
+  EXPECT_TRUE(std::regex_match(first.substr(0, 26), time)) << first;
+  EXPECT_EQ(first.substr(26),
+            " fd=7 GET /a total=12.0us wait=1.5us queue=1.5us read=1.5us "
+            "parse=1.5us match=1.5us handler=1.5us response=1.5us "
+            "write=1.5us reads=2 writes=1\n");
+  EXPECT_TRUE(std::regex_match(second.substr(0, 26), time)) << second;
+  EXPECT_EQ(second.substr(26),
+            " fd=8 GET /b total=0.2us wait=0.0us queue=0.0us read=0.0us "
+            "parse=0.0us match=0.0us handler=0.0us response=0.0us "
+            "write=0.0us reads=2 writes=1\n");
+}
+
+TEST(SlowRequestLogTest, Clears) {
+  TestSlowRequestLog log(2);
+  log.set_threshold(1ns);
+  for (auto uri : {"/0", "/1", "/2"}) log.finish(make_trace(uri, 10), 1);
+  log.clear();
+  EXPECT_EQ(log.get_count(), 0u);
+  EXPECT_TRUE(log.snapshot().empty());
+  std::string out;
+  log.dump(out);
+  EXPECT_EQ(out, "");
+  // the ring is reused from the start
+  log.finish(make_trace("/3", 10), 1);
+  EXPECT_EQ(uris(log), std::vector<std::string>{"/3"});
+}
@@ -0,0 +1,68 @@
+#include "tinywebserver/utils/ring_queue.hpp"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <utility>
+
+TEST(RingQueueTest, KeepsTheOrderWhileGrowing) {
+  RingQueue<int> queue(4);
+  EXPECT_EQ(queue.capacity(), 4);
+  // move the head so the elements wrap around when it grows
+  int next_push = 0, next_pop = 0;
+  for (int i = 0; i < 3; ++i) queue.push(next_push++);
+  for (int i = 0; i < 2; ++i) {
+    EXPECT_EQ(queue.front(), next_pop++);
+    queue.pop();
+  }
+  while (next_push < 100) queue.push(next_push++);
+  EXPECT_EQ(queue.size(), 100 - next_pop);
+  EXPECT_EQ(queue.capacity(), 128);
+  for (; !queue.empty(); queue.pop()) EXPECT_EQ(queue.front(), next_pop++);
+  EXPECT_EQ(next_pop, 100);
+}
+
+TEST(RingQueueTest, KeepsTheCapacityAtThePeak) {
+  RingQueue<int> queue(1);
+  for (int round = 0; round < 10; ++round) {
+    for (int i = 0; i < 10; ++i) queue.push(i);
+    while (!queue.empty()) queue.pop();
+  }
+  EXPECT_EQ(queue.capacity(), 16);
+  queue.reserve(3);
+  EXPECT_EQ(queue.capacity(), 16);
+  queue.reserve(17);
+  EXPECT_EQ(queue.capacity(), 32);
+}
+
+TEST(RingQueueTest, HoldsMoveOnlyElements) {
+  RingQueue<std::unique_ptr<int>> queue(2);
+  for (int i = 0; i < 5; ++i) queue.emplace(std::make_unique<int>(i));
+  for (int i = 0; i < 5; ++i) {
+    EXPECT_EQ(*queue.front(), i);
+    queue.pop();
+  }
+}
+
+TEST(RingQueueTest, DestroysTheElements) {
+  auto alive = std::make_shared<int>();
+  {
+    RingQueue<std::shared_ptr<int>> queue(2);
+    for (int i = 0; i < 5; ++i) queue.push(alive);
+    queue.pop();
+    EXPECT_EQ(alive.use_count(), 5);
+    RingQueue<std::shared_ptr<int>> moved(std::move(queue));
+    EXPECT_TRUE(queue.empty());
+    EXPECT_EQ(moved.size(), 4);
+    EXPECT_EQ(alive.use_count(), 5);
+    RingQueue<std::shared_ptr<int>> assigned;
+    assigned.push(alive);
+    assigned = std::move(moved);
+    EXPECT_EQ(assigned.size(), 4);
+    EXPECT_EQ(alive.use_count(), 5);
+    assigned.clear();
+    EXPECT_EQ(alive.use_count(), 1);
+    for (int i = 0; i < 3; ++i) assigned.push(alive);
+  }
+  EXPECT_EQ(alive.use_count(), 1);
+}
@@ -0,0 +1,725 @@
+#include "tinywebserver/network/http/server.h"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <set>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "tinywebserver/utils/cpu.h"
+
+using namespace std::chrono_literals;
+
+namespace {
+
+/**
+ * @brief Connect to the port on the loopback, return -1 on failure. A read
+ * of the socket fails after 5 seconds instead of hanging.
+ */
+int connect_to(uint16_t port) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  timeval timeout = {.tv_sec = 5, .tv_usec = 0};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+  if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+bool send_all(int fd, std::string_view data) {
+  while (!data.empty()) {
+    auto n = send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+    if (n <= 0) return false;
+    data.remove_prefix(n);
+  }
+  return true;
+}
+
+/**
+ * @brief Read until the peer closes the connection.
+ * @return Return false if the read fails or times out.
+ */
+bool read_until_eof(int fd, std::string &out) {
+  char buf[4096];
+  for (;;) {
+    auto n = recv(fd, buf, sizeof(buf), 0);
+    if (n == 0) return true;
+    if (n < 0) return false;
+    out.append(buf, n);
+  }
+}
+
+/**
+ * @brief Read n responses, which must have Content-Length.
+ * @return Return false if the read fails, the connection is closed first or
+ * more bytes follow.
+ */
+bool read_responses(int fd, size_t n, std::vector<std::string> &out) {
+  std::string buf;
+  size_t begin = 0;
+  out.clear();
+  while (out.size() < n) {
+    auto end = buf.find("\r\n\r\n", begin);
+    auto pos = buf.find("\r\nContent-Length: ", begin);
+    if (end != std::string::npos) {
+      if (pos == std::string::npos || pos > end) return false;
+      auto size = end + 4 + std::stoul(buf.substr(pos + 18)) - begin;
+      if (buf.size() - begin >= size) {
+        out.push_back(buf.substr(begin, size));
+        begin += size;
+        continue;
+      }
+    }
+    char tmp[4096];
+    auto ret = recv(fd, tmp, sizeof(tmp), 0);
+    if (ret <= 0) return false;
+    buf.append(tmp, ret);
+  }
+  return begin == buf.size();
+}
+
+bool read_response(int fd, std::string &out) {
+  std::vector<std::string> resps;
+  if (!read_responses(fd, 1, resps)) return false;
+  out = std::move(resps[0]);
+  return true;
+}
+
+/**
+ * @brief Wait until pred holds or the time runs out.
+ */
+template <typename Pred>
+bool wait_for(Pred pred, std::chrono::milliseconds timeout = 5s) {
+  auto deadline = std::chrono::steady_clock::now() + timeout;
+  while (!pred()) {
+    if (std::chrono::steady_clock::now() > deadline) return false;
+    std::this_thread::sleep_for(1ms);
+  }
+  return true;
+}
+
+/**
+ * @brief Send a request to the handler of serve_thread_ids().
+ * @return The id of the thread that served it, empty on failure.
+ */
+std::string served_by(int fd) {
+  std::string resp;
+  if (!send_all(fd, "GET / HTTP/1.1\r\n\r\n") || !read_response(fd, resp))
+    return "";
+  return resp.substr(resp.find("\r\n\r\n") + 4);
+}
+
+std::string thread_id(std::thread::id id) {
+  return std::to_string(std::hash<std::thread::id>{}(id));
+}
+
+/**
+ * @brief Expose the event loops of the server.
+ */
+class TestServer : public http::Server {
+ public:
+  using Server::hand_off;
+
+  /**
+   * @brief Whether loops_[i] has a listener of its own.
+   */
+  bool listens(size_t i) const { return loops_[i]->listen_fd != -1; }
+
+  /**
+   * @brief Detach the steering program from the SO_REUSEPORT group, as if it
+   * couldn't be attached, so the kernel's hash picks the listener.
+   */
+  bool detach_steering() {
+    int unused = 0;
+    if (setsockopt(loops_[1]->listen_fd, SOL_SOCKET, SO_DETACH_REUSEPORT_BPF,
+                   &unused, sizeof(unused)) != 0)
+      return false;
+    steered_ = false;
+    return true;
+  }
+
+  /**
+   * @brief Fill the handoffs of loops_[i] with copies of fd, as if the loop
+   * had stopped taking them.
+   */
+  void fill_handoffs(size_t i, int fd) {
+    for (;;) {
+      int copy = dup(fd);
+      if (!loops_[i]->handoffs.try_push({.fd = copy, .addr = {}})) {
+        close(copy);
+        return;
+      }
+    }
+  }
+};
+
+/**
+ * @brief The value of a counter of the server.
+ */
+uint64_t counter(http::Server &server, const std::string &name) {
+  auto out = server.metrics().scrape();
+  auto pos = out.find("\n" + name + " ");
+  if (pos == std::string::npos) return 0;
+  return std::stoull(out.substr(pos + name.size() + 2));
+}
+
+/**
+ * @brief Run the event loop of a server in a thread.
+ */
+class ServerTest : public ::testing::Test {
+ protected:
+  void start(uint16_t port) {
+    ASSERT_TRUE(server_.listen(port, "127.0.0.1"));
+    run(port);
+  }
+
+  /**
+   * @brief Run the server, which listens on the port.
+   */
+  void run(uint16_t port) {
+    port_ = port;
+    loop_ = std::thread([this] { server_.start(); });
+  }
+
+  /**
+   * @brief Queue n connections in the backlog before the server runs, then
+   * send a request on each.
+   * @return Return false if a request is not answered.
+   */
+  bool serve_queued(uint16_t port, size_t n) {
+    server_.handle("/", [](http::ResponseWriter &resp, const http::Request &) {
+      resp.write("ok");
+    });
+    if (!server_.listen(port, "127.0.0.1")) return false;
+    std::vector<int> fds;
+    for (size_t i = 0; i < n; ++i) fds.push_back(connect_to(port));
+    run(port);
+    bool served = true;
+    for (int fd : fds) {
+      std::string resp;
+      served &= send_all(fd, "GET / HTTP/1.1\r\n\r\n") &&
+                read_response(fd, resp);
+      close(fd);
+    }
+    return served;
+  }
+
+  /**
+   * @brief Answer every request with the id of the thread that serves it.
+   */
+  void serve_thread_ids() {
+    server_.handle("/", [](http::ResponseWriter &resp, const http::Request &) {
+      resp.write(thread_id(std::this_thread::get_id()));
+    });
+  }
+
+  /**
+   * @brief Run the loop on a thread with a stack of the size, so serving that
+   * recurses once per request overflows it.
+   */
+  void start(uint16_t port, size_t stack_size) {
+    pthread_attr_t attr, old;
+    pthread_getattr_default_np(&old);
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, stack_size);
+    pthread_setattr_default_np(&attr);
+    start(port);
+    pthread_setattr_default_np(&old);
+    pthread_attr_destroy(&attr);
+    pthread_attr_destroy(&old);
+  }
+
+  /**
+   * @brief Stop the server and wait for the loop to return.
+   */
+  void stop() {
+    // stop() fails until the loop is running
+    while (!server_.stop()) std::this_thread::yield();
+    // wake the loop up from epoll_wait
+    close(connect_to(port_));
+    loop_.join();
+  }
+
+  void TearDown() override {
+    if (loop_.joinable()) stop();
+  }
+
+  TestServer server_;
+
+  std::thread loop_;
+
+  uint16_t port_ = 0;
+};
+
+}  // namespace
+
+TEST_F(ServerTest, ListensOnThePort) {
+  ASSERT_TRUE(server_.listen(18200, "127.0.0.1"));
+  // the backlog completes the handshake before the loop runs
+  int fd = connect_to(18200);
+  EXPECT_NE(fd, -1);
+  close(fd);
+}
+
+TEST_F(ServerTest, RejectsABadAddress) {
+  EXPECT_FALSE(server_.listen(18201, "not an address"));
+  EXPECT_FALSE(server_.listen(80, "127.0.0.1"));
+}
+
+TEST_F(ServerTest, Stops) {
+  start(18202);
+  stop();
+  EXPECT_FALSE(server_.stop());
+}
+
+TEST_F(ServerTest, ReadsTheRequest) {
+  std::atomic<bool> called = false;
+  server_.handle("/", [&](http::ResponseWriter &, const http::Request &req) {
+    EXPECT_EQ(req.uri(), "/");
+    called = true;
+  });
+  start(18203);
+  int fd = connect_to(18203);
+  ASSERT_TRUE(send_all(fd, "GET / HTTP/1.1\r\nContent-Length: 0\r\n\r\n"));
+  EXPECT_TRUE(wait_for([&] { return called.load(); }));
+  close(fd);
+}
+
+TEST_F(ServerTest, ClosesABadRequest) {
+  start(18204);
+  int fd = connect_to(18204);
+  ASSERT_TRUE(send_all(fd, "NOT A REQUEST\r\n\r\n"));
+  std::string resp;
+  EXPECT_TRUE(read_until_eof(fd, resp));
+  close(fd);
+}
+
+TEST_F(ServerTest, Responds) {
+  server_.handle("/", [](http::ResponseWriter &resp, const http::Request &) {
+    resp.write("hello");
+  });
+  start(18205);
+  int fd = connect_to(18205);
+  ASSERT_TRUE(send_all(fd,
+                       "GET / HTTP/1.1\r\nConnection: close\r\n"
+                       "Content-Length: 0\r\n\r\n"));
+  std::string resp;
+  EXPECT_TRUE(read_until_eof(fd, resp));
+  EXPECT_TRUE(resp.starts_with("HTTP/1.1 200 OK\r\n")) << resp;
+  EXPECT_NE(resp.find("\r\nContent-Length: 5\r\n"), std::string::npos);
+  EXPECT_NE(resp.find("\r\nConnection: close\r\n"), std::string::npos);
+  EXPECT_TRUE(resp.ends_with("\r\n\r\nhello")) << resp;
+  close(fd);
+}
+
+TEST_F(ServerTest, KeepsTheConnectionAlive) {
+  server_.handle("/", [](http::ResponseWriter &resp, const http::Request &req) {
+    resp.write(req.uri());
+  });
+  start(18206);
+  int fd = connect_to(18206);
+  for (auto uri : {"/a", "/b", "/c"}) {
+    ASSERT_TRUE(send_all(fd, "GET " + std::string(uri) + " HTTP/1.1\r\n\r\n"));
+    std::string resp;
+    ASSERT_TRUE(read_response(fd, resp)) << uri;
+    EXPECT_TRUE(resp.ends_with(uri)) << resp;
+    EXPECT_EQ(resp.find("Connection: close"), std::string::npos);
+  }
+  close(fd);
+}
+
+TEST_F(ServerTest, AnswersPipelinedRequests) {
+  server_.handle("/", [](http::ResponseWriter &resp, const http::Request &req) {
+    resp.write(req.uri());
+  });
+  start(18207);
+  int fd = connect_to(18207);
+  // the requests arrive in one read
+  ASSERT_TRUE(send_all(fd,
+                       "GET /a HTTP/1.1\r\n\r\n"
+                       "POST /b HTTP/1.1\r\nContent-Length: 2\r\n\r\nok"
+                       "GET /c HTTP/1.1\r\n\r\n"));
+  std::vector<std::string> resps;
+  ASSERT_TRUE(read_responses(fd, 3, resps));
+  EXPECT_TRUE(resps[0].ends_with("\r\n\r\n/a")) << resps[0];
+  EXPECT_TRUE(resps[1].ends_with("\r\n\r\n/b")) << resps[1];
+  EXPECT_TRUE(resps[2].ends_with("\r\n\r\n/c")) << resps[2];
+  close(fd);
+}
+
+/**
+ * @brief Pipeline n identical requests on one connection while reading the
+ * responses, so the server has many of them buffered at once.
+ * @return Return false if a response is missing or differs from the first.
+ */
+bool pipeline(int fd, size_t n) {
+  constexpr std::string_view request = "GET / HTTP/1.1\r\n\r\n";
+  std::string first;
+  if (!send_all(fd, request) || !read_response(fd, first)) return false;
+  std::string requests;
+  for (size_t i = 0; i < n; ++i) requests.append(request);
+  std::thread sender([fd, &requests] { send_all(fd, requests); });
+  std::string buf;
+  char tmp[4096];
+  while (buf.size() < n * first.size()) {
+    auto ret = recv(fd, tmp, sizeof(tmp), 0);
+    if (ret <= 0) break;
+    buf.append(tmp, ret);
+  }
+  // unblock the sender if the server has stopped reading
+  shutdown(fd, SHUT_RDWR);
+  sender.join();
+  if (buf.size() != n * first.size()) return false;
+  for (size_t i = 0; i < n; ++i)
+    if (buf.compare(i * first.size(), first.size(), first) != 0) return false;
+  return true;
+}
+
+TEST_F(ServerTest, ServesManyPipelinedRequests) {
+  server_.handle("/", [](http::ResponseWriter &resp, const http::Request &) {
+    resp.write("ok");
+  });
+  // it used to recurse once per buffered request
+  start(18208, 256 * 1024);
+  int fd = connect_to(18208);
+  EXPECT_TRUE(pipeline(fd, 1000));
+  close(fd);
+}
+
+TEST_F(ServerTest, ServesManyPipelinedRequestsLevelTriggered) {
+  server_.handle("/", [](http::ResponseWriter &resp, const http::Request &) {
+    resp.write("ok");
+  });
+  server_.set_triger_mode(true, false);
+  ASSERT_TRUE(server_.set_event_budget(4, 1024));
+  start(18209, 256 * 1024);
+  int fd = connect_to(18209);
+  EXPECT_TRUE(pipeline(fd, 500));
+  close(fd);
+}
+
+TEST_F(ServerTest, ServesOthersWhilePipelining) {
+  server_.handle("/", [](http::ResponseWriter &resp, const http::Request &) {
+    resp.write("ok");
+  });
+  ASSERT_TRUE(server_.set_event_budget(4, 1024));
+  start(18210);
+  int busy = connect_to(18210);
+  std::thread client([&] { EXPECT_TRUE(pipeline(busy, 500)); });
+  int fd = connect_to(18210);
+  std::string resp;
+  ASSERT_TRUE(send_all(fd, "GET / HTTP/1.1\r\n\r\n"));
+  EXPECT_TRUE(read_response(fd, resp));
+  client.join();
+  close(fd);
+  close(busy);
+}
+
+TEST_F(ServerTest, RejectsAnEmptyEventBudget) {
+  EXPECT_FALSE(server_.set_event_budget(0, 1024));
+  EXPECT_FALSE(server_.set_event_budget(4, 0));
+}
+
+TEST_F(ServerTest, RejectsEventLoopsWithoutAWakeupFd) {
+  rlimit old;
+  ASSERT_EQ(getrlimit(RLIMIT_NOFILE, &old), 0);
+  // a new fd can't be numbered below the limit, so every one fails
+  int lowest = dup(0);
+  ASSERT_NE(lowest, -1);
+  close(lowest);
+  rlimit low = old;
+  low.rlim_cur = lowest;
+  ASSERT_EQ(setrlimit(RLIMIT_NOFILE, &low), 0);
+  bool ret = server_.set_event_loops(2);
+  ASSERT_EQ(setrlimit(RLIMIT_NOFILE, &old), 0);
+  EXPECT_FALSE(ret);
+  EXPECT_TRUE(server_.set_event_loops(2));
+}
+
+TEST_F(ServerTest, RejectsCpusItMayNotRunOn) {
+  EXPECT_FALSE(server_.set_cpu_affinity({CPU_SETSIZE}, {}));
+  EXPECT_FALSE(server_.set_cpu_affinity({}, {-1}));
+  EXPECT_TRUE(server_.set_cpu_affinity({}, {}));
+}
+
+TEST_F(ServerTest, LogsTheRejectedRequests) {
+  char path[] = "/tmp/tinywebserver_access_XXXXXX";
+  int log_fd = mkstemp(path);
+  ASSERT_NE(log_fd, -1);
+  close(log_fd);
+  ASSERT_TRUE(server_.access_log().open(path));
+  server_.access_log().set(http::AccessLog::Format::COMMON);
+  server_.handle("/hello",
+                 [](http::ResponseWriter &resp, const http::Request &) {
+                   resp.write("hi");
+                 });
+  start(18211);
+  for (auto request :
+       {"GET /hello HTTP/1.1\r\nConnection: close\r\n\r\n",
+        "NOT A REQUEST\r\n\r\n", "GET /missing HTTP/1.1\r\n\r\n"}) {
+    int fd = connect_to(18211);
+    ASSERT_TRUE(send_all(fd, request));
+    std::string resp;
+    EXPECT_TRUE(read_until_eof(fd, resp)) << request;
+    close(fd);
+  }
+  // stopping the server writes the queued records
+  stop();
+
+  std::string log;
+  log_fd = open(path, O_RDONLY);
+  char buf[4096];
+  for (ssize_t n; (n = read(log_fd, buf, sizeof(buf))) > 0;) log.append(buf, n);
+  close(log_fd);
+  unlink(path);
+  EXPECT_NE(log.find("\"GET /hello HTTP/1.1\" 200 "), std::string::npos)
+      << log;
+  EXPECT_NE(log.find("\"-\" 400 0\n"), std::string::npos) << log;
+  EXPECT_NE(log.find("\"GET /missing HTTP/1.1\" 404 0\n"), std::string::npos)
+      << log;
+}
+
+TEST_F(ServerTest, TracesPipelinedRequests) {
+  server_.handle("/", [](http::ResponseWriter &resp, const http::Request &) {
+    resp.write("ok");
+  });
+  // every request is slow
+  server_.slow_requests().set_threshold(1ns);
+  start(18212);
+  int fd = connect_to(18212);
+  // the second request is parsed from the bytes of the first read
+  ASSERT_TRUE(send_all(fd, "GET /a HTTP/1.1\r\n\r\nGET /b HTTP/1.1\r\n\r\n"));
+  std::vector<std::string> resps;
+  ASSERT_TRUE(read_responses(fd, 2, resps));
+  close(fd);
+  ASSERT_TRUE(
+      wait_for([&] { return server_.slow_requests().get_count() >= 2; }));
+  auto slow = server_.slow_requests().snapshot();
+  for (auto &request : slow) {
+    for (size_t i = 0; i < http::SlowRequest::N_PHASES; ++i)
+      EXPECT_GE(request.phase_ns[i], 0)
+          << request.uri.view() << " " << http::SlowRequest::phase_name(i);
+  }
+  EXPECT_EQ(slow.back().uri.view(), "/b");
+}
+
+TEST_F(ServerTest, SteersByTheCpuOfTheClient) {
+  serve_thread_ids();
+  ASSERT_TRUE(server_.set_event_loops(2));
+  ASSERT_TRUE(server_.set_listen_options({.reuse_port = true}));
+  start(18213);
+  // the loops accept by themselves
+  EXPECT_FALSE(server_.listens(0));
+  EXPECT_TRUE(server_.listens(1));
+  EXPECT_TRUE(server_.listens(2));
+  EXPECT_TRUE(server_.reuse_port_steered());
+
+  cpu_set_t allowed;
+  ASSERT_EQ(sched_getaffinity(0, sizeof(allowed), &allowed), 0);
+  // the unpinned loops take the CPUs by their parity
+  std::map<int, std::set<std::string>> loops_by_parity;
+  for (int cpu = 0, used = 0; cpu < CPU_SETSIZE && used < 4; ++cpu) {
+    if (!CPU_ISSET(cpu, &allowed)) continue;
+    ++used;
+    std::thread client([&, cpu] {
+      ASSERT_TRUE(pin_current_thread({cpu}));
+      for (int i = 0; i < 4; ++i) {
+        int fd = connect_to(18213);
+        auto id = served_by(fd);
+        close(fd);
+        EXPECT_NE(id, "") << cpu;
+        EXPECT_NE(id, thread_id(loop_.get_id())) << cpu;
+        loops_by_parity[cpu % 2].insert(id);
+      }
+    });
+    client.join();
+  }
+  for (auto &[parity, loops] : loops_by_parity)
+    EXPECT_EQ(loops.size(), 1u) << parity;
+  if (loops_by_parity.size() == 2) {
+    EXPECT_NE(*loops_by_parity[0].begin(), *loops_by_parity[1].begin());
+  }
+}
+
+TEST_F(ServerTest, FallsBackToTheHashOfReusePort) {
+  serve_thread_ids();
+  ASSERT_TRUE(server_.set_event_loops(2));
+  ASSERT_TRUE(server_.set_listen_options({.reuse_port = true}));
+  ASSERT_TRUE(server_.listen(18214, "127.0.0.1"));
+  ASSERT_TRUE(server_.detach_steering());
+  EXPECT_FALSE(server_.reuse_port_steered());
+  run(18214);
+  // the hash of the client ports spreads them over both listeners
+  std::vector<int> fds;
+  std::set<std::string> loops;
+  for (int i = 0; i < 32; ++i) {
+    fds.push_back(connect_to(18214));
+    auto id = served_by(fds.back());
+    ASSERT_NE(id, "") << i;
+    EXPECT_NE(id, thread_id(loop_.get_id()));
+    loops.insert(id);
+  }
+  for (int fd : fds) close(fd);
+  EXPECT_EQ(loops.size(), 2u);
+}
+
+TEST_F(ServerTest, SpreadsTheConnectionsOverTheLoops) {
+  serve_thread_ids();
+  ASSERT_TRUE(server_.set_event_loops(3));
+  start(18215);
+  std::vector<int> fds;
+  std::map<std::string, int> served;
+  for (int i = 0; i < 12; ++i) {
+    fds.push_back(connect_to(18215));
+    ++served[served_by(fds.back())];
+  }
+  // the open connections are counted, so every loop has as many
+  EXPECT_EQ(served.size(), 3u);
+  EXPECT_EQ(served.count(""), 0u);
+  EXPECT_EQ(served.count(thread_id(loop_.get_id())), 0u);
+  for (auto &[id, n] : served) EXPECT_EQ(n, 4) << id;
+  // a closed connection frees its loop for the next one
+  auto id = served_by(fds[0]);
+  close(fds[0]);
+  ASSERT_TRUE(wait_for([&] {
+    return counter(server_, "tinywebserver_connections_closed_total") == 1;
+  }));
+  fds[0] = connect_to(18215);
+  EXPECT_EQ(served_by(fds[0]), id);
+  for (int fd : fds) close(fd);
+  EXPECT_EQ(counter(server_, "tinywebserver_connections_accepted_total"), 13u);
+}
+
+TEST_F(ServerTest, PrefersAnIdleLoopByLatency) {
+  serve_thread_ids();
+  ASSERT_TRUE(server_.set_event_loops(3, http::Server::Balance::LEAST_LATENCY));
+  start(18216);
+  std::vector<int> fds;
+  std::set<std::string> loops;
+  for (int i = 0; i < 3; ++i) {
+    fds.push_back(connect_to(18216));
+    // the requests give the busy loops a latency
+    for (int j = 0; j < 3; ++j) EXPECT_NE(served_by(fds.back()), "");
+    loops.insert(served_by(fds.back()));
+  }
+  EXPECT_EQ(loops.size(), 3u);
+  // then the loops are busy, and the connections still served
+  for (int i = 0; i < 6; ++i) {
+    fds.push_back(connect_to(18216));
+    EXPECT_EQ(loops.count(served_by(fds.back())), 1u) << i;
+  }
+  for (int fd : fds) close(fd);
+}
+
+TEST_F(ServerTest, DropsAConnectionWhenTheLoopsAreFull) {
+  ASSERT_TRUE(server_.set_event_loops(2));
+  int pipe_fds[2];
+  ASSERT_EQ(pipe(pipe_fds), 0);
+  server_.fill_handoffs(1, pipe_fds[0]);
+  server_.fill_handoffs(2, pipe_fds[0]);
+  int fd = dup(pipe_fds[1]);
+  server_.hand_off(fd, {});
+  // it is closed
+  EXPECT_EQ(fcntl(fd, F_GETFD), -1);
+  EXPECT_EQ(counter(server_, "tinywebserver_handoff_dropped_total"), 1u);
+  close(pipe_fds[0]);
+  close(pipe_fds[1]);
+}
+
+TEST_F(ServerTest, StopsEveryLoop) {
+  serve_thread_ids();
+  ASSERT_TRUE(server_.set_event_loops(3));
+  start(18217);
+  int fd = connect_to(18217);
+  EXPECT_NE(served_by(fd), "");
+  // the idle loops wait in epoll_wait() until the eventfd wakes them
+  auto begin = std::chrono::steady_clock::now();
+  stop();
+  EXPECT_LT(std::chrono::steady_clock::now() - begin, 1s);
+  EXPECT_FALSE(server_.stop());
+  close(fd);
+}
+
+TEST_F(ServerTest, AcceptsTheBacklogInBudgets) {
+  // an edge triggered listen fd reports the queued connections once
+  server_.set_triger_mode(true, true);
+  ASSERT_TRUE(server_.set_listen_options({.accept_budget = 2}));
+  EXPECT_TRUE(serve_queued(18218, 9));
+  EXPECT_EQ(counter(server_, "tinywebserver_connections_accepted_total"), 9u);
+  EXPECT_GE(counter(server_, "tinywebserver_accept_budget_exhausted_total"),
+            4u);
+}
+
+TEST_F(ServerTest, AcceptsTheBacklogInBudgetsLevelTriggered) {
+  server_.set_triger_mode(false, true);
+  ASSERT_TRUE(server_.set_listen_options({.accept_budget = 2}));
+  EXPECT_TRUE(serve_queued(18219, 9));
+  EXPECT_GE(counter(server_, "tinywebserver_accept_budget_exhausted_total"),
+            4u);
+}
+
+TEST_F(ServerTest, HandsOffTheBacklogInBudgets) {
+  server_.set_triger_mode(true, true);
+  ASSERT_TRUE(server_.set_event_loops(2));
+  ASSERT_TRUE(server_.set_listen_options({.accept_budget = 2}));
+  EXPECT_TRUE(serve_queued(18220, 9));
+}
+
+TEST_F(ServerTest, AcceptsNonBlockingCloseOnExec) {
+  server_.handle("/", [](http::ResponseWriter &resp, const http::Request &) {
+    resp.write("ok");
+  });
+  start(18221);
+  int fd = connect_to(18221);
+  std::string resp;
+  ASSERT_TRUE(send_all(fd, "GET / HTTP/1.1\r\n\r\n"));
+  ASSERT_TRUE(read_response(fd, resp));
+  sockaddr_in client = {};
+  socklen_t len = sizeof(client);
+  ASSERT_EQ(getsockname(fd, reinterpret_cast<sockaddr *>(&client), &len), 0);
+
+  // the server's end is in this process, its peer is the client
+  int accepted = -1;
+  for (int i = 0; i < 4096 && accepted == -1; ++i) {
+    sockaddr_in peer = {};
+    len = sizeof(peer);
+    if (i != fd &&
+        getpeername(i, reinterpret_cast<sockaddr *>(&peer), &len) == 0 &&
+        peer.sin_family == AF_INET && peer.sin_port == client.sin_port)
+      accepted = i;
+  }
+  ASSERT_NE(accepted, -1);
+  EXPECT_TRUE(fcntl(accepted, F_GETFL) & O_NONBLOCK);
+  EXPECT_TRUE(fcntl(accepted, F_GETFD) & FD_CLOEXEC);
+  close(fd);
+}
+
+TEST_F(ServerTest, RejectsBadListenOptions) {
+  EXPECT_FALSE(server_.set_listen_options({.backlog = 0}));
+  EXPECT_FALSE(server_.set_listen_options({.backlog = -1}));
+  EXPECT_FALSE(server_.set_listen_options({.accept_budget = 0}));
+  EXPECT_FALSE(server_.set_listen_options({.accept_budget = -1}));
+  EXPECT_TRUE(server_.set_listen_options({.backlog = 1, .accept_budget = 1}));
+  start(18222);
+  ASSERT_TRUE(wait_for([&] { return !server_.set_listen_options({}); }));
+}
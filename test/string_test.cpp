@@ -0,0 +1,24 @@
+#include "tinywebserver/utils/string.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+TEST(StringTest, ConvertsInPlace) {
+  std::string str = "Content-Type";
+  EXPECT_EQ(&toupper(str), &str);
+  EXPECT_EQ(str, "CONTENT-TYPE");
+  EXPECT_EQ(tolower(str), "content-type");
+}
+
+TEST(StringTest, ConvertsACopy) {
+  const std::string str = "Keep-Alive";
+  EXPECT_EQ(toupper(str), "KEEP-ALIVE");
+  EXPECT_EQ(tolower(str), "keep-alive");
+  EXPECT_EQ(str, "Keep-Alive");
+}
+
+TEST(StringTest, ConvertsATemporary) {
+  EXPECT_EQ(toupper(std::string("close")), "CLOSE");
+  EXPECT_EQ(tolower(std::string("CLOSE")), "close");
+}
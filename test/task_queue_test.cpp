@@ -0,0 +1,170 @@
+#include "tinywebserver/pool/task_queue.hpp"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+namespace {
+
+/**
+ * @brief Push tasks that record their id when they run.
+ */
+class TaskQueueTest : public ::testing::Test {
+ protected:
+  void push(int id, TaskOptions options = {}) {
+    queue_.push([this, id] { ran_.push_back(id); }, now_, options);
+  }
+
+  void push_until(int id, TaskQueue::clock::duration timeout,
+                  TaskPriority priority = TaskPriority::NORMAL) {
+    push(id, {priority, now_ + timeout});
+  }
+
+  /**
+   * @brief Pop and run the next task, return its id.
+   */
+  int pop() {
+    auto item = queue_.pop(now_);
+    item.task();
+    return ran_.back();
+  }
+
+  std::vector<int> pop_all() {
+    std::vector<int> ret;
+    while (!queue_.empty()) ret.push_back(pop());
+    return ret;
+  }
+
+  TaskQueue queue_;
+
+  TaskQueue::clock::time_point now_ = TaskQueue::clock::now();
+
+  std::vector<int> ran_;
+};
+
+}  // namespace
+
+TEST_F(TaskQueueTest, RunsATaskWithoutDeadlineInOrder) {
+  for (int i = 0; i < 100; ++i) push(i);
+  EXPECT_EQ(queue_.size(), 100);
+  auto ran = pop_all();
+  for (int i = 0; i < 100; ++i) EXPECT_EQ(ran[i], i);
+}
+
+TEST_F(TaskQueueTest, RunsTheBetterPriorityFirst) {
+  push(2, {TaskPriority::LOW});
+  push(1, {TaskPriority::NORMAL});
+  push(0, {TaskPriority::HIGH});
+  EXPECT_EQ(pop_all(), (std::vector<int>{0, 1, 2}));
+}
+
+TEST_F(TaskQueueTest, RunsTheEarliestDeadlineFirst) {
+  push_until(3, 30ms);
+  push_until(1, 10ms);
+  push_until(2, 20ms);
+  EXPECT_EQ(pop_all(), (std::vector<int>{1, 2, 3}));
+}
+
+TEST_F(TaskQueueTest, TellsAnExpiredTask) {
+  push_until(0, 1ms);
+  auto item = queue_.pop(now_ + 2ms);
+  EXPECT_TRUE(item.expired(now_ + 2ms));
+  EXPECT_FALSE(item.expired(now_));
+}
+
+TEST_F(TaskQueueTest, AgesALowPriorityLevel) {
+  queue_.set_aging(10ms);
+  push(1, {TaskPriority::LOW});
+  // the low task has waited for three aging intervals, one more than the
+  // classes between LOW and HIGH
+  now_ += 35ms;
+  push(0, {TaskPriority::HIGH});
+  EXPECT_EQ(pop(), 1);
+  EXPECT_EQ(pop(), 0);
+}
+
+TEST_F(TaskQueueTest, AgesByTheOldestTaskWithADeadline) {
+  queue_.set_aging(10ms);
+  push_until(1, 1h, TaskPriority::LOW);
+  now_ += 35ms;
+  // the head of the heap is now a new task, the old one still ages the level
+  push_until(2, 1ms, TaskPriority::LOW);
+  push(0, {TaskPriority::HIGH});
+  EXPECT_EQ(pop_all(), (std::vector<int>{2, 1, 0}));
+}
+
+TEST_F(TaskQueueTest, TracksTheOldestTaskWithADeadline) {
+  auto begin = now_;
+  push_until(0, 30ms);
+  now_ += 1ms;
+  push_until(1, 10ms);
+  now_ += 1ms;
+  push_until(2, 20ms);
+  push(3);
+  EXPECT_EQ(queue_.oldest(), begin);
+  EXPECT_EQ(pop(), 1);
+  EXPECT_EQ(queue_.oldest(), begin);
+  EXPECT_EQ(pop(), 2);
+  EXPECT_EQ(queue_.oldest(), begin);
+  EXPECT_EQ(pop(), 0);
+  // only the task without a deadline is left
+  EXPECT_EQ(queue_.oldest(), now_);
+  push_until(4, 1ms);
+  EXPECT_EQ(queue_.oldest(), now_);
+}
+
+TEST_F(TaskQueueTest, DoesNotAgeWithoutAging) {
+  queue_.set_aging(0ms);
+  push(1, {TaskPriority::LOW});
+  now_ += 1h;
+  push(0, {TaskPriority::HIGH});
+  EXPECT_EQ(pop_all(), (std::vector<int>{0, 1}));
+}
+
+TEST_F(TaskQueueTest, RunsTheDeadlinesFirstWithoutAging) {
+  queue_.set_aging(0ms);
+  push(3);
+  push_until(1, 10ms);
+  push(4);
+  now_ += 1ms;
+  push_until(0, 5ms);
+  push_until(2, 20ms);
+  // a worker takes a task every millisecond
+  std::vector<int> ran;
+  while (!queue_.empty()) {
+    auto item = queue_.pop(now_);
+    EXPECT_FALSE(item.expired(now_));
+    item.task();
+    ran.push_back(ran_.back());
+    now_ += 1ms;
+  }
+  EXPECT_EQ(ran, (std::vector<int>{0, 1, 2, 3, 4}));
+}
+
+TEST_F(TaskQueueTest, RunsATaskWithoutDeadlineUnderDeadlineLoad) {
+  queue_.set_aging(10ms);
+  push(-1);
+  // a worker takes a task every millisecond, while one with a deadline of
+  // 5ms is pushed every millisecond
+  for (int i = 0; i < 1000; ++i) {
+    push_until(i, 5ms);
+    if (pop() == -1) {
+      EXPECT_LE(i, 20);
+      return;
+    }
+    now_ += 1ms;
+  }
+  FAIL() << "the task without a deadline has never run";
+}
+
+TEST_F(TaskQueueTest, Clears) {
+  push(0);
+  push_until(1, 1ms);
+  queue_.clear();
+  EXPECT_TRUE(queue_.empty());
+  push(2);
+  EXPECT_EQ(pop_all(), (std::vector<int>{2}));
+}
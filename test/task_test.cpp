@@ -0,0 +1,121 @@
+#include "tinywebserver/pool/task.hpp"
+
+#include <gtest/gtest.h>
+
+#include <array>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+
+using namespace std::chrono_literals;
+
+TEST(UniqueFunctionTest, CallsASmallAndALargeCallable) {
+  int x = 1;
+  UniqueFunction<int(int)> small = [&x](int y) { return x + y; };
+  EXPECT_EQ(small(2), 3);
+  // too large to be stored inline
+  std::array<int, 64> big = {};
+  big[63] = 5;
+  UniqueFunction<int(int)> large = [big](int y) { return big[63] + y; };
+  EXPECT_EQ(large(2), 7);
+  UniqueFunction<int(int)> empty;
+  EXPECT_FALSE(empty);
+  empty = std::move(large);
+  EXPECT_TRUE(empty);
+  EXPECT_FALSE(large);
+  EXPECT_EQ(empty(3), 8);
+}
+
+TEST(UniqueFunctionTest, OwnsAMoveOnlyCallable) {
+  auto alive = std::make_shared<int>(42);
+  {
+    Task task = [p = std::make_unique<std::shared_ptr<int>>(alive)] {
+      EXPECT_EQ(**p, 42);
+    };
+    EXPECT_EQ(alive.use_count(), 2);
+    Task moved = std::move(task);
+    EXPECT_EQ(alive.use_count(), 2);
+    moved();
+    moved = nullptr;
+    EXPECT_EQ(alive.use_count(), 1);
+    moved = [alive] {};
+  }
+  EXPECT_EQ(alive.use_count(), 1);
+}
+
+TEST(UniqueFunctionTest, BindsTheArguments) {
+  int out = 0;
+  Task task = bind_task([](std::unique_ptr<int> &p, int *out) { *out = *p; },
+                        std::make_unique<int>(7), &out);
+  task();
+  EXPECT_EQ(out, 7);
+  auto f = bind_task([](int a, int b) { return a - b; }, 5, 3);
+  EXPECT_EQ(f(), 2);
+}
+
+TEST(TaskFutureTest, GetsTheResult) {
+  auto [future, runner] = make_task<int>([] { return 42; });
+  EXPECT_TRUE(future.valid());
+  EXPECT_FALSE(future.is_ready());
+  EXPECT_EQ(future.wait_for(1ms), std::future_status::timeout);
+  runner();
+  EXPECT_TRUE(future.is_ready());
+  EXPECT_EQ(future.wait_for(0ms), std::future_status::ready);
+  EXPECT_EQ(future.get(), 42);
+  EXPECT_FALSE(future.valid());
+}
+
+TEST(TaskFutureTest, GetsAReferenceAndVoid) {
+  int x = 0;
+  auto [ref, ref_runner] = make_task<int &>([&x]() -> int & { return x; });
+  ref_runner();
+  EXPECT_EQ(&ref.get(), &x);
+  bool ran = false;
+  auto [done, done_runner] = make_task<void>([&ran] { ran = true; });
+  done_runner();
+  done.get();
+  EXPECT_TRUE(ran);
+}
+
+TEST(TaskFutureTest, RethrowsTheException) {
+  auto [future, runner] =
+      make_task<int>([]() -> int { throw std::runtime_error("x"); });
+  runner();
+  EXPECT_THROW(future.get(), std::runtime_error);
+}
+
+TEST(TaskFutureTest, BreaksWhenTheTaskIsDropped) {
+  auto [future, runner] = make_task<int>([] { return 1; });
+  {
+    auto dropped = std::move(runner);
+  }
+  EXPECT_THROW(future.get(), std::future_error);
+}
+
+TEST(TaskFutureTest, OutlivesTheRunnerAndTheOtherWay) {
+  auto alive = std::make_shared<int>();
+  {
+    auto [future, runner] = make_task<int>([alive] { return 1; });
+    runner();
+  }
+  {
+    auto [future, runner] = make_task<int>([alive] { return 1; });
+    future = TaskFuture<int>();
+    runner();
+  }
+  EXPECT_EQ(alive.use_count(), 1);
+}
+
+TEST(TaskFutureTest, WakesAWaitingThread) {
+  for (int i = 0; i < 100; ++i) {
+    auto [future, runner] = make_task<int>([i] { return i; });
+    std::thread producer([&runner] {
+      std::this_thread::yield();
+      runner();
+    });
+    EXPECT_EQ(future.get(), i);
+    producer.join();
+  }
+}
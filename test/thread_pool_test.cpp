@@ -0,0 +1,269 @@
+#include "tinywebserver/pool/thread_pool.hpp"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+namespace {
+
+template <typename Pred>
+bool wait_for(Pred pred, std::chrono::milliseconds timeout = 5s) {
+  auto deadline = std::chrono::steady_clock::now() + timeout;
+  while (!pred()) {
+    if (std::chrono::steady_clock::now() > deadline) return false;
+    std::this_thread::sleep_for(1ms);
+  }
+  return true;
+}
+
+/**
+ * @brief Push n tasks that block until release, each after the one before has
+ * waited for a few milliseconds.
+ */
+void push_blocking(ThreadPool &pool, int n, std::atomic<bool> &release,
+                   std::atomic<int> &running) {
+  for (int i = 0; i < n; ++i) {
+    pool.push_task([&] {
+      ++running;
+      while (!release) std::this_thread::sleep_for(100us);
+    });
+    std::this_thread::sleep_for(5ms);
+  }
+}
+
+}  // namespace
+
+TEST(ThreadPoolTest, SubmitsATaskWithAStdFuture) {
+  ThreadPool pool(2);
+  auto future = pool.submit([](int a, int b) { return a + b; }, 40, 2);
+  static_assert(std::is_same_v<decltype(future), std::future<int>>);
+  EXPECT_EQ(future.get(), 42);
+
+  std::atomic<int> count = 0;
+  pool.submit([&count] { ++count; }).get();
+  EXPECT_EQ(count, 1);
+}
+
+TEST(ThreadPoolTest, PassesTheExceptionOfASubmittedTask) {
+  ThreadPool pool(1);
+  auto future = pool.submit([]() -> int { throw std::runtime_error("x"); });
+  EXPECT_THROW(future.get(), std::runtime_error);
+  auto task = pool.submit_task([]() -> int { throw std::runtime_error("x"); });
+  EXPECT_THROW(task.get(), std::runtime_error);
+}
+
+TEST(ThreadPoolTest, BreaksTheFutureOfADroppedTask) {
+  ThreadPool pool(1);
+  pool.pause();
+  auto future = pool.submit(TaskOptions::within(1ms), [] { return 1; });
+  auto task = pool.submit_task(TaskOptions::within(1ms), [] { return 1; });
+  std::this_thread::sleep_for(5ms);
+  pool.unpause();
+  EXPECT_THROW(future.get(), std::future_error);
+  EXPECT_THROW(task.get(), std::future_error);
+}
+
+TEST(ThreadPoolTest, SubmitsATaskWithATaskFuture) {
+  ThreadPool pool(2);
+  auto future = pool.submit_task([](int a) { return a * 2; }, 21);
+  static_assert(std::is_same_v<decltype(future), TaskFuture<int>>);
+  EXPECT_EQ(future.get(), 42);
+}
+
+TEST(ThreadPoolTest, RunsABatchOfTasks) {
+  ThreadPool pool(4);
+  std::atomic<int> count = 0;
+  std::vector<std::function<void()>> tasks(100, [&count] { ++count; });
+  // an lvalue range is copied and stays usable
+  pool.push_tasks(tasks).get();
+  EXPECT_EQ(count, 100);
+  EXPECT_EQ(tasks.size(), 100);
+  pool.push_tasks(std::move(tasks)).get();
+  EXPECT_EQ(count, 200);
+  pool.push_tasks(std::vector<std::function<void()>>()).get();
+}
+
+TEST(ThreadPoolTest, RethrowsTheExceptionOfABatch) {
+  ThreadPool pool(2);
+  std::atomic<int> count = 0;
+  std::vector<std::function<void()>> tasks(10, [&count] { ++count; });
+  tasks[3] = [] { throw std::runtime_error("x"); };
+  auto future = pool.push_tasks(std::move(tasks));
+  EXPECT_THROW(future.get(), std::runtime_error);
+  // the other tasks still run
+  EXPECT_EQ(count, 9);
+}
+
+TEST(ThreadPoolTest, ParallelForVisitsEveryIndexOnce) {
+  ThreadPool pool(4);
+  constexpr int n = 10007;
+  std::vector<std::atomic<int>> visits(n);
+  pool.parallel_for(0, n, 100, [&visits](int i) { ++visits[i]; }).get();
+  int wrong = 0;
+  for (auto &v : visits) wrong += v != 1;
+  EXPECT_EQ(wrong, 0);
+}
+
+TEST(ThreadPoolTest, ParallelForSplitsTheLoopIntoBlocks) {
+  ThreadPool pool(4);
+  std::mutex mutex;
+  std::vector<std::pair<int, int>> blocks;
+  auto future = pool.parallel_for(-50, 55, 10, [&](int b, int e) {
+    std::lock_guard lock(mutex);
+    blocks.emplace_back(b, e);
+  });
+  future.get();
+  std::sort(blocks.begin(), blocks.end());
+  ASSERT_EQ(blocks.size(), 11);
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    EXPECT_EQ(blocks[i].first, -50 + 10 * int(i));
+    int end = i + 1 == blocks.size() ? 55 : -40 + 10 * int(i);
+    EXPECT_EQ(blocks[i].second, end);
+  }
+}
+
+TEST(ThreadPoolTest, ParallelForHandlesAnEmptyLoopAndNoGrain) {
+  ThreadPool pool(2);
+  std::atomic<int> count = 0;
+  pool.parallel_for(5, 5, 1, [&count](int) { ++count; }).get();
+  pool.parallel_for(5, 0, 1, [&count](int) { ++count; }).get();
+  EXPECT_EQ(count, 0);
+  // a grain of zero is one index per block
+  pool.parallel_for(size_t(0), 3, 0, [&count](size_t) { ++count; }).get();
+  EXPECT_EQ(count, 3);
+}
+
+TEST(ThreadPoolTest, ParallelForSplitsTheWholeRangeOfT) {
+  ThreadPool pool(2);
+  std::mutex mutex;
+  std::vector<std::pair<int, int>> blocks;
+  // end - begin doesn't fit in int
+  auto future = pool.parallel_for(INT_MIN, INT_MAX, 1 << 30, [&](int b, int e) {
+    std::lock_guard lock(mutex);
+    blocks.emplace_back(b, e);
+  });
+  future.get();
+  std::sort(blocks.begin(), blocks.end());
+  EXPECT_EQ(blocks, (std::vector<std::pair<int, int>>{
+                        {INT_MIN, -(1 << 30)},
+                        {-(1 << 30), 0},
+                        {0, 1 << 30},
+                        {1 << 30, INT_MAX}}));
+
+  // the last block ends at the max without stepping past it
+  std::atomic<int64_t> count = 0;
+  pool.parallel_for(INT64_MAX - 10, INT64_MAX, 3,
+                    [&](int64_t b, int64_t e) { count += e - b; })
+      .get();
+  EXPECT_EQ(count, 10);
+}
+
+TEST(ThreadPoolTest, RejectsCpusItMayNotRunOn) {
+  ThreadPool pool(2);
+  EXPECT_FALSE(pool.set_cpu_affinity({CPU_SETSIZE}));
+  EXPECT_TRUE(pool.get_cpu_affinity().empty());
+  EXPECT_TRUE(pool.set_cpu_affinity({}));
+  EXPECT_EQ(pool.submit([] { return 1; }).get(), 1);
+  EXPECT_EQ(pool.get_pin_failures(), 0);
+}
+
+TEST(ThreadPoolTest, SpawnsThreadsUpToTheMax) {
+  ThreadPool pool(1);
+  pool.set_elastic(3, 1ms);
+  std::atomic<bool> release = false;
+  std::atomic<int> running = 0;
+  // a push finds the task before it waiting longer than the threshold
+  push_blocking(pool, 8, release, running);
+  EXPECT_TRUE(wait_for([&] { return running == 3; }));
+  EXPECT_EQ(pool.get_thread_count(), 3u);
+  EXPECT_EQ(pool.get_tasks_queued(), 5u);
+  release = true;
+  pool.wait_for_tasks();
+  EXPECT_EQ(running, 8);
+}
+
+TEST(ThreadPoolTest, SpawnsThreadsForABurstWhileAllWorkersAreBusy) {
+  ThreadPool pool(1);
+  pool.set_elastic(3, 2ms);
+  std::atomic<bool> release = false;
+  std::atomic<int> running = 0;
+  pool.push_task([&] {
+    ++running;
+    while (!release) std::this_thread::sleep_for(100us);
+  });
+  ASSERT_TRUE(wait_for([&] { return running == 1; }));
+  // no push or pop happens after the burst, the supervisor spawns the threads
+  std::vector<std::function<void()>> burst(4, [&] {
+    ++running;
+    while (!release) std::this_thread::sleep_for(100us);
+  });
+  pool.push_tasks(std::move(burst));
+  EXPECT_TRUE(wait_for([&] { return running == 3; }, 50ms));
+  EXPECT_EQ(pool.get_thread_count(), 3u);
+  release = true;
+  pool.wait_for_tasks();
+  EXPECT_EQ(running, 5);
+}
+
+TEST(ThreadPoolTest, DoesNotSpawnWhenNotElastic) {
+  ThreadPool pool(1);
+  // no larger than the thread count
+  pool.set_elastic(1, 1ms);
+  std::atomic<bool> release = false;
+  std::atomic<int> running = 0;
+  push_blocking(pool, 4, release, running);
+  EXPECT_EQ(pool.get_thread_count(), 1u);
+  EXPECT_EQ(running, 1);
+  release = true;
+  pool.wait_for_tasks();
+  EXPECT_EQ(running, 4);
+}
+
+TEST(ThreadPoolTest, RetiresIdleThreadsDownToTheMin) {
+  ThreadPool pool(1);
+  pool.set_elastic(3, 1ms, 20ms);
+  std::atomic<bool> release = false;
+  std::atomic<int> running = 0;
+  push_blocking(pool, 4, release, running);
+  ASSERT_TRUE(wait_for([&] { return running == 3; }));
+  ASSERT_EQ(pool.get_thread_count(), 3u);
+  release = true;
+  // the elastic threads retire by themselves, without wait_for_tasks()
+  EXPECT_TRUE(wait_for([&] { return pool.get_thread_count() == 1; }));
+  EXPECT_EQ(running, 4);
+  std::this_thread::sleep_for(50ms);
+  EXPECT_EQ(pool.get_thread_count(), 1u);
+  EXPECT_EQ(pool.submit([] { return 1; }).get(), 1);
+}
+
+TEST(ThreadPoolTest, RecordsTheQueueDepthAndWaitTime) {
+  ThreadPool pool(1);
+  pool.pause();
+  for (int i = 0; i < 4; ++i) pool.push_task([] {});
+  std::this_thread::sleep_for(5ms);
+  pool.unpause();
+  pool.wait_for_tasks();
+  // recorded at every push
+  auto &depth = pool.get_queue_depth_histogram();
+  EXPECT_EQ(depth.count(), 4u);
+  EXPECT_EQ(depth.sum(), 1u + 2 + 3 + 4);
+  EXPECT_EQ(depth.percentile(0.99), 4u);
+  // in nanoseconds, recorded when a worker takes the task
+  auto &wait = pool.get_wait_time_histogram();
+  EXPECT_EQ(wait.count(), 4u);
+  EXPECT_GE(wait.sum(), 4 * 5'000'000u);
+}
@@ -0,0 +1,179 @@
+#include "tinywebserver/timer.hpp"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+namespace {
+
+/**
+ * @brief Wait until pred holds or the time runs out.
+ */
+template <typename Pred>
+bool wait_for(Pred pred, std::chrono::milliseconds timeout = 5s) {
+  auto deadline = std::chrono::steady_clock::now() + timeout;
+  while (!pred()) {
+    if (std::chrono::steady_clock::now() > deadline) return false;
+    std::this_thread::sleep_for(1ms);
+  }
+  return true;
+}
+
+using Task = Timer<int>::Task;
+using duration = Timer<int>::duration;
+using time_point = Timer<int>::time_point;
+
+time_point fire_time(time_point next_run_time, duration slack) {
+  Task task([] {}, 0us, 1, 0us, slack);
+  task.next_run_time = next_run_time;
+  task.update_fire_time();
+  return task.fire_time;
+}
+
+/**
+ * @brief Wait until the beginning of a second, so the next half second stays
+ * in it.
+ */
+void wait_for_second_start() {
+  using namespace std::chrono;
+  auto now = steady_clock::now().time_since_epoch();
+  if (now - floor<seconds>(now) >= 500ms)
+    std::this_thread::sleep_for(ceil<seconds>(now) - now);
+}
+
+}  // namespace
+
+TEST(TimerTest, RunsTheTasksTheGivenTimes) {
+  Timer<int> timer;
+  std::atomic<int> once = 0, thrice = 0;
+  EXPECT_TRUE(timer.add(1, [&] { ++once; }, 1ms));
+  EXPECT_TRUE(timer.add(2, [&] { ++thrice; }, 1ms, 3, 1ms));
+  EXPECT_FALSE(timer.add(2, [] {}, 1ms));
+  EXPECT_FALSE(timer.add(3, [] {}, 1ms, 0));
+  EXPECT_TRUE(timer.start());
+  EXPECT_FALSE(timer.start());
+  EXPECT_TRUE(wait_for([&] { return once == 1 && thrice == 3; }));
+  std::this_thread::sleep_for(10ms);
+  EXPECT_EQ(once, 1);
+  EXPECT_EQ(thrice, 3);
+  EXPECT_TRUE(timer.stop());
+  EXPECT_FALSE(timer.stop());
+}
+
+TEST(TimerTest, CancelsATask) {
+  Timer<int> timer;
+  std::atomic<int> runs = 0;
+  timer.add(1, [&] { ++runs; }, 50ms);
+  timer.start();
+  EXPECT_TRUE(timer.cancel(1));
+  EXPECT_FALSE(timer.cancel(1));
+  std::this_thread::sleep_for(100ms);
+  EXPECT_EQ(runs, 0);
+}
+
+TEST(TimerTest, UpdatesATask) {
+  Timer<int> timer;
+  std::atomic<int> runs = 0;
+  timer.add(1, [&] { ++runs; }, 1ms, -1, 1ms);
+  timer.start();
+  EXPECT_TRUE(wait_for([&] { return runs > 0; }));
+  // stop the endless task from inside the timer
+  EXPECT_TRUE(timer.update(1, [](auto &task) { task.times = 1; }));
+  EXPECT_TRUE(wait_for([&] { return !timer.cancel(1); }));
+  int last = runs;
+  std::this_thread::sleep_for(10ms);
+  EXPECT_EQ(runs, last);
+}
+
+TEST(TimerTest, FiresWithinTheSlack) {
+  std::mt19937_64 rng(11);
+  for (int i = 0; i < 10000; ++i) {
+    time_point next(std::chrono::nanoseconds(rng() >> 12));
+    duration slack(rng() % 2 ? rng() % 4 : rng() % 1000000);
+    auto fire = fire_time(next, slack);
+    ASSERT_GE(fire, next) << i;
+    ASSERT_LE(fire, next + slack) << i;
+  }
+  time_point next(1500ns);
+  EXPECT_EQ(fire_time(next, 0us), next);
+  // no whole microsecond is picked past the window
+  EXPECT_EQ(fire_time(next, 1us), time_point(2us));
+}
+
+TEST(TimerTest, PicksTheSameTimeInOverlappingWindows) {
+  // the windows narrower than 2^14us that contain a multiple of it pick it
+  const time_point aligned(duration(uint64_t(12345) << 14));
+  std::mt19937_64 rng(5);
+  for (int i = 0; i < 1000; ++i) {
+    duration slack(rng() % (1 << 14));
+    auto next = aligned - duration(rng() % (slack.count() + 1));
+    ASSERT_EQ(fire_time(next, slack), aligned) << i;
+  }
+  // and the wider windows around it pick it too
+  EXPECT_EQ(fire_time(aligned - 1000us, 5000us), aligned);
+  EXPECT_EQ(fire_time(aligned - 4000us, 8000us), aligned);
+}
+
+TEST(TimerTest, StaggeredTasksWithSlackShareWakeups) {
+  auto run = [](duration slack) {
+    Timer<int> timer;
+    std::mutex mutex;
+    std::vector<time_point> ran(8);
+    std::atomic<int> runs = 0;
+    for (int i = 0; i < 8; ++i) {
+      timer.add(
+          i,
+          [&, i] {
+            std::lock_guard lock(mutex);
+            ran[i] = std::chrono::steady_clock::now();
+            ++runs;
+          },
+          10ms * i, 1, 0us, slack);
+    }
+    auto begin = std::chrono::steady_clock::now();
+    timer.start();
+    EXPECT_TRUE(wait_for([&] { return runs == 8; }));
+    timer.stop();
+    // never early
+    for (int i = 0; i < 8; ++i) EXPECT_GE(ran[i], begin + 10ms * i) << i;
+    return timer.wakeups().total();
+  };
+  auto without_slack = run(0us);
+  auto with_slack = run(200ms);
+  EXPECT_LT(with_slack, without_slack);
+}
+
+TEST(WakeupCounterTest, CountsTheLastWholeSecond) {
+  using namespace std::chrono;
+  wait_for_second_start();
+  const auto now = steady_clock::now();
+  WakeupCounter counter;
+  EXPECT_EQ(counter.last_second(), 0u);
+
+  // the second before, with wakeups in this second
+  for (int i = 0; i < 3; ++i) counter.add(now - 1s);
+  for (int i = 0; i < 2; ++i) counter.add(now);
+  EXPECT_EQ(counter.total(), 5u);
+  EXPECT_EQ(counter.last_second(), 3u);
+
+  // no wakeup yet in this second
+  WakeupCounter quiet;
+  for (int i = 0; i < 3; ++i) quiet.add(now - 1s);
+  EXPECT_EQ(quiet.last_second(), 3u);
+
+  // a second without wakeups in between
+  WakeupCounter gap;
+  for (int i = 0; i < 3; ++i) gap.add(now - 2s);
+  EXPECT_EQ(gap.last_second(), 0u);
+  gap.add(now);
+  EXPECT_EQ(gap.last_second(), 0u);
+  EXPECT_EQ(gap.total(), 4u);
+}
@@ -0,0 +1,231 @@
+#include "tinywebserver/timing_wheel.hpp"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+namespace {
+
+template <typename Pred>
+bool wait_for(Pred pred, std::chrono::milliseconds timeout = 5s) {
+  auto deadline = std::chrono::steady_clock::now() + timeout;
+  while (!pred()) {
+    if (std::chrono::steady_clock::now() > deadline) return false;
+    std::this_thread::sleep_for(1ms);
+  }
+  return true;
+}
+
+/**
+ * @brief Drive the wheel by ticks without the worker thread.
+ */
+class ManualWheel : public TimingWheel<int> {
+ public:
+  /**
+   * @brief Put a task in the slot of the tick, counted from the current base.
+   */
+  void add_at(int id, uint64_t tick) {
+    auto node =
+        std::make_unique<Node>(id, std::function<void()>([] {}), 0ms);
+    node->expire = tick;
+    place(node.get());
+    tasks_.emplace(id, std::move(node));
+  }
+
+  /**
+   * @brief Collect the ticks up to tick.
+   * @return The ids of the collected tasks, which are removed.
+   */
+  std::vector<int> collect_until(uint64_t tick) {
+    std::vector<Node *> batch;
+    collect(tick, batch);
+    std::vector<int> ids;
+    for (auto node : batch) ids.push_back(node->id);
+    for (auto id : ids) tasks_.erase(id);
+    return ids;
+  }
+};
+
+}  // namespace
+
+TEST(TimingWheelTest, CascadesDownToTheTick) {
+  ManualWheel wheel;
+  // the first slot, the edges of every level and the last tick of the span
+  const std::vector<uint64_t> ticks = {
+      1,         255,           256,           257,
+      65535,     65536,         65537,         (1ull << 24) - 1,
+      1ull << 24, (1ull << 24) + 300, (1ull << 32) - 1};
+  for (size_t i = 0; i < ticks.size(); ++i) wheel.add_at(i, ticks[i]);
+  for (size_t i = 0; i < ticks.size(); ++i) {
+    EXPECT_TRUE(wheel.collect_until(ticks[i] - 1).empty()) << ticks[i];
+    EXPECT_EQ(wheel.collect_until(ticks[i]), std::vector<int>{int(i)})
+        << ticks[i];
+  }
+  EXPECT_EQ(wheel.size(), 0u);
+}
+
+TEST(TimingWheelTest, FiresTasksBeyondTheSpanOfTheLevels) {
+  ManualWheel wheel;
+  // farther than 2^32 ticks, they wait at the end of the last level
+  const std::vector<uint64_t> ticks = {1ull << 32, (1ull << 32) + 1,
+                                       (1ull << 33) + 12345, (1ull << 40) + 7};
+  for (size_t i = 0; i < ticks.size(); ++i) wheel.add_at(i, ticks[i]);
+  for (size_t i = 0; i < ticks.size(); ++i) {
+    EXPECT_TRUE(wheel.collect_until(ticks[i] - 1).empty()) << ticks[i];
+    EXPECT_EQ(wheel.collect_until(ticks[i]), std::vector<int>{int(i)})
+        << ticks[i];
+  }
+}
+
+TEST(TimingWheelTest, CollectsATickOnce) {
+  ManualWheel wheel;
+  wheel.add_at(1, 300);
+  wheel.add_at(2, 300);
+  wheel.add_at(3, 301);
+  auto ids = wheel.collect_until(300);
+  std::sort(ids.begin(), ids.end());
+  EXPECT_EQ(ids, (std::vector<int>{1, 2}));
+  EXPECT_TRUE(wheel.collect_until(300).empty());
+  EXPECT_EQ(wheel.collect_until(1000), std::vector<int>{3});
+}
+
+TEST(TimingWheelTest, CollectsRandomTicksInOrder) {
+  ManualWheel wheel;
+  std::mt19937_64 rng(42);
+  std::map<int, uint64_t> due;
+  for (int id = 0; id < 2000; ++id) {
+    // spread over every level and beyond
+    uint64_t tick = rng() >> (24 + rng() % 40);
+    wheel.add_at(id, tick);
+    due[id] = tick;
+  }
+  uint64_t now = 0;
+  while (!due.empty()) {
+    uint64_t prev = now;
+    now += rng() >> (30 + rng() % 34);
+    for (auto id : wheel.collect_until(now)) {
+      ASSERT_TRUE(due.count(id)) << id;
+      EXPECT_GT(due[id] + 1, prev) << id;
+      EXPECT_LE(due[id], now) << id;
+      due.erase(id);
+    }
+    for (auto &[id, tick] : due) ASSERT_GT(tick, now) << id;
+  }
+}
+
+TEST(TimingWheelTest, RunsTheTasksTheGivenTimes) {
+  TimingWheel<int> wheel;
+  std::atomic<int> once = 0, thrice = 0;
+  EXPECT_TRUE(wheel.add(1, [&] { ++once; }, 1ms));
+  EXPECT_TRUE(wheel.add(2, [&] { ++thrice; }, 1ms, 3, 1ms));
+  EXPECT_FALSE(wheel.add(2, [] {}, 1ms));
+  EXPECT_TRUE(wheel.start());
+  EXPECT_TRUE(wait_for([&] { return wheel.size() == 0; }));
+  EXPECT_EQ(once, 1);
+  EXPECT_EQ(thrice, 3);
+}
+
+TEST(TimingWheelTest, CancelsTasksOfTheRunningBatch) {
+  TimingWheel<int> wheel;
+  std::atomic<int> runs1 = 0, runs2 = 0;
+  // due in the same tick, so they are fired as one batch
+  wheel.add(
+      1,
+      [&] {
+        ++runs1;
+        EXPECT_TRUE(wheel.cancel(1));
+        EXPECT_TRUE(wheel.cancel(2));
+      },
+      5ms, -1, 1ms);
+  wheel.add(2, [&] { ++runs2; }, 5ms, -1, 1ms);
+  wheel.start();
+  EXPECT_TRUE(wait_for([&] { return wheel.size() == 0; }));
+  std::this_thread::sleep_for(10ms);
+  EXPECT_EQ(runs1, 1);
+  EXPECT_LE(runs2, 1);
+  EXPECT_FALSE(wheel.cancel(1));
+}
+
+TEST(TimingWheelTest, CancelsATaskWhileItRuns) {
+  TimingWheel<int> wheel;
+  std::atomic<int> runs = 0;
+  std::atomic<bool> release = false;
+  wheel.add(
+      1,
+      [&] {
+        ++runs;
+        while (!release) std::this_thread::yield();
+      },
+      1ms, -1, 1ms);
+  wheel.start();
+  ASSERT_TRUE(wait_for([&] { return runs == 1; }));
+  EXPECT_TRUE(wheel.cancel(1));
+  // it is erased once the batch is done
+  EXPECT_EQ(wheel.size(), 1u);
+  release = true;
+  EXPECT_TRUE(wait_for([&] { return wheel.size() == 0; }));
+  std::this_thread::sleep_for(10ms);
+  EXPECT_EQ(runs, 1);
+}
+
+TEST(TimingWheelTest, UpdatesATaskWhileItRuns) {
+  TimingWheel<int> wheel;
+  std::atomic<int> runs = 0;
+  std::atomic<bool> release = false;
+  wheel.add(
+      1,
+      [&] {
+        ++runs;
+        while (!release) std::this_thread::yield();
+      },
+      1ms, -1, 1ms);
+  wheel.start();
+  ASSERT_TRUE(wait_for([&] { return runs == 1; }));
+  // applied after the batch, so the task runs once more
+  EXPECT_TRUE(wheel.update(1, [](auto &task) { task.times = 1; }));
+  release = true;
+  EXPECT_TRUE(wait_for([&] { return wheel.size() == 0; }));
+  std::this_thread::sleep_for(10ms);
+  EXPECT_EQ(runs, 2);
+}
+
+TEST(TimingWheelTest, StaggeredTasksWithSlackShareWakeups) {
+  using clock = TimingWheel<int>::clock;
+  auto run = [](TimingWheel<int>::duration slack) {
+    TimingWheel<int> wheel;
+    std::mutex mutex;
+    std::vector<clock::time_point> ran(8);
+    std::atomic<int> runs = 0;
+    for (int i = 0; i < 8; ++i) {
+      wheel.add(
+          i,
+          [&, i] {
+            std::lock_guard lock(mutex);
+            ran[i] = clock::now();
+            ++runs;
+          },
+          10ms * i, 1, 0ms, slack);
+    }
+    auto begin = clock::now();
+    wheel.start();
+    EXPECT_TRUE(wait_for([&] { return runs == 8; }));
+    wheel.stop();
+    // never early
+    for (int i = 0; i < 8; ++i) EXPECT_GE(ran[i], begin + 10ms * i) << i;
+    return wheel.wakeups().total();
+  };
+  auto without_slack = run(0ms);
+  auto with_slack = run(200ms);
+  EXPECT_LT(with_slack, without_slack);
+}
@@ -0,0 +1,80 @@
+#include "tinywebserver/utils/work_stealing_deque.hpp"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+TEST(WorkStealingDequeTest, PopsTheLastPushed) {
+  WorkStealingDeque<int> deque;
+  EXPECT_TRUE(deque.empty());
+  EXPECT_EQ(deque.pop(), std::nullopt);
+  for (int i = 0; i < 3; ++i) deque.push(i);
+  EXPECT_EQ(deque.size(), 3);
+  EXPECT_EQ(deque.pop(), 2);
+  EXPECT_EQ(deque.pop(), 1);
+  EXPECT_EQ(deque.pop(), 0);
+  EXPECT_EQ(deque.pop(), std::nullopt);
+  EXPECT_TRUE(deque.empty());
+}
+
+TEST(WorkStealingDequeTest, StealsTheFirstPushed) {
+  WorkStealingDeque<int> deque;
+  EXPECT_EQ(deque.steal(), std::nullopt);
+  for (int i = 0; i < 3; ++i) deque.push(i);
+  EXPECT_EQ(deque.steal(), 0);
+  EXPECT_EQ(deque.pop(), 2);
+  EXPECT_EQ(deque.steal(), 1);
+  EXPECT_EQ(deque.steal(), std::nullopt);
+  EXPECT_EQ(deque.pop(), std::nullopt);
+}
+
+TEST(WorkStealingDequeTest, GrowsAndKeepsTheOrder) {
+  WorkStealingDeque<int> deque(3);
+  // wrap around the array before it grows
+  deque.push(-1);
+  deque.push(-2);
+  EXPECT_EQ(deque.steal(), -1);
+  EXPECT_EQ(deque.steal(), -2);
+  for (int i = 0; i < 1000; ++i) deque.push(i);
+  EXPECT_EQ(deque.size(), 1000);
+  for (int i = 0; i < 500; ++i) EXPECT_EQ(deque.steal(), i);
+  for (int i = 999; i >= 500; --i) EXPECT_EQ(deque.pop(), i);
+  EXPECT_TRUE(deque.empty());
+}
+
+TEST(WorkStealingDequeTest, TakesEveryElementOnceUnderThieves) {
+  constexpr int n = 200000;
+  WorkStealingDeque<int> deque(2);
+  auto taken = std::make_unique<std::atomic<int>[]>(n);
+  std::atomic<bool> done = false;
+  std::atomic<int> total = 0;
+  auto take = [&](std::optional<int> x) {
+    if (!x) return;
+    taken[*x].fetch_add(1, std::memory_order_relaxed);
+    total.fetch_add(1, std::memory_order_relaxed);
+  };
+
+  std::vector<std::thread> thieves;
+  for (int t = 0; t < 3; ++t) {
+    thieves.emplace_back([&] {
+      while (!done.load(std::memory_order_acquire) || !deque.empty())
+        take(deque.steal());
+    });
+  }
+  // the owner pops now and then, often racing for the last element
+  for (int i = 0; i < n; ++i) {
+    deque.push(i);
+    if (i % 3 == 0) take(deque.pop());
+  }
+  while (auto x = deque.pop()) take(x);
+  done.store(true, std::memory_order_release);
+  for (auto &t : thieves) t.join();
+
+  EXPECT_EQ(total, n);
+  int wrong = 0;
+  for (int i = 0; i < n; ++i) wrong += taken[i] != 1;
+  EXPECT_EQ(wrong, 0);
+}
@@ -0,0 +1,83 @@
+#include "tinywebserver/pool/work_stealing_thread_pool.hpp"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+TEST(WorkStealingThreadPoolTest, RunsEveryTask) {
+  WorkStealingThreadPool pool(4);
+  EXPECT_EQ(pool.get_thread_count(), 4);
+  std::atomic<int> count = 0;
+  for (int i = 0; i < 10000; ++i) pool.push_task([&count] { ++count; });
+  pool.wait_for_tasks();
+  EXPECT_EQ(count, 10000);
+  EXPECT_EQ(pool.get_tasks_total(), 0);
+}
+
+TEST(WorkStealingThreadPoolTest, RunsTheTasksPushedByWorkers) {
+  WorkStealingThreadPool pool(4);
+  std::atomic<int> count = 0;
+  // the children go to the deque of the parent's worker, the others steal
+  for (int i = 0; i < 100; ++i) {
+    pool.push_task([&pool, &count] {
+      for (int j = 0; j < 100; ++j) pool.push_task([&count] { ++count; });
+    });
+  }
+  pool.wait_for_tasks();
+  EXPECT_EQ(count, 10000);
+}
+
+TEST(WorkStealingThreadPoolTest, SubmitsATaskWithAResult) {
+  WorkStealingThreadPool pool(2);
+  auto future = pool.submit([](int a, int b) { return a + b; }, 40, 2);
+  EXPECT_EQ(future.get(), 42);
+}
+
+TEST(WorkStealingThreadPoolTest, HoldsTheTasksWhilePaused) {
+  WorkStealingThreadPool pool(2);
+  pool.pause();
+  std::atomic<int> count = 0;
+  for (int i = 0; i < 10; ++i) pool.push_task([&count] { ++count; });
+  std::this_thread::sleep_for(20ms);
+  EXPECT_EQ(count, 0);
+  EXPECT_EQ(pool.get_tasks_queued(), 10);
+  pool.unpause();
+  pool.wait_for_tasks();
+  EXPECT_EQ(count, 10);
+}
+
+TEST(WorkStealingThreadPoolTest, RunsABatchOfTasks) {
+  WorkStealingThreadPool pool(4);
+  std::atomic<int> count = 0;
+  std::vector<std::function<void()>> tasks(100, [&count] { ++count; });
+  pool.push_tasks(tasks).get();
+  EXPECT_EQ(count, 100);
+  tasks[0] = [] { throw std::runtime_error("x"); };
+  EXPECT_THROW(pool.push_tasks(std::move(tasks)).get(), std::runtime_error);
+  EXPECT_EQ(count, 199);
+}
+
+TEST(WorkStealingThreadPoolTest, ParallelForVisitsEveryIndexOnce) {
+  WorkStealingThreadPool pool(4);
+  constexpr int n = 10007;
+  std::vector<std::atomic<int>> visits(n);
+  // a loop started by a worker is split into its own deque
+  auto nested = pool.submit([&] {
+    pool.parallel_for(0, n, 64, [&visits](int i) { ++visits[i]; }).get();
+  });
+  nested.get();
+  auto future = pool.parallel_for(0, n, 100, [&visits](int b, int e) {
+    for (int i = b; i < e; ++i) ++visits[i];
+  });
+  future.get();
+  int wrong = 0;
+  for (auto &v : visits) wrong += v != 2;
+  EXPECT_EQ(wrong, 0);
+}